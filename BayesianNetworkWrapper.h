@@ -12,6 +12,33 @@
 @class BNEdge;
 @class BNInferenceResult;
 
+// Error domain of asynchronous queries
+extern NSString *const BNErrorDomain;
+
+/**
+ * Error codes of asynchronous queries
+ */
+typedef NS_ENUM(NSInteger, BNErrorCode) {
+    BNErrorInferenceFailed = 1,  // The query threw (see localizedDescription)
+    BNErrorCancelled = 2,        // The returned NSProgress was cancelled
+    BNErrorTimedOut = 3          // The timeout passed before the query finished
+};
+
+/**
+ * Completion of an asynchronous inference query, called on the main queue
+ * @param result Probabilities, or nil on error
+ * @param error nil on success, otherwise a BNErrorDomain error
+ */
+typedef void (^BNInferenceCompletion)(BNInferenceResult *result, NSError *error);
+
+/**
+ * Completion of an asynchronous marginals query, called on the main queue
+ * @param marginals Map of node ID to state -> probability, or nil on error
+ * @param error nil on success, otherwise a BNErrorDomain error
+ */
+typedef void (^BNMarginalsCompletion)(NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *marginals,
+                                      NSError *error);
+
 /**
  * BNNode represents a node in the Bayesian network
  */
@@ -123,6 +150,34 @@
 - (BNInferenceResult *)performInferenceWithQueryNodes:(NSArray<NSString *> *)queryNodeIds 
                                                evidence:(NSDictionary<NSString *, NSString *> *)evidence;
 
+/**
+ * Perform an inference query on a background queue
+ * The returned progress is cancellable; cancelling it (or passing the
+ * timeout) stops the query partway through elimination. Its
+ * fractionCompleted follows the elimination, and its KVO notifications
+ * arrive on the background queue.
+ * @param queryNodeIds Array of node IDs to query
+ * @param evidence Dictionary mapping observed node IDs to their states
+ * @param timeout Seconds before the query is stopped (0 for no limit)
+ * @param completion Called on the main queue with the result or an error
+ * @return Progress of the query
+ */
+- (NSProgress *)performInferenceWithQueryNodes:(NSArray<NSString *> *)queryNodeIds
+                                      evidence:(NSDictionary<NSString *, NSString *> *)evidence
+                                       timeout:(NSTimeInterval)timeout
+                                    completion:(BNInferenceCompletion)completion;
+
+/**
+ * Compute the posterior marginal of every node on a background queue
+ * @param evidence Dictionary mapping observed node IDs to their states
+ * @param timeout Seconds before the query is stopped (0 for no limit)
+ * @param completion Called on the main queue with the marginals or an error
+ * @return Cancellable progress of the query
+ */
+- (NSProgress *)computeMarginalsWithEvidence:(NSDictionary<NSString *, NSString *> *)evidence
+                                     timeout:(NSTimeInterval)timeout
+                                  completion:(BNMarginalsCompletion)completion;
+
 /**
  * Compute joint probability for a full assignment
  * @param assignment Dictionary mapping node IDs to their states
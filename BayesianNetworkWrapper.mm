@@ -10,6 +10,12 @@
 #import <vector>
 #import <string>
 #import <map>
+#import <memory>
+
+NSString *const BNErrorDomain = @"BNErrorDomain";
+
+// Units of the NSProgress of an asynchronous query
+static const int64_t kProgressUnits = 1000;
 
 // Convert NSString to std::string
 static std::string NSStringToStdString(NSString *nsString) {
@@ -49,13 +55,11 @@ static std::map<std::string, std::string> NSDictionaryToMap(NSDictionary<NSStrin
     return result;
 }
 
-// Convert std::map to NSDictionary
-static NSDictionary<NSString *, NSString *> *MapToNSDictionary(const std::map<std::string, std::string> &map) {
-    NSMutableDictionary<NSString *, NSString *> *result = [NSMutableDictionary dictionary];
-    for (const auto &pair : map) {
-        result[StdStringToNSString(pair.first)] = StdStringToNSString(pair.second);
-    }
-    return result;
+// Error of an asynchronous query
+static NSError *QueryError(BNErrorCode code, const char *message) {
+    return [NSError errorWithDomain:BNErrorDomain
+                               code:code
+                           userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithUTF8String:message]}];
 }
 
 @implementation BNNode
@@ -94,12 +98,59 @@ static NSDictionary<NSString *, NSString *> *MapToNSDictionary(const std::map<st
 
 @end
 
+// Convert a joint table to an inference result, naming each node and state once
+static BNInferenceResult *InferenceResultFromJointTable(const JointTable &table) {
+    BNInferenceResult *result = [[BNInferenceResult alloc] init];
+    NSMutableDictionary<NSDictionary<NSString *, NSString *> *, NSNumber *> *probDict =
+        [NSMutableDictionary dictionaryWithCapacity:table.size()];
+    
+    const std::vector<int> &vars = table.getVariables();
+    NSMutableArray<NSString *> *nodeNames = [NSMutableArray arrayWithCapacity:vars.size()];
+    NSMutableArray<NSArray<NSString *> *> *stateNames = [NSMutableArray arrayWithCapacity:vars.size()];
+    for (int var : vars) {
+        [nodeNames addObject:StdStringToNSString(table.network().nodeId(var))];
+        [stateNames addObject:VectorToNSArray(table.network().states(var))];
+    }
+    for (size_t i = 0; i < table.size(); ++i) {
+        NSMutableDictionary<NSString *, NSString *> *assignment =
+            [NSMutableDictionary dictionaryWithCapacity:vars.size()];
+        for (size_t v = 0; v < vars.size(); ++v) {
+            size_t state = (i / table.getStrides()[v]) % table.getCardinalities()[v];
+            assignment[nodeNames[v]] = stateNames[v][state];
+        }
+        probDict[assignment] = [NSNumber numberWithDouble:table.getValues()[i]];
+    }
+    
+    result.probabilities = probDict;
+    return result;
+}
+
+// Convert marginals to a dictionary of node ID to state -> probability
+static NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *DictionaryFromMarginals(const Marginals &marginals) {
+    NSMutableDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *result =
+        [NSMutableDictionary dictionaryWithCapacity:marginals.size()];
+    for (size_t v = 0; v < marginals.size(); ++v) {
+        int var = static_cast<int>(v);
+        const std::vector<std::string> &states = marginals.network().states(var);
+        ArrayView<double> probabilities = marginals.probabilities(var);
+        NSMutableDictionary<NSString *, NSNumber *> *distribution =
+            [NSMutableDictionary dictionaryWithCapacity:states.size()];
+        for (size_t s = 0; s < states.size(); ++s) {
+            distribution[StdStringToNSString(states[s])] = [NSNumber numberWithDouble:probabilities[s]];
+        }
+        result[StdStringToNSString(marginals.network().nodeId(var))] = distribution;
+    }
+    return result;
+}
+
 @interface BayesianNetworkWrapper ()
 
 // Internal C++ network instance
 @property (nonatomic, assign) void *cppNetwork;
 // Last error message
 @property (nonatomic, strong) NSString *errorMessage;
+// Concurrent queue of asynchronous queries (const queries may run in parallel)
+@property (nonatomic, strong) dispatch_queue_t inferenceQueue;
 
 @end
 
@@ -114,6 +165,7 @@ static NSDictionary<NSString *, NSString *> *MapToNSDictionary(const std::map<st
         _nodes = @[];
         _edges = @[];
         _errorMessage = nil;
+        _inferenceQueue = dispatch_queue_create("BayesianNetworkWrapper.inference", DISPATCH_QUEUE_CONCURRENT);
     }
     return self;
 }
@@ -203,18 +255,9 @@ static NSDictionary<NSString *, NSString *> *MapToNSDictionary(const std::map<st
         std::vector<std::string> queryVec = NSArrayToVector(queryNodeIds);
         std::map<std::string, std::string> evidenceMap = NSDictionaryToMap(evidence);
         
-        auto cppResults = network->variableElimination(queryVec, evidenceMap);
+        JointTable table = network->computeJointTable(queryVec, evidenceMap);
         
-        BNInferenceResult *result = [[BNInferenceResult alloc] init];
-        NSMutableDictionary<NSDictionary<NSString *, NSString *> *, NSNumber *> *probDict = [NSMutableDictionary dictionary];
-        
-        for (const auto &pair : cppResults) {
-            NSDictionary<NSString *, NSString *> *assignment = MapToNSDictionary(pair.first);
-            NSNumber *prob = [NSNumber numberWithDouble:pair.second];
-            probDict[assignment] = prob;
-        }
-        
-        result.probabilities = probDict;
+        BNInferenceResult *result = InferenceResultFromJointTable(table);
         self.errorMessage = nil;
         return result;
     } catch (const std::exception& e) {
@@ -226,6 +269,76 @@ static NSDictionary<NSString *, NSString *> *MapToNSDictionary(const std::map<st
     }
 }
 
+// Run work on the inference queue under a cancellable query control
+// The work block runs C++ queries; its value or error goes to completion on the main queue.
+- (NSProgress *)startQueryWithTimeout:(NSTimeInterval)timeout
+                                 work:(id (^)(BayesianNetwork *network))work
+                           completion:(void (^)(id value, NSError *error))completion {
+    auto control = std::make_shared<QueryControl>();
+    if (timeout > 0) {
+        control->token.setTimeout(timeout);
+    }
+    NSProgress *progress = [NSProgress discreteProgressWithTotalUnitCount:kProgressUnits];
+    progress.cancellable = YES;
+    CancellationToken token = control->token;
+    progress.cancellationHandler = ^{
+        token.cancel();
+    };
+    control->progress = [progress](double fraction) {
+        progress.completedUnitCount = static_cast<int64_t>(fraction * kProgressUnits);
+    };
+    
+    // The block keeps self, and so the C++ network, alive until the query is done
+    dispatch_async(self.inferenceQueue, ^{
+        id value = nil;
+        NSError *error = nil;
+        try {
+            QueryControl::Scope scope(*control);
+            control->token.throwIfStopped();
+            value = work([self getCppNetwork]);
+            progress.completedUnitCount = kProgressUnits;
+        } catch (const QueryCancelled& e) {
+            error = QueryError(e.deadlineExceeded() ? BNErrorTimedOut : BNErrorCancelled, e.what());
+        } catch (const std::exception& e) {
+            error = QueryError(BNErrorInferenceFailed, e.what());
+        } catch (...) {
+            error = QueryError(BNErrorInferenceFailed, "Unknown C++ exception");
+        }
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completion(value, error);
+        });
+    });
+    return progress;
+}
+
+- (NSProgress *)performInferenceWithQueryNodes:(NSArray<NSString *> *)queryNodeIds
+                                      evidence:(NSDictionary<NSString *, NSString *> *)evidence
+                                       timeout:(NSTimeInterval)timeout
+                                    completion:(BNInferenceCompletion)completion {
+    std::vector<std::string> queryVec = NSArrayToVector(queryNodeIds);
+    std::map<std::string, std::string> evidenceMap = NSDictionaryToMap(evidence);
+    return [self startQueryWithTimeout:timeout
+                                  work:^id(BayesianNetwork *network) {
+                                      return InferenceResultFromJointTable(network->computeJointTable(queryVec, evidenceMap));
+                                  }
+                            completion:^(id value, NSError *error) {
+                                completion(value, error);
+                            }];
+}
+
+- (NSProgress *)computeMarginalsWithEvidence:(NSDictionary<NSString *, NSString *> *)evidence
+                                     timeout:(NSTimeInterval)timeout
+                                  completion:(BNMarginalsCompletion)completion {
+    std::map<std::string, std::string> evidenceMap = NSDictionaryToMap(evidence);
+    return [self startQueryWithTimeout:timeout
+                                  work:^id(BayesianNetwork *network) {
+                                      return DictionaryFromMarginals(network->computeMarginals(evidenceMap));
+                                  }
+                            completion:^(id value, NSError *error) {
+                                completion(value, error);
+                            }];
+}
+
 - (double)computeJointProbability:(NSDictionary<NSString *, NSString *> *)assignment {
     try {
         BayesianNetwork *network = [self getCppNetwork];
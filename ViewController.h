@@ -19,6 +19,8 @@
 @property (nonatomic, weak) IBOutlet NSTextView *resultsTextView;
 // Status label
 @property (nonatomic, weak) IBOutlet NSTextField *statusLabel;
+// Progress of the running inference query, or nil
+@property (nonatomic, strong) NSProgress *inferenceProgress;
 
 // Perform inference button action
 - (IBAction)performInference:(id)sender;
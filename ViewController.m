@@ -49,13 +49,32 @@
         }
     }
     
-    // Perform inference
-    BNInferenceResult *result = [self.graphView.network performInferenceWithQueryNodes:trimmedQueryNodes
-                                                                                evidence:evidence];
-    
+    // Perform inference off the main thread; a newer query replaces a running one
+    [self.inferenceProgress cancel];
+    self.statusLabel.stringValue = @"Running inference...";
+    __weak ViewController *weakSelf = self;
+    __block NSProgress *progress = nil;
+    progress = [self.graphView.network performInferenceWithQueryNodes:trimmedQueryNodes
+                                                              evidence:evidence
+                                                               timeout:0
+                                                            completion:^(BNInferenceResult *result, NSError *error) {
+        ViewController *strongSelf = weakSelf;
+        if (!strongSelf || strongSelf.inferenceProgress != progress) {
+            return;  // Superseded by a newer query
+        }
+        strongSelf.inferenceProgress = nil;
+        [strongSelf showInferenceResult:result error:error queryNodes:trimmedQueryNodes evidence:evidence];
+    }];
+    self.inferenceProgress = progress;
+}
+
+- (void)showInferenceResult:(BNInferenceResult *)result
+                      error:(NSError *)error
+                 queryNodes:(NSArray<NSString *> *)queryNodes
+                   evidence:(NSDictionary<NSString *, NSString *> *)evidence {
     if (result) {
         // Update graph view
-        self.graphView.queryNodes = trimmedQueryNodes;
+        self.graphView.queryNodes = queryNodes;
         self.graphView.evidence = evidence;
         self.graphView.inferenceResult = result;
         [self.graphView updateNetwork];
@@ -75,14 +94,17 @@
         
         self.resultsTextView.string = resultsText;
         self.statusLabel.stringValue = @"Inference completed successfully";
+    } else if (error.code == BNErrorCancelled) {
+        self.statusLabel.stringValue = @"Inference cancelled";
     } else {
-        NSString *error = [self.graphView.network lastErrorMessage];
-        self.statusLabel.stringValue = [NSString stringWithFormat:@"Error: %@", error ?: @"Unknown error"];
+        self.statusLabel.stringValue = [NSString stringWithFormat:@"Error: %@", error.localizedDescription ?: @"Unknown error"];
         self.resultsTextView.string = @"";
     }
 }
 
 - (IBAction)loadExampleNetwork:(id)sender {
+    [self.inferenceProgress cancel];
+    self.inferenceProgress = nil;
     BayesianNetworkWrapper *network = self.graphView.network;
     
     // Clear existing network
@@ -108,6 +130,8 @@
 }
 
 - (IBAction)clearNetwork:(id)sender {
+    [self.inferenceProgress cancel];
+    self.inferenceProgress = nil;
     self.graphView.network = [[BayesianNetworkWrapper alloc] init];
     [self.graphView updateNetwork];
     self.queryNodesField.stringValue = @"";
@@ -0,0 +1,398 @@
+/*
+ * async_query.hpp - Cancellable, non-blocking query execution
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements the pieces of the asynchronous query API:
+ * CancellationToken, a shared flag with an optional deadline; QueryControl,
+ * which a thread installs for the queries it runs so the engines can stop
+ * at their checkpoints (between eliminated variables, calibration levels,
+ * loopy sweeps and sampling rounds) and report progress; and QueryExecutor,
+ * the worker threads that run submitted queries and hand back futures or
+ * call completion callbacks. A cancelled or expired query throws
+ * QueryCancelled from its next checkpoint, and nothing it computed is kept.
+ */
+
+#ifndef ASYNC_QUERY_HPP
+#define ASYNC_QUERY_HPP
+
+// Exception handling
+#include <stdexcept>
+// Shared token state
+#include <memory>
+// Cancellation flag and deadline
+#include <atomic>
+// Deadlines
+#include <chrono>
+// Progress and completion callbacks
+#include <functional>
+// Query results
+#include <future>
+// Worker threads
+#include <thread>
+// Task queue and its lock
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+// Vector container
+#include <vector>
+// Fixed-width integers
+#include <cstdint>
+// std::numeric_limits
+#include <limits>
+// std::is_void
+#include <type_traits>
+// std::max
+#include <algorithm>
+
+/**
+ * QueryCancelled is thrown by a query whose token was cancelled or whose
+ * deadline passed
+ */
+class QueryCancelled : public std::runtime_error {
+private:
+    bool expired;
+
+public:
+    explicit QueryCancelled(bool deadlineExceeded)
+        : std::runtime_error(deadlineExceeded ? "Query deadline exceeded" : "Query cancelled"),
+          expired(deadlineExceeded) {}
+
+    /**
+     * Whether the query stopped at its deadline rather than on cancel()
+     */
+    bool deadlineExceeded() const {
+        return expired;
+    }
+};
+
+/**
+ * CancellationToken is a cancellation flag and deadline shared by copies
+ * Any thread may cancel; queries observe it at their next checkpoint.
+ */
+class CancellationToken {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct State {
+        std::atomic<bool> cancelled{false};
+        // Deadline in clock ticks (max: none)
+        std::atomic<int64_t> deadline{std::numeric_limits<int64_t>::max()};
+    };
+
+    std::shared_ptr<State> state;
+
+public:
+    CancellationToken() : state(std::make_shared<State>()) {}
+
+    /**
+     * Ask every query holding this token to stop
+     */
+    void cancel() const {
+        state->cancelled.store(true);
+    }
+
+    /**
+     * Whether cancel() was called
+     */
+    bool isCancelled() const {
+        return state->cancelled.load();
+    }
+
+    /**
+     * Stop queries holding this token once the time point has passed
+     * @param deadline Steady-clock time point
+     */
+    void setDeadline(Clock::time_point deadline) const {
+        state->deadline.store(deadline.time_since_epoch().count());
+    }
+
+    /**
+     * Stop queries holding this token after a number of seconds from now
+     * @param seconds Time budget
+     */
+    void setTimeout(double seconds) const {
+        setDeadline(Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds)));
+    }
+
+    /**
+     * Whether the deadline (if any) has passed
+     */
+    bool deadlineExceeded() const {
+        int64_t deadline = state->deadline.load();
+        return deadline != std::numeric_limits<int64_t>::max() &&
+               Clock::now().time_since_epoch().count() >= deadline;
+    }
+
+    /**
+     * Throw QueryCancelled if the token was cancelled or has expired
+     */
+    void throwIfStopped() const {
+        if (isCancelled()) {
+            throw QueryCancelled(false);
+        }
+        if (deadlineExceeded()) {
+            throw QueryCancelled(true);
+        }
+    }
+};
+
+/**
+ * QueryControl holds the cancellation token and progress callback of a query
+ * Install it on the thread that runs the query with QueryControl::Scope
+ * (QueryExecutor does this for submitted queries). Checkpoints run on that
+ * thread only; pool workers helping the query never check.
+ */
+struct QueryControl {
+    CancellationToken token;
+    // Called on the query thread with the fraction of the current pass
+    // done, in [0, 1]; a query with several passes (e.g. MPE: sum, then
+    // max) reports each in turn
+    std::function<void(double)> progress;
+
+    /**
+     * Checkpoint of a running engine: throws QueryCancelled if the
+     * installed token stopped, then reports progress
+     * Does nothing on a thread without a control installed.
+     * @param completed Steps of the current pass done
+     * @param total Steps of the current pass
+     */
+    static void checkpoint(size_t completed, size_t total) {
+        const QueryControl* control = installed();
+        if (control == nullptr) {
+            return;
+        }
+        control->token.throwIfStopped();
+        if (control->progress && total > 0) {
+            control->progress(static_cast<double>(completed) / static_cast<double>(total));
+        }
+    }
+
+    /**
+     * Get the control installed on this thread, or null
+     */
+    static const QueryControl*& installed() {
+        static thread_local const QueryControl* control = nullptr;
+        return control;
+    }
+
+    /**
+     * Scope installs a control on this thread for its lifetime
+     */
+    class Scope {
+    private:
+        const QueryControl* previous;
+
+    public:
+        explicit Scope(const QueryControl& control) : previous(installed()) {
+            installed() = &control;
+        }
+
+        ~Scope() {
+            installed() = previous;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+};
+
+/**
+ * QueryExecutor runs submitted queries on its own worker threads, in
+ * submission order. Workers start on the first submission. Destroying the
+ * executor cancels the queries it is running, fails the queued ones with
+ * QueryCancelled and joins the workers. Copies share nothing: a copy is an
+ * idle executor with the same thread count.
+ */
+class QueryExecutor {
+private:
+    struct Task {
+        QueryControl control;
+        std::function<void()> run;      // Runs the query under control
+        std::function<void()> abandon;  // Fails the query without running it
+    };
+
+    size_t numThreads;
+    std::vector<std::thread> workers;
+    std::deque<Task> queue;
+    // Control of the task each worker is running (null when idle)
+    std::vector<const QueryControl*> running;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable ready;
+
+    void work(size_t index) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            ready.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            Task task = std::move(queue.front());
+            queue.pop_front();
+            running[index] = &task.control;
+            lock.unlock();
+            {
+                QueryControl::Scope scope(task.control);
+                task.run();
+            }
+            lock.lock();
+            running[index] = nullptr;
+        }
+    }
+
+    /**
+     * Start the workers (mutex held)
+     */
+    void start() {
+        running.assign(numThreads, nullptr);
+        for (size_t i = 0; i < numThreads; ++i) {
+            workers.emplace_back(&QueryExecutor::work, this, i);
+        }
+    }
+
+    void enqueue(Task task) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (workers.empty()) {
+            start();
+        }
+        queue.push_back(std::move(task));
+        ready.notify_one();
+    }
+
+    /**
+     * Run a query and store its result or exception in a promise
+     */
+    template <typename Result, typename Query>
+    static void fulfil(std::promise<Result>& promise, Query& query) {
+        try {
+            if constexpr (std::is_void<Result>::value) {
+                query();
+                promise.set_value();
+            } else {
+                promise.set_value(query());
+            }
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }
+
+public:
+    /**
+     * Constructor
+     * @param threads Worker count (0 uses all hardware threads)
+     */
+    explicit QueryExecutor(size_t threads = 1)
+        : numThreads(threads != 0 ? threads : std::max<size_t>(1, std::thread::hardware_concurrency())) {}
+
+    QueryExecutor(const QueryExecutor& other) : numThreads(other.numThreads) {}
+
+    QueryExecutor& operator=(const QueryExecutor& other) {
+        if (this != &other) {
+            shutdown();
+            numThreads = other.numThreads;
+        }
+        return *this;
+    }
+
+    ~QueryExecutor() {
+        shutdown();
+    }
+
+    /**
+     * Get the worker count
+     */
+    size_t size() const {
+        return numThreads;
+    }
+
+    /**
+     * Cancel running queries, fail queued ones and join the workers
+     * The executor restarts on the next submission.
+     */
+    void shutdown() {
+        std::deque<Task> abandoned;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            for (const QueryControl* control : running) {
+                if (control != nullptr) {
+                    control->token.cancel();
+                }
+            }
+            abandoned.swap(queue);
+        }
+        ready.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        for (Task& task : abandoned) {
+            task.abandon();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        workers.clear();
+        running.clear();
+        stopping = false;
+        // Queries submitted while shutting down run on fresh workers
+        if (!queue.empty()) {
+            start();
+        }
+    }
+
+    /**
+     * Set the worker count; running and queued queries are shut down first
+     * @param threads Worker count (0 uses all hardware threads)
+     */
+    void setThreadCount(size_t threads) {
+        shutdown();
+        numThreads = threads != 0 ? threads : std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+
+    /**
+     * Run a query on a worker
+     * @param query Callable computing the result
+     * @param control Token and progress callback of the query
+     * @return Future of the result; it holds QueryCancelled if the query
+     *         was stopped, or whatever else the query threw
+     */
+    template <typename Query>
+    auto submit(Query query, QueryControl control = QueryControl()) -> std::future<decltype(query())> {
+        using Result = decltype(query());
+        auto promise = std::make_shared<std::promise<Result>>();
+        std::future<Result> result = promise->get_future();
+        Task task;
+        task.control = std::move(control);
+        task.run = [promise, query]() mutable { fulfil(*promise, query); };
+        task.abandon = [promise]() { promise->set_exception(std::make_exception_ptr(QueryCancelled(false))); };
+        enqueue(std::move(task));
+        return result;
+    }
+
+    /**
+     * Run a query on a worker and call a completion with its ready future
+     * @param query Callable computing the result
+     * @param control Token and progress callback of the query
+     * @param done Called on the worker (or on the thread shutting the
+     *             executor down, for a query that never ran) with the
+     *             ready future; get() returns the result or rethrows.
+     *             It must not throw.
+     */
+    template <typename Query, typename Completion>
+    void submit(Query query, QueryControl control, Completion done) {
+        using Result = decltype(query());
+        Task task;
+        task.control = std::move(control);
+        task.run = [query, done]() mutable {
+            std::promise<Result> promise;
+            fulfil(promise, query);
+            done(promise.get_future());
+        };
+        task.abandon = [done]() mutable {
+            std::promise<Result> promise;
+            promise.set_exception(std::make_exception_ptr(QueryCancelled(false)));
+            done(promise.get_future());
+        };
+        enqueue(std::move(task));
+    }
+};
+
+#endif // ASYNC_QUERY_HPP
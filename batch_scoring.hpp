@@ -0,0 +1,607 @@
+/*
+ * batch_scoring.hpp - Sharded, multi-process batch scoring of evidence cases
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements BatchScorer, the engine of the batch_score driver.
+ * The model is a memory-mapped binary model file, so every process reads
+ * the same page-cache pages, and its junction tree is built once before
+ * the workers are forked, so they share it copy-on-write. A reader streams
+ * the CSV evidence cases in chunks of state indices, keeps the cases of
+ * this machine's shard and deals the chunks round-robin to the worker
+ * processes over pipes; a writer thread collects the results in the same
+ * order and streams the marginals to a CSV or binary sink. Every stage
+ * blocks when the next one falls behind (backpressure through the pipes),
+ * so resident memory is a few chunks per process however long the input.
+ *
+ * Binary output (native byte order, like the model file):
+ *   char magic[8] = "LBNSCORE", uint32 version, uint32 columns,
+ *   per column its "node=state" name as a uint32 length and the bytes,
+ *   then per case uint64 caseIndex and double probabilities[columns]
+ */
+
+#ifndef BATCH_SCORING_HPP
+#define BATCH_SCORING_HPP
+
+// Compiled network snapshot
+#include "compiled_network.hpp"
+// Binary model files
+#include "model_file.hpp"
+// Exact marginals
+#include "junction_tree.hpp"
+// Streaming CSV cases
+#include "parameter_learning.hpp"
+// Vector container
+#include <vector>
+// String operations
+#include <string>
+// Shared snapshot ownership
+#include <memory>
+// Input and output streams
+#include <istream>
+#include <ostream>
+// Writer thread
+#include <thread>
+// Worker failure flag
+#include <atomic>
+// Fixed-width integers
+#include <cstdint>
+// Number formatting
+#include <cstdio>
+// Memory copy
+#include <cstring>
+// Error codes of system calls
+#include <cerrno>
+// Exception handling
+#include <stdexcept>
+// Worker processes and pipes
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/**
+ * Output format of batch scoring
+ */
+enum class ScoreFormat {
+    CSV,     // Header row, then case index and probabilities per line
+    Binary   // Column table, then fixed-size records of doubles
+};
+
+/**
+ * Options of BatchScorer
+ */
+struct ScoringOptions {
+    size_t workers = 0;                      // Worker processes (0: score in the calling process)
+    size_t chunkRows = 4096;                 // Cases per chunk sent to a worker
+    size_t shardIndex = 0;                   // Shard scored by this machine
+    size_t shardCount = 1;                   // Machines the input is split across
+    std::vector<std::string> outputNodes;    // Nodes whose marginals are written (empty: all)
+    ScoreFormat format = ScoreFormat::CSV;   // Sink format
+};
+
+/**
+ * Outcome of BatchScorer::run
+ */
+struct ScoringResult {
+    size_t casesRead = 0;    // Data rows read from the input
+    size_t casesScored = 0;  // Rows of this shard scored and written
+    size_t chunks = 0;       // Chunks scored
+};
+
+/**
+ * MarginalSink writes scored cases to a stream as CSV or binary records
+ * Writes block while the stream does, which holds back the whole pipeline.
+ */
+class MarginalSink {
+private:
+    static constexpr uint32_t kVersion = 1;
+
+    std::ostream& out;
+    ScoreFormat format;
+    size_t numColumns;
+    // Formatted CSV lines, reused across chunks
+    std::string text;
+
+    void check() const {
+        if (!out) {
+            throw std::runtime_error("Cannot write scores");
+        }
+    }
+
+public:
+    /**
+     * Constructor: writes the header
+     * @param output Destination stream
+     * @param sinkFormat CSV or binary
+     * @param columns Column names ("node=state")
+     */
+    MarginalSink(std::ostream& output, ScoreFormat sinkFormat, const std::vector<std::string>& columns)
+        : out(output), format(sinkFormat), numColumns(columns.size()) {
+        if (format == ScoreFormat::CSV) {
+            text = "case";
+            for (const std::string& column : columns) {
+                text += "," + column;
+            }
+            text += "\n";
+            out.write(text.data(), static_cast<std::streamsize>(text.size()));
+        } else {
+            uint32_t version = kVersion;
+            uint32_t count = static_cast<uint32_t>(columns.size());
+            out.write("LBNSCORE", 8);
+            out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+            out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+            for (const std::string& column : columns) {
+                uint32_t length = static_cast<uint32_t>(column.size());
+                out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+                out.write(column.data(), static_cast<std::streamsize>(length));
+            }
+        }
+        check();
+    }
+
+    /**
+     * Write scored cases
+     * @param caseIds Input row index of each case
+     * @param values rows * columns probabilities
+     * @param rows Number of cases
+     */
+    void write(const uint64_t* caseIds, const double* values, size_t rows) {
+        if (format == ScoreFormat::CSV) {
+            text.clear();
+            char number[32];
+            for (size_t r = 0; r < rows; ++r) {
+                text += std::to_string(caseIds[r]);
+                for (size_t c = 0; c < numColumns; ++c) {
+                    // 17 significant digits round-trip every double
+                    std::snprintf(number, sizeof(number), ",%.17g", values[r * numColumns + c]);
+                    text += number;
+                }
+                text += '\n';
+            }
+            out.write(text.data(), static_cast<std::streamsize>(text.size()));
+        } else {
+            for (size_t r = 0; r < rows; ++r) {
+                out.write(reinterpret_cast<const char*>(&caseIds[r]), sizeof(uint64_t));
+                out.write(reinterpret_cast<const char*>(values + r * numColumns),
+                          static_cast<std::streamsize>(numColumns * sizeof(double)));
+            }
+        }
+        check();
+    }
+};
+
+/**
+ * BatchScorer computes the exact marginals of many evidence cases
+ * Cases are CSV rows as read by DatasetReader (columns named by node ID,
+ * "?", "NA" or empty for unobserved). Case i is row i of the data, counted
+ * from 0 over every shard; a machine scores the cases with
+ * i % shardCount == shardIndex, so the shards' outputs merge by case index.
+ * Each case is one junction tree calibration, and observed nodes are
+ * written as point masses, exactly as BayesianNetwork::computeMarginals.
+ */
+class BatchScorer {
+private:
+    std::shared_ptr<const CompiledNetwork> net;
+    std::shared_ptr<const JunctionTree> tree;
+    ScoringOptions options;
+    // Variables written, and their "node=state" columns
+    std::vector<int> outputVars;
+    std::vector<std::string> columnNames;
+
+    /**
+     * Parent-side ends of a worker's pipes
+     */
+    struct Worker {
+        pid_t pid = -1;
+        int toWorker = -1;    // Chunks of cases
+        int fromWorker = -1;  // Chunks of marginals
+    };
+
+    /**
+     * Ignores SIGPIPE for its lifetime, so writing to a dead worker fails
+     * with EPIPE instead of killing the process
+     */
+    class PipeSignalGuard {
+    private:
+        struct sigaction previous;
+
+    public:
+        PipeSignalGuard() {
+            struct sigaction ignore;
+            std::memset(&ignore, 0, sizeof(ignore));
+            ignore.sa_handler = SIG_IGN;
+            sigemptyset(&ignore.sa_mask);
+            ::sigaction(SIGPIPE, &ignore, &previous);
+        }
+
+        ~PipeSignalGuard() {
+            ::sigaction(SIGPIPE, &previous, nullptr);
+        }
+
+        PipeSignalGuard(const PipeSignalGuard&) = delete;
+        PipeSignalGuard& operator=(const PipeSignalGuard&) = delete;
+    };
+
+    static void writeAll(int fd, const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t written = ::write(fd, bytes, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Scoring pipe closed: " + std::string(std::strerror(errno)));
+            }
+            bytes += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    /**
+     * Read exactly size bytes
+     * @return False at end of stream before the first byte
+     */
+    static bool readAll(int fd, void* data, size_t size) {
+        char* bytes = static_cast<char*>(data);
+        size_t done = 0;
+        while (done < size) {
+            ssize_t count = ::read(fd, bytes + done, size - done);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Scoring pipe failed: " + std::string(std::strerror(errno)));
+            }
+            if (count == 0) {
+                if (done == 0) {
+                    return false;
+                }
+                throw std::runtime_error("Scoring pipe closed mid-chunk");
+            }
+            done += static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+    /**
+     * Read up to chunkRows cases of this shard
+     * @param reader CSV reader
+     * @param raw Scratch rows as read
+     * @param caseIds Output: input row index of each kept case
+     * @param states Output: kept rows of state indices
+     * @param result Counts, updated
+     * @return Number of cases kept (0 at the end of the input)
+     */
+    size_t readShard(DatasetReader& reader, std::vector<int>& raw, std::vector<uint64_t>& caseIds,
+                     std::vector<int>& states, ScoringResult& result) const {
+        size_t numVars = net->numNodes();
+        caseIds.clear();
+        states.clear();
+        while (caseIds.size() < options.chunkRows) {
+            size_t rows = reader.readChunk(options.chunkRows - caseIds.size(), raw);
+            if (rows == 0) {
+                break;
+            }
+            for (size_t r = 0; r < rows; ++r) {
+                uint64_t caseId = result.casesRead++;
+                if (caseId % options.shardCount == options.shardIndex) {
+                    caseIds.push_back(caseId);
+                    states.insert(states.end(), raw.begin() + r * numVars, raw.begin() + (r + 1) * numVars);
+                }
+            }
+        }
+        return caseIds.size();
+    }
+
+    /**
+     * Worker process loop: score chunks until the input pipe closes
+     */
+    void serve(int in, int out) const {
+        size_t numVars = net->numNodes();
+        std::vector<uint64_t> caseIds;
+        std::vector<int> states;
+        std::vector<double> values;
+        uint64_t rows = 0;
+        while (readAll(in, &rows, sizeof(rows))) {
+            caseIds.resize(rows);
+            states.resize(rows * numVars);
+            readAll(in, caseIds.data(), rows * sizeof(uint64_t));
+            readAll(in, states.data(), states.size() * sizeof(int));
+            values.resize(rows * columnNames.size());
+            scoreCases(states.data(), rows, values.data());
+            writeAll(out, &rows, sizeof(rows));
+            writeAll(out, caseIds.data(), rows * sizeof(uint64_t));
+            writeAll(out, values.data(), values.size() * sizeof(double));
+        }
+    }
+
+    /**
+     * Fork the workers; each inherits the mapped model and the tree
+     */
+    std::vector<Worker> startWorkers() const {
+        std::vector<Worker> workers;
+        for (size_t w = 0; w < options.workers; ++w) {
+            int cases[2];
+            int scores[2];
+            if (::pipe(cases) != 0) {
+                stopWorkers(workers);
+                throw std::runtime_error("Cannot create scoring pipe");
+            }
+            if (::pipe(scores) != 0) {
+                ::close(cases[0]);
+                ::close(cases[1]);
+                stopWorkers(workers);
+                throw std::runtime_error("Cannot create scoring pipe");
+            }
+#ifdef F_SETPIPE_SZ
+            // Room for a whole chunk, so a worker can start its next one
+            // while the writer drains the last
+            ::fcntl(cases[1], F_SETPIPE_SZ, 1 << 20);
+            ::fcntl(scores[1], F_SETPIPE_SZ, 1 << 20);
+#endif
+            pid_t pid = ::fork();
+            if (pid == 0) {
+                // Only this worker's ends stay open, so closing a pipe in
+                // the parent reaches its worker as end of input
+                for (const Worker& other : workers) {
+                    ::close(other.toWorker);
+                    ::close(other.fromWorker);
+                }
+                ::close(cases[1]);
+                ::close(scores[0]);
+                int status = 0;
+                try {
+                    serve(cases[0], scores[1]);
+                } catch (const std::exception& e) {
+                    std::fprintf(stderr, "Scoring worker %zu: %s\n", w, e.what());
+                    status = 1;
+                }
+                // Skip the parent's exit handlers and buffered output
+                ::_exit(status);
+            }
+            ::close(cases[0]);
+            ::close(scores[1]);
+            if (pid < 0) {
+                ::close(cases[1]);
+                ::close(scores[0]);
+                stopWorkers(workers);
+                throw std::runtime_error("Cannot start scoring worker");
+            }
+            Worker worker;
+            worker.pid = pid;
+            worker.toWorker = cases[1];
+            worker.fromWorker = scores[0];
+            workers.push_back(worker);
+        }
+        return workers;
+    }
+
+    /**
+     * Kill and reap workers after a failure
+     */
+    static void stopWorkers(std::vector<Worker>& workers) {
+        for (Worker& worker : workers) {
+            ::kill(worker.pid, SIGKILL);
+        }
+        for (Worker& worker : workers) {
+            if (worker.toWorker != -1) {
+                ::close(worker.toWorker);
+            }
+            if (worker.fromWorker != -1) {
+                ::close(worker.fromWorker);
+            }
+            ::waitpid(worker.pid, nullptr, 0);
+        }
+        workers.clear();
+    }
+
+    /**
+     * Score the input on worker processes
+     * This thread reads and deals chunks round-robin; a writer thread takes
+     * results from the workers in the same order, so no reordering buffer
+     * is needed and memory stays bounded by the chunks in flight.
+     */
+    void runWorkers(DatasetReader& reader, MarginalSink& sink, ScoringResult& result) const {
+        PipeSignalGuard guard;
+        std::vector<Worker> workers = startWorkers();
+        size_t numWorkers = workers.size();
+        std::atomic<bool> inputDone(false);
+        std::atomic<bool> failed(false);
+        auto abort = [&]() {
+            if (!failed.exchange(true)) {
+                for (const Worker& worker : workers) {
+                    ::kill(worker.pid, SIGKILL);
+                }
+            }
+        };
+
+        std::exception_ptr writeError;
+        size_t written = 0;
+        std::thread writer([&]() {
+            try {
+                std::vector<uint64_t> caseIds;
+                std::vector<double> values;
+                for (size_t chunk = 0;; ++chunk) {
+                    const Worker& worker = workers[chunk % numWorkers];
+                    uint64_t rows = 0;
+                    if (!readAll(worker.fromWorker, &rows, sizeof(rows))) {
+                        // Workers only close early when they fail
+                        if (!inputDone.load()) {
+                            abort();
+                        }
+                        break;
+                    }
+                    caseIds.resize(rows);
+                    values.resize(rows * columnNames.size());
+                    readAll(worker.fromWorker, caseIds.data(), rows * sizeof(uint64_t));
+                    readAll(worker.fromWorker, values.data(), values.size() * sizeof(double));
+                    sink.write(caseIds.data(), values.data(), rows);
+                    written += rows;
+                }
+            } catch (...) {
+                writeError = std::current_exception();
+                abort();
+            }
+        });
+
+        std::exception_ptr readError;
+        std::vector<int> raw;
+        std::vector<uint64_t> caseIds;
+        std::vector<int> states;
+        try {
+            uint64_t rows = 0;
+            while ((rows = readShard(reader, raw, caseIds, states, result)) > 0) {
+                const Worker& worker = workers[result.chunks % numWorkers];
+                writeAll(worker.toWorker, &rows, sizeof(rows));
+                writeAll(worker.toWorker, caseIds.data(), rows * sizeof(uint64_t));
+                writeAll(worker.toWorker, states.data(), states.size() * sizeof(int));
+                ++result.chunks;
+            }
+        } catch (...) {
+            readError = std::current_exception();
+            abort();
+        }
+        inputDone.store(true);
+        for (Worker& worker : workers) {
+            ::close(worker.toWorker);
+            worker.toWorker = -1;
+        }
+        writer.join();
+
+        // A worker failed on its own unless it died of our SIGKILL
+        bool killed = failed.load();
+        int failedWorker = -1;
+        for (size_t w = 0; w < numWorkers; ++w) {
+            ::close(workers[w].fromWorker);
+            int status = 0;
+            ::waitpid(workers[w].pid, &status, 0);
+            bool ok = WIFEXITED(status) ? WEXITSTATUS(status) == 0
+                                        : killed && WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL;
+            if (!ok && failedWorker == -1) {
+                failedWorker = static_cast<int>(w);
+            }
+        }
+        if (failedWorker != -1) {
+            throw std::runtime_error("Scoring worker " + std::to_string(failedWorker) + " failed");
+        }
+        // A failed sink stops the reader too; report the cause
+        if (writeError) {
+            std::rethrow_exception(writeError);
+        }
+        if (readError) {
+            std::rethrow_exception(readError);
+        }
+        if (killed) {
+            throw std::runtime_error("Scoring worker exited early");
+        }
+        result.casesScored = written;
+    }
+
+    void initialize() {
+        tree = std::make_shared<const JunctionTree>(net);
+        if (options.chunkRows == 0) {
+            throw std::runtime_error("Chunk size must be positive");
+        }
+        if (options.shardCount == 0 || options.shardIndex >= options.shardCount) {
+            throw std::runtime_error("Shard index must be below the shard count");
+        }
+        if (options.outputNodes.empty()) {
+            for (size_t v = 0; v < net->numNodes(); ++v) {
+                outputVars.push_back(static_cast<int>(v));
+            }
+        } else {
+            for (const std::string& nodeId : options.outputNodes) {
+                outputVars.push_back(net->requireIndex(nodeId));
+            }
+        }
+        for (int v : outputVars) {
+            for (const std::string& state : net->states(v)) {
+                columnNames.push_back(net->nodeId(v) + "=" + state);
+            }
+        }
+    }
+
+public:
+    /**
+     * Constructor from a binary model file, which is memory-mapped
+     * @param modelFile Path of the model file
+     * @param scoringOptions Workers, chunking, shard and output
+     */
+    BatchScorer(const std::string& modelFile, const ScoringOptions& scoringOptions)
+        : net(ModelFile::map(modelFile)), options(scoringOptions) {
+        initialize();
+    }
+
+    /**
+     * Constructor from a compiled network
+     * @param network Compiled network
+     * @param scoringOptions Workers, chunking, shard and output
+     */
+    BatchScorer(std::shared_ptr<const CompiledNetwork> network, const ScoringOptions& scoringOptions)
+        : net(std::move(network)), options(scoringOptions) {
+        initialize();
+    }
+
+    /**
+     * Get the output column names ("node=state"), in output order
+     */
+    const std::vector<std::string>& columns() const {
+        return columnNames;
+    }
+
+    /**
+     * Score rows of state indices
+     * @param states rows * numNodes() state indices, -1 when unobserved
+     * @param rows Number of cases
+     * @param values Output: rows * columns().size() probabilities
+     */
+    void scoreCases(const int* states, size_t rows, double* values) const {
+        size_t numVars = net->numNodes();
+        std::vector<int> evidenceState(numVars);
+        for (size_t r = 0; r < rows; ++r) {
+            evidenceState.assign(states + r * numVars, states + (r + 1) * numVars);
+            JunctionTree::Calibration calibration = tree->calibrate(evidenceState);
+            for (int v : outputVars) {
+                for (size_t s = 0; s < net->cardinality(v); ++s) {
+                    *values++ = (evidenceState[v] != -1)
+                                    ? (static_cast<int>(s) == evidenceState[v] ? 1.0 : 0.0)
+                                    : calibration.marginals[v][s];
+                }
+            }
+        }
+    }
+
+    /**
+     * Score every case of this shard and stream the marginals out
+     * @param input CSV cases, header row first
+     * @param output Destination of the scores (opened in binary mode for
+     *               ScoreFormat::Binary)
+     * @return Cases read, scored and chunks
+     */
+    ScoringResult run(std::istream& input, std::ostream& output) const {
+        DatasetReader reader(input, *net);
+        MarginalSink sink(output, options.format, columnNames);
+        ScoringResult result;
+        if (options.workers > 0) {
+            runWorkers(reader, sink, result);
+        } else {
+            std::vector<int> raw;
+            std::vector<uint64_t> caseIds;
+            std::vector<int> states;
+            std::vector<double> values;
+            size_t rows = 0;
+            while ((rows = readShard(reader, raw, caseIds, states, result)) > 0) {
+                values.resize(rows * columnNames.size());
+                scoreCases(states.data(), rows, values.data());
+                sink.write(caseIds.data(), values.data(), rows);
+                result.casesScored += rows;
+                ++result.chunks;
+            }
+        }
+        output.flush();
+        return result;
+    }
+};
+
+#endif // BATCH_SCORING_HPP
@@ -13,6 +13,46 @@
 #include "node.hpp"
 // Conditional Probability Table
 #include "cpt.hpp"
+// Structured CPT models
+#include "cpt_model.hpp"
+// Dense factors for variable elimination
+#include "factor.hpp"
+// Elimination ordering heuristics and cost model
+#include "elimination_order.hpp"
+// Frozen index-based network snapshot
+#include "compiled_network.hpp"
+// Junction tree for all-marginals inference
+#include "junction_tree.hpp"
+// Incremental evidence sessions
+#include "inference_session.hpp"
+// Batched factors for multi-case queries
+#include "batch_factor.hpp"
+// Work-stealing thread pool
+#include "thread_pool.hpp"
+// Binary model files
+#include "model_file.hpp"
+// Text model formats
+#include "model_text.hpp"
+// Query result cache
+#include "result_cache.hpp"
+// Flat belief propagation messages
+#include "message_store.hpp"
+// Sampling inference
+#include "sampling.hpp"
+// Streaming CSV datasets and sufficient statistics
+#include "parameter_learning.hpp"
+// Per-query phase timers, counters and trace export
+#include "instrumentation.hpp"
+// Flat joint tables and marginals
+#include "query_result.hpp"
+// Versioned copy-on-write model snapshots
+#include "model_snapshot.hpp"
+// Message kernels for small state and parent counts
+#include "small_kernels.hpp"
+// Cancellable asynchronous queries
+#include "async_query.hpp"
+// Query-specific relevance reduction
+#include "relevance.hpp"
 // Map container
 #include <map>
 // Vector container
@@ -33,11 +73,95 @@
 #include <fstream>
 // String stream operations
 #include <sstream>
+// Character classes
+#include <cctype>
+// Shared snapshot ownership
+#include <memory>
+// Policy dispatch
+#include <type_traits>
+// std::exp for MAP posteriors
+#include <cmath>
+// Influence tracing time budget
+#include <chrono>
+
+/**
+ * Message schedules of loopy belief propagation
+ */
+enum class LoopySchedule {
+    Flooding,  // Every message is recomputed from the previous sweep
+    Residual   // The message that would change most is sent first
+};
+
+/**
+ * Controls of loopy belief propagation
+ */
+struct LoopyOptions {
+    LoopySchedule schedule = LoopySchedule::Residual;
+    size_t maxIterations = 100;  // Sweeps; residual runs send up to maxIterations * messages
+    double tolerance = 1e-8;     // Converged once no message would change by more
+    double damping = 0.0;        // Sent message = (1 - damping) * update + damping * old
+};
+
+/**
+ * Approximate marginals and convergence diagnostics of a loopy run
+ */
+struct LoopyResult {
+    std::map<std::string, std::map<std::string, double>> beliefs;
+    bool converged = false;     // Largest pending change fell below the tolerance
+    size_t iterations = 0;      // Sweeps (residual: messages sent / messages, rounded up)
+    size_t messageUpdates = 0;  // Messages sent
+    double maxResidual = 0.0;   // Largest pending change when the run stopped
+};
+
+/**
+ * Sampled marginals with confidence intervals
+ */
+struct SamplingResult {
+    std::map<std::string, std::map<std::string, double>> marginals;
+    std::map<std::string, std::map<std::string, double>> halfWidths;  // Confidence interval half-widths
+    size_t samples = 0;            // Samples drawn
+    double effectiveSamples = 0.0; // Effective sample size
+    double seconds = 0.0;          // Time since the run started
+};
+
+/**
+ * One explanation of the evidence from a MAP or MPE query
+ */
+struct Explanation {
+    std::map<std::string, std::string> assignment;  // State of each explained node
+    double logProbability = 0.0;  // Natural log of P(assignment, evidence)
+    double posterior = 0.0;       // P(assignment | evidence)
+};
+
+/**
+ * Bounds of influence tracing
+ * Tracing keeps the strongest paths of each (evidence, query) pair and
+ * stops early once a budget is spent; whatever was found is returned.
+ */
+struct TraceOptions {
+    size_t pathsPerPair = 3;        // Strongest paths kept per (evidence, query) pair
+    size_t maxPaths = 256;          // Paths over all pairs
+    size_t maxExpansions = 100000;  // Partial paths extended over all pairs
+    double timeLimit = 0.0;         // Seconds (0: no limit)
+};
 
 /**
  * BayesianNetwork class implements a lossless Bayesian network.
  * Supports exact inference using variable elimination and maintains
  * all probability distributions without loss of precision.
+ *
+ * Thread safety: any number of threads may call const member functions on
+ * one shared network at the same time. CPT updates (setCPT,
+ * learnParameters) may run concurrently with them: every query pins the
+ * immutable ModelSnapshot current when it starts and finishes on it, while
+ * the writer publishes a new version that shares the unchanged CPT storage.
+ * Structural changes (addNode, addEdge, batches, loading) and
+ * setEliminationHeuristic, setThreadCount, setAsyncThreadCount and
+ * setResultCacheCapacity must not run concurrently with queries, including
+ * queries submitted with the *Async functions and not yet finished. Lazily built caches are immutable once
+ * published and are swapped in with atomic shared_ptr operations; the
+ * result cache is guarded by its own lock; an InferenceSession is owned by
+ * one thread.
  */
 class BayesianNetwork {
 private:
@@ -45,11 +169,80 @@ private:
     std::map<std::string, Node> nodes;
     // Map of node ID to CPT
     std::map<std::string, ConditionalProbabilityTable> cpts;
-    // Topological order of nodes
-    std::vector<std::string> nodeOrder;
+    // Map of node ID to structured CPT model (nodes without a dense CPT)
+    std::map<std::string, std::shared_ptr<const CPTModel>> cptModels;
+    // Model file snapshot whose CPTs are not yet copied into cpts: nodes
+    // without an entry in cpts or cptModels read theirs from the mapping.
+    // Set only while the published snapshot derives from it.
+    std::shared_ptr<const CompiledNetwork> mappedModel;
+    // Rank of each node in a topological order kept by addEdge (Pearce-Kelly)
+    std::map<std::string, size_t> topoRank;
+    // Rank given to the next node added
+    size_t nextRank = 0;
+    // True between beginBatch() and commit()
+    bool batchOpen = false;
+    // Nodes and edges added since beginBatch(), undone if commit() fails
+    std::vector<std::string> batchNodes;
+    std::vector<std::pair<std::string, std::string>> batchEdges;
+    // Heuristic used to order variable eliminations
+    EliminationHeuristic eliminationHeuristic = EliminationHeuristic::MinFill;
+    // Published compiled snapshots and the model version
+    SnapshotPublisher snapshots;
+    // Lazily built junction tree of the current snapshot
+    mutable std::shared_ptr<const JunctionTree> junctionTree;
+    // Worker pool for parallel inference (null runs everything serially)
+    std::shared_ptr<ThreadPool> threadPool;
+    // Optional cache of query results (disabled while its capacity is 0)
+    mutable ResultCache resultCache;
+    // Workers of asynchronous queries; declared last so it is destroyed
+    // first, stopping and joining queries before the state they read goes
+    mutable QueryExecutor executor;
+
+    /**
+     * Structure holding a resolved variable elimination query
+     */
+    struct EliminationPlan {
+        std::shared_ptr<const CompiledNetwork> net; // Snapshot the plan indexes
+        std::vector<bool> isQuery;                 // Query flag per variable
+        std::vector<int> evidenceState;            // Observed state, or -1
+        RelevantSubnetwork relevant;               // Nodes whose CPTs the query needs
+        std::vector<int> order;                    // Elimination order
+        std::vector<int> auxiliary;                // Auxiliary variable of each decomposed node, or -1
+        std::vector<size_t> cardinalities;         // Per variable, auxiliary variables included
+    };
+
+    /**
+     * Structure holding a MAP query once its hidden variables are summed out
+     */
+    struct MaxProductProblem {
+        std::shared_ptr<const CompiledNetwork> net; // Snapshot the problem indexes
+        std::vector<BasicFactor<LogPolicy>> factors; // Log factors over MAP variables only
+        std::vector<int> order;                      // Max-elimination order of the MAP variables
+        std::vector<int> position;                   // Position of each variable in order, or -1
+        double logEvidence = 0.0;                    // Natural log of P(evidence)
+    };
+
+    /**
+     * Structure holding exact Pearl messages, indexed by CSR parent edge
+     * (edge parentOffsets[v] + k links parents(v)[k] to v), and the scratch
+     * buffers the passes reuse, sized once so sweeps do not allocate
+     */
+    struct PearlMessages {
+        MessageStore store;                  // Lambda and pi per edge, over parent states
+        std::vector<int> edgeChild;          // Child endpoint of each edge
+        std::vector<double> weights;         // Row weights, one per CPT row
+        std::vector<double> rowLikelihood;   // Upward row likelihoods
+        std::vector<double> lambda;          // Evidence times incoming lambdas of a node
+        std::vector<double> support;         // Causal support of a node
+        std::vector<double> message;         // Message being computed
+        std::vector<double> expanded;        // Structured CPT expanded to dense
+        std::vector<size_t> parentStates;    // Row odometer over the parents
+    };
 
     /**
      * Perform topological sort to determine node ordering
+     * The order only depends on the graph: ready nodes are taken in ID
+     * order, so compiled indices do not depend on how the model was built.
      * @return Vector of node IDs in topological order
      */
     std::vector<std::string> topologicalSort() const {
@@ -57,17 +250,11 @@ private:
         std::map<std::string, size_t> inDegree;
         // Result ordering
         std::vector<std::string> result;
+        result.reserve(nodes.size());
 
         // Initialize in-degrees
         for (const auto& pair : nodes) {
-            inDegree[pair.first] = 0;
-        }
-
-        // Calculate in-degrees
-        for (const auto& pair : nodes) {
-            for ([[maybe_unused]] const std::string& parentId : pair.second.parentIds) {
-                inDegree[pair.first]++;
-            }
+            inDegree[pair.first] = pair.second.getNumParents();
         }
 
         // Kahn's algorithm for topological sort
@@ -84,12 +271,9 @@ private:
             result.push_back(current);
 
             // Decrease in-degree of children
-            for (auto& pair : nodes) {
-                if (pair.second.hasParent(current)) {
-                    inDegree[pair.first]--;
-                    if (inDegree[pair.first] == 0) {
-                        q.push(pair.first);
-                    }
+            for (const std::string& childId : nodes.at(current).childIds) {
+                if (--inDegree[childId] == 0) {
+                    q.push(childId);
                 }
             }
         }
@@ -103,16 +287,92 @@ private:
     }
 
     /**
-     * Check if graph is acyclic (DAG validation)
-     * @return True if acyclic, false otherwise
+     * Restore the topological ranks before adding parent -> child
+     * Pearce-Kelly dynamic ordering: only nodes ranked between the child and
+     * the parent are visited, and only those are given new ranks.
+     * @param parentId ID of parent node
+     * @param childId ID of child node
+     * @return False if the edge would close a cycle (ranks are unchanged)
      */
-    bool isAcyclic() const {
-        try {
-            topologicalSort();
+    bool reorderForEdge(const std::string& parentId, const std::string& childId) {
+        size_t lower = topoRank.at(childId);
+        size_t upper = topoRank.at(parentId);
+        if (upper < lower) {
             return true;
-        } catch (const std::runtime_error&) {
-            return false;
         }
+        // Affected nodes with their rank entries; visited ranks are unique
+        using Visit = std::pair<size_t, const std::string*>;
+        std::set<size_t> visited = {lower, upper};
+        // Nodes reachable from the child that rank below the parent
+        std::vector<Visit> forward;
+        std::vector<Visit> stack = {Visit(lower, &topoRank.find(childId)->first)};
+        while (!stack.empty()) {
+            Visit current = stack.back();
+            stack.pop_back();
+            for (const std::string& next : nodes.at(*current.second).childIds) {
+                auto rank = topoRank.find(next);
+                if (rank->second == upper) {
+                    return false;
+                }
+                if (rank->second < upper && visited.insert(rank->second).second) {
+                    stack.emplace_back(rank->second, &rank->first);
+                }
+            }
+            forward.push_back(current);
+        }
+        // Nodes reaching the parent that rank above the child
+        std::vector<Visit> backward;
+        stack.emplace_back(upper, &topoRank.find(parentId)->first);
+        while (!stack.empty()) {
+            Visit current = stack.back();
+            stack.pop_back();
+            for (const std::string& previous : nodes.at(*current.second).parentIds) {
+                auto rank = topoRank.find(previous);
+                if (rank->second > lower && visited.insert(rank->second).second) {
+                    stack.emplace_back(rank->second, &rank->first);
+                }
+            }
+            backward.push_back(current);
+        }
+        // Ancestors of the parent take the lowest of the freed ranks, each
+        // side keeping its relative order
+        std::sort(forward.begin(), forward.end());
+        std::sort(backward.begin(), backward.end());
+        std::set<size_t>::const_iterator rank = visited.begin();
+        for (const Visit& visit : backward) {
+            topoRank[*visit.second] = *rank++;
+        }
+        for (const Visit& visit : forward) {
+            topoRank[*visit.second] = *rank++;
+        }
+        return true;
+    }
+
+    /**
+     * Rebuild child lists and topological ranks from the parent sets
+     * @throws std::runtime_error if the graph contains a cycle
+     */
+    void rebuildStructure() {
+        for (auto& pair : nodes) {
+            pair.second.childIds.clear();
+        }
+        for (auto& pair : nodes) {
+            for (const std::string& parentId : pair.second.parentIds) {
+                nodes.at(parentId).addChild(pair.first);
+            }
+        }
+        rankNodes(topologicalSort());
+    }
+
+    /**
+     * Give nodes consecutive ranks in the given topological order
+     */
+    void rankNodes(const std::vector<std::string>& order) {
+        topoRank.clear();
+        for (size_t i = 0; i < order.size(); ++i) {
+            topoRank.emplace(order[i], i);
+        }
+        nextRank = order.size();
     }
 
 public:
@@ -134,11 +394,18 @@ public:
             throw std::runtime_error("Node with ID " + nodeId + " already exists");
         }
         nodes[nodeId] = Node(nodeName, states);
-        nodeOrder = topologicalSort();
+        // A new node has no edges, so it can go last
+        topoRank[nodeId] = nextRank++;
+        if (batchOpen) {
+            batchNodes.push_back(nodeId);
+        }
+        invalidateSnapshot();
     }
 
     /**
      * Add an edge from parent to child
+     * Outside a batch, cycles are detected incrementally in time proportional
+     * to the part of the topological order the edge reorders.
      * @param parentId ID of parent node
      * @param childId ID of child node
      */
@@ -152,13 +419,65 @@ public:
         if (parentId == childId) {
             throw std::runtime_error("Cannot add self-loop");
         }
-        nodes[childId].addParent(parentId);
-        // Check for cycles after adding edge
-        if (!isAcyclic()) {
-            nodes[childId].removeParent(parentId);
+        if (nodes[childId].hasParent(parentId)) {
+            return;
+        }
+        if (batchOpen) {
+            batchEdges.emplace_back(parentId, childId);
+        } else if (!reorderForEdge(parentId, childId)) {
             throw std::runtime_error("Adding edge would create a cycle");
         }
-        nodeOrder = topologicalSort();
+        nodes[childId].addParent(parentId);
+        nodes[parentId].addChild(childId);
+        invalidateSnapshot();
+    }
+
+    /**
+     * Start adding nodes and edges without per-edge cycle checks
+     * Until commit(), addEdge only records edges and the network cannot be
+     * queried; commit() validates the whole DAG once.
+     */
+    void beginBatch() {
+        if (batchOpen) {
+            throw std::runtime_error("A batch is already open");
+        }
+        batchOpen = true;
+        batchNodes.clear();
+        batchEdges.clear();
+    }
+
+    /**
+     * Close the batch opened by beginBatch(), validating the DAG once
+     * If the batch created a cycle, its nodes and edges are removed again
+     * (with any CPTs set on its nodes) and the network is left as it was
+     * before beginBatch().
+     * @throws std::runtime_error if the graph contains a cycle
+     */
+    void commit() {
+        if (!batchOpen) {
+            throw std::runtime_error("No batch is open");
+        }
+        batchOpen = false;
+        try {
+            rankNodes(topologicalSort());
+        } catch (const std::runtime_error&) {
+            for (const auto& edge : batchEdges) {
+                nodes.at(edge.second).removeParent(edge.first);
+                nodes.at(edge.first).removeChild(edge.second);
+            }
+            for (const std::string& nodeId : batchNodes) {
+                nodes.erase(nodeId);
+                cpts.erase(nodeId);
+                cptModels.erase(nodeId);
+                topoRank.erase(nodeId);
+            }
+            batchNodes.clear();
+            batchEdges.clear();
+            invalidateSnapshot();
+            throw std::runtime_error("Batch would create a cycle - not a valid DAG");
+        }
+        batchNodes.clear();
+        batchEdges.clear();
     }
 
     /**
@@ -170,7 +489,280 @@ public:
         if (nodes.find(nodeId) == nodes.end()) {
             throw std::runtime_error("Node " + nodeId + " does not exist");
         }
-        cpts[nodeId] = cpt;
+        publishCPTs([&](std::vector<CompiledNetwork::CPTUpdate>& updates, const CompiledNetwork* current) {
+            cpts[nodeId] = cpt;
+            cptModels.erase(nodeId);
+            if (current != nullptr) {
+                updates.push_back(CompiledNetwork::CPTUpdate{current->requireIndex(nodeId), &cpts.at(nodeId), nullptr});
+            }
+        });
+    }
+
+    /**
+     * Set a structured CPT model for a node
+     * The model replaces any dense CPT of the node and is shared, not
+     * copied, by compiled snapshots. Variable elimination runs a noisy-MAX
+     * model as its factor decomposition when that is smaller than the
+     * table; every other engine, and saving to a file, uses the expanded
+     * dense table.
+     * @param nodeId ID of the node
+     * @param model Sparse, context-specific, deterministic or noisy-MAX model
+     */
+    void setCPT(const std::string& nodeId, std::shared_ptr<const CPTModel> model) {
+        if (nodes.find(nodeId) == nodes.end()) {
+            throw std::runtime_error("Node " + nodeId + " does not exist");
+        }
+        if (!model) {
+            throw std::runtime_error("CPT model for node " + nodeId + " is null");
+        }
+        publishCPTs([&](std::vector<CompiledNetwork::CPTUpdate>& updates, const CompiledNetwork* current) {
+            cptModels[nodeId] = model;
+            cpts.erase(nodeId);
+            if (current != nullptr) {
+                updates.push_back(CompiledNetwork::CPTUpdate{current->requireIndex(nodeId), nullptr, model});
+            }
+        });
+    }
+
+    /**
+     * Compile the network into a frozen, index-based snapshot
+     * The snapshot is built on first use and shared until the model changes;
+     * inference engines run on it so strings only appear at the API boundary.
+     * Inside a query this is the snapshot the query pinned.
+     * @return Shared pointer to the immutable compiled network
+     */
+    std::shared_ptr<const CompiledNetwork> compile() const {
+        return snapshot()->network;
+    }
+
+    /**
+     * Get the current model snapshot without taking a lock
+     * A snapshot never changes: CPT updates publish a new one, so a reader
+     * may keep using this one (e.g. across several calls) while writers
+     * move on. Inside a query this is the snapshot the query pinned.
+     * @return Snapshot with its model version
+     */
+    std::shared_ptr<const ModelSnapshot> snapshot() const {
+        for (const SnapshotPin* pin = pinnedSnapshot(); pin != nullptr; pin = pin->previous) {
+            if (pin->owner == this) {
+                return pin->snapshot;
+            }
+        }
+        return snapshots.acquire([this]() {
+            if (batchOpen) {
+                throw std::runtime_error("Cannot use the network while a batch is open");
+            }
+            return std::make_shared<const CompiledNetwork>(nodes, cpts, topologicalSort(), cptModels);
+        });
+    }
+
+    /**
+     * Compile the junction tree of the current snapshot
+     * The tree is triangulated once per model with the current elimination
+     * heuristic and reused by every calibration until the model changes.
+     * @return Shared pointer to the immutable junction tree
+     */
+    std::shared_ptr<const JunctionTree> compileJunctionTree() const {
+        std::shared_ptr<const CompiledNetwork> net = compile();
+        std::shared_ptr<const JunctionTree> tree = std::atomic_load(&junctionTree);
+        if (!tree || tree->network() != net) {
+            // After a CPT update only the cliques holding changed CPTs are rebuilt
+            tree = (tree && tree->network()->sameStructure(*net))
+                       ? tree->withNetwork(net)
+                       : std::make_shared<const JunctionTree>(net, eliminationHeuristic);
+            std::atomic_store(&junctionTree, tree);
+        }
+        return tree;
+    }
+
+    /**
+     * Start an incremental inference session on the current model
+     * The session keeps its messages between observations, so each
+     * observe/retract only recomputes the messages a later query needs.
+     * @return Session without evidence, pinned to the current snapshot
+     */
+    InferenceSession createSession() const {
+        return InferenceSession(compileJunctionTree());
+    }
+
+    /**
+     * Exact posterior marginals of every node from one calibration
+     * @param evidence Map of observed node IDs to their states
+     * @return Flat distributions by compiled index; names resolve on demand
+     */
+    Marginals computeMarginals(const std::map<std::string, std::string>& evidence) const {
+        LBN_PHASE("computeBeliefs");
+        return cachedQuery<Marginals>(ResultCache::Kind::Marginals, std::vector<std::string>(), evidence,
+                                      [&]() { return calibrateMarginals(evidence); });
+    }
+
+    /**
+     * Exact posterior marginals of every node as nested string maps
+     * @param evidence Map of observed node IDs to their states
+     * @return Map of node ID to state -> probability
+     */
+    std::map<std::string, std::map<std::string, double>>
+    computeAllMarginals(const std::map<std::string, std::string>& evidence) const {
+        return computeMarginals(evidence).toMap();
+    }
+
+    /**
+     * Set the memory budget of the query result cache
+     * With a non-zero budget, variableElimination, computeAllMarginals and
+     * traced belief propagation keep their results, keyed by the query and
+     * the evidence as state indices, and answer repeated queries from the
+     * cache. Least recently used results are evicted to stay within the
+     * budget, and every model change drops the cache.
+     * @param bytes Estimated bytes of results to keep (0 disables the cache)
+     */
+    void setResultCacheCapacity(size_t bytes) {
+        resultCache.setCapacity(bytes);
+    }
+
+    /**
+     * Get hit/miss counters and memory use of the result cache
+     * @return Cache statistics
+     */
+    ResultCache::Stats getResultCacheStats() const {
+        return resultCache.getStats();
+    }
+
+    /**
+     * Drop every cached result and reset the cache counters
+     */
+    void clearResultCache() {
+        resultCache.clear();
+    }
+
+    /**
+     * Get the model version
+     * @return Counter bumped by every change that can alter a query result
+     */
+    uint64_t getModelVersion() const {
+        return snapshots.getVersion();
+    }
+
+private:
+    /**
+     * Exact posterior marginals of every node from one calibration (uncached)
+     */
+    Marginals calibrateMarginals(const std::map<std::string, std::string>& evidence) const {
+        std::shared_ptr<const JunctionTree> tree = compileJunctionTree();
+        const CompiledNetwork& net = *tree->network();
+        std::vector<int> evidenceState = resolveEvidence(net, evidence);
+        JunctionTree::Calibration calibration = tree->calibrate(evidenceState, threadPool.get());
+
+        Marginals marginals(tree->network());
+        for (size_t v = 0; v < net.numNodes(); ++v) {
+            double* belief = marginals.mutableProbabilities(static_cast<int>(v));
+            for (size_t s = 0; s < net.cardinality(static_cast<int>(v)); ++s) {
+                // Observed nodes are a point mass even under impossible evidence
+                belief[s] = (evidenceState[v] != -1) ? (static_cast<int>(s) == evidenceState[v] ? 1.0 : 0.0)
+                                                     : calibration.marginals[v][s];
+            }
+        }
+        return marginals;
+    }
+
+    /**
+     * Build the canonical cache key of a query
+     * Elimination queries are sorted and deduplicated, since their results
+     * do not depend on the order; traced belief propagation keeps the order,
+     * which determines the order of its traces, and is not cached for
+     * unknown query nodes.
+     * @param key Output key
+     * @return False if the query should not be cached
+     */
+    bool makeCacheKey(ResultCache::Kind kind,
+                      const std::vector<std::string>& queryNodes,
+                      const std::map<std::string, std::string>& evidence,
+                      ResultCache::Key& key) const {
+        std::shared_ptr<const CompiledNetwork> net = compile();
+        key.kind = kind;
+        for (const std::string& nodeId : queryNodes) {
+            int var = (kind == ResultCache::Kind::Elimination) ? net->requireIndex(nodeId) : net->indexOf(nodeId);
+            if (var == -1) {
+                return false;
+            }
+            key.query.push_back(var);
+        }
+        if (kind == ResultCache::Kind::Elimination) {
+            std::sort(key.query.begin(), key.query.end());
+            key.query.erase(std::unique(key.query.begin(), key.query.end()), key.query.end());
+        }
+        std::vector<int> evidenceState = resolveEvidence(*net, evidence);
+        for (size_t v = 0; v < evidenceState.size(); ++v) {
+            if (evidenceState[v] != -1) {
+                key.evidence.push_back(static_cast<int>(v));
+                key.evidence.push_back(evidenceState[v]);
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Answer a query from the result cache, computing and storing it on a miss
+     * @param compute Callable producing the uncached result
+     */
+    template <typename Result, typename Compute>
+    Result cachedQuery(ResultCache::Kind kind,
+                       const std::vector<std::string>& queryNodes,
+                       const std::map<std::string, std::string>& evidence,
+                       Compute compute) const {
+        QueryScope scope(*this);
+        ResultCache::Key key;
+        if (resultCache.getCapacity() == 0 || !makeCacheKey(kind, queryNodes, evidence, key)) {
+            return compute();
+        }
+        uint64_t version = scope.version();
+        if (std::shared_ptr<const Result> hit = resultCache.find<Result>(version, key)) {
+            return *hit;
+        }
+        std::shared_ptr<const Result> result = std::make_shared<const Result>(compute());
+        resultCache.insert(version, std::move(key), result, resultFootprint(*result));
+        return *result;
+    }
+
+    /**
+     * Estimated footprint of a cached result
+     */
+    template <typename Result>
+    static size_t resultFootprint(const Result& result) {
+        return ResultCache::footprint(result);
+    }
+
+    static size_t resultFootprint(const JointTable& result) {
+        return result.footprint();
+    }
+
+    static size_t resultFootprint(const Marginals& result) {
+        return result.footprint();
+    }
+
+public:
+    /**
+     * Probability of the evidence, P(evidence)
+     * @param evidence Map of observed node IDs to their states
+     * @return Exact probability of observing the evidence
+     */
+    double computeEvidenceProbability(const std::map<std::string, std::string>& evidence) const {
+        std::shared_ptr<const JunctionTree> tree = compileJunctionTree();
+        return tree->calibrate(resolveEvidence(*tree->network(), evidence), threadPool.get()).evidenceProbability;
+    }
+
+    /**
+     * Probability of the evidence under a numeric policy
+     * Sums the evidence out by variable elimination, so with LogPolicy or
+     * ExactPolicy the result does not underflow however long the evidence.
+     * @tparam Policy DoublePolicy, LogPolicy, KahanPolicy or ExactPolicy
+     * @param evidence Map of observed node IDs to their states
+     * @return P(evidence) as a Policy value (a natural log for LogPolicy)
+     */
+    template <typename Policy>
+    typename Policy::Value computeEvidenceProbability(const std::map<std::string, std::string>& evidence) const {
+        EliminationPlan plan = planElimination(std::vector<std::string>(), evidence, Policy::kSigned,
+                                               Relevance::Ancestral);
+        return eliminate<Policy>(plan).sum();
     }
 
     /**
@@ -183,34 +775,33 @@ public:
     double getConditionalProbability(const std::string& nodeId,
                                     const std::string& nodeState,
                                     const std::map<std::string, std::string>& parentStates) const {
-        if (cpts.find(nodeId) == cpts.end()) {
-            throw std::runtime_error("CPT not set for node " + nodeId);
-        }
-
-        const Node& node = nodes.at(nodeId);
-        const ConditionalProbabilityTable& cpt = cpts.at(nodeId);
+        std::shared_ptr<const CompiledNetwork> net = compile();
+        int v = net->requireIndex(nodeId);
+        net->requireCPT(v);
 
         // Build parent state indices
-        std::vector<size_t> parentStateIndices;
-        for (const std::string& parentId : node.parentIds) {
-            if (parentStates.find(parentId) == parentStates.end()) {
+        ArrayView<int> parents = net->parents(v);
+        std::vector<size_t> parentStateIndices(parents.size());
+        for (size_t i = 0; i < parents.size(); ++i) {
+            const std::string& parentId = net->nodeId(parents[i]);
+            auto it = parentStates.find(parentId);
+            if (it == parentStates.end()) {
                 throw std::runtime_error("Missing parent state for " + parentId);
             }
-            const Node& parentNode = nodes.at(parentId);
-            int parentStateIdx = parentNode.getStateIndex(parentStates.at(parentId));
+            int parentStateIdx = net->stateIndex(parents[i], it->second);
             if (parentStateIdx == -1) {
                 throw std::runtime_error("Invalid state for parent " + parentId);
             }
-            parentStateIndices.push_back(static_cast<size_t>(parentStateIdx));
+            parentStateIndices[i] = static_cast<size_t>(parentStateIdx);
         }
 
         // Get node state index
-        int nodeStateIdx = node.getStateIndex(nodeState);
+        int nodeStateIdx = net->stateIndex(v, nodeState);
         if (nodeStateIdx == -1) {
             throw std::runtime_error("Invalid state for node " + nodeId);
         }
 
-        return cpt.getProbability(parentStateIndices, static_cast<size_t>(nodeStateIdx));
+        return net->probability(v, parentStateIndices.data(), static_cast<size_t>(nodeStateIdx));
     }
 
     /**
@@ -219,29 +810,55 @@ public:
      * @return Joint probability P(assignment)
      */
     double computeJointProbability(const std::map<std::string, std::string>& assignment) const {
-        double jointProb = 1.0;
+        return computeJointProbability<DoublePolicy>(assignment);
+    }
 
-        // Process nodes in topological order
-        for (const std::string& nodeId : nodeOrder) {
-            if (assignment.find(nodeId) == assignment.end()) {
-                throw std::runtime_error("Missing assignment for node " + nodeId);
+    /**
+     * Compute joint probability for a full assignment under a numeric policy
+     * @tparam Policy DoublePolicy, LogPolicy, KahanPolicy or ExactPolicy
+     * @param assignment Map of node IDs to their states
+     * @return P(assignment) as a Policy value (a natural log for LogPolicy)
+     */
+    template <typename Policy>
+    typename Policy::Value computeJointProbability(const std::map<std::string, std::string>& assignment) const {
+        std::shared_ptr<const CompiledNetwork> net = compile();
+        size_t numVars = net->numNodes();
+
+        // Resolve the assignment to state indices once
+        std::vector<size_t> states(numVars);
+        for (size_t v = 0; v < numVars; ++v) {
+            auto it = assignment.find(net->nodeId(static_cast<int>(v)));
+            if (it == assignment.end()) {
+                throw std::runtime_error("Missing assignment for node " + net->nodeId(static_cast<int>(v)));
             }
+            int stateIdx = net->stateIndex(static_cast<int>(v), it->second);
+            if (stateIdx == -1) {
+                throw std::runtime_error("Invalid state for node " + it->first);
+            }
+            states[v] = static_cast<size_t>(stateIdx);
+        }
 
-            const Node& node = nodes.at(nodeId);
-            std::string nodeState = assignment.at(nodeId);
-
-            // Build parent states
-            std::map<std::string, std::string> parentStates;
-            for (const std::string& parentId : node.parentIds) {
-                if (assignment.find(parentId) == assignment.end()) {
-                    throw std::runtime_error("Missing assignment for parent " + parentId);
+        // Multiply conditional probabilities in topological order
+        typename Policy::Value jointProb = Policy::one();
+        std::vector<size_t> parentStates;
+        for (size_t v = 0; v < numVars; ++v) {
+            const double* table = net->requireCPT(static_cast<int>(v));
+            ArrayView<int> parents = net->parents(static_cast<int>(v));
+            if (table == nullptr) {
+                parentStates.clear();
+                for (int p : parents) {
+                    parentStates.push_back(states[p]);
                 }
-                parentStates[parentId] = assignment.at(parentId);
+                jointProb = Policy::multiply(jointProb, Policy::fromDouble(
+                    net->probability(static_cast<int>(v), parentStates.data(), states[v])));
+                continue;
             }
-
-            // Multiply by conditional probability
-            double condProb = getConditionalProbability(nodeId, nodeState, parentStates);
-            jointProb *= condProb;
+            ArrayView<size_t> strides = net->strides(static_cast<int>(v));
+            size_t index = states[v];
+            for (size_t i = 0; i < parents.size(); ++i) {
+                index += states[parents[i]] * strides[i];
+            }
+            jointProb = Policy::multiply(jointProb, Policy::fromDouble(table[index]));
         }
 
         return jointProb;
@@ -249,6 +866,26 @@ public:
 
     /**
      * Variable elimination for exact inference
+     * Builds one factor per relevant CPT, reduces the factors by the evidence,
+     * and sums out every non-query variable in the order chosen by the
+     * current elimination heuristic, so the cost is bounded by the largest
+     * intermediate factor rather than by the full joint distribution.
+     * @param queryNodes Nodes to query (variables of interest)
+     * @param evidence Map of observed node IDs to their states
+     * @return Normalized joint of the query nodes as a flat table
+     */
+    JointTable computeJointTable(const std::vector<std::string>& queryNodes,
+                                 const std::map<std::string, std::string>& evidence) const {
+        return cachedQuery<JointTable>(ResultCache::Kind::Elimination, queryNodes, evidence, [&]() {
+            EliminationPlan plan = planElimination(queryNodes, evidence, DoublePolicy::kSigned);
+            Factor joint = eliminate<DoublePolicy>(plan);
+            joint.normalize();
+            return JointTable(plan.net, joint);
+        });
+    }
+
+    /**
+     * Variable elimination with the result as nested string maps
      * @param queryNodes Nodes to query (variables of interest)
      * @param evidence Map of observed node IDs to their states
      * @return Map of query assignments to their probabilities
@@ -256,73 +893,132 @@ public:
     std::map<std::map<std::string, std::string>, double> 
     variableElimination(const std::vector<std::string>& queryNodes,
                        const std::map<std::string, std::string>& evidence) const {
-        // This is a simplified version - full implementation would use
-        // factor graphs and proper elimination ordering
-        std::map<std::map<std::string, std::string>, double> result;
-
-        // Get all unobserved nodes
-        std::vector<std::string> unobservedNodes;
-        for (const auto& pair : nodes) {
-            if (evidence.find(pair.first) == evidence.end()) {
-                unobservedNodes.push_back(pair.first);
-            }
-        }
+        return computeJointTable(queryNodes, evidence).toMap();
+    }
 
-        // Generate all possible assignments for query nodes
-        std::vector<std::map<std::string, std::string>> queryAssignments;
-        generateAssignments(queryNodes, queryAssignments);
+    /**
+     * Run a query on the asynchronous workers without blocking
+     * The query runs on the model snapshot current at submission, whatever
+     * CPT updates are published before it starts, under control: it stops
+     * with QueryCancelled at the next checkpoint of an exact or approximate
+     * engine once the token is cancelled or expires, and reports progress.
+     * Queries are served in submission order by setAsyncThreadCount workers.
+     * @param query Callable running synchronous queries on this network
+     * @param control Cancellation token, deadline and progress callback
+     * @return Future of the query's result
+     */
+    template <typename Query>
+    auto submitQuery(Query query, QueryControl control = QueryControl()) const -> std::future<decltype(query())> {
+        std::shared_ptr<const ModelSnapshot> pinned = snapshot();
+        return executor.submit(
+            [this, pinned, query]() mutable {
+                QueryScope scope(*this, pinned);
+                return query();
+            },
+            std::move(control));
+    }
 
-        // For each query assignment, compute probability
-        for (const auto& queryAssignment : queryAssignments) {
-            // Combine with evidence
-            std::map<std::string, std::string> fullAssignment = evidence;
-            for (const auto& pair : queryAssignment) {
-                fullAssignment[pair.first] = pair.second;
-            }
+    /**
+     * Run a query on the asynchronous workers and call a completion
+     * @param query Callable running synchronous queries on this network
+     * @param control Cancellation token, deadline and progress callback
+     * @param done Called on a worker with the ready std::future of the
+     *             result (get() rethrows errors); it must not throw
+     */
+    template <typename Query, typename Completion>
+    void submitQuery(Query query, QueryControl control, Completion done) const {
+        std::shared_ptr<const ModelSnapshot> pinned = snapshot();
+        executor.submit(
+            [this, pinned, query]() mutable {
+                QueryScope scope(*this, pinned);
+                return query();
+            },
+            std::move(control), std::move(done));
+    }
 
-            // Sum over all unobserved non-query nodes
-            double prob = 0.0;
-            std::vector<std::string> sumNodes;
-            for (const std::string& nodeId : unobservedNodes) {
-                bool isQueryNode = false;
-                for (const std::string& qNode : queryNodes) {
-                    if (nodeId == qNode) {
-                        isQueryNode = true;
-                        break;
-                    }
-                }
-                if (!isQueryNode) {
-                    sumNodes.push_back(nodeId);
-                }
-            }
+    /**
+     * Variable elimination without blocking (see submitQuery)
+     * @param queryNodes Nodes to query (variables of interest)
+     * @param evidence Map of observed node IDs to their states
+     * @param control Cancellation token, deadline and progress callback
+     * @return Future of the normalized joint of the query nodes
+     */
+    std::future<JointTable> computeJointTableAsync(const std::vector<std::string>& queryNodes,
+                                                   const std::map<std::string, std::string>& evidence,
+                                                   QueryControl control = QueryControl()) const {
+        return submitQuery([this, queryNodes, evidence]() { return computeJointTable(queryNodes, evidence); },
+                           std::move(control));
+    }
 
-            // Sum over all configurations of sum nodes
-            std::vector<std::map<std::string, std::string>> sumAssignments;
-            generateAssignments(sumNodes, sumAssignments);
+    /**
+     * Variable elimination with a completion callback (see submitQuery)
+     * @param done Called on a worker with the ready future of the result
+     */
+    void computeJointTableAsync(const std::vector<std::string>& queryNodes,
+                                const std::map<std::string, std::string>& evidence,
+                                QueryControl control,
+                                std::function<void(std::future<JointTable>)> done) const {
+        submitQuery([this, queryNodes, evidence]() { return computeJointTable(queryNodes, evidence); },
+                    std::move(control), std::move(done));
+    }
 
-            for (const auto& sumAssignment : sumAssignments) {
-                std::map<std::string, std::string> completeAssignment = fullAssignment;
-                for (const auto& pair : sumAssignment) {
-                    completeAssignment[pair.first] = pair.second;
-                }
-                try {
-                    prob += computeJointProbability(completeAssignment);
-                } catch (const std::exception&) {
-                    // Skip invalid assignments
-                }
-            }
+    /**
+     * Every exact posterior marginal without blocking (see submitQuery)
+     * @param evidence Map of observed node IDs to their states
+     * @param control Cancellation token, deadline and progress callback
+     * @return Future of the marginals
+     */
+    std::future<Marginals> computeMarginalsAsync(const std::map<std::string, std::string>& evidence,
+                                                 QueryControl control = QueryControl()) const {
+        return submitQuery([this, evidence]() { return computeMarginals(evidence); }, std::move(control));
+    }
 
-            result[queryAssignment] = prob;
-        }
+    /**
+     * Every exact posterior marginal with a completion callback (see submitQuery)
+     * @param done Called on a worker with the ready future of the result
+     */
+    void computeMarginalsAsync(const std::map<std::string, std::string>& evidence,
+                               QueryControl control,
+                               std::function<void(std::future<Marginals>)> done) const {
+        submitQuery([this, evidence]() { return computeMarginals(evidence); }, std::move(control), std::move(done));
+    }
 
-        // Normalize
-        double sum = 0.0;
-        for (const auto& pair : result) {
-            sum += pair.second;
-        }
-        if (sum > 1e-10) {
-            for (auto& pair : result) {
-                pair.second /= sum;
+    /**
+     * Variable elimination under a numeric policy
+     * The plan and the factors are the same as for doubles; values are
+     * converted when each factor enters elimination. LogPolicy and
+     * ExactPolicy normalize any non-zero mass, however small. LogPolicy
+     * cannot hold negative values, so it uses the dense table of noisy-MAX
+     * nodes instead of their decomposition.
+     * @tparam Policy DoublePolicy, LogPolicy, KahanPolicy or ExactPolicy
+     * @param queryNodes Nodes to query (variables of interest)
+     * @param evidence Map of observed node IDs to their states
+     * @return Map of query assignments to their probabilities as Policy
+     *         values (natural logs for LogPolicy)
+     */
+    template <typename Policy>
+    std::map<std::map<std::string, std::string>, typename Policy::Value>
+    variableElimination(const std::vector<std::string>& queryNodes,
+                        const std::map<std::string, std::string>& evidence) const {
+        std::map<std::map<std::string, std::string>, typename Policy::Value> result;
+        EliminationPlan plan = planElimination(queryNodes, evidence, Policy::kSigned);
+        BasicFactor<Policy> joint = eliminate<Policy>(plan);
+        joint.normalize();
+
+        // Read out every query assignment in the joint's storage order
+        const std::vector<int>& jointVars = joint.getVariables();
+        std::vector<size_t> states(jointVars.size(), 0);
+        for (size_t i = 0; i < joint.size(); ++i) {
+            std::map<std::string, std::string> assignment;
+            for (size_t v = 0; v < jointVars.size(); ++v) {
+                assignment[plan.net->nodeId(jointVars[v])] = plan.net->states(jointVars[v])[states[v]];
+            }
+            result[assignment] = joint.getValues()[i];
+            for (int v = static_cast<int>(jointVars.size()) - 1; v >= 0; --v) {
+                if (++states[v] < joint.getCardinalities()[v]) {
+                    break;
+                }
+                states[v] = 0;
             }
         }
 
@@ -330,12 +1026,326 @@ public:
     }
 
     /**
-     * Generate all possible assignments for given nodes
-     * @param nodeIds Vector of node IDs
-     * @param assignments Output vector of assignments
+     * Evidence for one case: observed node IDs to their states
      */
-    void generateAssignments(const std::vector<std::string>& nodeIds,
-                            std::vector<std::map<std::string, std::string>>& assignments) const {
+    using Evidence = std::map<std::string, std::string>;
+
+    /**
+     * Most probable explanation: the k most probable joint states of every
+     * unobserved node given the evidence
+     * Max-product elimination in log space with traceback, so the cost is
+     * that of one variable elimination query per explanation subspace
+     * rather than a search over the joint.
+     * @param evidence Map of observed node IDs to their states
+     * @param k Number of explanations (top-k mode when greater than 1)
+     * @return Up to k explanations in decreasing probability; empty if the
+     *         evidence is impossible
+     */
+    std::vector<Explanation> mostProbableExplanation(const Evidence& evidence, size_t k = 1) const {
+        std::vector<std::string> mapVars;
+        for (const auto& pair : nodes) {
+            if (evidence.find(pair.first) == evidence.end()) {
+                mapVars.push_back(pair.first);
+            }
+        }
+        return mapQuery(mapVars, evidence, k);
+    }
+
+    /**
+     * Maximum a posteriori query: the k most probable joint states of the
+     * MAP variables, with every other unobserved node summed out
+     * Hidden nodes are summed out first, then the MAP variables are
+     * maximized out in the order chosen by the elimination heuristic and
+     * recovered by traceback (ties go to the lowest state). Further
+     * explanations come from Lawler-Murty partitioning of the assignment
+     * space, one constrained max-product run per subspace.
+     * @param mapVars Nodes to explain
+     * @param evidence Map of observed node IDs to their states
+     * @param k Number of explanations (top-k mode when greater than 1)
+     * @return Up to k explanations in decreasing probability; empty if the
+     *         evidence is impossible
+     */
+    std::vector<Explanation> mapQuery(const std::vector<std::string>& mapVars,
+                                      const Evidence& evidence,
+                                      size_t k = 1) const {
+        std::vector<Explanation> explanations;
+        MaxProductProblem problem = planMaxProduct(mapVars, evidence);
+        if (k == 0 || problem.logEvidence == LogPolicy::zero()) {
+            return explanations;
+        }
+
+        // Subspaces of the assignment space, best first (ties in discovery order)
+        struct Subspace {
+            double logProbability;
+            size_t id;
+            std::vector<std::vector<bool>> allowed;  // Allowed states per position of problem.order
+            size_t fixed;                            // Leading positions fixed to one state
+            std::vector<size_t> states;              // Best assignment inside the subspace
+        };
+        auto worse = [](const Subspace& a, const Subspace& b) {
+            return a.logProbability < b.logProbability || (a.logProbability == b.logProbability && a.id > b.id);
+        };
+        std::priority_queue<Subspace, std::vector<Subspace>, decltype(worse)> queue(worse);
+        size_t nextId = 0;
+        auto solve = [&](std::vector<std::vector<bool>> allowed, size_t fixed) {
+            std::vector<size_t> states;
+            double value = maxProduct(problem, allowed, states);
+            if (value != LogPolicy::zero()) {
+                queue.push(Subspace{value, nextId++, std::move(allowed), fixed, std::move(states)});
+            }
+        };
+        solve(std::vector<std::vector<bool>>(problem.order.size()), 0);
+
+        const CompiledNetwork& net = *problem.net;
+        while (!queue.empty() && explanations.size() < k) {
+            Subspace best = queue.top();
+            queue.pop();
+            Explanation explanation;
+            for (int var : problem.order) {
+                explanation.assignment[net.nodeId(var)] = net.states(var)[best.states[var]];
+            }
+            explanation.logProbability = best.logProbability;
+            explanation.posterior = std::exp(best.logProbability - problem.logEvidence);
+            explanations.push_back(explanation);
+            if (explanations.size() == k) {
+                break;
+            }
+
+            // The rest of the subspace splits into parts that agree with the
+            // best assignment up to position i and differ from it at i
+            std::vector<std::vector<bool>> allowed = best.allowed;
+            for (size_t i = best.fixed; i < problem.order.size(); ++i) {
+                int var = problem.order[i];
+                size_t state = best.states[var];
+                if (allowed[i].empty()) {
+                    allowed[i].assign(net.cardinality(var), true);
+                }
+                std::vector<std::vector<bool>> part = allowed;
+                part[i][state] = false;
+                if (std::find(part[i].begin(), part[i].end(), true) != part[i].end()) {
+                    solve(std::move(part), i);
+                }
+                allowed[i].assign(net.cardinality(var), false);
+                allowed[i][state] = true;
+            }
+        }
+        return explanations;
+    }
+
+    /**
+     * Precision contract of batchQuery
+     */
+    enum class BatchMode {
+        Exact,  // Bit-identical to variableElimination for every case
+        Fast    // One shared plan for the whole batch, within fastModeUlpBound()
+    };
+
+    // Cases processed together in one structure-of-arrays block
+    static constexpr size_t kBatchLanes = 256;
+
+    /**
+     * Answer the same query for many independent evidence sets
+     * Cases are laid out as lanes of BatchFactor, so every product and sum
+     * is vectorized across cases. Exact mode groups cases by which nodes
+     * they observe and replays variableElimination's plan for each group,
+     * giving bit-identical results. Fast mode runs every case through one
+     * plan with evidence entered as indicators, which avoids per-pattern
+     * planning and keeps the lanes full; it agrees with exact mode to
+     * within fastModeUlpBound(queryNodes) units in the last place.
+     * @param cases Evidence map per case
+     * @param queryNodes Nodes to query
+     * @param mode Exact or Fast
+     * @return Per case, map of query assignments to their probabilities
+     */
+    std::vector<std::map<std::map<std::string, std::string>, double>>
+    batchQuery(const std::vector<Evidence>& cases,
+               const std::vector<std::string>& queryNodes,
+               BatchMode mode = BatchMode::Exact) const {
+        std::vector<std::map<std::map<std::string, std::string>, double>> results(cases.size());
+        if (cases.empty()) {
+            return results;
+        }
+        QueryScope scope(*this);
+        std::shared_ptr<const CompiledNetwork> net = compile();
+        size_t numVars = net->numNodes();
+
+        // Resolve every case once and group cases by observation pattern
+        std::vector<std::vector<int>> caseStates(cases.size());
+        std::map<std::vector<bool>, std::vector<size_t>> groups;
+        std::vector<bool> observedAnywhere(numVars, false);
+        for (size_t i = 0; i < cases.size(); ++i) {
+            caseStates[i] = resolveEvidence(*net, cases[i]);
+            std::vector<bool> pattern(numVars, false);
+            for (size_t v = 0; v < numVars; ++v) {
+                pattern[v] = caseStates[i][v] != -1;
+                observedAnywhere[v] = observedAnywhere[v] || pattern[v];
+            }
+            groups[pattern].push_back(i);
+        }
+
+        // One plan per group of cases; blocks of kBatchLanes cases become jobs
+        std::vector<EliminationPlan> plans;
+        std::vector<std::vector<size_t>> planCases;
+        if (mode == BatchMode::Exact) {
+            for (const auto& group : groups) {
+                plans.push_back(planElimination(queryNodes, cases[group.second.front()]));
+                planCases.push_back(group.second);
+            }
+        } else {
+            plans.push_back(planFastBatch(*net, queryNodes, observedAnywhere));
+            planCases.emplace_back(cases.size());
+            for (size_t i = 0; i < cases.size(); ++i) {
+                planCases.back()[i] = i;
+            }
+        }
+        std::vector<std::pair<size_t, size_t>> jobs;
+        for (size_t p = 0; p < plans.size(); ++p) {
+            for (size_t first = 0; first < planCases[p].size(); first += kBatchLanes) {
+                jobs.emplace_back(p, first);
+            }
+        }
+
+        // Jobs write disjoint cases, so they run concurrently on the pool
+        auto runJob = [&](size_t j) {
+            size_t p = jobs[j].first;
+            size_t first = jobs[j].second;
+            size_t lanes = std::min(kBatchLanes, planCases[p].size() - first);
+            runBatch(plans[p], caseStates, planCases[p], first, lanes, results);
+        };
+        if (threadPool) {
+            threadPool->parallelFor(0, jobs.size(), runJob);
+        } else {
+            for (size_t j = 0; j < jobs.size(); ++j) {
+                runJob(j);
+            }
+        }
+        return results;
+    }
+
+    /**
+     * Largest difference between Fast and Exact batchQuery results, in ULPs
+     * Every table entry is a sum of products of non-negative numbers, so
+     * each mode has relative error at most k * 2^-53 with k bounded by the
+     * number of products and additions on any term's path. The bound
+     * 8 * (F + S + T) covers both modes, where F is the number of nodes,
+     * S the sum of their cardinalities and T the size of the query table.
+     * It assumes no intermediate value underflows to a subnormal, and does
+     * not hold for decomposed noisy-MAX nodes, whose factors subtract.
+     * @param queryNodes Nodes to query
+     * @return Maximum distance in units in the last place
+     */
+    double fastModeUlpBound(const std::vector<std::string>& queryNodes) const {
+        std::shared_ptr<const CompiledNetwork> net = compile();
+        double cardinalitySum = 0.0;
+        for (size_t card : net->getCardinalities()) {
+            cardinalitySum += static_cast<double>(card);
+        }
+        double tableSize = 1.0;
+        for (const std::string& nodeId : queryNodes) {
+            tableSize *= static_cast<double>(net->cardinality(net->requireIndex(nodeId)));
+        }
+        return 8.0 * (static_cast<double>(net->numNodes()) + cardinalitySum + tableSize);
+    }
+
+    /**
+     * Estimate the cost of a variable elimination query without running it
+     * Uses the same pruning and ordering as variableElimination, so callers
+     * can reject or reroute expensive queries up front.
+     * @param queryNodes Nodes to query
+     * @param evidence Map of observed node IDs to their states
+     * @return Largest factor size, total operations, and induced width
+     */
+    EliminationCost estimateEliminationCost(const std::vector<std::string>& queryNodes,
+                                            const std::map<std::string, std::string>& evidence) const {
+        EliminationPlan plan = planElimination(queryNodes, evidence);
+        return EliminationOrdering::estimateCost(reducedScopes(plan), plan.cardinalities, plan.order);
+    }
+
+    /**
+     * Get the elimination order variableElimination would use
+     * @param queryNodes Nodes to query
+     * @param evidence Map of observed node IDs to their states
+     * @return Node IDs in elimination order
+     */
+    std::vector<std::string> getEliminationOrder(const std::vector<std::string>& queryNodes,
+                                                 const std::map<std::string, std::string>& evidence) const {
+        EliminationPlan plan = planElimination(queryNodes, evidence);
+        std::vector<std::string> order;
+        for (int var : plan.order) {
+            order.push_back(plan.net->nodeId(var));
+        }
+        return order;
+    }
+
+    /**
+     * Set the heuristic used to order eliminations
+     * @param heuristic Elimination heuristic
+     */
+    void setEliminationHeuristic(EliminationHeuristic heuristic) {
+        eliminationHeuristic = heuristic;
+        // Same model under a new version, so cached results are dropped, and
+        // the junction tree is triangulated again with the new heuristic
+        snapshots.update([](std::shared_ptr<const CompiledNetwork> current) { return current; });
+        std::atomic_store(&junctionTree, std::shared_ptr<const JunctionTree>());
+    }
+
+    /**
+     * Get the heuristic used to order eliminations
+     * @return Elimination heuristic
+     */
+    EliminationHeuristic getEliminationHeuristic() const {
+        return eliminationHeuristic;
+    }
+
+    /**
+     * Set the number of threads used by inference
+     * With more than one thread, batchQuery runs case blocks concurrently,
+     * junction-tree calibration processes independent branches in parallel,
+     * and large factor products are split across workers. Results do not
+     * depend on the thread count.
+     * @param numThreads Thread count (0 uses all hardware threads, 1 is serial)
+     */
+    void setThreadCount(size_t numThreads) {
+        if (numThreads == 0) {
+            numThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+        threadPool = (numThreads > 1) ? std::make_shared<ThreadPool>(numThreads)
+                                      : std::shared_ptr<ThreadPool>();
+    }
+
+    /**
+     * Get the number of threads used by inference
+     * @return Thread count (1 when running serially)
+     */
+    size_t getThreadCount() const {
+        return threadPool ? threadPool->size() : 1;
+    }
+
+    /**
+     * Set the number of workers serving asynchronous queries
+     * Queries still running are cancelled and queued ones fail with
+     * QueryCancelled. Each worker runs one query at a time; queries can
+     * still use the setThreadCount pool inside.
+     * @param numThreads Worker count (0 uses all hardware threads; default 1)
+     */
+    void setAsyncThreadCount(size_t numThreads) {
+        executor.setThreadCount(numThreads);
+    }
+
+    /**
+     * Get the number of workers serving asynchronous queries
+     */
+    size_t getAsyncThreadCount() const {
+        return executor.size();
+    }
+
+    /**
+     * Generate all possible assignments for given nodes
+     * @param nodeIds Vector of node IDs
+     * @param assignments Output vector of assignments
+     */
+    void generateAssignments(const std::vector<std::string>& nodeIds,
+                            std::vector<std::map<std::string, std::string>>& assignments) const {
         assignments.clear();
         if (nodeIds.empty()) {
             assignments.push_back(std::map<std::string, std::string>());
@@ -351,8 +1361,33 @@ public:
             stateLists.push_back(nodes.at(nodeId).states);
         }
 
-        generateAssignmentsRecursive(nodeIds, stateLists, 0, 
-                                    std::map<std::string, std::string>(), assignments);
+        // Odometer over the states, updating one assignment in place
+        size_t total = 1;
+        for (const std::vector<std::string>& states : stateLists) {
+            total *= states.size();
+        }
+        assignments.reserve(total);
+        std::vector<size_t> digits(nodeIds.size(), 0);
+        std::map<std::string, std::string> current;
+        for (size_t i = 0; i < nodeIds.size(); ++i) {
+            if (stateLists[i].empty()) {
+                return;
+            }
+            current[nodeIds[i]] = stateLists[i][0];
+        }
+        while (true) {
+            assignments.push_back(current);
+            int i = static_cast<int>(nodeIds.size()) - 1;
+            while (i >= 0 && ++digits[i] == stateLists[i].size()) {
+                digits[i] = 0;
+                current[nodeIds[i]] = stateLists[i][0];
+                --i;
+            }
+            if (i < 0) {
+                break;
+            }
+            current[nodeIds[i]] = stateLists[i][digits[i]];
+        }
     }
 
     /**
@@ -368,8 +1403,8 @@ public:
             return;
         }
 
+        std::map<std::string, std::string> newAssignment = currentAssignment;
         for (const std::string& state : stateLists[currentIndex]) {
-            std::map<std::string, std::string> newAssignment = currentAssignment;
             newAssignment[nodeIds[currentIndex]] = state;
             generateAssignmentsRecursive(nodeIds, stateLists, currentIndex + 1,
                                         newAssignment, assignments);
@@ -400,72 +1435,246 @@ public:
         return ids;
     }
 
+    /**
+     * Get the children of a node
+     * @param nodeId ID of the node
+     * @return Child node IDs, sorted
+     */
+    std::vector<std::string> getChildren(const std::string& nodeId) const {
+        const std::set<std::string>& children = getNode(nodeId).childIds;
+        return std::vector<std::string>(children.begin(), children.end());
+    }
+
+    /**
+     * Get the Markov blanket of a node: its parents, its children and the
+     * other parents of its children
+     * @param nodeId ID of the node
+     * @return Blanket node IDs, sorted
+     */
+    std::vector<std::string> getMarkovBlanket(const std::string& nodeId) const {
+        const Node& node = getNode(nodeId);
+        std::set<std::string> blanket(node.parentIds.begin(), node.parentIds.end());
+        for (const std::string& childId : node.childIds) {
+            blanket.insert(childId);
+            const std::set<std::string>& coParents = nodes.at(childId).parentIds;
+            blanket.insert(coParents.begin(), coParents.end());
+        }
+        blanket.erase(nodeId);
+        return std::vector<std::string>(blanket.begin(), blanket.end());
+    }
+
+    /**
+     * On-disk model formats
+     */
+    enum class FileFormat {
+        Text,   // Human-readable NODES / EDGES / CPTS sections
+        Binary, // Versioned, memory-mappable model file (see model_file.hpp)
+        Bif,    // BIF interchange format (import only)
+        XmlBif  // XMLBIF interchange format (import only)
+    };
+
     /**
      * Save network to file
      * @param filename Output filename
+     * @param format File format to write
      */
-    void saveToFile(const std::string& filename) const {
+    void saveToFile(const std::string& filename, FileFormat format = FileFormat::Text) const {
+        if (format == FileFormat::Binary) {
+            std::shared_ptr<const CompiledNetwork> net = compile();
+            for (size_t v = 0; v < net->numNodes(); ++v) {
+                if (net->getCPTStatus(static_cast<int>(v)) == CompiledNetwork::CPTStatus::Mismatch) {
+                    throw std::runtime_error("CPT dimensions do not match structure for node " +
+                                             net->nodeId(static_cast<int>(v)));
+                }
+            }
+            ModelFile::write(*net, filename);
+            return;
+        }
+
+        if (format != FileFormat::Text) {
+            throw std::runtime_error("BIF and XMLBIF are supported for import only");
+        }
         std::ofstream file(filename);
         if (!file.is_open()) {
             throw std::runtime_error("Cannot open file for writing: " + filename);
         }
+        saveToStream(file);
+    }
 
-        // Write header
-        file << "# Lossless Bayesian Network\n";
-        file << "# Copyright (C) 2025, Shyamal Chandra\n\n";
-
-        // Write nodes
-        file << "NODES\n";
-        for (const auto& pair : nodes) {
-            const Node& node = pair.second;
-            file << pair.first << " " << node.name << " ";
-            file << node.states.size();
-            for (const std::string& state : node.states) {
-                file << " " << state;
-            }
-            file << "\n";
+    /**
+     * Write network to a stream in the text format
+     * @param out Output stream
+     */
+    void saveToStream(std::ostream& out) const {
+        std::unique_lock<std::mutex> lock = snapshots.lockWriters();
+        if (cptModels.empty() && !mappedModel) {
+            ModelText::write(out, nodes, cpts);
+            return;
         }
-
-        // Write edges
-        file << "\nEDGES\n";
-        for (const auto& pair : nodes) {
-            for (const std::string& parentId : pair.second.parentIds) {
-                file << parentId << " -> " << pair.first << "\n";
-            }
+        // Structured models are written as their dense tables, CPTs still in
+        // a loaded model file as copies
+        std::map<std::string, ConditionalProbabilityTable> expanded = cpts;
+        for (const auto& pair : cptModels) {
+            expanded.emplace(pair.first, pair.second->toDense());
         }
+        addMappedCPTs(expanded);
+        ModelText::write(out, nodes, expanded);
+    }
 
-        // Write CPTs
-        file << "\nCPTS\n";
-        for (const auto& pair : cpts) {
-            const std::string& nodeId = pair.first;
-            const ConditionalProbabilityTable& cpt = pair.second;
+    /**
+     * Load network from file, replacing the current model
+     * Binary model files are recognised by their magic bytes and are
+     * memory-mapped without copying: each CPT is read straight from the
+     * mapping until it is replaced, or until a structural change compiles
+     * the model afresh. Files ending in .bif, .xml or .xmlbif are imported
+     * as BIF or XMLBIF; anything else is read as text.
+     * @param filename Input filename
+     */
+    void loadFromFile(const std::string& filename) {
+        if (ModelFile::isModelFile(filename)) {
+            loadSnapshot(ModelFile::map(filename));
+            return;
+        }
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot open file for reading: " + filename);
+        }
+        auto endsWith = [&](const std::string& suffix) {
+            return filename.size() >= suffix.size() &&
+                   std::equal(suffix.rbegin(), suffix.rend(), filename.rbegin(),
+                              [](char a, char b) { return a == std::tolower(static_cast<unsigned char>(b)); });
+        };
+        FileFormat format = FileFormat::Text;
+        if (endsWith(".bif")) {
+            format = FileFormat::Bif;
+        } else if (endsWith(".xml") || endsWith(".xmlbif")) {
+            format = FileFormat::XmlBif;
+        }
+        try {
+            loadFromStream(file, format);
+        } catch (const ParseError& e) {
+            throw ParseError(e.getDetail(), e.getLine(), e.getColumn(), filename);
+        }
+    }
 
-            file << nodeId << "\n";
-            const std::vector<size_t>& dims = cpt.getDimensions();
+    /**
+     * Learn every CPT from a CSV dataset
+     * The header row names the nodes and each field holds a state name;
+     * empty, "?" and "NA" fields, and nodes without a column, are missing.
+     * Rows are streamed in chunks and counted into thread-local tables the
+     * size of the CPTs, so memory does not grow with the dataset. With
+     * complete data one pass gives maximum likelihood (pseudoCount 0) or
+     * Dirichlet-smoothed CPTs. Otherwise the CPTs estimated from fully
+     * observed families start EM: each iteration rereads the data, adds the
+     * expected counts of incomplete families from batchQuery, and
+     * re-estimates until no probability moves by more than the tolerance.
+     * Structured CPT models are replaced by dense tables.
+     * @param data CSV stream (seekable when values are missing)
+     * @param options Prior, chunk size and EM stopping rule
+     * @return Row counts and EM diagnostics
+     */
+    LearningResult learnParameters(std::istream& data, const LearningOptions& options = LearningOptions()) {
+        if (options.chunkRows == 0) {
+            throw std::runtime_error("Learning chunk size must be positive");
+        }
+        if (!(options.pseudoCount >= 0.0)) {
+            throw std::runtime_error("Pseudo-count must be non-negative");
+        }
+        std::shared_ptr<const CompiledNetwork> net = compile();
+        DatasetReader reader(data, *net);
+        LearningResult result;
+
+        // First pass: counts of fully observed families
+        SufficientStatistics observed(*net);
+        std::vector<int> states;
+        while (size_t rows = reader.readChunk(options.chunkRows, states)) {
+            result.incompleteRows += observed.countObserved(states, rows, threadPool.get());
+            result.rows += rows;
+        }
+        std::vector<std::vector<double>> tables(net->numNodes());
+        for (size_t v = 0; v < net->numNodes(); ++v) {
+            tables[v] = observed.estimate(static_cast<int>(v), options.pseudoCount);
+        }
+        setLearnedCPTs(*net, tables);
+        if (result.incompleteRows == 0) {
+            return result;
+        }
 
-            // Write dimensions
-            file << dims.size();
-            for (size_t dim : dims) {
-                file << " " << dim;
+        // EM: expected counts of incomplete families under the current CPTs
+        result.converged = false;
+        while (result.iterations < options.maxIterations) {
+            SufficientStatistics expected = observed;
+            reader.rewind();
+            while (size_t rows = reader.readChunk(options.chunkRows, states)) {
+                addExpectedCounts(*net, states, rows, expected);
+            }
+            result.maxChange = 0.0;
+            for (size_t v = 0; v < net->numNodes(); ++v) {
+                std::vector<double> table = expected.estimate(static_cast<int>(v), options.pseudoCount);
+                for (size_t i = 0; i < table.size(); ++i) {
+                    result.maxChange = std::max(result.maxChange, std::abs(table[i] - tables[v][i]));
+                }
+                tables[v].swap(table);
+            }
+            setLearnedCPTs(*net, tables);
+            ++result.iterations;
+            if (result.maxChange <= options.tolerance) {
+                result.converged = true;
+                break;
             }
-            file << "\n";
-
-            // Write probabilities (simplified - would need proper serialization)
-            file << "# CPT data would be serialized here\n";
         }
+        return result;
+    }
 
-        file.close();
+    /**
+     * Learn every CPT from a CSV file
+     * @param filename Path to the dataset
+     * @param options Prior, chunk size and EM stopping rule
+     * @return Row counts and EM diagnostics
+     */
+    LearningResult learnParametersFromFile(const std::string& filename,
+                                           const LearningOptions& options = LearningOptions()) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot open file for reading: " + filename);
+        }
+        try {
+            return learnParameters(file, options);
+        } catch (const ParseError& e) {
+            throw ParseError(e.getDetail(), e.getLine(), e.getColumn(), filename);
+        }
     }
 
     /**
-     * Load network from file
-     * @param filename Input filename
+     * Load network from a text stream, replacing the current model
+     * The stream is parsed in chunks; the model is only replaced once the
+     * whole input has been read and validated.
+     * @param in Input stream
+     * @param format Text, Bif or XmlBif
      */
-    void loadFromFile(const std::string& filename) {
-        // Implementation would parse the file format
-        // This is a placeholder for the full implementation
-        (void)filename;  // Suppress unused parameter warning
-        throw std::runtime_error("File loading not fully implemented");
+    void loadFromStream(std::istream& in, FileFormat format = FileFormat::Text) {
+        ModelText::ParsedModel model;
+        if (format == FileFormat::Text) {
+            model = ModelText::read(in);
+        } else if (format == FileFormat::Bif) {
+            model = ModelText::readBif(in);
+        } else if (format == FileFormat::XmlBif) {
+            model = ModelText::readXmlBif(in);
+        } else {
+            throw std::runtime_error("Binary model files can only be loaded with loadFromFile");
+        }
+        std::swap(nodes, model.nodes);
+        try {
+            rebuildStructure();
+        } catch (...) {
+            std::swap(nodes, model.nodes);
+            throw;
+        }
+        batchOpen = false;
+        cpts = std::move(model.cpts);
+        cptModels.clear();
+        mappedModel.reset();
+        invalidateSnapshot();
     }
 
     /**
@@ -488,10 +1697,30 @@ public:
         std::map<std::string, double> stateInfluences;  // Per-state influence
     };
 
+private:
+    /**
+     * Estimated footprint of a traced belief propagation result
+     */
+    static size_t resultFootprint(const std::pair<std::map<std::string, std::map<std::string, double>>,
+                                                  std::vector<InfluenceTrace>>& result) {
+        size_t bytes = ResultCache::footprint(result.first) + sizeof(result.second);
+        for (const InfluenceTrace& trace : result.second) {
+            bytes += ResultCache::footprint(trace.sourceNode) + ResultCache::footprint(trace.targetNode) +
+                     ResultCache::footprint(trace.path) + ResultCache::footprint(trace.influenceStrength) +
+                     ResultCache::footprint(trace.stateInfluences);
+        }
+        return bytes;
+    }
+
+public:
+
     /**
      * Lossless Belief Propagation with influence tracing
-     * Implements sum-product algorithm for exact inference while tracing
-     * how probabilities flow through the network.
+     * Beliefs for every node come from one calibration of the cached
+     * junction tree, so they are exact on any DAG. Tracing is opt-in: it
+     * runs exact Pearl lambda/pi messages on the network itself and keeps
+     * the strongest paths within the default TraceOptions (call
+     * traceInfluence for other bounds).
      * 
      * @param queryNodes Nodes to query (variables of interest)
      * @param evidence Map of observed node IDs to their states
@@ -502,980 +1731,1621 @@ public:
               std::vector<InfluenceTrace>>
     beliefPropagation(const std::vector<std::string>& queryNodes,
                      const std::map<std::string, std::string>& evidence,
-                     bool traceInfluence = true) const {
-        
-        // Beliefs: node -> state -> probability
-        std::map<std::string, std::map<std::string, double>> beliefs;
-        std::vector<InfluenceTrace> influenceTraces;
-        
-        // Initialize beliefs with prior probabilities
-        for (const auto& pair : nodes) {
-            const std::string& nodeId = pair.first;
-            const Node& node = pair.second;
-            
-            // If node is in evidence, set belief to 1.0 for observed state
-            if (evidence.find(nodeId) != evidence.end()) {
-                std::string observedState = evidence.at(nodeId);
-                for (const std::string& state : node.states) {
-                    beliefs[nodeId][state] = (state == observedState) ? 1.0 : 0.0;
-                }
-            } else {
-                // Initialize with uniform prior (will be updated by messages)
-                double uniformProb = 1.0 / static_cast<double>(node.states.size());
-                for (const std::string& state : node.states) {
-                    beliefs[nodeId][state] = uniformProb;
-                }
-            }
+                     bool traceInfluence = false) const {
+        if (!traceInfluence) {
+            return std::make_pair(computeAllMarginals(evidence), std::vector<InfluenceTrace>());
         }
-        
-        // Build message passing structure
-        // Messages: (from, to) -> message probabilities
-        std::map<std::pair<std::string, std::string>, 
-                 std::map<std::string, double>> messages;
-        
-        // Initialize messages from CPTs
-        initializeMessages(messages, evidence);
-        
-        // Upward pass: messages from leaves to root
-        upwardPass(messages, evidence);
-        
-        // Downward pass: messages from root to leaves
-        downwardPass(messages, evidence);
-        
-        // Compute beliefs from messages
-        computeBeliefs(messages, beliefs, evidence);
-        
-        // Trace influence if requested
-        if (traceInfluence) {
-            traceInfluencePaths(messages, beliefs, queryNodes, evidence, influenceTraces);
-        }
-        
-        return std::make_pair(beliefs, influenceTraces);
+        return cachedQuery<std::pair<std::map<std::string, std::map<std::string, double>>,
+                                     std::vector<InfluenceTrace>>>(
+            ResultCache::Kind::BeliefPropagation, queryNodes, evidence, [&]() {
+                // Beliefs: node -> state -> probability
+                std::map<std::string, std::map<std::string, double>> beliefs = computeAllMarginals(evidence);
+                return std::make_pair(beliefs, this->traceInfluence(queryNodes, evidence));
+            });
+    }
+
+    /**
+     * Trace how evidence influences query nodes along directed paths
+     * Influence flows from each evidence node down its unobserved
+     * descendants. Every edge is weighted by how far its converged pi
+     * message is from uniform (1 for a point mass, 0 for no information)
+     * and a path's strength is the product of its edge weights, so a
+     * best-first search finds the strongest paths first. Pairs that Bayes-ball
+     * shows d-separated are skipped without searching.
+     * @param queryNodes Nodes to explain
+     * @param evidence Map of observed node IDs to their states
+     * @param options Paths per pair and search budgets
+     * @return Strongest paths of each pair, strongest first; a trace's
+     *         stateInfluences is the causal support (pi) of the query node
+     */
+    std::vector<InfluenceTrace> traceInfluence(const std::vector<std::string>& queryNodes,
+                                               const std::map<std::string, std::string>& evidence,
+                                               const TraceOptions& options = TraceOptions()) const {
+        QueryScope scope(*this);
+        PearlMessages messages = propagateMessages(evidence);
+        return traceInfluencePaths(messages, queryNodes, evidence, options, false);
+    }
+
+    /**
+     * Trace how evidence influences query nodes along reverse (diagnostic) paths
+     * Like traceInfluence, following parents from each evidence node and
+     * weighting edges by their lambda messages.
+     * @param queryNodes Nodes to explain (typically causes)
+     * @param evidence Map of observed node IDs to their states (typically effects)
+     * @param options Paths per pair and search budgets
+     * @return Strongest paths of each pair, strongest first; a trace's
+     *         stateInfluences is the lambda message that reaches the query node
+     */
+    std::vector<InfluenceTrace> traceReverseInfluence(const std::vector<std::string>& queryNodes,
+                                                      const std::map<std::string, std::string>& evidence,
+                                                      const TraceOptions& options = TraceOptions()) const {
+        QueryScope scope(*this);
+        PearlMessages messages = propagateMessages(evidence);
+        return traceInfluencePaths(messages, queryNodes, evidence, options, true);
     }
 
 private:
     /**
-     * Initialize messages from CPTs
+     * Run exact Pearl message passing
+     * Sweeps alternate upward and downward passes until no message changes;
+     * on a polytree the fixed point is exact. Loopy networks stop after a
+     * bounded number of sweeps. Buffers are allocated once before the first
+     * sweep.
+     * @param evidence Map of observed node IDs to their states
+     * @return Lambda and pi messages by edge, both over the parent's states
      */
-    void initializeMessages(std::map<std::pair<std::string, std::string>, 
-                                    std::map<std::string, double>>& messages,
-                           const std::map<std::string, std::string>& evidence) const {
-        for (const auto& pair : nodes) {
-            const std::string& nodeId = pair.first;
-            const Node& node = pair.second;
-            
-            // Skip if node is observed
-            if (evidence.find(nodeId) != evidence.end()) {
-                continue;
-            }
-            
-            // If node has no parents, initialize from prior
-            if (node.parentIds.empty()) {
-                if (cpts.find(nodeId) != cpts.end()) {
-                    const ConditionalProbabilityTable& cpt = cpts.at(nodeId);
-                    for (size_t i = 0; i < node.states.size(); ++i) {
-                        double prob = cpt.getProbability({}, i);
-                        // Send message to all children
-                        for (const auto& childPair : nodes) {
-                            if (childPair.second.hasParent(nodeId)) {
-                                std::pair<std::string, std::string> key(nodeId, childPair.first);
-                                messages[key][node.states[i]] = prob;
-                            }
-                        }
-                    }
-                }
+    PearlMessages propagateMessages(const std::map<std::string, std::string>& evidence) const {
+        std::shared_ptr<const CompiledNetwork> net = compile();
+        std::vector<int> evidenceState = resolveEvidence(*net, evidence);
+        for (size_t v = 0; v < net->numNodes(); ++v) {
+            net->requireCPT(static_cast<int>(v));
+        }
+
+        PearlMessages messages;
+        initializeMessages(*net, messages);
+        for (size_t sweep = 0; sweep <= net->numNodes() + 1; ++sweep) {
+            bool changed = upwardPass(*net, evidenceState, messages);
+            changed = downwardPass(*net, evidenceState, messages) || changed;
+            if (!changed) {
+                break;
             }
         }
+        return messages;
     }
 
     /**
-     * Upward pass: propagate messages from leaves to root
+     * Initialize every lambda and pi message to the uniform message and size
+     * the scratch buffers for the largest family
+     * @param doubleBuffered Whether message writes go to a back buffer (loopy schedules)
      */
-    void upwardPass(std::map<std::pair<std::string, std::string>, 
-                            std::map<std::string, double>>& messages,
-                   const std::map<std::string, std::string>& evidence) const {
-        // Process nodes in reverse topological order (leaves first)
-        std::vector<std::string> reverseOrder = nodeOrder;
-        std::reverse(reverseOrder.begin(), reverseOrder.end());
-        
-        for (const std::string& nodeId : reverseOrder) {
-            if (evidence.find(nodeId) != evidence.end()) {
-                continue;  // Skip observed nodes
-            }
-            
-            const Node& node = nodes.at(nodeId);
-            if (cpts.find(nodeId) == cpts.end()) {
-                continue;  // Skip nodes without CPT
-            }
-            
-            // Collect messages from children
-            std::map<std::string, std::map<std::string, double>> childMessages;
-            for (const auto& childPair : nodes) {
-                if (childPair.second.hasParent(nodeId)) {
-                    std::pair<std::string, std::string> key(nodeId, childPair.first);
-                    if (messages.find(key) != messages.end()) {
-                        childMessages[childPair.first] = messages[key];
-                    }
-                }
+    void initializeMessages(const CompiledNetwork& net, PearlMessages& messages, bool doubleBuffered = false) const {
+        LBN_PHASE("initializeMessages");
+        size_t numEdges = net.getParentIndices().size();
+        messages.store = MessageStore::forNetwork(net, doubleBuffered);
+        messages.store.reset();
+        messages.edgeChild.resize(numEdges);
+        size_t maxRows = 1;
+        size_t maxCard = 1;
+        size_t maxParents = 0;
+        size_t maxModel = 0;
+        for (size_t v = 0; v < net.numNodes(); ++v) {
+            int var = static_cast<int>(v);
+            for (size_t e = net.getParentOffsets()[v]; e < net.getParentOffsets()[v + 1]; ++e) {
+                messages.edgeChild[e] = var;
             }
-            
-            // Send message to each parent
-            for (const std::string& parentId : node.parentIds) {
-                if (evidence.find(parentId) != evidence.end()) {
-                    continue;  // Skip observed parents
-                }
-                
-                std::map<std::string, double> messageToParent;
-                const Node& parentNode = nodes.at(parentId);
-                
-                // For each parent state
-                for (const std::string& parentState : parentNode.states) {
-                    double messageValue = 0.0;
-                    
-                    // Sum over all node states
-                    for (size_t nodeStateIdx = 0; nodeStateIdx < node.states.size(); ++nodeStateIdx) {
-                        const std::string& nodeState = node.states[nodeStateIdx];
-                        
-                        // Get conditional probability
-                        std::map<std::string, std::string> parentStates;
-                        parentStates[parentId] = parentState;
-                        // Add other parents if any
-                        for (const std::string& otherParentId : node.parentIds) {
-                            if (otherParentId != parentId) {
-                                if (evidence.find(otherParentId) != evidence.end()) {
-                                    parentStates[otherParentId] = evidence.at(otherParentId);
-                                } else {
-                                    // Use most likely state (simplified)
-                                    parentStates[otherParentId] = parentNode.states[0];
-                                }
-                            }
-                        }
-                        
-                        double condProb = getConditionalProbability(nodeId, nodeState, parentStates);
-                        
-                        // Multiply by messages from children
-                        double childProduct = 1.0;
-                        for (const auto& childMsgPair : childMessages) {
-                            if (childMsgPair.second.find(nodeState) != childMsgPair.second.end()) {
-                                childProduct *= childMsgPair.second.at(nodeState);
-                            }
-                        }
-                        
-                        messageValue += condProb * childProduct;
-                    }
-                    
-                    messageToParent[parentState] = messageValue;
-                }
-                
-                // Normalize message
-                double sum = 0.0;
-                for (const auto& msgPair : messageToParent) {
-                    sum += msgPair.second;
-                }
-                if (sum > 1e-10) {
-                    for (auto& msgPair : messageToParent) {
-                        msgPair.second /= sum;
-                    }
-                }
-                
-                std::pair<std::string, std::string> key(nodeId, parentId);
-                messages[key] = messageToParent;
+            maxRows = std::max(maxRows, net.cptSize(var) / net.cardinality(var));
+            maxCard = std::max(maxCard, net.cardinality(var));
+            maxParents = std::max(maxParents, net.parents(var).size());
+            if (net.cptModel(var)) {
+                maxModel = std::max(maxModel, net.cptSize(var));
             }
         }
+        messages.weights.resize(maxRows);
+        messages.rowLikelihood.resize(maxRows);
+        messages.lambda.resize(maxCard);
+        messages.support.resize(maxCard);
+        messages.message.resize(maxCard);
+        messages.expanded.reserve(maxModel);
+        messages.parentStates.resize(maxParents);
     }
 
     /**
-     * Downward pass: propagate messages from root to leaves
+     * Weight of each CPT row: product of the incoming pi messages
+     * @param skipSlot Parent slot left out of the product (-1 for none)
+     * @param weights Output, one weight per parent configuration in CPT row order
      */
-    void downwardPass(std::map<std::pair<std::string, std::string>, 
-                              std::map<std::string, double>>& messages,
-                     const std::map<std::string, std::string>& evidence) const {
-        // Process nodes in topological order (root first)
-        for (const std::string& nodeId : nodeOrder) {
-            if (evidence.find(nodeId) != evidence.end()) {
-                continue;  // Skip observed nodes
-            }
-            
-            const Node& node = nodes.at(nodeId);
-            if (cpts.find(nodeId) == cpts.end()) {
-                continue;
+    void rowWeights(const CompiledNetwork& net,
+                    PearlMessages& messages,
+                    int v,
+                    int skipSlot,
+                    double* weights) const {
+        ArrayView<int> parents = net.parents(v);
+        size_t firstEdge = net.getParentOffsets()[v];
+        if (parents.size() <= kernels::kMaxFixedParents) {
+            // Nested loops over up to four parents instead of the odometer
+            const double* pi[kernels::kMaxFixedParents];
+            size_t cards[kernels::kMaxFixedParents];
+            for (size_t k = 0; k < parents.size(); ++k) {
+                pi[k] = messages.store.pi(firstEdge + k);
+                cards[k] = net.cardinality(parents[k]);
             }
-            
-            // Collect messages from parents
-            std::map<std::string, std::map<std::string, double>> parentMessages;
-            for (const std::string& parentId : node.parentIds) {
-                std::pair<std::string, std::string> key(parentId, nodeId);
-                if (messages.find(key) != messages.end()) {
-                    parentMessages[parentId] = messages[key];
+            kernels::withParentCount(parents.size(), [&](auto fixed) {
+                if constexpr (decltype(fixed)::value == 0) {
+                    weights[0] = 1.0;
+                } else {
+                    kernels::rowWeights<decltype(fixed)::value>(pi, cards, skipSlot, weights);
+                }
+            });
+            return;
+        }
+        size_t numRows = net.cptSize(v) / net.cardinality(v);
+        size_t* parentStates = messages.parentStates.data();
+        std::fill(parentStates, parentStates + parents.size(), size_t(0));
+        for (size_t r = 0; r < numRows; ++r) {
+            weights[r] = 1.0;
+            for (size_t k = 0; k < parents.size(); ++k) {
+                if (static_cast<int>(k) != skipSlot) {
+                    weights[r] *= messages.store.pi(firstEdge + k)[parentStates[k]];
                 }
             }
-            
-            // Send message to each child
-            for (const auto& childPair : nodes) {
-                if (childPair.second.hasParent(nodeId)) {
-                    const std::string& childId = childPair.first;
-                    if (evidence.find(childId) != evidence.end()) {
-                        continue;  // Skip observed children
-                    }
-                    
-                    std::map<std::string, double> messageToChild;
-                    const Node& childNode = nodes.at(childId);
-                    
-                    // For each child state
-                    for (const std::string& childState : childNode.states) {
-                        double messageValue = 0.0;
-                        
-                        // Sum over all node states
-                        for (size_t nodeStateIdx = 0; nodeStateIdx < node.states.size(); ++nodeStateIdx) {
-                            const std::string& nodeState = node.states[nodeStateIdx];
-                            
-                            // Build parent states for conditional probability
-                            std::map<std::string, std::string> parentStates;
-                            for (const std::string& parentId : node.parentIds) {
-                                if (evidence.find(parentId) != evidence.end()) {
-                                    parentStates[parentId] = evidence.at(parentId);
-                                } else if (parentMessages.find(parentId) != parentMessages.end()) {
-                                    // Use most likely parent state from message
-                                    double maxProb = 0.0;
-                                    std::string maxState = nodes.at(parentId).states[0];
-                                    for (const auto& msgPair : parentMessages.at(parentId)) {
-                                        if (msgPair.second > maxProb) {
-                                            maxProb = msgPair.second;
-                                            maxState = msgPair.first;
-                                        }
-                                    }
-                                    parentStates[parentId] = maxState;
-                                } else {
-                                    parentStates[parentId] = nodes.at(parentId).states[0];
-                                }
-                            }
-                            
-                            double condProb = getConditionalProbability(nodeId, nodeState, parentStates);
-                            
-                            // Multiply by parent messages
-                            double parentProduct = 1.0;
-                            for (const auto& parentMsgPair : parentMessages) {
-                                if (parentMsgPair.second.find(parentStates[parentMsgPair.first]) != 
-                                    parentMsgPair.second.end()) {
-                                    parentProduct *= parentMsgPair.second.at(parentStates[parentMsgPair.first]);
-                                }
-                            }
-                            
-                            messageValue += condProb * parentProduct;
-                        }
-                        
-                        messageToChild[childState] = messageValue;
-                    }
-                    
-                    // Normalize message
-                    double sum = 0.0;
-                    for (const auto& msgPair : messageToChild) {
-                        sum += msgPair.second;
-                    }
-                    if (sum > 1e-10) {
-                        for (auto& msgPair : messageToChild) {
-                            msgPair.second /= sum;
-                        }
-                    }
-                    
-                    std::pair<std::string, std::string> key(nodeId, childId);
-                    messages[key] = messageToChild;
+            for (int k = static_cast<int>(parents.size()) - 1; k >= 0; --k) {
+                if (++parentStates[k] < net.cardinality(parents[k])) {
+                    break;
                 }
+                parentStates[k] = 0;
             }
         }
     }
 
     /**
-     * Compute beliefs from messages
+     * Evidence indicator times the product of a node's incoming lambda messages
+     * @param skipEdge Child edge left out of the product (-1 for none)
+     * @param lambda Output, one value per state of v
      */
-    void computeBeliefs(const std::map<std::pair<std::string, std::string>, 
-                                     std::map<std::string, double>>& messages,
-                      std::map<std::string, std::map<std::string, double>>& beliefs,
-                      const std::map<std::string, std::string>& evidence) const {
-        for (const auto& pair : nodes) {
-            const std::string& nodeId = pair.first;
-            const Node& node = pair.second;
-            
-            // Skip observed nodes
-            if (evidence.find(nodeId) != evidence.end()) {
-                continue;
-            }
-            
-            // Initialize belief from prior if available
-            if (cpts.find(nodeId) != cpts.end() && node.parentIds.empty()) {
-                const ConditionalProbabilityTable& cpt = cpts.at(nodeId);
-                for (size_t i = 0; i < node.states.size(); ++i) {
-                    beliefs[nodeId][node.states[i]] = cpt.getProbability({}, i);
-                }
-            }
-            
-            // Multiply by messages from parents
-            for (const std::string& parentId : node.parentIds) {
-                std::pair<std::string, std::string> key(parentId, nodeId);
-                if (messages.find(key) != messages.end()) {
-                    for (const std::string& state : node.states) {
-                        if (messages.at(key).find(state) != messages.at(key).end()) {
-                            beliefs[nodeId][state] *= messages.at(key).at(state);
-                        }
-                    }
-                }
-            }
-            
-            // Multiply by messages from children
-            for (const auto& childPair : nodes) {
-                if (childPair.second.hasParent(nodeId)) {
-                    std::pair<std::string, std::string> key(nodeId, childPair.first);
-                    if (messages.find(key) != messages.end()) {
-                        for (const std::string& state : node.states) {
-                            if (messages.at(key).find(state) != messages.at(key).end()) {
-                                beliefs[nodeId][state] *= messages.at(key).at(state);
-                            }
-                        }
-                    }
-                }
-            }
-            
-            // Normalize beliefs
-            double sum = 0.0;
-            for (const auto& beliefPair : beliefs[nodeId]) {
-                sum += beliefPair.second;
-            }
-            if (sum > 1e-10) {
-                for (auto& beliefPair : beliefs[nodeId]) {
-                    beliefPair.second /= sum;
+    void lambdaProduct(const CompiledNetwork& net,
+                       const std::vector<int>& evidenceState,
+                       const PearlMessages& messages,
+                       int v,
+                       long skipEdge,
+                       double* lambda) const {
+        size_t card = net.cardinality(v);
+        for (size_t s = 0; s < card; ++s) {
+            lambda[s] = (evidenceState[v] != -1 && static_cast<int>(s) != evidenceState[v]) ? 0.0 : 1.0;
+        }
+        kernels::withCardinality(card, [&](auto fixed) {
+            for (size_t e : net.childEdges(v)) {
+                if (static_cast<long>(e) != skipEdge) {
+                    kernels::multiplyInto<decltype(fixed)::value>(lambda, messages.store.lambda(e), card);
                 }
             }
-        }
+        });
     }
 
     /**
-     * Trace influence paths through the network
+     * Causal support of a node: sum_u P(x | u) prod_k pi_{U_k->X}(u_k)
+     * @param support Output, one value per state of v (unnormalized)
      */
-    void traceInfluencePaths(const std::map<std::pair<std::string, std::string>, 
-                                           std::map<std::string, double>>& /*messages*/,
-                            const std::map<std::string, std::map<std::string, double>>& beliefs,
-                            const std::vector<std::string>& queryNodes,
-                            const std::map<std::string, std::string>& evidence,
-                            std::vector<InfluenceTrace>& traces) const {
-        traces.clear();
-        
-        // For each evidence node, trace influence to query nodes
-        for (const auto& evidencePair : evidence) {
-            const std::string& evidenceNode = evidencePair.first;
-            
-            for (const std::string& queryNode : queryNodes) {
-                if (evidenceNode == queryNode) {
-                    continue;  // Skip self-influence
-                }
-                
-                // Find paths from evidence to query
-                std::vector<std::vector<std::string>> paths;
-                findPaths(evidenceNode, queryNode, std::vector<std::string>(), paths);
-                
-                // For each path, compute influence
-                for (const auto& path : paths) {
-                    InfluenceTrace trace;
-                    trace.sourceNode = evidenceNode;
-                    trace.targetNode = queryNode;
-                    
-                    // Build path string
-                    std::ostringstream pathStream;
-                    pathStream << evidenceNode;
-                    for (size_t i = 1; i < path.size(); ++i) {
-                        pathStream << "->" << path[i];
-                    }
-                    trace.path = pathStream.str();
-                    
-                    // Compute influence strength
-                    double totalInfluence = 0.0;
-                    if (beliefs.find(queryNode) != beliefs.end()) {
-                        for (const auto& beliefPair : beliefs.at(queryNode)) {
-                            totalInfluence += beliefPair.second;
-                        }
-                        totalInfluence /= static_cast<double>(beliefs.at(queryNode).size());
-                    }
-                    trace.influenceStrength = totalInfluence;
-                    
-                    // Compute per-state influence
-                    if (beliefs.find(queryNode) != beliefs.end()) {
-                        for (const auto& beliefPair : beliefs.at(queryNode)) {
-                            trace.stateInfluences[beliefPair.first] = beliefPair.second;
-                        }
-                    }
-                    
-                    traces.push_back(trace);
-                }
+    void causalSupport(const CompiledNetwork& net, PearlMessages& messages, int v, double* support) const {
+        const double* table = net.denseCPT(v, messages.expanded);
+        size_t card = net.cardinality(v);
+        double* weights = messages.weights.data();
+        rowWeights(net, messages, v, -1, weights);
+        kernels::withCardinality(card, [&](auto fixed) {
+            kernels::causalSupport<decltype(fixed)::value>(table, weights, net.cptSize(v) / card, card, support);
+        });
+    }
+
+    /**
+     * Normalize a message in place, leaving zero or non-finite mass
+     * unchanged as Factor does; any positive mass is normalized
+     */
+    static void normalizeMessage(double* message, size_t length) {
+        double sum = 0.0;
+        for (size_t i = 0; i < length; ++i) {
+            sum += message[i];
+        }
+        if (!DoublePolicy::isNegligible(sum)) {
+            for (size_t i = 0; i < length; ++i) {
+                message[i] /= sum;
             }
         }
     }
 
     /**
-     * Find all paths from source to target
+     * Store a computed message if it differs from the current one
+     * @return True if the message changed
      */
-    void findPaths(const std::string& source,
-                  const std::string& target,
-                  std::vector<std::string> currentPath,
-                  std::vector<std::vector<std::string>>& allPaths) const {
-        currentPath.push_back(source);
-        
-        if (source == target) {
-            allPaths.push_back(currentPath);
-            return;
+    static bool updateMessage(const double* message, size_t length, const double* current, double* target) {
+        if (std::equal(message, message + length, current)) {
+            return false;
         }
-        
-        // Find children of source
-        for (const auto& pair : nodes) {
-            if (pair.second.hasParent(source)) {
-                // Check if already in path (avoid cycles)
-                bool inPath = false;
-                for (const std::string& nodeInPath : currentPath) {
-                    if (nodeInPath == pair.first) {
-                        inPath = true;
-                        break;
-                    }
-                }
-                if (!inPath) {
-                    findPaths(pair.first, target, currentPath, allPaths);
-                }
+        std::copy(message, message + length, target);
+        return true;
+    }
+
+    /**
+     * Upward pass: lambda messages from children to parents
+     * lambda_{X->U_k}(u_k) = sum_x lambda_X(x) sum_{u : u_k} P(x | u) prod_{l != k} pi_{U_l->X}(u_l),
+     * summing over every co-parent configuration.
+     * @return True if any message changed
+     */
+    bool upwardPass(const CompiledNetwork& net,
+                    const std::vector<int>& evidenceState,
+                    PearlMessages& messages) const {
+        LBN_PHASE("upwardPass");
+        bool changed = false;
+        for (int v = static_cast<int>(net.numNodes()) - 1; v >= 0; --v) {
+            ArrayView<int> parents = net.parents(v);
+            if (parents.empty()) {
+                continue;
+            }
+            const double* table = net.denseCPT(v, messages.expanded);
+            size_t card = net.cardinality(v);
+            size_t numRows = net.cptSize(v) / card;
+            double* lambda = messages.lambda.data();
+            lambdaProduct(net, evidenceState, messages, v, -1, lambda);
+
+            // Row likelihood: sum_x P(x | row) lambda_X(x)
+            double* rowLikelihood = messages.rowLikelihood.data();
+            kernels::withCardinality(card, [&](auto fixed) {
+                kernels::rowLikelihoods<decltype(fixed)::value>(table, lambda, numRows, card, rowLikelihood);
+            });
+
+            ArrayView<size_t> strides = net.strides(v);
+            size_t firstEdge = net.getParentOffsets()[v];
+            double* weights = messages.weights.data();
+            double* message = messages.message.data();
+            for (size_t k = 0; k < parents.size(); ++k) {
+                rowWeights(net, messages, v, static_cast<int>(k), weights);
+                size_t parentCard = net.cardinality(parents[k]);
+                size_t rowStride = strides[k] / card;
+                kernels::withCardinality(parentCard, [&](auto fixed) {
+                    kernels::accumulateParent<decltype(fixed)::value>(weights, rowLikelihood, numRows, parentCard,
+                                                                      rowStride, message);
+                });
+                normalizeMessage(message, parentCard);
+                size_t e = firstEdge + k;
+                changed = updateMessage(message, parentCard, messages.store.lambda(e),
+                                        messages.store.writeLambda(e)) || changed;
             }
+            LBN_COUNT(MessagesSent, parents.size());
+        }
+        return changed;
+    }
+
+    /**
+     * Downward pass: pi messages from parents to children
+     * pi_X(x) = sum_u P(x | u) prod_k pi_{U_k->X}(u_k), and each child C
+     * receives pi_{X->C}(x) = pi_X(x) times every other incoming lambda.
+     * @return True if any message changed
+     */
+    bool downwardPass(const CompiledNetwork& net,
+                      const std::vector<int>& evidenceState,
+                      PearlMessages& messages) const {
+        LBN_PHASE("downwardPass");
+        bool changed = false;
+        for (size_t v = 0; v < net.numNodes(); ++v) {
+            int var = static_cast<int>(v);
+            if (net.childEdges(var).empty()) {
+                continue;
+            }
+            size_t card = net.cardinality(var);
+
+            // Causal support summed over every parent configuration
+            double* support = messages.support.data();
+            causalSupport(net, messages, var, support);
+
+            double* message = messages.message.data();
+            for (size_t e : net.childEdges(var)) {
+                lambdaProduct(net, evidenceState, messages, var, static_cast<long>(e), message);
+                kernels::withCardinality(card, [&](auto fixed) {
+                    kernels::multiplyInto<decltype(fixed)::value>(message, support, card);
+                });
+                normalizeMessage(message, card);
+                changed = updateMessage(message, card, messages.store.pi(e), messages.store.writePi(e)) || changed;
+            }
+            LBN_COUNT(MessagesSent, net.childEdges(var).size());
+        }
+        return changed;
+    }
+
+    /**
+     * Compute the lambda message of an edge from the current messages
+     * @param e Edge ID (child -> parent)
+     * @param out Output, over the parent's states (must not be a scratch buffer)
+     */
+    void computeLambdaMessage(const CompiledNetwork& net,
+                              const std::vector<int>& evidenceState,
+                              PearlMessages& messages,
+                              size_t e,
+                              double* out) const {
+        int v = messages.edgeChild[e];
+        size_t k = e - net.getParentOffsets()[v];
+        const double* table = net.denseCPT(v, messages.expanded);
+        size_t card = net.cardinality(v);
+        size_t numRows = net.cptSize(v) / card;
+        double* lambda = messages.lambda.data();
+        lambdaProduct(net, evidenceState, messages, v, -1, lambda);
+        double* weights = messages.weights.data();
+        rowWeights(net, messages, v, static_cast<int>(k), weights);
+        double* rowLikelihood = messages.rowLikelihood.data();
+        kernels::withCardinality(card, [&](auto fixed) {
+            kernels::rowLikelihoods<decltype(fixed)::value>(table, lambda, numRows, card, rowLikelihood);
+        });
+        size_t parentCard = net.cardinality(net.parents(v)[k]);
+        size_t rowStride = net.strides(v)[k] / card;
+        kernels::withCardinality(parentCard, [&](auto fixed) {
+            kernels::accumulateParent<decltype(fixed)::value>(weights, rowLikelihood, numRows, parentCard, rowStride,
+                                                              out);
+        });
+        normalizeMessage(out, parentCard);
+    }
+
+    /**
+     * Compute the pi message of an edge from the current messages
+     * @param e Edge ID (parent -> child)
+     * @param out Output, over the parent's states (must not be a scratch buffer)
+     */
+    void computePiMessage(const CompiledNetwork& net,
+                          const std::vector<int>& evidenceState,
+                          PearlMessages& messages,
+                          size_t e,
+                          double* out) const {
+        int u = net.getParentIndices()[e];
+        size_t card = net.cardinality(u);
+        double* support = messages.support.data();
+        causalSupport(net, messages, u, support);
+        lambdaProduct(net, evidenceState, messages, u, static_cast<long>(e), out);
+        kernels::withCardinality(card, [&](auto fixed) {
+            kernels::multiplyInto<decltype(fixed)::value>(out, support, card);
+        });
+        normalizeMessage(out, card);
+    }
+
+    /**
+     * Compute message m (lambda of edge m, or pi of edge m - numEdges) into
+     * the back buffer, damped towards the current message
+     * @return Largest absolute change the message would make
+     */
+    double computePending(const CompiledNetwork& net,
+                          const std::vector<int>& evidenceState,
+                          double damping,
+                          PearlMessages& messages,
+                          size_t m) const {
+        size_t numEdges = messages.store.numEdges();
+        size_t e = (m < numEdges) ? m : m - numEdges;
+        double* pending;
+        const double* current;
+        if (m < numEdges) {
+            pending = messages.store.writeLambda(e);
+            current = messages.store.lambda(e);
+            computeLambdaMessage(net, evidenceState, messages, e, pending);
+        } else {
+            pending = messages.store.writePi(e);
+            current = messages.store.pi(e);
+            computePiMessage(net, evidenceState, messages, e, pending);
+        }
+        LBN_COUNT(MessagesSent, 1);
+        double residual = 0.0;
+        for (size_t s = 0; s < messages.store.length(e); ++s) {
+            pending[s] = (1.0 - damping) * pending[s] + damping * current[s];
+            residual = std::max(residual, std::fabs(pending[s] - current[s]));
         }
+        return residual;
     }
 
     /**
-     * Find all reverse paths from target to source (following parent relationships)
+     * Flooding schedule: every message is recomputed from the previous sweep
      */
-    void findReversePaths(const std::string& source,
-                         const std::string& target,
-                         std::vector<std::string> currentPath,
-                         std::vector<std::vector<std::string>>& allPaths) const {
-        currentPath.push_back(source);
-        
-        if (source == target) {
-            allPaths.push_back(currentPath);
+    void runFlooding(const CompiledNetwork& net,
+                     const std::vector<int>& evidenceState,
+                     const LoopyOptions& options,
+                     PearlMessages& messages,
+                     LoopyResult& result) const {
+        LBN_PHASE("loopySweeps");
+        size_t numMessages = 2 * messages.store.numEdges();
+        if (numMessages == 0) {
+            result.converged = true;
             return;
         }
-        
-        // Find parents of source (reverse direction)
-        if (nodes.find(source) != nodes.end()) {
-            const Node& node = nodes.at(source);
-            for (const std::string& parentId : node.parentIds) {
-                // Check if already in path (avoid cycles)
-                bool inPath = false;
-                for (const std::string& nodeInPath : currentPath) {
-                    if (nodeInPath == parentId) {
-                        inPath = true;
-                        break;
-                    }
-                }
-                if (!inPath) {
-                    findReversePaths(parentId, target, currentPath, allPaths);
-                }
+        while (result.iterations < options.maxIterations) {
+            QueryControl::checkpoint(result.iterations, options.maxIterations);
+            double sweepResidual = 0.0;
+            for (size_t m = 0; m < numMessages; ++m) {
+                sweepResidual = std::max(sweepResidual,
+                                         computePending(net, evidenceState, options.damping, messages, m));
+            }
+            messages.store.swapBuffers();
+            ++result.iterations;
+            result.messageUpdates += numMessages;
+            result.maxResidual = sweepResidual;
+            if (sweepResidual <= options.tolerance) {
+                result.converged = true;
+                break;
             }
         }
     }
 
-public:
     /**
-     * Reverse Belief Propagation with Lossless Tracing
-     * Propagates beliefs from effects (children) to causes (parents),
-     * tracing how probabilities flow backwards through the network.
-     * 
-     * This is particularly useful for diagnostic reasoning: given
-     * observed effects, infer the probabilities of their causes.
-     * 
-     * @param queryNodes Nodes to query (typically causes/parents)
-     * @param evidence Map of observed node IDs to their states (typically effects/children)
-     * @param traceInfluence If true, trace reverse influence paths
-     * @return Pair of (beliefs, reverse influence traces)
+     * Residual schedule: repeatedly send the message whose pending update is
+     * largest, then refresh the pending updates of the messages it feeds
      */
-    std::pair<std::map<std::string, std::map<std::string, double>>, 
-              std::vector<InfluenceTrace>>
-    reverseBeliefPropagation(const std::vector<std::string>& queryNodes,
-                            const std::map<std::string, std::string>& evidence,
-                            bool traceInfluence = true) const {
-        
-        // Beliefs: node -> state -> probability
-        std::map<std::string, std::map<std::string, double>> beliefs;
-        std::vector<InfluenceTrace> reverseInfluenceTraces;
-        
-        // Initialize beliefs
-        for (const auto& pair : nodes) {
-            const std::string& nodeId = pair.first;
-            const Node& node = pair.second;
-            
-            // If node is in evidence, set belief to 1.0 for observed state
-            if (evidence.find(nodeId) != evidence.end()) {
-                std::string observedState = evidence.at(nodeId);
-                for (const std::string& state : node.states) {
-                    beliefs[nodeId][state] = (state == observedState) ? 1.0 : 0.0;
-                }
+    void runResidual(const CompiledNetwork& net,
+                     const std::vector<int>& evidenceState,
+                     const LoopyOptions& options,
+                     PearlMessages& messages,
+                     LoopyResult& result) const {
+        LBN_PHASE("loopySweeps");
+        size_t numEdges = messages.store.numEdges();
+        size_t numMessages = 2 * numEdges;
+        // Pending change per message, and the messages ordered by it
+        std::vector<double> residual(numMessages, 0.0);
+        std::set<std::pair<double, size_t>> queue;
+        for (size_t m = 0; m < numMessages; ++m) {
+            residual[m] = computePending(net, evidenceState, options.damping, messages, m);
+            queue.emplace(residual[m], m);
+        }
+        auto refresh = [&](size_t m) {
+            queue.erase(std::make_pair(residual[m], m));
+            residual[m] = computePending(net, evidenceState, options.damping, messages, m);
+            queue.emplace(residual[m], m);
+        };
+
+        size_t budget = options.maxIterations * numMessages;
+        while (!queue.empty() && queue.rbegin()->first > options.tolerance && result.messageUpdates < budget) {
+            if (result.messageUpdates % numMessages == 0) {
+                QueryControl::checkpoint(result.messageUpdates, budget);
+            }
+            size_t m = queue.rbegin()->second;
+            size_t e = (m < numEdges) ? m : m - numEdges;
+            if (m < numEdges) {
+                messages.store.publishLambda(e);
             } else {
-                // Initialize with prior if available, otherwise uniform
-                if (cpts.find(nodeId) != cpts.end() && node.parentIds.empty()) {
-                    const ConditionalProbabilityTable& cpt = cpts.at(nodeId);
-                    for (size_t i = 0; i < node.states.size(); ++i) {
-                        beliefs[nodeId][node.states[i]] = cpt.getProbability({}, i);
-                    }
-                } else {
-                    double uniformProb = 1.0 / static_cast<double>(node.states.size());
-                    for (const std::string& state : node.states) {
-                        beliefs[nodeId][state] = uniformProb;
-                    }
+                messages.store.publishPi(e);
+            }
+            queue.erase(std::make_pair(residual[m], m));
+            residual[m] = 0.0;
+            queue.emplace(0.0, m);
+            ++result.messageUpdates;
+
+            // A lambda into u feeds u's other messages; a pi into x feeds x's
+            int target = (m < numEdges) ? net.getParentIndices()[e] : messages.edgeChild[e];
+            for (size_t f = net.getParentOffsets()[target]; f < net.getParentOffsets()[target + 1]; ++f) {
+                if (m < numEdges || f != e) {
+                    refresh(f);
+                }
+            }
+            for (size_t g : net.childEdges(target)) {
+                if (m >= numEdges || g != e) {
+                    refresh(numEdges + g);
                 }
             }
         }
-        
-        // Reverse message passing structure
-        // Messages: (from, to) -> message probabilities
-        std::map<std::pair<std::string, std::string>, 
-                 std::map<std::string, double>> reverseMessages;
-        
-        // Initialize reverse messages from evidence nodes
-        initializeReverseMessages(reverseMessages, evidence);
-        
-        // Reverse upward pass: from evidence nodes (children) to parents
-        reverseUpwardPass(reverseMessages, evidence);
-        
-        // Reverse downward pass: from parents to other children
-        reverseDownwardPass(reverseMessages, evidence);
-        
-        // Compute beliefs from reverse messages
-        computeReverseBeliefs(reverseMessages, beliefs, evidence);
-        
-        // Trace reverse influence if requested
-        if (traceInfluence) {
-            traceReverseInfluencePaths(reverseMessages, beliefs, queryNodes, evidence, reverseInfluenceTraces);
-        }
-        
-        return std::make_pair(beliefs, reverseInfluenceTraces);
+        result.iterations = (result.messageUpdates + numMessages - 1) / std::max<size_t>(numMessages, 1);
+        result.maxResidual = queue.empty() ? 0.0 : queue.rbegin()->first;
+        result.converged = result.maxResidual <= options.tolerance;
     }
 
-private:
     /**
-     * Initialize reverse messages from evidence nodes
-     */
-    void initializeReverseMessages(std::map<std::pair<std::string, std::string>, 
-                                           std::map<std::string, double>>& reverseMessages,
-                                  const std::map<std::string, std::string>& evidence) const {
-        // For each evidence node, send messages to its parents
-        for (const auto& evidencePair : evidence) {
-            const std::string& evidenceNode = evidencePair.first;
-            const std::string& observedState = evidencePair.second;
-            
-            if (nodes.find(evidenceNode) == nodes.end()) {
-                continue;
+     * How far a normalized message is from uniform
+     * @return Total variation distance to the uniform message, scaled to [0, 1]
+     */
+    static double informativeness(const double* message, size_t length) {
+        if (length < 2) {
+            return 0.0;
+        }
+        double uniform = 1.0 / static_cast<double>(length);
+        double distance = 0.0;
+        for (size_t s = 0; s < length; ++s) {
+            distance += std::fabs(message[s] - uniform);
+        }
+        return std::min(1.0, 0.5 * distance / (1.0 - uniform));
+    }
+
+    /**
+     * Best-first search for the strongest directed influence paths
+     * Partial paths are kept as a tree of steps (each step points to the
+     * step it extends), so extending a path copies nothing; a directed
+     * path in a DAG cannot revisit a node. Edge weights are at most 1, so
+     * paths leave the frontier strongest first and the first paths that
+     * reach the target are the strongest ones.
+     * @param messages Converged Pearl messages (scratch buffers are reused)
+     * @param options Paths per pair and search budgets
+     * @param reverse Follow parents and lambda messages instead of children and pi messages
+     * @return Traces, pair by pair, strongest first
+     */
+    std::vector<InfluenceTrace> traceInfluencePaths(PearlMessages& messages,
+                                                    const std::vector<std::string>& queryNodes,
+                                                    const std::map<std::string, std::string>& evidence,
+                                                    const TraceOptions& options,
+                                                    bool reverse) const {
+        LBN_PHASE("traceInfluence");
+        std::shared_ptr<const CompiledNetwork> net = compile();
+        std::vector<int> evidenceState = resolveEvidence(*net, evidence);
+        const MessageStore& store = messages.store;
+        std::vector<double> weight(store.numEdges());
+        for (size_t e = 0; e < weight.size(); ++e) {
+            weight[e] = informativeness(reverse ? store.lambda(e) : store.pi(e), store.length(e));
+        }
+
+        struct Step {
+            int node;
+            long previous;     // Step this one extends (-1 at the source)
+            size_t edge;       // Edge taken to reach node
+            double strength;   // Product of the edge weights so far
+        };
+        std::vector<Step> steps;
+        auto weaker = [&steps](long a, long b) {
+            return steps[a].strength < steps[b].strength ||
+                   (steps[a].strength == steps[b].strength && a > b);
+        };
+        auto start = std::chrono::steady_clock::now();
+        auto overBudget = [&](size_t expansions) {
+            if (expansions >= options.maxExpansions) {
+                return true;
             }
-            
-            const Node& evidenceNodeObj = nodes.at(evidenceNode);
-            
-            // Send message to each parent
-            for (const std::string& parentId : evidenceNodeObj.parentIds) {
-                if (nodes.find(parentId) == nodes.end()) {
+            return options.timeLimit > 0.0 && expansions % 256 == 0 &&
+                   std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= options.timeLimit;
+        };
+
+        std::vector<InfluenceTrace> traces;
+        size_t expansions = 0;
+        bool exhausted = false;
+        for (auto evidenceIt = evidence.begin(); evidenceIt != evidence.end() && !exhausted; ++evidenceIt) {
+            int source = net->indexOf(evidenceIt->first);
+            std::vector<bool> active = net->activeTrails(source, evidenceState);
+            for (const std::string& queryNode : queryNodes) {
+                int target = net->indexOf(queryNode);
+                // Bayes-ball precheck: no active trail, no influence
+                if (target == -1 || target == source || evidenceState[target] != -1 || !active[target]) {
                     continue;
                 }
-                
-                const Node& parentNode = nodes.at(parentId);
-                std::map<std::string, double> messageToParent;
-                
-                // For each parent state, compute reverse message
-                for (const std::string& parentState : parentNode.states) {
-                    double messageValue = 0.0;
-                    
-                    // Sum over all evidence node states
-                    for (size_t evidenceStateIdx = 0; evidenceStateIdx < evidenceNodeObj.states.size(); ++evidenceStateIdx) {
-                        const std::string& evidenceState = evidenceNodeObj.states[evidenceStateIdx];
-                        
-                        // Get conditional probability P(evidenceState | parentState)
-                        std::map<std::string, std::string> parentStates;
-                        parentStates[parentId] = parentState;
-                        
-                        // Add other parents if any
-                        for (const std::string& otherParentId : evidenceNodeObj.parentIds) {
-                            if (otherParentId != parentId) {
-                                // Use prior or uniform for other parents
-                                if (cpts.find(otherParentId) != cpts.end() && 
-                                    nodes.at(otherParentId).parentIds.empty()) {
-                                    const ConditionalProbabilityTable& otherCPT = cpts.at(otherParentId);
-                                    // Use most likely state
-                                    double maxProb = 0.0;
-                                    size_t maxIdx = 0;
-                                    for (size_t i = 0; i < nodes.at(otherParentId).states.size(); ++i) {
-                                        double prob = otherCPT.getProbability({}, i);
-                                        if (prob > maxProb) {
-                                            maxProb = prob;
-                                            maxIdx = i;
-                                        }
-                                    }
-                                    parentStates[otherParentId] = nodes.at(otherParentId).states[maxIdx];
-                                } else {
-                                    parentStates[otherParentId] = nodes.at(otherParentId).states[0];
-                                }
-                            }
-                        }
-                        
-                        double condProb = getConditionalProbability(evidenceNode, evidenceState, parentStates);
-                        
-                        // Weight by observed state (if this is the observed state, use full weight)
-                        double weight = (evidenceState == observedState) ? 1.0 : 0.0;
-                        
-                        messageValue += condProb * weight;
-                    }
-                    
-                    messageToParent[parentState] = messageValue;
-                }
-                
-                // Normalize message
-                double sum = 0.0;
-                for (const auto& msgPair : messageToParent) {
-                    sum += msgPair.second;
+                if (traces.size() >= options.maxPaths) {
+                    exhausted = true;
+                    break;
                 }
-                if (sum > 1e-10) {
-                    for (auto& msgPair : messageToParent) {
-                        msgPair.second /= sum;
+                // Downward paths only pass through ancestors of the target, upward ones through descendants
+                std::vector<bool> leadsTo = reverse
+                    ? EliminationOrdering::ancestralSet(net->getChildOffsets(), net->getChildIndices(), {target})
+                    : EliminationOrdering::ancestralSet(net->getParentOffsets(), net->getParentIndices(), {target});
+                steps.assign(1, Step{source, -1, 0, 1.0});
+                std::priority_queue<long, std::vector<long>, decltype(weaker)> frontier(weaker);
+                frontier.push(0);
+                size_t found = 0;
+                while (!frontier.empty() && found < options.pathsPerPair && traces.size() < options.maxPaths) {
+                    if (overBudget(expansions)) {
+                        exhausted = true;
+                        break;
                     }
-                } else {
-                    // If sum is zero, use uniform
-                    double uniform = 1.0 / static_cast<double>(messageToParent.size());
-                    for (auto& msgPair : messageToParent) {
-                        msgPair.second = uniform;
+                    ++expansions;
+                    long current = frontier.top();
+                    frontier.pop();
+                    int v = steps[current].node;
+                    double strength = steps[current].strength;
+                    if (v == target) {
+                        traces.push_back(makeTrace(*net, messages, steps, current, reverse));
+                        ++found;
+                        continue;
+                    }
+                    auto extend = [&](int next, size_t e) {
+                        // Observed nodes block a directed trail
+                        if (leadsTo[next] && (next == target || evidenceState[next] == -1)) {
+                            steps.push_back(Step{next, current, e, strength * weight[e]});
+                            frontier.push(static_cast<long>(steps.size()) - 1);
+                        }
+                    };
+                    if (reverse) {
+                        for (size_t e = net->getParentOffsets()[v]; e < net->getParentOffsets()[v + 1]; ++e) {
+                            extend(net->getParentIndices()[e], e);
+                        }
+                    } else {
+                        ArrayView<int> children = net->children(v);
+                        ArrayView<size_t> edges = net->childEdges(v);
+                        for (size_t k = 0; k < children.size(); ++k) {
+                            extend(children[k], edges[k]);
+                        }
                     }
                 }
-                
-                std::pair<std::string, std::string> key(evidenceNode, parentId);
-                reverseMessages[key] = messageToParent;
+                if (exhausted) {
+                    break;
+                }
             }
         }
+        return traces;
     }
 
     /**
-     * Reverse upward pass: propagate messages from children to parents
+     * Build the trace of a path found by traceInfluencePaths
+     * @param steps Search tree
+     * @param last Step at the target
+     * @param reverse Whether the path follows parents
      */
-    void reverseUpwardPass(std::map<std::pair<std::string, std::string>, 
-                                   std::map<std::string, double>>& reverseMessages,
-                          const std::map<std::string, std::string>& evidence) const {
-        // Process nodes in reverse topological order (children first)
-        std::vector<std::string> reverseOrder = nodeOrder;
-        std::reverse(reverseOrder.begin(), reverseOrder.end());
-        
-        for (const std::string& nodeId : reverseOrder) {
-            if (evidence.find(nodeId) != evidence.end()) {
-                continue;  // Skip evidence nodes (already processed)
+    template <typename Step>
+    InfluenceTrace makeTrace(const CompiledNetwork& net, PearlMessages& messages,
+                             const std::vector<Step>& steps, long last, bool reverse) const {
+        std::vector<int> path;
+        for (long s = last; s != -1; s = steps[s].previous) {
+            path.push_back(steps[s].node);
+        }
+        std::reverse(path.begin(), path.end());
+        InfluenceTrace trace;
+        trace.sourceNode = net.nodeId(path.front());
+        trace.targetNode = net.nodeId(path.back());
+        trace.path = trace.sourceNode;
+        for (size_t i = 1; i < path.size(); ++i) {
+            trace.path += (reverse ? "<-" : "->") + net.nodeId(path[i]);
+        }
+        trace.influenceStrength = steps[last].strength;
+
+        // What reaches the target: its incoming lambda message upwards, its causal support downwards
+        int target = path.back();
+        size_t card = net.cardinality(target);
+        std::vector<double> influence(card);
+        if (reverse) {
+            const double* lambda = messages.store.lambda(steps[last].edge);
+            influence.assign(lambda, lambda + card);
+        } else {
+            causalSupport(net, messages, target, influence.data());
+            normalizeMessage(influence.data(), card);
+        }
+        for (size_t x = 0; x < card; ++x) {
+            trace.stateInfluences[net.states(target)[x]] = influence[x];
+        }
+        return trace;
+    }
+
+    /**
+     * Replace the model with the contents of a compiled snapshot
+     * The snapshot is installed as the current one, so inference runs on it
+     * directly; node indices are topological, which gives the node order.
+     * CPTs are not copied: they stay in the snapshot until a node's CPT is
+     * replaced, or until the structure changes and the maps are needed to
+     * compile afresh (see materializeCPTs).
+     * @param net Compiled network
+     */
+    void loadSnapshot(std::shared_ptr<const CompiledNetwork> net) {
+        std::map<std::string, Node> loadedNodes;
+        std::vector<std::string> loadedOrder;
+        for (size_t v = 0; v < net->numNodes(); ++v) {
+            int i = static_cast<int>(v);
+            Node node(net->nodeName(i), net->states(i));
+            for (int p : net->parents(i)) {
+                node.addParent(net->nodeId(p));
+            }
+            // CPT dimensions follow the node's sorted parent set
+            if (!std::equal(node.parentIds.begin(), node.parentIds.end(),
+                            net->parents(i).begin(), net->parents(i).end(), [&](const std::string& id, int p) { return id == net->nodeId(p); })) {
+                throw std::runtime_error("Parents of node " + net->nodeId(i) + " are not in CPT order");
+            }
+            loadedNodes.emplace(net->nodeId(i), std::move(node));
+            loadedOrder.push_back(net->nodeId(i));
+        }
+        nodes = std::move(loadedNodes);
+        cpts.clear();
+        cptModels.clear();
+        mappedModel = net;
+        for (const std::string& id : loadedOrder) {
+            for (const std::string& parentId : nodes.at(id).parentIds) {
+                nodes.at(parentId).addChild(id);
             }
-            
-            const Node& node = nodes.at(nodeId);
-            if (cpts.find(nodeId) == cpts.end()) {
+        }
+        rankNodes(loadedOrder);
+        batchOpen = false;
+        std::atomic_store(&junctionTree, std::shared_ptr<const JunctionTree>());
+        snapshots.update([&](const std::shared_ptr<const CompiledNetwork>&) { return net; });
+    }
+
+    /**
+     * Add the CPTs still read from the loaded model file to a CPT map
+     * Nodes that were given a CPT or a CPT model since the load, or that no
+     * longer exist, are skipped.
+     * @param target Map to add copies to
+     */
+    void addMappedCPTs(std::map<std::string, ConditionalProbabilityTable>& target) const {
+        if (!mappedModel) {
+            return;
+        }
+        const CompiledNetwork& net = *mappedModel;
+        for (size_t v = 0; v < net.numNodes(); ++v) {
+            int i = static_cast<int>(v);
+            const std::string& nodeId = net.nodeId(i);
+            if (net.getCPTStatus(i) != CompiledNetwork::CPTStatus::Valid || nodes.count(nodeId) == 0 ||
+                cpts.count(nodeId) != 0 || cptModels.count(nodeId) != 0) {
                 continue;
             }
-            
-            // Collect messages from children
-            std::map<std::string, std::map<std::string, double>> childMessages;
-            for (const auto& childPair : nodes) {
-                if (childPair.second.hasParent(nodeId)) {
-                    std::pair<std::string, std::string> key(childPair.first, nodeId);
-                    if (reverseMessages.find(key) != reverseMessages.end()) {
-                        childMessages[childPair.first] = reverseMessages[key];
-                    }
-                }
+            std::vector<size_t> dims;
+            for (int p : net.parents(i)) {
+                dims.push_back(net.cardinality(p));
             }
-            
-            // Send message to each parent
-            for (const std::string& parentId : node.parentIds) {
-                if (evidence.find(parentId) != evidence.end()) {
-                    continue;  // Skip observed parents
-                }
-                
-                std::map<std::string, double> messageToParent;
-                const Node& parentNode = nodes.at(parentId);
-                
-                // For each parent state
-                for (const std::string& parentState : parentNode.states) {
-                    double messageValue = 0.0;
-                    
-                    // Sum over all node states
-                    for (size_t nodeStateIdx = 0; nodeStateIdx < node.states.size(); ++nodeStateIdx) {
-                        const std::string& nodeState = node.states[nodeStateIdx];
-                        
-                        // Get conditional probability
-                        std::map<std::string, std::string> parentStates;
-                        parentStates[parentId] = parentState;
-                        
-                        // Add other parents
-                        for (const std::string& otherParentId : node.parentIds) {
-                            if (otherParentId != parentId) {
-                                if (evidence.find(otherParentId) != evidence.end()) {
-                                    parentStates[otherParentId] = evidence.at(otherParentId);
-                                } else {
-                                    parentStates[otherParentId] = nodes.at(otherParentId).states[0];
-                                }
-                            }
-                        }
-                        
-                        double condProb = getConditionalProbability(nodeId, nodeState, parentStates);
-                        
-                        // Multiply by messages from children
-                        double childProduct = 1.0;
-                        for (const auto& childMsgPair : childMessages) {
-                            if (childMsgPair.second.find(nodeState) != childMsgPair.second.end()) {
-                                childProduct *= childMsgPair.second.at(nodeState);
-                            }
-                        }
-                        
-                        messageValue += condProb * childProduct;
+            dims.push_back(net.cardinality(i));
+            target.emplace(nodeId, ConditionalProbabilityTable(dims, net.cpt(i)));
+        }
+    }
+
+    /**
+     * Copy the CPTs still read from the loaded model file into the maps,
+     * before a snapshot is compiled from the maps
+     */
+    void materializeCPTs() {
+        addMappedCPTs(cpts);
+        mappedModel.reset();
+    }
+
+    /**
+     * Drop the compiled snapshot after a structural model change
+     */
+    void invalidateSnapshot() {
+        materializeCPTs();
+        snapshots.invalidate();
+        std::atomic_store(&junctionTree, std::shared_ptr<const JunctionTree>());
+    }
+
+    // Derived snapshots owning more memory blocks than this are compiled afresh
+    static constexpr size_t kMaxSnapshotBlocks = 32;
+
+    /**
+     * Apply a CPT change under the writer lock and publish the next version
+     * The change updates the source maps and lists its replacements against
+     * the current snapshot, from which the next one is derived with shared
+     * CPT storage. Once derived snapshots hold too many small blocks (or no
+     * snapshot is built) the next one is compiled from the maps instead.
+     * @param change Callable (updates, current snapshot or null)
+     */
+    template <typename Change>
+    void publishCPTs(Change change) {
+        snapshots.update([&](const std::shared_ptr<const CompiledNetwork>& current) {
+            std::vector<CompiledNetwork::CPTUpdate> updates;
+            change(updates, current.get());
+            if (!current) {
+                return std::shared_ptr<const CompiledNetwork>();
+            }
+            if (current->storageBlocks() >= kMaxSnapshotBlocks) {
+                materializeCPTs();
+                return std::make_shared<const CompiledNetwork>(nodes, cpts, topologicalSort(), cptModels);
+            }
+            return current->withCPTs(updates);
+        });
+    }
+
+    /**
+     * Snapshot pinned by a query running on this thread (a stack, one entry
+     * per nested query scope)
+     */
+    struct SnapshotPin {
+        const BayesianNetwork* owner;
+        std::shared_ptr<const ModelSnapshot> snapshot;
+        const SnapshotPin* previous;
+    };
+
+    static const SnapshotPin*& pinnedSnapshot() {
+        static thread_local const SnapshotPin* pin = nullptr;
+        return pin;
+    }
+
+    /**
+     * QueryScope pins the current snapshot on this thread for its lifetime,
+     * so every step of a query (planning, calibration, cache lookups) sees
+     * one model version even while CPT updates are published
+     */
+    class QueryScope {
+    private:
+        SnapshotPin pin;
+
+    public:
+        explicit QueryScope(const BayesianNetwork& network) : QueryScope(network, network.snapshot()) {}
+
+        /**
+         * Pin a given snapshot (e.g. the one current when a query was submitted)
+         */
+        QueryScope(const BayesianNetwork& network, std::shared_ptr<const ModelSnapshot> snapshot)
+            : pin{&network, std::move(snapshot), pinnedSnapshot()} {
+            pinnedSnapshot() = &pin;
+        }
+
+        ~QueryScope() {
+            pinnedSnapshot() = pin.previous;
+        }
+
+        QueryScope(const QueryScope&) = delete;
+        QueryScope& operator=(const QueryScope&) = delete;
+
+        /**
+         * Get the pinned model version
+         */
+        uint64_t version() const {
+            return pin.snapshot->version;
+        }
+    };
+
+    /**
+     * Resolve evidence to a state index per variable
+     * @param net Compiled network
+     * @param evidence Map of observed node IDs to their states
+     * @return Observed state per variable, or -1
+     */
+    static std::vector<int> resolveEvidence(const CompiledNetwork& net,
+                                            const std::map<std::string, std::string>& evidence) {
+        std::vector<int> evidenceState(net.numNodes(), -1);
+        for (const auto& pair : evidence) {
+            int var = net.requireIndex(pair.first);
+            int stateIdx = net.stateIndex(var, pair.second);
+            if (stateIdx == -1) {
+                throw std::runtime_error("Invalid state for node " + pair.first);
+            }
+            evidenceState[var] = stateIdx;
+        }
+        return evidenceState;
+    }
+
+    /**
+     * Resolve a query into dense indices, reduce the network to the nodes
+     * it needs and order the eliminations
+     * @param queryNodes Nodes to query
+     * @param evidence Map of observed node IDs to their states
+     * @param allowDecomposition Whether noisy-MAX nodes may be decomposed
+     *                           (their factors hold negative values)
+     * @param relevance Requisite nodes for results normalized over the
+     *                  query, ancestral ones for unnormalized results
+     * @return Elimination plan shared by inference and cost estimation
+     */
+    EliminationPlan planElimination(const std::vector<std::string>& queryNodes,
+                                    const std::map<std::string, std::string>& evidence,
+                                    bool allowDecomposition = true,
+                                    Relevance relevance = Relevance::Requisite) const {
+        LBN_PHASE("planElimination");
+        EliminationPlan plan;
+        plan.net = compile();
+        const CompiledNetwork& net = *plan.net;
+        size_t numVars = net.numNodes();
+
+        // Resolve query variables (duplicates are ignored)
+        std::vector<int> queryVars;
+        plan.isQuery.assign(numVars, false);
+        for (const std::string& nodeId : queryNodes) {
+            int var = net.requireIndex(nodeId);
+            if (!plan.isQuery[var]) {
+                plan.isQuery[var] = true;
+                queryVars.push_back(var);
+            }
+        }
+
+        // Resolve evidence to state indices and keep only the nodes needed
+        plan.evidenceState = resolveEvidence(net, evidence);
+        plan.relevant = RelevantSubnetwork::build(relevance, plan.net, queryVars, plan.evidenceState);
+
+        // Decomposed noisy-MAX nodes get an auxiliary variable numbered after
+        // the nodes; it is never observed and is always eliminated
+        plan.auxiliary.assign(numVars, -1);
+        plan.cardinalities = net.getCardinalities();
+        for (int var : plan.relevant.nodes()) {
+            if (allowDecomposition && net.isDecomposable(var)) {
+                plan.auxiliary[var] = static_cast<int>(plan.cardinalities.size());
+                plan.cardinalities.push_back(net.cardinality(var));
+            }
+        }
+        plan.isQuery.resize(plan.cardinalities.size(), false);
+        plan.evidenceState.resize(plan.cardinalities.size(), -1);
+        orderEliminations(plan);
+        return plan;
+    }
+
+    /**
+     * Order a plan's eliminations: every relevant variable that is neither
+     * observed nor queried, and every auxiliary variable
+     * @param plan Elimination plan (relevance and auxiliary variables set),
+     *             whose order is replaced
+     */
+    void orderEliminations(EliminationPlan& plan) const {
+        const CompiledNetwork& net = *plan.net;
+        size_t numVars = net.numNodes();
+
+        // Order eliminations on the moral graph with evidence removed
+        std::vector<bool> inGraph(numVars, false);
+        std::vector<int> toEliminate;
+        for (int var : plan.relevant.nodes()) {
+            bool observed = plan.evidenceState[var] != -1;
+            inGraph[var] = !observed || plan.isQuery[var];
+            if (!observed && !plan.isQuery[var]) {
+                toEliminate.push_back(var);
+            }
+        }
+        if (plan.cardinalities.size() == numVars) {
+            MoralGraph graph = MoralGraph::fromCSR(net.getParentOffsets(), net.getParentIndices(), inGraph);
+            plan.order = EliminationOrdering::compute(graph, plan.cardinalities, toEliminate,
+                                                      eliminationHeuristic);
+            return;
+        }
+        // With decompositions, order on the interaction graph of the factors
+        for (size_t aux = numVars; aux < plan.cardinalities.size(); ++aux) {
+            toEliminate.push_back(static_cast<int>(aux));
+        }
+        MoralGraph graph = MoralGraph::fromScopes(plan.cardinalities.size(), reducedScopes(plan));
+        plan.order = EliminationOrdering::compute(graph, plan.cardinalities, toEliminate,
+                                                  eliminationHeuristic);
+    }
+
+    /**
+     * Scopes of a plan's initial factors after reduction by non-query evidence
+     * @param plan Elimination plan (relevance and auxiliary variables set)
+     * @return One scope per factor variableElimination builds
+     */
+    static std::vector<std::vector<int>> reducedScopes(const EliminationPlan& plan) {
+        const CompiledNetwork& net = *plan.net;
+        std::vector<std::vector<int>> scopes;
+        for (int var : plan.relevant.nodes()) {
+            for (const std::vector<int>& family : net.familyScopes(var, plan.auxiliary[var])) {
+                std::vector<int> scope;
+                for (int v : family) {
+                    if (plan.evidenceState[v] == -1 || plan.isQuery[v]) {
+                        scope.push_back(v);
                     }
-                    
-                    messageToParent[parentState] = messageValue;
-                }
-                
-                // Normalize message
-                double sum = 0.0;
-                for (const auto& msgPair : messageToParent) {
-                    sum += msgPair.second;
                 }
-                if (sum > 1e-10) {
-                    for (auto& msgPair : messageToParent) {
-                        msgPair.second /= sum;
+                scopes.push_back(scope);
+            }
+        }
+        return scopes;
+    }
+
+    /**
+     * Plan shared by every case of a fast-mode batch
+     * Observed nodes are planned as query variables so they stay relevant,
+     * then turned back into ordinary variables: each case enters its
+     * evidence as indicators, and the observed nodes are eliminated in the
+     * normal order like any other non-query variable.
+     * @param net Compiled network
+     * @param queryNodes Nodes to query
+     * @param observedAnywhere Whether any case observes each variable
+     * @return Elimination plan for the whole batch
+     */
+    EliminationPlan planFastBatch(const CompiledNetwork& net,
+                                  const std::vector<std::string>& queryNodes,
+                                  const std::vector<bool>& observedAnywhere) const {
+        std::vector<bool> isQuery(net.numNodes(), false);
+        for (const std::string& nodeId : queryNodes) {
+            isQuery[net.requireIndex(nodeId)] = true;
+        }
+        std::vector<std::string> extendedQuery = queryNodes;
+        std::vector<int> observed;
+        for (size_t v = 0; v < net.numNodes(); ++v) {
+            if (observedAnywhere[v] && !isQuery[v]) {
+                extendedQuery.push_back(net.nodeId(static_cast<int>(v)));
+                observed.push_back(static_cast<int>(v));
+            }
+        }
+        EliminationPlan plan = planElimination(extendedQuery, Evidence());
+        if (!observed.empty()) {
+            for (int v : observed) {
+                plan.isQuery[v] = false;
+            }
+            orderEliminations(plan);
+        }
+        return plan;
+    }
+
+    /**
+     * Build a plan's factors, apply the evidence and eliminate under a policy
+     * Evidence is applied to the double factors, which is an exact
+     * selection, before they are converted to Policy values.
+     * @param plan Elimination plan
+     * @return Unnormalized joint over the query variables
+     */
+    template <typename Policy>
+    BasicFactor<Policy> eliminate(const EliminationPlan& plan) const {
+        LBN_PHASE("eliminate");
+        std::vector<BasicFactor<Policy>> factors = planFactors<Policy>(plan);
+
+        // Sum out every unobserved non-query variable
+        for (size_t i = 0; i < plan.order.size(); ++i) {
+            QueryControl::checkpoint(i, plan.order.size());
+            eliminateVariable(factors, plan.order[i], BasicFactor<Policy>(), threadPool.get());
+        }
+        QueryControl::checkpoint(plan.order.size(), plan.order.size());
+
+        // Remaining factors only mention query variables
+        BasicFactor<Policy> joint;
+        for (const BasicFactor<Policy>& factor : factors) {
+            joint = joint.product(factor, threadPool.get());
+        }
+        return joint;
+    }
+
+    /**
+     * Build the factors of every relevant CPT of a plan, with the evidence
+     * applied (reduced away, or kept as a point mass on query variables)
+     * @param plan Elimination plan
+     * @return Initial factors, converted to Policy values
+     */
+    template <typename Policy>
+    std::vector<BasicFactor<Policy>> planFactors(const EliminationPlan& plan) const {
+        std::vector<BasicFactor<Policy>> factors;
+        for (int var : plan.relevant.nodes()) {
+            for (Factor& factor : plan.net->familyFactors(var, plan.auxiliary[var])) {
+                std::vector<int> scope = factor.getVariables();
+                for (int v : scope) {
+                    if (plan.evidenceState[v] == -1) {
+                        continue;
                     }
-                } else {
-                    double uniform = 1.0 / static_cast<double>(messageToParent.size());
-                    for (auto& msgPair : messageToParent) {
-                        msgPair.second = uniform;
+                    if (plan.isQuery[v]) {
+                        // Observed query variables stay in scope as a point mass
+                        factor.applyIndicator(v, static_cast<size_t>(plan.evidenceState[v]));
+                    } else {
+                        factor = factor.reduce(v, static_cast<size_t>(plan.evidenceState[v]));
                     }
                 }
-                
-                std::pair<std::string, std::string> key(nodeId, parentId);
-                reverseMessages[key] = messageToParent;
+                factors.push_back(convertFactor<Policy>(std::move(factor)));
             }
         }
+        return factors;
     }
 
     /**
-     * Reverse downward pass: propagate messages from parents to other children
+     * Replace every CPT with learned tables
+     * @param net Compiled network the tables are laid out for
+     * @param tables Row-major probabilities per variable
      */
-    void reverseDownwardPass(std::map<std::pair<std::string, std::string>, 
-                                     std::map<std::string, double>>& reverseMessages,
-                             const std::map<std::string, std::string>& evidence) const {
-        // Process nodes in topological order (parents first)
-        for (const std::string& nodeId : nodeOrder) {
-            if (evidence.find(nodeId) != evidence.end()) {
-                continue;  // Skip evidence nodes
-            }
-            
-            const Node& node = nodes.at(nodeId);
-            if (cpts.find(nodeId) == cpts.end()) {
-                continue;
+    void setLearnedCPTs(const CompiledNetwork& net, const std::vector<std::vector<double>>& tables) {
+        // Every table is published in one version
+        publishCPTs([&](std::vector<CompiledNetwork::CPTUpdate>& updates, const CompiledNetwork* current) {
+            for (size_t v = 0; v < net.numNodes(); ++v) {
+                std::vector<size_t> dims;
+                for (int parent : net.parents(static_cast<int>(v))) {
+                    dims.push_back(net.cardinality(parent));
+                }
+                dims.push_back(net.cardinality(static_cast<int>(v)));
+                const std::string& nodeId = net.nodeId(static_cast<int>(v));
+                cpts[nodeId] = ConditionalProbabilityTable(dims, tables[v].data());
+                cptModels.erase(nodeId);
+                if (current != nullptr) {
+                    updates.push_back(CompiledNetwork::CPTUpdate{current->requireIndex(nodeId), &cpts.at(nodeId), nullptr});
+                }
             }
-            
-            // Collect messages from parents
-            std::map<std::string, std::map<std::string, double>> parentMessages;
-            for (const std::string& parentId : node.parentIds) {
-                std::pair<std::string, std::string> key(nodeId, parentId);
-                if (reverseMessages.find(key) != reverseMessages.end()) {
-                    parentMessages[parentId] = reverseMessages[key];
+        });
+    }
+
+    /**
+     * E-step for one chunk: add the expected counts of every family with a
+     * missing member
+     * Rows are grouped by the missing members of a family, and each group
+     * is answered by one batchQuery over those members.
+     * @param net Compiled network the rows refer to
+     * @param states Rows of state indices, -1 when missing
+     * @param rows Number of rows
+     * @param stats Counts to add to
+     */
+    void addExpectedCounts(const CompiledNetwork& net, const std::vector<int>& states, size_t rows,
+                           SufficientStatistics& stats) const {
+        LBN_PHASE("expectedCounts");
+        size_t numVars = net.numNodes();
+
+        // Rows needing each query, with the families each row completes
+        struct Group {
+            std::vector<size_t> rows;
+            std::vector<std::vector<int>> families;
+        };
+        std::map<std::vector<int>, Group> groups;
+        std::vector<int> missing;
+        for (size_t r = 0; r < rows; ++r) {
+            const int* row = &states[r * numVars];
+            for (size_t v = 0; v < numVars; ++v) {
+                missing.clear();
+                if (row[v] < 0) {
+                    missing.push_back(static_cast<int>(v));
+                }
+                for (int parent : net.parents(static_cast<int>(v))) {
+                    if (row[parent] < 0) {
+                        missing.push_back(parent);
+                    }
+                }
+                if (missing.empty()) {
+                    continue;
+                }
+                std::sort(missing.begin(), missing.end());
+                Group& group = groups[missing];
+                if (group.rows.empty() || group.rows.back() != r) {
+                    group.rows.push_back(r);
+                    group.families.emplace_back();
                 }
+                group.families.back().push_back(static_cast<int>(v));
             }
-            
-            // Send message to each child
-            for (const auto& childPair : nodes) {
-                if (childPair.second.hasParent(nodeId)) {
-                    const std::string& childId = childPair.first;
-                    if (evidence.find(childId) != evidence.end()) {
-                        continue;  // Skip observed children
+        }
+
+        // Observed states of a row as evidence, built once per row
+        std::vector<Evidence> rowEvidence(rows);
+        std::vector<bool> built(rows, false);
+        auto evidenceOf = [&](size_t r) -> const Evidence& {
+            if (!built[r]) {
+                for (size_t v = 0; v < numVars; ++v) {
+                    int state = states[r * numVars + v];
+                    if (state >= 0) {
+                        rowEvidence[r][net.nodeId(static_cast<int>(v))] = net.states(static_cast<int>(v))[state];
                     }
-                    
-                    std::map<std::string, double> messageToChild;
-                    const Node& childNode = nodes.at(childId);
-                    
-                    // For each child state
-                    for (const std::string& childState : childNode.states) {
-                        double messageValue = 0.0;
-                        
-                        // Sum over all node states
-                        for (size_t nodeStateIdx = 0; nodeStateIdx < node.states.size(); ++nodeStateIdx) {
-                            const std::string& nodeState = node.states[nodeStateIdx];
-                            
-                            // Build parent states
-                            std::map<std::string, std::string> parentStates;
-                            for (const std::string& parentId : node.parentIds) {
-                                if (evidence.find(parentId) != evidence.end()) {
-                                    parentStates[parentId] = evidence.at(parentId);
-                                } else if (parentMessages.find(parentId) != parentMessages.end()) {
-                                    // Use most likely parent state
-                                    double maxProb = 0.0;
-                                    std::string maxState = nodes.at(parentId).states[0];
-                                    for (const auto& msgPair : parentMessages.at(parentId)) {
-                                        if (msgPair.second > maxProb) {
-                                            maxProb = msgPair.second;
-                                            maxState = msgPair.first;
-                                        }
-                                    }
-                                    parentStates[parentId] = maxState;
-                                } else {
-                                    parentStates[parentId] = nodes.at(parentId).states[0];
-                                }
-                            }
-                            
-                            double condProb = getConditionalProbability(nodeId, nodeState, parentStates);
-                            
-                            // Multiply by parent messages
-                            double parentProduct = 1.0;
-                            for (const auto& parentMsgPair : parentMessages) {
-                                if (parentMsgPair.second.find(parentStates[parentMsgPair.first]) != 
-                                    parentMsgPair.second.end()) {
-                                    parentProduct *= parentMsgPair.second.at(parentStates[parentMsgPair.first]);
-                                }
-                            }
-                            
-                            messageValue += condProb * parentProduct;
-                        }
-                        
-                        messageToChild[childState] = messageValue;
+                }
+                built[r] = true;
+            }
+            return rowEvidence[r];
+        };
+
+        std::vector<int> completed(numVars);
+        for (const auto& pair : groups) {
+            const std::vector<int>& query = pair.first;
+            const Group& group = pair.second;
+            std::vector<std::string> queryNodes;
+            for (int var : query) {
+                queryNodes.push_back(net.nodeId(var));
+            }
+            std::vector<Evidence> cases;
+            cases.reserve(group.rows.size());
+            for (size_t r : group.rows) {
+                cases.push_back(evidenceOf(r));
+            }
+            std::vector<std::map<std::map<std::string, std::string>, double>> posteriors =
+                batchQuery(cases, queryNodes);
+
+            for (size_t i = 0; i < group.rows.size(); ++i) {
+                // Posteriors are normalized; a row impossible under the
+                // current CPTs has an all-zero posterior and adds nothing
+                std::copy(&states[group.rows[i] * numVars], &states[group.rows[i] * numVars] + numVars,
+                          completed.begin());
+                for (const auto& entry : posteriors[i]) {
+                    if (entry.second == 0.0) {
+                        continue;
                     }
-                    
-                    // Normalize message
-                    double sum = 0.0;
-                    for (const auto& msgPair : messageToChild) {
-                        sum += msgPair.second;
+                    for (int var : query) {
+                        completed[var] = net.stateIndex(var, entry.first.at(net.nodeId(var)));
                     }
-                    if (sum > 1e-10) {
-                        for (auto& msgPair : messageToChild) {
-                            msgPair.second /= sum;
-                        }
-                    } else {
-                        double uniform = 1.0 / static_cast<double>(messageToChild.size());
-                        for (auto& msgPair : messageToChild) {
-                            msgPair.second = uniform;
-                        }
+                    for (int v : group.families[i]) {
+                        stats.family(v)[stats.entry(v, completed.data())] += entry.second;
                     }
-                    
-                    std::pair<std::string, std::string> key(nodeId, childId);
-                    reverseMessages[key] = messageToChild;
                 }
             }
         }
     }
 
     /**
-     * Compute beliefs from reverse messages
+     * Resolve a MAP query: sum out the hidden variables in log space and
+     * order the max-eliminations of the MAP variables
+     * Noisy-MAX nodes use their dense tables, as for LogPolicy elimination.
+     * @param mapVars Nodes to explain
+     * @param evidence Map of observed node IDs to their states
+     * @return Factors over the MAP variables, their order and log P(evidence)
      */
-    void computeReverseBeliefs(const std::map<std::pair<std::string, std::string>, 
-                                               std::map<std::string, double>>& reverseMessages,
-                               std::map<std::string, std::map<std::string, double>>& beliefs,
-                               const std::map<std::string, std::string>& evidence) const {
-        for (const auto& pair : nodes) {
-            const std::string& nodeId = pair.first;
-            const Node& node = pair.second;
-            
-            // Skip observed nodes
-            if (evidence.find(nodeId) != evidence.end()) {
+    MaxProductProblem planMaxProduct(const std::vector<std::string>& mapVars, const Evidence& evidence) const {
+        LBN_PHASE("planMaxProduct");
+        EliminationPlan plan = planElimination(mapVars, evidence, LogPolicy::kSigned, Relevance::Ancestral);
+        MaxProductProblem problem;
+        problem.net = plan.net;
+        problem.factors = planFactors<LogPolicy>(plan);
+        for (size_t i = 0; i < plan.order.size(); ++i) {
+            QueryControl::checkpoint(i, plan.order.size());
+            eliminateVariable(problem.factors, plan.order[i], BasicFactor<LogPolicy>(), threadPool.get());
+        }
+
+        // Order the MAP variables on the interaction graph of what is left
+        std::vector<std::vector<int>> scopes;
+        for (const BasicFactor<LogPolicy>& factor : problem.factors) {
+            scopes.push_back(factor.getVariables());
+        }
+        std::vector<int> mapIndices;
+        for (size_t var = 0; var < plan.isQuery.size(); ++var) {
+            if (plan.isQuery[var]) {
+                mapIndices.push_back(static_cast<int>(var));
+            }
+        }
+        problem.order = EliminationOrdering::compute(MoralGraph::fromScopes(plan.cardinalities.size(), scopes),
+                                                     plan.cardinalities, mapIndices, eliminationHeuristic);
+
+        problem.position.assign(plan.cardinalities.size(), -1);
+        for (size_t i = 0; i < problem.order.size(); ++i) {
+            problem.position[problem.order[i]] = static_cast<int>(i);
+        }
+
+        // Summing the MAP variables out of the same factors gives P(evidence)
+        problem.logEvidence = eliminateBuckets(problem, problem.factors, false, nullptr);
+        return problem;
+    }
+
+    /**
+     * Eliminate the MAP variables of a problem in order, bucket by bucket
+     * Each factor waits in the bucket of its earliest variable, so a run
+     * touches every factor once.
+     * @param problem MAP problem (order and positions)
+     * @param factors Factors over MAP variables only
+     * @param maximize Maximize the variables out instead of summing them
+     * @param combined Optional output: the product formed for each variable
+     * @return Natural log of the scalar left once every variable is gone
+     */
+    double eliminateBuckets(const MaxProductProblem& problem,
+                            std::vector<BasicFactor<LogPolicy>> factors,
+                            bool maximize,
+                            std::vector<BasicFactor<LogPolicy>>* combined) const {
+        std::vector<std::vector<BasicFactor<LogPolicy>>> buckets(problem.order.size());
+        double result = LogPolicy::one();
+        auto place = [&](BasicFactor<LogPolicy>&& factor) {
+            int first = -1;
+            for (int v : factor.getVariables()) {
+                int pos = problem.position[v];
+                if (first == -1 || pos < first) {
+                    first = pos;
+                }
+            }
+            if (first == -1) {
+                result = LogPolicy::multiply(result, factor.getValues()[0]);
+            } else {
+                buckets[first].push_back(std::move(factor));
+            }
+        };
+        for (BasicFactor<LogPolicy>& factor : factors) {
+            place(std::move(factor));
+        }
+        if (combined != nullptr) {
+            combined->clear();
+            combined->reserve(problem.order.size());
+        }
+        for (size_t i = 0; i < problem.order.size(); ++i) {
+            QueryControl::checkpoint(i, problem.order.size());
+            int var = problem.order[i];
+            BasicFactor<LogPolicy> product;
+            for (const BasicFactor<LogPolicy>& factor : buckets[i]) {
+                product = product.product(factor, threadPool.get());
+            }
+            buckets[i].clear();
+            if (product.contains(var)) {
+                place(maximize ? product.maximize(var) : product.marginalize(var, threadPool.get()));
+            }
+            if (combined != nullptr) {
+                combined->push_back(std::move(product));
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Max-product elimination with traceback over a constrained subspace
+     * Each combined factor is kept until the traceback, so memory matches
+     * the sum-product run over the same order.
+     * @param problem MAP problem
+     * @param allowed Allowed states per position of problem.order (an empty
+     *                entry leaves the variable unconstrained)
+     * @param states Output: best state per variable index (MAP variables only)
+     * @return Natural log of the best P(assignment, evidence), or
+     *         LogPolicy::zero() if the subspace has no possible assignment
+     */
+    double maxProduct(const MaxProductProblem& problem,
+                      const std::vector<std::vector<bool>>& allowed,
+                      std::vector<size_t>& states) const {
+        LBN_PHASE("maxProduct");
+        const CompiledNetwork& net = *problem.net;
+        std::vector<BasicFactor<LogPolicy>> factors = problem.factors;
+        for (size_t i = 0; i < allowed.size(); ++i) {
+            if (allowed[i].empty()) {
+                continue;
+            }
+            std::vector<double> mask;
+            for (bool ok : allowed[i]) {
+                mask.push_back(ok ? LogPolicy::one() : LogPolicy::zero());
+            }
+            int var = problem.order[i];
+            factors.emplace_back(std::vector<int>{var}, std::vector<size_t>{net.cardinality(var)}, mask);
+        }
+
+        // Maximize out the MAP variables, keeping each combined factor
+        std::vector<BasicFactor<LogPolicy>> combined;
+        double best = eliminateBuckets(problem, std::move(factors), true, &combined);
+        if (best == LogPolicy::zero()) {
+            return best;
+        }
+
+        // Traceback: each variable takes its argmax given the variables
+        // maximized after it, which are already assigned
+        states.assign(net.numNodes(), 0);
+        for (size_t i = problem.order.size(); i-- > 0;) {
+            const BasicFactor<LogPolicy>& factor = combined[i];
+            int var = problem.order[i];
+            int pos = factor.position(var);
+            if (pos == -1) {
                 continue;
             }
-            
-            // Initialize belief from prior if available
-            if (cpts.find(nodeId) != cpts.end() && node.parentIds.empty()) {
-                const ConditionalProbabilityTable& cpt = cpts.at(nodeId);
-                for (size_t i = 0; i < node.states.size(); ++i) {
-                    beliefs[nodeId][node.states[i]] = cpt.getProbability({}, i);
+            const std::vector<int>& scope = factor.getVariables();
+            size_t base = 0;
+            for (size_t j = 0; j < scope.size(); ++j) {
+                if (static_cast<int>(j) != pos) {
+                    base += states[scope[j]] * factor.getStrides()[j];
                 }
             }
-            
-            // Multiply by reverse messages from children
-            for (const auto& childPair : nodes) {
-                if (childPair.second.hasParent(nodeId)) {
-                    std::pair<std::string, std::string> key(childPair.first, nodeId);
-                    if (reverseMessages.find(key) != reverseMessages.end()) {
-                        for (const std::string& state : node.states) {
-                            if (reverseMessages.at(key).find(state) != reverseMessages.at(key).end()) {
-                                beliefs[nodeId][state] *= reverseMessages.at(key).at(state);
-                            }
-                        }
-                    }
+            size_t stride = factor.getStrides()[pos];
+            const std::vector<double>& values = factor.getValues();
+            size_t argmax = 0;
+            for (size_t x = 1; x < factor.getCardinalities()[pos]; ++x) {
+                if (values[base + argmax * stride] < values[base + x * stride]) {
+                    argmax = x;
                 }
             }
-            
-            // Multiply by reverse messages from parents (if any)
-            for (const std::string& parentId : node.parentIds) {
-                std::pair<std::string, std::string> key(nodeId, parentId);
-                if (reverseMessages.find(key) != reverseMessages.end()) {
-                    for (const std::string& state : node.states) {
-                        if (reverseMessages.at(key).find(state) != reverseMessages.at(key).end()) {
-                            beliefs[nodeId][state] *= reverseMessages.at(key).at(state);
-                        }
+            states[var] = argmax;
+        }
+        return best;
+    }
+
+    /**
+     * Convert a double factor to a policy's values (a move for doubles)
+     */
+    template <typename Policy>
+    static BasicFactor<Policy> convertFactor(Factor&& factor) {
+        if constexpr (std::is_same<Policy, DoublePolicy>::value) {
+            return std::move(factor);
+        } else {
+            std::vector<typename Policy::Value> values;
+            values.reserve(factor.size());
+            for (double value : factor.getValues()) {
+                values.push_back(Policy::fromDouble(value));
+            }
+            return BasicFactor<Policy>(factor.getVariables(), factor.getCardinalities(), values);
+        }
+    }
+
+    /**
+     * Run an elimination plan for one block of cases
+     * Evidence on nodes the plan treats as observed non-query variables is
+     * reduced away; any other observed node gets a per-lane indicator.
+     * @param plan Elimination plan shared by the cases
+     * @param caseStates Resolved evidence of every case
+     * @param caseIds Cases of the plan
+     * @param first Position of the block's first case in caseIds
+     * @param lanes Number of cases in the block
+     * @param results Output, indexed by case
+     */
+    void runBatch(const EliminationPlan& plan,
+                  const std::vector<std::vector<int>>& caseStates,
+                  const std::vector<size_t>& caseIds,
+                  size_t first,
+                  size_t lanes,
+                  std::vector<std::map<std::map<std::string, std::string>, double>>& results) const {
+        LBN_PHASE("batchEliminate");
+        const CompiledNetwork& net = *plan.net;
+        auto laneStates = [&](int v) {
+            std::vector<int> states(lanes);
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                states[lane] = caseStates[caseIds[first + lane]][v];
+            }
+            return states;
+        };
+
+        // Same factor construction as variableElimination, per lane
+        std::vector<BatchFactor> factors;
+        for (int var : plan.relevant.nodes()) {
+            for (const Factor& family : net.familyFactors(var, plan.auxiliary[var])) {
+                BatchFactor factor(family, lanes);
+                std::vector<int> scope = factor.getVariables();
+                for (int v : scope) {
+                    if (v >= static_cast<int>(net.numNodes())) {
+                        continue;  // Auxiliary variables are never observed
+                    }
+                    std::vector<int> states = laneStates(v);
+                    if (plan.evidenceState[v] != -1 && !plan.isQuery[v]) {
+                        factor = factor.reduce(v, states);
+                    } else if (std::any_of(states.begin(), states.end(), [](int s) { return s != -1; })) {
+                        factor.applyIndicator(v, states);
                     }
                 }
+                factors.push_back(factor);
             }
-            
-            // Normalize beliefs
-            double sum = 0.0;
-            for (const auto& beliefPair : beliefs[nodeId]) {
-                sum += beliefPair.second;
+        }
+
+        BatchFactor unit(lanes);
+        for (size_t i = 0; i < plan.order.size(); ++i) {
+            QueryControl::checkpoint(i, plan.order.size());
+            eliminateVariable(factors, plan.order[i], unit);
+        }
+        BatchFactor joint = unit;
+        for (const BatchFactor& factor : factors) {
+            joint = joint.product(factor);
+        }
+        joint.normalize();
+
+        // Read out every query assignment for every lane
+        const std::vector<int>& jointVars = joint.getVariables();
+        std::vector<size_t> states(jointVars.size(), 0);
+        for (size_t i = 0; i < joint.size(); ++i) {
+            std::map<std::string, std::string> assignment;
+            for (size_t v = 0; v < jointVars.size(); ++v) {
+                assignment[net.nodeId(jointVars[v])] = net.states(jointVars[v])[states[v]];
+            }
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                results[caseIds[first + lane]][assignment] = joint.value(i, lane);
             }
-            if (sum > 1e-10) {
-                for (auto& beliefPair : beliefs[nodeId]) {
-                    beliefPair.second /= sum;
+            for (int v = static_cast<int>(jointVars.size()) - 1; v >= 0; --v) {
+                if (++states[v] < joint.getCardinalities()[v]) {
+                    break;
                 }
+                states[v] = 0;
             }
         }
     }
 
     /**
-     * Trace reverse influence paths through the network
+     * Multiply all factors mentioning a variable and sum it out
+     * Works on Factor and BatchFactor alike, so batched cases perform the
+     * same operations in the same order as a single case.
+     * @param factors Factor list, updated in place
+     * @param var Variable to eliminate
+     * @param unit Unit factor the product starts from
      */
-    void traceReverseInfluencePaths(const std::map<std::pair<std::string, std::string>, 
-                                                   std::map<std::string, double>>& /*reverseMessages*/,
-                                    const std::map<std::string, std::map<std::string, double>>& beliefs,
-                                    const std::vector<std::string>& queryNodes,
-                                    const std::map<std::string, std::string>& evidence,
-                                    std::vector<InfluenceTrace>& traces) const {
-        traces.clear();
-        
-        // For each evidence node (effect), trace reverse influence to query nodes (causes)
-        for (const auto& evidencePair : evidence) {
-            const std::string& evidenceNode = evidencePair.first;
-            
-            for (const std::string& queryNode : queryNodes) {
-                if (evidenceNode == queryNode) {
-                    continue;  // Skip self-influence
+    template <typename FactorType>
+    static void eliminateVariable(std::vector<FactorType>& factors, int var,
+                                  const FactorType& unit = FactorType(),
+                                  ThreadPool* pool = nullptr) {
+        FactorType combined = unit;
+        bool found = false;
+        // Compact the untouched factors in place, keeping their order
+        size_t kept = 0;
+        for (size_t i = 0; i < factors.size(); ++i) {
+            if (factors[i].contains(var)) {
+                combined = multiply(combined, factors[i], pool);
+                found = true;
+            } else {
+                if (kept != i) {
+                    factors[kept] = std::move(factors[i]);
                 }
-                
-                // Find reverse paths from evidence to query (following parent relationships)
-                std::vector<std::vector<std::string>> reversePaths;
-                findReversePaths(evidenceNode, queryNode, std::vector<std::string>(), reversePaths);
-                
-                // For each reverse path, compute influence
-                for (const auto& path : reversePaths) {
-                    InfluenceTrace trace;
-                    trace.sourceNode = evidenceNode;
-                    trace.targetNode = queryNode;
-                    
-                    // Build reverse path string
-                    std::ostringstream pathStream;
-                    pathStream << evidenceNode;
-                    for (size_t i = 1; i < path.size(); ++i) {
-                        pathStream << "<-" << path[i];  // Use <- to indicate reverse direction
-                    }
-                    trace.path = pathStream.str();
-                    
-                    // Compute reverse influence strength
-                    double totalInfluence = 0.0;
-                    if (beliefs.find(queryNode) != beliefs.end()) {
-                        for (const auto& beliefPair : beliefs.at(queryNode)) {
-                            totalInfluence += beliefPair.second;
-                        }
-                        totalInfluence /= static_cast<double>(beliefs.at(queryNode).size());
-                    }
-                    trace.influenceStrength = totalInfluence;
-                    
-                    // Compute per-state reverse influence
-                    if (beliefs.find(queryNode) != beliefs.end()) {
-                        for (const auto& beliefPair : beliefs.at(queryNode)) {
-                            trace.stateInfluences[beliefPair.first] = beliefPair.second;
-                        }
-                    }
-                    
-                    traces.push_back(trace);
+                ++kept;
+            }
+        }
+        factors.erase(factors.begin() + kept, factors.end());
+        if (found) {
+            factors.push_back(sumOut(combined, var, pool));
+        }
+    }
+
+    /**
+     * Factor product, split across the pool for large results
+     */
+    template <typename Policy>
+    static BasicFactor<Policy> multiply(const BasicFactor<Policy>& a, const BasicFactor<Policy>& b,
+                                        ThreadPool* pool) {
+        return a.product(b, pool);
+    }
+
+    /**
+     * Batch factor product (batches are parallelized across blocks instead)
+     */
+    static BatchFactor multiply(const BatchFactor& a, const BatchFactor& b, ThreadPool*) {
+        return a.product(b);
+    }
+
+    /**
+     * Sum a variable out, split across the pool for large factors
+     */
+    template <typename Policy>
+    static BasicFactor<Policy> sumOut(const BasicFactor<Policy>& factor, int var, ThreadPool* pool) {
+        return factor.marginalize(var, pool);
+    }
+
+    /**
+     * Sum a variable out of a batch factor
+     */
+    static BatchFactor sumOut(const BatchFactor& factor, int var, ThreadPool*) {
+        return factor.marginalize(var);
+    }
+
+public:
+    /**
+     * Reverse Belief Propagation with Lossless Tracing
+     * Propagates beliefs from effects (children) to causes (parents),
+     * tracing how probabilities flow backwards through the network.
+     * 
+     * This is particularly useful for diagnostic reasoning: given
+     * observed effects, infer the probabilities of their causes.
+     * 
+     * @param queryNodes Nodes to query (typically causes/parents)
+     * @param evidence Map of observed node IDs to their states (typically effects/children)
+     * @param traceInfluence If true, trace reverse influence paths (see traceReverseInfluence)
+     * @return Pair of (beliefs, reverse influence traces)
+     */
+    std::pair<std::map<std::string, std::map<std::string, double>>, 
+              std::vector<InfluenceTrace>>
+    reverseBeliefPropagation(const std::vector<std::string>& queryNodes,
+                            const std::map<std::string, std::string>& evidence,
+                            bool traceInfluence = false) const {
+        if (!traceInfluence) {
+            return std::make_pair(computeAllMarginals(evidence), std::vector<InfluenceTrace>());
+        }
+        return cachedQuery<std::pair<std::map<std::string, std::map<std::string, double>>,
+                                     std::vector<InfluenceTrace>>>(
+            ResultCache::Kind::ReverseBeliefPropagation, queryNodes, evidence, [&]() {
+                // Beliefs: node -> state -> probability (exact, from the junction tree)
+                std::map<std::string, std::map<std::string, double>> beliefs = computeAllMarginals(evidence);
+                // Reverse traces follow the lambda half of the exact message schedule
+                return std::make_pair(beliefs, traceReverseInfluence(queryNodes, evidence));
+            });
+    }
+
+    /**
+     * Loopy belief propagation
+     * Runs Pearl's lambda/pi messages on graphs with loops, giving bounded
+     * time approximate marginals where estimateEliminationCost rules out the
+     * exact engines. On a polytree the fixed point is exact.
+     * @param evidence Map of observed node IDs to their states
+     * @param options Schedule, damping, iteration limit and tolerance
+     * @return Beliefs of every node with convergence diagnostics
+     */
+    LoopyResult loopyBeliefPropagation(const std::map<std::string, std::string>& evidence,
+                                       const LoopyOptions& options = LoopyOptions()) const {
+        if (!(options.damping >= 0.0 && options.damping < 1.0)) {
+            throw std::runtime_error("Damping must be in [0, 1)");
+        }
+        if (!(options.tolerance >= 0.0)) {
+            throw std::runtime_error("Tolerance must be non-negative");
+        }
+        std::shared_ptr<const CompiledNetwork> net = compile();
+        std::vector<int> evidenceState = resolveEvidence(*net, evidence);
+        for (size_t v = 0; v < net->numNodes(); ++v) {
+            net->requireCPT(static_cast<int>(v));
+        }
+
+        PearlMessages messages;
+        initializeMessages(*net, messages, true);
+        LoopyResult result;
+        if (options.schedule == LoopySchedule::Flooding) {
+            runFlooding(*net, evidenceState, options, messages, result);
+        } else {
+            runResidual(*net, evidenceState, options, messages, result);
+        }
+
+        // Belief: causal support times evidence and every incoming lambda
+        for (size_t v = 0; v < net->numNodes(); ++v) {
+            int var = static_cast<int>(v);
+            size_t card = net->cardinality(var);
+            double* belief = messages.message.data();
+            causalSupport(*net, messages, var, belief);
+            double* lambda = messages.lambda.data();
+            lambdaProduct(*net, evidenceState, messages, var, -1, lambda);
+            for (size_t x = 0; x < card; ++x) {
+                belief[x] *= lambda[x];
+            }
+            normalizeMessage(belief, card);
+            std::map<std::string, double>& marginal = result.beliefs[net->nodeId(var)];
+            for (size_t x = 0; x < card; ++x) {
+                marginal[net->states(var)[x]] = belief[x];
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Approximate posterior marginals by sampling
+     * Forward sampling, likelihood weighting or Gibbs sampling, drawn in
+     * batches on the thread pool. The estimate only depends on the seed and
+     * the batching options, not on the thread count, and is streamed to the
+     * progress callback after every round.
+     * @param evidence Map of observed node IDs to their states
+     * @param options Method, seed, sample budget, batching and time limit
+     * @param progress Called with the running estimate; returning false stops
+     * @return Final estimate with confidence intervals
+     */
+    SamplingResult sampleMarginals(const std::map<std::string, std::string>& evidence,
+                                   const SamplingOptions& options = SamplingOptions(),
+                                   const std::function<bool(const SamplingResult&)>& progress = nullptr) const {
+        std::shared_ptr<const CompiledNetwork> net = compile();
+        Sampler sampler(net, resolveEvidence(*net, evidence), options);
+        auto named = [&net](const Sampler::Estimate& estimate) {
+            SamplingResult result;
+            for (size_t v = 0; v < net->numNodes(); ++v) {
+                int var = static_cast<int>(v);
+                std::map<std::string, double>& marginal = result.marginals[net->nodeId(var)];
+                std::map<std::string, double>& halfWidth = result.halfWidths[net->nodeId(var)];
+                for (size_t x = 0; x < net->cardinality(var); ++x) {
+                    marginal[net->states(var)[x]] = estimate.marginals[v][x];
+                    halfWidth[net->states(var)[x]] = estimate.halfWidths[v][x];
                 }
             }
+            result.samples = estimate.samples;
+            result.effectiveSamples = estimate.effectiveSamples;
+            result.seconds = estimate.seconds;
+            return result;
+        };
+        std::function<bool(const Sampler::Estimate&)> report;
+        if (progress) {
+            report = [&](const Sampler::Estimate& estimate) { return progress(named(estimate)); };
         }
+        return named(sampler.run(threadPool.get(), report));
     }
 };
 
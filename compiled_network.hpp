@@ -0,0 +1,782 @@
+/*
+ * compiled_network.hpp - Frozen index-based network representation
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements CompiledNetwork, an immutable snapshot of a Bayesian
+ * network in which node IDs and states are dense integers, parents are
+ * stored as a CSR adjacency array, and all dense CPT probabilities live in
+ * one aligned arena; structured CPT models are kept as shared models.
+ * Inference engines run on this snapshot; strings are only used at the API
+ * boundary.
+ */
+
+#ifndef COMPILED_NETWORK_HPP
+#define COMPILED_NETWORK_HPP
+
+// Node structure
+#include "node.hpp"
+// Conditional Probability Table
+#include "cpt.hpp"
+// Structured CPT models
+#include "cpt_model.hpp"
+// Dense factors
+#include "factor.hpp"
+// Vector container
+#include <vector>
+// String operations
+#include <string>
+// Map container
+#include <map>
+// Hash map for ID lookup
+#include <unordered_map>
+// Shared ownership of storage
+#include <memory>
+// Aligned allocation
+#include <new>
+// Memory copy
+#include <cstring>
+// Exception handling
+#include <stdexcept>
+
+/**
+ * ArrayView is a non-owning view of a contiguous array
+ */
+template <typename T>
+class ArrayView {
+private:
+    // First element
+    const T* first;
+    // Number of elements
+    size_t count;
+
+public:
+    /**
+     * Constructor with pointer and length
+     * @param data Pointer to the first element
+     * @param size Number of elements
+     */
+    ArrayView(const T* data = nullptr, size_t size = 0) : first(data), count(size) {}
+
+    const T* begin() const { return first; }
+    const T* end() const { return first + count; }
+    const T* data() const { return first; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return first[i]; }
+};
+
+/**
+ * CompiledNetwork is a frozen, index-based snapshot of a Bayesian network.
+ * Variable indices follow the topological order, so every parent index is
+ * smaller than its child's index.
+ */
+class CompiledNetwork {
+public:
+    // Alignment of the CPT arena and of every CPT block (bytes)
+    static constexpr size_t kAlignment = 64;
+
+    /**
+     * Status of a node's CPT in the snapshot
+     */
+    enum class CPTStatus : unsigned char {
+        Missing,   // No CPT was set
+        Valid,     // CPT matches the node's family
+        Mismatch   // CPT dimensions do not match the family
+    };
+
+private:
+    // Node IDs by index
+    std::vector<std::string> nodeIds;
+    // Node display names by index
+    std::vector<std::string> nodeNames;
+    // Node ID -> index
+    std::unordered_map<std::string, int> indexById;
+    // State names per node
+    std::vector<std::vector<std::string>> stateNames;
+    // Number of states per node
+    std::vector<size_t> cardinalities;
+    // CSR parent array (parents in CPT dimension order)
+    std::vector<size_t> parentOffsets;
+    std::vector<int> parentIndices;
+    // CSR child array (children by increasing index) and, per child entry,
+    // the parent edge linking it back: childEdgeIds[k] indexes parentIndices
+    std::vector<size_t> childOffsets;
+    std::vector<int> childIndices;
+    std::vector<size_t> childEdgeIds;
+    // CSR family strides: numParents + 1 entries per node, node state last
+    std::vector<size_t> strideOffsets;
+    std::vector<size_t> familyStrides;
+    // Per-node CPT block pointer, length and status
+    std::vector<const double*> cptData;
+    std::vector<size_t> cptSizes;
+    std::vector<CPTStatus> cptStatus;
+    // Per-node structured model (null for dense CPTs)
+    std::vector<std::shared_ptr<const CPTModel>> cptModels;
+    // Owners of the memory the CPT blocks point into
+    std::vector<std::shared_ptr<const void>> storage;
+
+    // The binary model loader fills a snapshot from a mapped file
+    friend class ModelFile;
+
+    /**
+     * Allocate a 64-byte aligned array of doubles
+     */
+    static std::shared_ptr<double> allocateArena(size_t count) {
+        if (count == 0) {
+            count = 1;
+        }
+        void* raw = ::operator new(count * sizeof(double), std::align_val_t(kAlignment));
+        return std::shared_ptr<double>(static_cast<double*>(raw), [](double* p) {
+            ::operator delete(p, std::align_val_t(kAlignment));
+        });
+    }
+
+    /**
+     * Build the CSR child index from the parent array
+     * Edges are bucketed by parent in increasing child order, O(V + E).
+     */
+    void buildChildIndex() {
+        size_t numNodes = cardinalities.size();
+        childOffsets.assign(numNodes + 1, 0);
+        for (int p : parentIndices) {
+            ++childOffsets[p + 1];
+        }
+        for (size_t v = 0; v < numNodes; ++v) {
+            childOffsets[v + 1] += childOffsets[v];
+        }
+        childIndices.resize(parentIndices.size());
+        childEdgeIds.resize(parentIndices.size());
+        std::vector<size_t> fill(childOffsets.begin(), childOffsets.end() - 1);
+        for (size_t v = 0; v < numNodes; ++v) {
+            for (size_t e = parentOffsets[v]; e < parentOffsets[v + 1]; ++e) {
+                size_t slot = fill[parentIndices[e]]++;
+                childIndices[slot] = static_cast<int>(v);
+                childEdgeIds[slot] = e;
+            }
+        }
+    }
+
+    /**
+     * Append the family strides of the next node (parents and cardinalities
+     * of the node must already be recorded)
+     * @param v Variable index
+     * @return Number of entries of the node's CPT
+     */
+    size_t appendFamilyStrides(int v) {
+        size_t numParents = parentOffsets[v + 1] - parentOffsets[v];
+        std::vector<size_t> strides(numParents + 1);
+        size_t stride = cardinalities[v];
+        strides[numParents] = 1;
+        for (int d = static_cast<int>(numParents) - 1; d >= 0; --d) {
+            strides[d] = stride;
+            stride *= cardinalities[parentIndices[parentOffsets[v] + d]];
+        }
+        familyStrides.insert(familyStrides.end(), strides.begin(), strides.end());
+        strideOffsets.push_back(familyStrides.size());
+        return stride;
+    }
+
+    /**
+     * Round a double count up to a whole number of aligned blocks
+     */
+    static size_t alignedCount(size_t count) {
+        const size_t perBlock = kAlignment / sizeof(double);
+        return (count + perBlock - 1) / perBlock * perBlock;
+    }
+
+public:
+    /**
+     * Default constructor: empty network
+     */
+    CompiledNetwork() : parentOffsets(1, 0), strideOffsets(1, 0) {}
+
+    /**
+     * Compile a network from its node and CPT maps
+     * @param nodes Map of node ID to Node
+     * @param cpts Map of node ID to CPT
+     * @param order Node IDs in topological order (defines the indices)
+     * @param models Map of node ID to structured CPT model (kept shared,
+     *               never expanded into the arena)
+     */
+    CompiledNetwork(const std::map<std::string, Node>& nodes,
+                    const std::map<std::string, ConditionalProbabilityTable>& cpts,
+                    const std::vector<std::string>& order,
+                    const std::map<std::string, std::shared_ptr<const CPTModel>>& models =
+                        std::map<std::string, std::shared_ptr<const CPTModel>>())
+        : CompiledNetwork() {
+        size_t numNodes = order.size();
+        nodeIds = order;
+        nodeNames.resize(numNodes);
+        stateNames.resize(numNodes);
+        cardinalities.resize(numNodes);
+        cptData.assign(numNodes, nullptr);
+        cptSizes.assign(numNodes, 0);
+        cptStatus.assign(numNodes, CPTStatus::Missing);
+        cptModels.assign(numNodes, nullptr);
+        for (size_t i = 0; i < numNodes; ++i) {
+            indexById[order[i]] = static_cast<int>(i);
+        }
+
+        // Structure: names, states, CSR parents and family strides
+        size_t arenaCount = 0;
+        std::vector<size_t> blockOffsets(numNodes, 0);
+        for (size_t i = 0; i < numNodes; ++i) {
+            const Node& node = nodes.at(order[i]);
+            nodeNames[i] = node.name;
+            stateNames[i] = node.states;
+            cardinalities[i] = node.getNumStates();
+
+            std::vector<size_t> familyCards;
+            for (const std::string& parentId : node.parentIds) {
+                int p = indexById.at(parentId);
+                parentIndices.push_back(p);
+                familyCards.push_back(nodes.at(parentId).getNumStates());
+            }
+            familyCards.push_back(cardinalities[i]);
+            parentOffsets.push_back(parentIndices.size());
+            size_t stride = appendFamilyStrides(static_cast<int>(i));
+
+            auto modelIt = models.find(order[i]);
+            if (modelIt != models.end()) {
+                cptStatus[i] = (modelIt->second->getDimensions() == familyCards) ? CPTStatus::Valid
+                                                                                  : CPTStatus::Mismatch;
+                if (cptStatus[i] == CPTStatus::Valid) {
+                    cptModels[i] = modelIt->second;
+                    cptSizes[i] = stride;
+                }
+                continue;
+            }
+            auto cptIt = cpts.find(order[i]);
+            if (cptIt == cpts.end()) {
+                continue;
+            }
+            if (cptIt->second.getDimensions() != familyCards) {
+                cptStatus[i] = CPTStatus::Mismatch;
+                continue;
+            }
+            cptStatus[i] = CPTStatus::Valid;
+            cptSizes[i] = stride;
+            blockOffsets[i] = arenaCount;
+            arenaCount += alignedCount(stride);
+        }
+
+        // Copy every valid CPT into its aligned block of the arena
+        std::shared_ptr<double> arena = allocateArena(arenaCount);
+        for (size_t i = 0; i < numNodes; ++i) {
+            if (cptStatus[i] != CPTStatus::Valid || cptModels[i]) {
+                continue;
+            }
+            const std::vector<double>& probs = cpts.at(order[i]).getProbabilities();
+            double* block = arena.get() + blockOffsets[i];
+            std::memcpy(block, probs.data(), probs.size() * sizeof(double));
+            cptData[i] = block;
+        }
+        storage.push_back(arena);
+        buildChildIndex();
+    }
+
+    /**
+     * One CPT replacement for withCPTs: a dense table or a structured model
+     */
+    struct CPTUpdate {
+        int node = -1;                                    // Variable index
+        const ConditionalProbabilityTable* table = nullptr; // Dense table (when model is null)
+        std::shared_ptr<const CPTModel> model;            // Structured model
+    };
+
+    /**
+     * Derive a snapshot with some CPTs replaced
+     * The derived snapshot shares every unchanged CPT block, and the owners
+     * of their memory, with this one; only the replaced tables are copied,
+     * into one new aligned block. The index arrays are copied. CPT status
+     * is checked against the family exactly as when compiling.
+     * @param updates Replacements, at most one per node
+     * @return New immutable snapshot
+     */
+    std::shared_ptr<const CompiledNetwork> withCPTs(const std::vector<CPTUpdate>& updates) const {
+        std::shared_ptr<CompiledNetwork> next = std::make_shared<CompiledNetwork>(*this);
+        std::vector<size_t> blockOffsets(updates.size(), 0);
+        size_t arenaCount = 0;
+        for (size_t u = 0; u < updates.size(); ++u) {
+            int v = updates[u].node;
+            if (v < 0 || static_cast<size_t>(v) >= numNodes()) {
+                throw std::runtime_error("CPT update for unknown node index");
+            }
+            std::vector<size_t> familyCards;
+            for (int p : parents(v)) {
+                familyCards.push_back(cardinalities[p]);
+            }
+            familyCards.push_back(cardinalities[v]);
+            size_t stride = 1;
+            for (size_t card : familyCards) {
+                stride *= card;
+            }
+            next->cptData[v] = nullptr;
+            next->cptSizes[v] = 0;
+            next->cptModels[v] = nullptr;
+            const std::vector<size_t>& dims =
+                updates[u].model ? updates[u].model->getDimensions() : updates[u].table->getDimensions();
+            next->cptStatus[v] = (dims == familyCards) ? CPTStatus::Valid : CPTStatus::Mismatch;
+            if (next->cptStatus[v] != CPTStatus::Valid) {
+                continue;
+            }
+            next->cptSizes[v] = stride;
+            if (updates[u].model) {
+                next->cptModels[v] = updates[u].model;
+                continue;
+            }
+            blockOffsets[u] = arenaCount;
+            arenaCount += alignedCount(stride);
+        }
+        if (arenaCount == 0) {
+            return next;
+        }
+        std::shared_ptr<double> arena = allocateArena(arenaCount);
+        for (size_t u = 0; u < updates.size(); ++u) {
+            int v = updates[u].node;
+            if (next->cptStatus[v] != CPTStatus::Valid || updates[u].model) {
+                continue;
+            }
+            const std::vector<double>& probs = updates[u].table->getProbabilities();
+            double* block = arena.get() + blockOffsets[u];
+            std::memcpy(block, probs.data(), probs.size() * sizeof(double));
+            next->cptData[v] = block;
+        }
+        next->storage.push_back(arena);
+        return next;
+    }
+
+    /**
+     * Get number of memory blocks the CPTs point into
+     * Grows by one per derived snapshot; a fresh compile has one.
+     */
+    size_t storageBlocks() const {
+        return storage.size();
+    }
+
+    /**
+     * Check whether another snapshot has the same nodes, states and parents
+     * (its CPTs may differ)
+     * @param other Snapshot to compare with
+     * @return True if indices, cardinalities and the parent CSR match
+     */
+    bool sameStructure(const CompiledNetwork& other) const {
+        return this == &other || (nodeIds == other.nodeIds && cardinalities == other.cardinalities &&
+                                  parentOffsets == other.parentOffsets && parentIndices == other.parentIndices);
+    }
+
+    /**
+     * Get number of nodes
+     * @return Number of variables
+     */
+    size_t numNodes() const {
+        return nodeIds.size();
+    }
+
+    /**
+     * Look up a node index by ID
+     * @param nodeId ID of the node
+     * @return Dense index, or -1 if the node does not exist
+     */
+    int indexOf(const std::string& nodeId) const {
+        auto it = indexById.find(nodeId);
+        return (it != indexById.end()) ? it->second : -1;
+    }
+
+    /**
+     * Look up a node index by ID, throwing if it does not exist
+     * @param nodeId ID of the node
+     * @return Dense index
+     */
+    int requireIndex(const std::string& nodeId) const {
+        int index = indexOf(nodeId);
+        if (index == -1) {
+            throw std::runtime_error("Node " + nodeId + " does not exist");
+        }
+        return index;
+    }
+
+    /**
+     * Get node ID by index
+     * @param v Variable index
+     * @return Node ID
+     */
+    const std::string& nodeId(int v) const {
+        return nodeIds[v];
+    }
+
+    /**
+     * Get node display name by index
+     * @param v Variable index
+     * @return Node name
+     */
+    const std::string& nodeName(int v) const {
+        return nodeNames[v];
+    }
+
+    /**
+     * Get state names of a node
+     * @param v Variable index
+     * @return Vector of state names
+     */
+    const std::vector<std::string>& states(int v) const {
+        return stateNames[v];
+    }
+
+    /**
+     * Look up a state index by name
+     * @param v Variable index
+     * @param stateName Name of the state
+     * @return State index, or -1 if not found
+     */
+    int stateIndex(int v, const std::string& stateName) const {
+        const std::vector<std::string>& names = stateNames[v];
+        for (size_t s = 0; s < names.size(); ++s) {
+            if (names[s] == stateName) {
+                return static_cast<int>(s);
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * Get number of states of a node
+     * @param v Variable index
+     * @return Cardinality
+     */
+    size_t cardinality(int v) const {
+        return cardinalities[v];
+    }
+
+    /**
+     * Get cardinalities of all nodes
+     * @return Vector of cardinalities by index
+     */
+    const std::vector<size_t>& getCardinalities() const {
+        return cardinalities;
+    }
+
+    /**
+     * Get parents of a node in CPT dimension order
+     * @param v Variable index
+     * @return View of parent indices
+     */
+    ArrayView<int> parents(int v) const {
+        return ArrayView<int>(parentIndices.data() + parentOffsets[v],
+                              parentOffsets[v + 1] - parentOffsets[v]);
+    }
+
+    /**
+     * Get CSR row offsets of the parent array
+     * @return numNodes + 1 offsets into getParentIndices()
+     */
+    const std::vector<size_t>& getParentOffsets() const {
+        return parentOffsets;
+    }
+
+    /**
+     * Get the flat CSR parent array
+     * @return Parent indices of all nodes, concatenated
+     */
+    const std::vector<int>& getParentIndices() const {
+        return parentIndices;
+    }
+
+    /**
+     * Get children of a node by increasing index
+     * @param v Variable index
+     * @return View of child indices
+     */
+    ArrayView<int> children(int v) const {
+        return ArrayView<int>(childIndices.data() + childOffsets[v],
+                              childOffsets[v + 1] - childOffsets[v]);
+    }
+
+    /**
+     * Get the parent edges leaving a node, aligned with children(v)
+     * @param v Variable index
+     * @return View of edge ids into getParentIndices()
+     */
+    ArrayView<size_t> childEdges(int v) const {
+        return ArrayView<size_t>(childEdgeIds.data() + childOffsets[v],
+                                 childOffsets[v + 1] - childOffsets[v]);
+    }
+
+    /**
+     * Get CSR row offsets of the child array
+     * @return numNodes + 1 offsets into getChildIndices()
+     */
+    const std::vector<size_t>& getChildOffsets() const {
+        return childOffsets;
+    }
+
+    /**
+     * Get the flat CSR child array
+     * @return Child indices of all nodes, concatenated
+     */
+    const std::vector<int>& getChildIndices() const {
+        return childIndices;
+    }
+
+    /**
+     * Nodes with an active trail to a source given the observed variables
+     * Bayes-ball (Shachter 1998): a ball leaving the source passes through
+     * unobserved nodes, bounces off observed nodes it reaches from a parent
+     * (the collider case) and stops at observed nodes it reaches from a
+     * child. Every node and direction is visited at most once.
+     * @param source Variable index (treated as unobserved)
+     * @param evidenceState Observed state per variable, or -1
+     * @return Mask of the variables the ball visits (source included)
+     */
+    std::vector<bool> activeTrails(int source, const std::vector<int>& evidenceState) const {
+        size_t numVars = numNodes();
+        std::vector<bool> reached(numVars, false);
+        // Visited flags per direction: arrived from a child, arrived from a parent
+        std::vector<bool> fromChild(numVars, false);
+        std::vector<bool> fromParent(numVars, false);
+        std::vector<std::pair<int, bool>> stack(1, std::make_pair(source, true));
+        while (!stack.empty()) {
+            int v = stack.back().first;
+            bool upward = stack.back().second;
+            stack.pop_back();
+            std::vector<bool>& visited = upward ? fromChild : fromParent;
+            if (visited[v]) {
+                continue;
+            }
+            visited[v] = true;
+            reached[v] = true;
+            bool observed = v != source && evidenceState[v] != -1;
+            if (upward && !observed) {
+                for (int p : parents(v)) {
+                    stack.emplace_back(p, true);
+                }
+                for (int c : children(v)) {
+                    stack.emplace_back(c, false);
+                }
+            } else if (!upward) {
+                if (observed) {
+                    for (int p : parents(v)) {
+                        stack.emplace_back(p, true);
+                    }
+                } else {
+                    for (int c : children(v)) {
+                        stack.emplace_back(c, false);
+                    }
+                }
+            }
+        }
+        return reached;
+    }
+
+    /**
+     * Get strides of a node's family (parents in CPT order, then the node)
+     * @param v Variable index
+     * @return View of strides into the node's CPT block
+     */
+    ArrayView<size_t> strides(int v) const {
+        return ArrayView<size_t>(familyStrides.data() + strideOffsets[v],
+                                 strideOffsets[v + 1] - strideOffsets[v]);
+    }
+
+    /**
+     * Get status of a node's CPT
+     * @param v Variable index
+     * @return CPT status
+     */
+    CPTStatus getCPTStatus(int v) const {
+        return cptStatus[v];
+    }
+
+    /**
+     * Get a node's CPT block, throwing if it is unusable
+     * @param v Variable index
+     * @return Pointer to the aligned, row-major CPT block, or nullptr when
+     *         the node has a structured model
+     */
+    const double* requireCPT(int v) const {
+        if (cptStatus[v] == CPTStatus::Missing) {
+            throw std::runtime_error("CPT not set for node " + nodeIds[v]);
+        }
+        if (cptStatus[v] == CPTStatus::Mismatch) {
+            throw std::runtime_error("CPT dimensions do not match structure for node " + nodeIds[v]);
+        }
+        return cptData[v];
+    }
+
+    /**
+     * Get a node's CPT block without checks
+     * @param v Variable index
+     * @return Pointer to the CPT block, or nullptr if not valid or modelled
+     */
+    const double* cpt(int v) const {
+        return cptData[v];
+    }
+
+    /**
+     * Get a node's structured CPT model
+     * @param v Variable index
+     * @return Model, or nullptr for dense (or missing) CPTs
+     */
+    const CPTModel* cptModel(int v) const {
+        return cptModels[v].get();
+    }
+
+    /**
+     * Get a node's CPT as a dense row-major table, throwing if it is unusable
+     * Dense blocks are returned in place; structured models are expanded
+     * into scratch.
+     * @param v Variable index
+     * @param scratch Buffer receiving the expansion of a model
+     * @return Pointer to cptSize(v) probabilities
+     */
+    const double* denseCPT(int v, std::vector<double>& scratch) const {
+        const double* block = requireCPT(v);
+        LBN_COUNT(CptLookups, cptSizes[v]);
+        if (cptModels[v]) {
+            scratch.resize(cptSizes[v]);
+            cptModels[v]->fillTable(scratch.data());
+            block = scratch.data();
+        }
+        return block;
+    }
+
+    /**
+     * Get number of entries of a node's CPT block
+     * @param v Variable index
+     * @return Number of probabilities of the dense table (0 if not valid)
+     */
+    size_t cptSize(int v) const {
+        return cptSizes[v];
+    }
+
+    /**
+     * Conditional probability lookup by state indices (unchecked)
+     * @param v Variable index
+     * @param parentStates State index of each parent, in CPT order
+     * @param state State index of the node
+     * @return P(v = state | parents = parentStates)
+     */
+    double probability(int v, const size_t* parentStates, size_t state) const {
+        LBN_COUNT(CptLookups, 1);
+        if (cptModels[v]) {
+            return cptModels[v]->getProbability(parentStates, state);
+        }
+        const size_t* stride = familyStrides.data() + strideOffsets[v];
+        size_t numParents = parentOffsets[v + 1] - parentOffsets[v];
+        size_t index = state;
+        for (size_t i = 0; i < numParents; ++i) {
+            index += parentStates[i] * stride[i];
+        }
+        return cptData[v][index];
+    }
+
+    /**
+     * Build the factor P(v | parents) over (parents..., v)
+     * Structured models are expanded to the dense table.
+     * @param v Variable index
+     * @return Factor in CPT storage order
+     */
+    Factor cptFactor(int v) const {
+        const double* block = requireCPT(v);
+        LBN_COUNT(CptLookups, cptSizes[v]);
+        std::vector<int> scope(parents(v).begin(), parents(v).end());
+        std::vector<size_t> cards;
+        for (int p : scope) {
+            cards.push_back(cardinalities[p]);
+        }
+        scope.push_back(v);
+        cards.push_back(cardinalities[v]);
+        if (cptModels[v]) {
+            Factor factor(scope, cards);
+            cptModels[v]->fillTable(factor.getValues().data());
+            return factor;
+        }
+        return Factor(scope, cards, std::vector<double>(block, block + cptSizes[v]));
+    }
+
+    /**
+     * Whether a node's CPT is cheaper to use as a noisy-MAX decomposition
+     * The decomposition holds card^2 + sum_i card_i * card entries instead
+     * of the dense card * prod_i card_i, at the price of one auxiliary
+     * variable with the node's cardinality.
+     * @param v Variable index
+     * @return True for noisy-MAX nodes whose decomposition is smaller
+     */
+    bool isDecomposable(int v) const {
+        if (!cptModels[v] || cptModels[v]->getKind() != CPTModel::Kind::NoisyMax) {
+            return false;
+        }
+        double card = static_cast<double>(cardinalities[v]);
+        double dense = card;
+        double decomposed = card * card;
+        for (int p : parents(v)) {
+            dense *= static_cast<double>(cardinalities[p]);
+            decomposed += static_cast<double>(cardinalities[p]) * card;
+        }
+        return decomposed < dense;
+    }
+
+    /**
+     * Scopes of the factors familyFactors(v, aux) returns
+     * @param v Variable index
+     * @param aux Auxiliary variable index, or -1 for the single CPT factor
+     * @return One scope per factor
+     */
+    std::vector<std::vector<int>> familyScopes(int v, int aux) const {
+        std::vector<std::vector<int>> scopes;
+        if (aux == -1) {
+            scopes.emplace_back(parents(v).begin(), parents(v).end());
+            scopes.back().push_back(v);
+            return scopes;
+        }
+        scopes.push_back({v, aux});
+        for (int p : parents(v)) {
+            scopes.push_back({p, aux});
+        }
+        return scopes;
+    }
+
+    /**
+     * Build the factors whose product over aux is P(v | parents)
+     * Without an auxiliary variable this is the single CPT factor. For a
+     * noisy-MAX node it is the additive decomposition of Diez and Galan:
+     * with Y' ranging over the node's levels,
+     *   P(y | x) = sum_y' D(y, y') leak(Y <= y') prod_i P(Z_i <= y' | x_i),
+     * where D(y, y) = 1, D(y, y - 1) = -1 and D is 0 elsewhere. The first
+     * factor, over (v, aux), holds D times the leak; each parent adds one
+     * factor over (parent, aux), so the family never becomes one table.
+     * @param v Variable index
+     * @param aux Auxiliary variable index, or -1 for the single CPT factor
+     * @return Factors in familyScopes(v, aux) order
+     */
+    std::vector<Factor> familyFactors(int v, int aux) const {
+        if (aux == -1) {
+            return std::vector<Factor>(1, cptFactor(v));
+        }
+        requireCPT(v);
+        const NoisyMaxCPT* model = dynamic_cast<const NoisyMaxCPT*>(cptModels[v].get());
+        if (model == nullptr) {
+            throw std::runtime_error("Only noisy-MAX CPTs decompose, node " + nodeIds[v]);
+        }
+        size_t card = cardinalities[v];
+        std::vector<Factor> factors;
+        factors.emplace_back(std::vector<int>{v, aux}, std::vector<size_t>{card, card});
+        std::vector<double>& difference = factors.back().getValues();
+        const std::vector<double>& leakCdf = model->getLeakCdf();
+        for (size_t y = 0; y < card; ++y) {
+            difference[y * card + y] = leakCdf[y];
+            if (y > 0) {
+                difference[y * card + y - 1] = -leakCdf[y - 1];
+            }
+        }
+        ArrayView<int> family = parents(v);
+        for (size_t k = 0; k < family.size(); ++k) {
+            factors.emplace_back(std::vector<int>{family[k], aux},
+                                 std::vector<size_t>{cardinalities[family[k]], card},
+                                 model->getParentCdf(k));
+        }
+        return factors;
+    }
+};
+
+#endif // COMPILED_NETWORK_HPP
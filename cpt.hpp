@@ -23,6 +23,8 @@
 #include <iomanip>
 // Mathematical operations
 #include <cmath>
+// Copy algorithm
+#include <algorithm>
 
 /**
  * ConditionalProbabilityTable class stores conditional probabilities
@@ -55,25 +57,6 @@ private:
         }
     }
 
-    /**
-     * Convert multi-dimensional indices to flat index
-     * @param indices Vector of indices for each dimension
-     * @return Flat index into probability array
-     */
-    size_t getFlatIndex(const std::vector<size_t>& indices) const {
-        if (indices.size() != dimensions.size()) {
-            throw std::runtime_error("Index dimension mismatch");
-        }
-        size_t index = 0;
-        for (size_t i = 0; i < indices.size(); ++i) {
-            if (indices[i] >= dimensions[i]) {
-                throw std::runtime_error("Index out of bounds");
-            }
-            index += indices[i] * strides[i];
-        }
-        return index;
-    }
-
 public:
     /**
      * Default constructor
@@ -95,6 +78,16 @@ public:
         calculateStrides();
     }
 
+    /**
+     * Constructor with dimensions and flat probabilities
+     * @param dims Vector of dimensions (last is node, others are parents)
+     * @param values Row-major probabilities, one per entry (copied)
+     */
+    ConditionalProbabilityTable(const std::vector<size_t>& dims, const double* values)
+        : ConditionalProbabilityTable(dims) {
+        std::copy(values, values + totalSize, probabilities.begin());
+    }
+
     /**
      * Set probability for given parent and node state indices
      * @param parentStates Vector of parent state indices
@@ -104,13 +97,26 @@ public:
     void setProbability(const std::vector<size_t>& parentStates, 
                        size_t nodeState, 
                        double prob) {
+        setProbability(parentStates.data(), parentStates.size(), nodeState, prob);
+    }
+
+    /**
+     * Set probability for given parent and node state indices (no allocation)
+     * @param parentStates Pointer to the parent state indices, in CPT order
+     * @param numParents Number of parent state indices
+     * @param nodeState Index of node state
+     * @param prob Probability value (must be in [0, 1])
+     */
+    void setProbability(const size_t* parentStates, size_t numParents,
+                        size_t nodeState, double prob) {
         if (prob < 0.0 || prob > 1.0) {
             throw std::runtime_error("Probability must be in [0, 1]");
         }
-        std::vector<size_t> indices = parentStates;
-        indices.push_back(nodeState);
-        size_t idx = getFlatIndex(indices);
-        probabilities[idx] = prob;
+        size_t offset = getRowOffset(parentStates, numParents);
+        if (nodeState >= dimensions.back()) {
+            throw std::runtime_error("Index out of bounds");
+        }
+        probabilities[offset + nodeState] = prob;
     }
 
     /**
@@ -121,10 +127,101 @@ public:
      */
     double getProbability(const std::vector<size_t>& parentStates, 
                          size_t nodeState) const {
-        std::vector<size_t> indices = parentStates;
-        indices.push_back(nodeState);
-        size_t idx = getFlatIndex(indices);
-        return probabilities[idx];
+        return getProbability(parentStates.data(), parentStates.size(), nodeState);
+    }
+
+    /**
+     * Get probability for given parent and node state indices (no allocation)
+     * @param parentStates Pointer to the parent state indices, in CPT order
+     * @param numParents Number of parent state indices
+     * @param nodeState Index of node state
+     * @return Probability value
+     */
+    double getProbability(const size_t* parentStates, size_t numParents,
+                          size_t nodeState) const {
+        size_t offset = getRowOffset(parentStates, numParents);
+        if (nodeState >= dimensions.back()) {
+            throw std::runtime_error("Index out of bounds");
+        }
+        return probabilities[offset + nodeState];
+    }
+
+    /**
+     * Get probability without bounds checks
+     * @param parentStates Pointer to one state index per parent, in range
+     * @param nodeState Index of node state, in range
+     * @return Probability value
+     */
+    double getProbabilityUnchecked(const size_t* parentStates, size_t nodeState) const {
+        return probabilities[getRowOffsetUnchecked(parentStates) + nodeState];
+    }
+
+    /**
+     * Get the flat offset of a parent configuration's row
+     * @param parentStates Pointer to the parent state indices, in CPT order
+     * @param numParents Number of parent state indices
+     * @return Offset of the row's first entry in getProbabilities()
+     */
+    size_t getRowOffset(const size_t* parentStates, size_t numParents) const {
+        if (numParents + 1 != dimensions.size()) {
+            throw std::runtime_error("Index dimension mismatch");
+        }
+        size_t offset = 0;
+        for (size_t i = 0; i < numParents; ++i) {
+            if (parentStates[i] >= dimensions[i]) {
+                throw std::runtime_error("Index out of bounds");
+            }
+            offset += parentStates[i] * strides[i];
+        }
+        return offset;
+    }
+
+    /**
+     * Get the flat offset of a parent configuration's row without checks
+     * @param parentStates Pointer to one state index per parent, in range
+     * @return Offset of the row's first entry in getProbabilities()
+     */
+    size_t getRowOffsetUnchecked(const size_t* parentStates) const {
+        size_t offset = 0;
+        for (size_t i = 0; i + 1 < dimensions.size(); ++i) {
+            offset += parentStates[i] * strides[i];
+        }
+        return offset;
+    }
+
+    /**
+     * Get a row of the table: the node's distribution for one parent configuration
+     * @param rowOffset Offset from getRowOffset()
+     * @return Pointer to getNumNodeStates() contiguous probabilities
+     */
+    const double* getRow(size_t rowOffset) const {
+        return probabilities.data() + rowOffset;
+    }
+
+    /**
+     * Get a writable row of the table
+     * @param rowOffset Offset from getRowOffset()
+     * @return Pointer to getNumNodeStates() contiguous probabilities
+     */
+    double* getRow(size_t rowOffset) {
+        return probabilities.data() + rowOffset;
+    }
+
+    /**
+     * Get number of node states (the length of every row)
+     * @return Last dimension
+     */
+    size_t getNumNodeStates() const {
+        return dimensions.empty() ? totalSize : dimensions.back();
+    }
+
+    /**
+     * Get number of parent configurations (rows)
+     * @return Product of the parent dimensions
+     */
+    size_t getNumParentConfigurations() const {
+        size_t rowLength = getNumNodeStates();
+        return (rowLength == 0) ? 0 : totalSize / rowLength;
     }
 
     /**
@@ -132,40 +229,21 @@ public:
      * Ensures each conditional distribution sums to 1.0
      */
     void normalize() {
-        size_t numParentConfigs = 1;
-        for (size_t i = 0; i < dimensions.size() - 1; ++i) {
-            numParentConfigs *= dimensions[i];
+        size_t rowLength = getNumNodeStates();
+        if (rowLength == 0) {
+            return;
         }
-        size_t numNodeStates = dimensions.back();
-
-        // Normalize each parent configuration
-        for (size_t parentConfig = 0; parentConfig < numParentConfigs; ++parentConfig) {
+        double* end = probabilities.data() + probabilities.size();
+        for (double* row = probabilities.data(); row != end; row += rowLength) {
             double sum = 0.0;
-            // Calculate sum for this parent configuration
-            for (size_t nodeState = 0; nodeState < numNodeStates; ++nodeState) {
-                std::vector<size_t> indices;
-                // Reconstruct parent indices from parentConfig
-                size_t temp = parentConfig;
-                for (size_t i = 0; i < dimensions.size() - 1; ++i) {
-                    indices.push_back(temp % dimensions[i]);
-                    temp /= dimensions[i];
-                }
-                indices.push_back(nodeState);
-                sum += probabilities[getFlatIndex(indices)];
+            for (size_t nodeState = 0; nodeState < rowLength; ++nodeState) {
+                sum += row[nodeState];
             }
 
             // Normalize if sum > 0
             if (sum > 1e-10) {
-                for (size_t nodeState = 0; nodeState < numNodeStates; ++nodeState) {
-                    std::vector<size_t> indices;
-                    size_t temp = parentConfig;
-                    for (size_t i = 0; i < dimensions.size() - 1; ++i) {
-                        indices.push_back(temp % dimensions[i]);
-                        temp /= dimensions[i];
-                    }
-                    indices.push_back(nodeState);
-                    size_t idx = getFlatIndex(indices);
-                    probabilities[idx] /= sum;
+                for (size_t nodeState = 0; nodeState < rowLength; ++nodeState) {
+                    row[nodeState] /= sum;
                 }
             }
         }
@@ -177,24 +255,15 @@ public:
      * @return True if valid, false otherwise
      */
     bool isValid(double tolerance = 1e-6) const {
-        size_t numParentConfigs = 1;
-        for (size_t i = 0; i < dimensions.size() - 1; ++i) {
-            numParentConfigs *= dimensions[i];
+        size_t rowLength = getNumNodeStates();
+        if (rowLength == 0) {
+            return true;
         }
-        size_t numNodeStates = dimensions.back();
-
-        // Check each parent configuration
-        for (size_t parentConfig = 0; parentConfig < numParentConfigs; ++parentConfig) {
+        const double* end = probabilities.data() + probabilities.size();
+        for (const double* row = probabilities.data(); row != end; row += rowLength) {
             double sum = 0.0;
-            for (size_t nodeState = 0; nodeState < numNodeStates; ++nodeState) {
-                std::vector<size_t> indices;
-                size_t temp = parentConfig;
-                for (size_t i = 0; i < dimensions.size() - 1; ++i) {
-                    indices.push_back(temp % dimensions[i]);
-                    temp /= dimensions[i];
-                }
-                indices.push_back(nodeState);
-                sum += probabilities[getFlatIndex(indices)];
+            for (size_t nodeState = 0; nodeState < rowLength; ++nodeState) {
+                sum += row[nodeState];
             }
             if (std::abs(sum - 1.0) > tolerance) {
                 return false;
@@ -211,6 +280,23 @@ public:
         return dimensions;
     }
 
+    /**
+     * Get flat probability storage (row-major, node state varies fastest)
+     * @return Vector of probabilities
+     */
+    const std::vector<double>& getProbabilities() const {
+        return probabilities;
+    }
+
+    /**
+     * Get writable flat probability storage (same layout as getProbabilities)
+     * Values are stored as given; callers keep them within [0, 1].
+     * @return Pointer to getTotalSize() probabilities
+     */
+    double* data() {
+        return probabilities.data();
+    }
+
     /**
      * Get total number of entries
      * @return Total size
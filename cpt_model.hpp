@@ -0,0 +1,576 @@
+/*
+ * cpt_model.hpp - Structured conditional probability models
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements CPT representations that avoid storing one entry per
+ * parent configuration: sparse rows over a default distribution, rules with
+ * context-specific independence, deterministic functions of the parents,
+ * and noisy-OR / noisy-MAX parameterizations. Every model answers the same
+ * row queries as a dense ConditionalProbabilityTable and can be expanded
+ * into one on demand.
+ */
+
+#ifndef CPT_MODEL_HPP
+#define CPT_MODEL_HPP
+
+// Conditional Probability Table
+#include "cpt.hpp"
+// Vector container
+#include <vector>
+// Hash map for sparse rows
+#include <unordered_map>
+// Deterministic node functions
+#include <functional>
+// Exception handling
+#include <stdexcept>
+// Mathematical operations
+#include <cmath>
+// Copy and fill algorithms
+#include <algorithm>
+
+/**
+ * CPTModel is the common interface of structured CPTs. Dimensions follow
+ * ConditionalProbabilityTable: one per parent in CPT order, node states
+ * last; parent configurations are numbered with the last parent fastest.
+ */
+class CPTModel {
+public:
+    /**
+     * Representation behind a model
+     */
+    enum class Kind {
+        Sparse,           // Explicit rows over a default row
+        ContextSpecific,  // First matching rule wins
+        Deterministic,    // Node state is a function of the parents
+        NoisyMax          // Independent causes combined by max (noisy-OR when binary)
+    };
+
+protected:
+    // Dimensions for each parent + self
+    std::vector<size_t> dimensions;
+
+    /**
+     * Constructor with dimensions
+     * @param dims Vector of dimensions (last is node, others are parents)
+     */
+    explicit CPTModel(const std::vector<size_t>& dims) : dimensions(dims) {
+        if (dimensions.empty()) {
+            throw std::runtime_error("CPT model needs at least the node dimension");
+        }
+        for (size_t dim : dimensions) {
+            if (dim == 0) {
+                throw std::runtime_error("CPT model dimensions must be positive");
+            }
+        }
+    }
+
+    /**
+     * Check a distribution over the node states
+     * @param distribution One probability per node state
+     */
+    void checkDistribution(const std::vector<double>& distribution) const {
+        if (distribution.size() != getNumNodeStates()) {
+            throw std::runtime_error("Distribution size does not match node states");
+        }
+        for (double p : distribution) {
+            if (!(p >= 0.0 && p <= 1.0)) {
+                throw std::runtime_error("Probability must be between 0 and 1");
+            }
+        }
+    }
+
+    /**
+     * Check a parent configuration and return its row index
+     * @param parentStates State index of each parent, in CPT order
+     * @return Row index (last parent fastest)
+     */
+    size_t checkedRowIndex(const std::vector<size_t>& parentStates) const {
+        if (parentStates.size() != getNumParents()) {
+            throw std::runtime_error("Parent state count mismatch");
+        }
+        size_t row = 0;
+        for (size_t i = 0; i < parentStates.size(); ++i) {
+            if (parentStates[i] >= dimensions[i]) {
+                throw std::runtime_error("Parent state out of bounds");
+            }
+            row = row * dimensions[i] + parentStates[i];
+        }
+        return row;
+    }
+
+public:
+    virtual ~CPTModel() = default;
+
+    /**
+     * Get the representation of the model
+     * @return Model kind
+     */
+    virtual Kind getKind() const = 0;
+
+    /**
+     * Fill the distribution of one parent configuration
+     * @param parentStates State index of each parent, in CPT order (unchecked)
+     * @param row Output, one probability per node state
+     */
+    virtual void fillRow(const size_t* parentStates, double* row) const = 0;
+
+    /**
+     * Conditional probability lookup (unchecked)
+     * @param parentStates State index of each parent, in CPT order
+     * @param nodeState State index of the node
+     * @return P(node = nodeState | parents = parentStates)
+     */
+    virtual double getProbability(const size_t* parentStates, size_t nodeState) const = 0;
+
+    /**
+     * Number of probabilities the model actually stores
+     * @return Stored parameter count
+     */
+    virtual size_t getStoredValues() const = 0;
+
+    /**
+     * Get dimensions
+     * @return Vector of dimensions (parents in CPT order, node last)
+     */
+    const std::vector<size_t>& getDimensions() const {
+        return dimensions;
+    }
+
+    /**
+     * Get number of parents
+     * @return Number of parent dimensions
+     */
+    size_t getNumParents() const {
+        return dimensions.size() - 1;
+    }
+
+    /**
+     * Get number of states of the node
+     * @return Size of the last dimension
+     */
+    size_t getNumNodeStates() const {
+        return dimensions.back();
+    }
+
+    /**
+     * Get number of parent configurations (rows of the dense table)
+     * @return Product of the parent dimensions
+     */
+    size_t getNumParentConfigurations() const {
+        size_t rows = 1;
+        for (size_t i = 0; i + 1 < dimensions.size(); ++i) {
+            rows *= dimensions[i];
+        }
+        return rows;
+    }
+
+    /**
+     * Expand the model into a dense table
+     * @return ConditionalProbabilityTable with the same dimensions
+     */
+    ConditionalProbabilityTable toDense() const {
+        ConditionalProbabilityTable dense(dimensions);
+        fillTable(dense.data());
+        return dense;
+    }
+
+    /**
+     * Write every row of the dense table, in CPT storage order
+     * @param out Output array of getNumParentConfigurations() * node states
+     */
+    void fillTable(double* out) const {
+        size_t numParents = getNumParents();
+        size_t card = getNumNodeStates();
+        std::vector<size_t> parentStates(numParents, 0);
+        for (size_t r = 0, rows = getNumParentConfigurations(); r < rows; ++r) {
+            fillRow(parentStates.data(), out + r * card);
+            for (int k = static_cast<int>(numParents) - 1; k >= 0; --k) {
+                if (++parentStates[k] < dimensions[k]) {
+                    break;
+                }
+                parentStates[k] = 0;
+            }
+        }
+    }
+};
+
+/**
+ * SparseCPT stores only rows that differ from a shared default row, e.g.
+ * tables where most parent configurations are impossible (all-zero rows)
+ * or share one distribution.
+ */
+class SparseCPT : public CPTModel {
+private:
+    // Distribution of every row not stored explicitly
+    std::vector<double> defaultRow;
+    // Row index -> offset of its distribution in values
+    std::unordered_map<size_t, size_t> rowOffsets;
+    // Distributions of the explicit rows, back to back
+    std::vector<double> values;
+
+    /**
+     * Row index of an unchecked parent configuration
+     */
+    size_t rowIndex(const size_t* parentStates) const {
+        size_t row = 0;
+        for (size_t i = 0; i + 1 < dimensions.size(); ++i) {
+            row = row * dimensions[i] + parentStates[i];
+        }
+        return row;
+    }
+
+    /**
+     * Distribution of a row (explicit or default)
+     */
+    const double* row(const size_t* parentStates) const {
+        auto it = rowOffsets.find(rowIndex(parentStates));
+        return (it != rowOffsets.end()) ? values.data() + it->second : defaultRow.data();
+    }
+
+public:
+    /**
+     * Constructor with dimensions and default row
+     * @param dims Vector of dimensions (last is node, others are parents)
+     * @param defaultDistribution Distribution of rows that are never set
+     *                            (empty for all-zero rows)
+     */
+    SparseCPT(const std::vector<size_t>& dims,
+              const std::vector<double>& defaultDistribution = std::vector<double>())
+        : CPTModel(dims), defaultRow(dims.back(), 0.0) {
+        if (!defaultDistribution.empty()) {
+            checkDistribution(defaultDistribution);
+            defaultRow = defaultDistribution;
+        }
+    }
+
+    Kind getKind() const override {
+        return Kind::Sparse;
+    }
+
+    /**
+     * Set the distribution of one parent configuration
+     * @param parentStates State index of each parent, in CPT order
+     * @param distribution One probability per node state
+     */
+    void setRow(const std::vector<size_t>& parentStates, const std::vector<double>& distribution) {
+        size_t r = checkedRowIndex(parentStates);
+        checkDistribution(distribution);
+        auto it = rowOffsets.find(r);
+        if (it == rowOffsets.end()) {
+            it = rowOffsets.emplace(r, values.size()).first;
+            values.resize(values.size() + distribution.size());
+        }
+        std::copy(distribution.begin(), distribution.end(), values.begin() + it->second);
+    }
+
+    /**
+     * Get number of explicitly stored rows
+     * @return Row count
+     */
+    size_t getNumStoredRows() const {
+        return rowOffsets.size();
+    }
+
+    void fillRow(const size_t* parentStates, double* out) const override {
+        const double* source = row(parentStates);
+        std::copy(source, source + getNumNodeStates(), out);
+    }
+
+    double getProbability(const size_t* parentStates, size_t nodeState) const override {
+        return row(parentStates)[nodeState];
+    }
+
+    size_t getStoredValues() const override {
+        return defaultRow.size() + values.size();
+    }
+};
+
+/**
+ * ContextSpecificCPT stores a list of rules. A rule fixes the states of
+ * some parents (the context) and gives the node's distribution whenever
+ * the context holds; the first matching rule wins, so a decision tree is
+ * written as one rule per leaf.
+ */
+class ContextSpecificCPT : public CPTModel {
+private:
+    // Context of each rule: one entry per parent, kAny for unconstrained
+    std::vector<int> contexts;
+    // Distribution of each rule, back to back
+    std::vector<double> distributions;
+
+    /**
+     * Distribution of the first rule matching a parent configuration
+     */
+    const double* match(const size_t* parentStates) const {
+        size_t numParents = getNumParents();
+        size_t card = getNumNodeStates();
+        size_t numRules = distributions.size() / card;
+        for (size_t r = 0; r < numRules; ++r) {
+            const int* context = contexts.data() + r * numParents;
+            size_t i = 0;
+            while (i < numParents && (context[i] == kAny || static_cast<size_t>(context[i]) == parentStates[i])) {
+                ++i;
+            }
+            if (i == numParents) {
+                return distributions.data() + r * card;
+            }
+        }
+        throw std::runtime_error("No rule of the context-specific CPT matches the parent states");
+    }
+
+public:
+    // Context entry matching every state of a parent
+    static constexpr int kAny = -1;
+
+    /**
+     * Constructor with dimensions (no rules)
+     * @param dims Vector of dimensions (last is node, others are parents)
+     */
+    explicit ContextSpecificCPT(const std::vector<size_t>& dims) : CPTModel(dims) {}
+
+    Kind getKind() const override {
+        return Kind::ContextSpecific;
+    }
+
+    /**
+     * Append a rule
+     * @param context State per parent in CPT order, or kAny
+     * @param distribution One probability per node state
+     */
+    void addRule(const std::vector<int>& context, const std::vector<double>& distribution) {
+        if (context.size() != getNumParents()) {
+            throw std::runtime_error("Rule context size does not match parents");
+        }
+        for (size_t i = 0; i < context.size(); ++i) {
+            if (context[i] != kAny && (context[i] < 0 || static_cast<size_t>(context[i]) >= dimensions[i])) {
+                throw std::runtime_error("Rule context state out of bounds");
+            }
+        }
+        checkDistribution(distribution);
+        contexts.insert(contexts.end(), context.begin(), context.end());
+        distributions.insert(distributions.end(), distribution.begin(), distribution.end());
+    }
+
+    /**
+     * Get number of rules
+     * @return Rule count
+     */
+    size_t getNumRules() const {
+        return distributions.size() / getNumNodeStates();
+    }
+
+    void fillRow(const size_t* parentStates, double* out) const override {
+        const double* source = match(parentStates);
+        std::copy(source, source + getNumNodeStates(), out);
+    }
+
+    double getProbability(const size_t* parentStates, size_t nodeState) const override {
+        return match(parentStates)[nodeState];
+    }
+
+    size_t getStoredValues() const override {
+        return distributions.size();
+    }
+};
+
+/**
+ * DeterministicCPT gives the node state as a function of its parents'
+ * states; every row is a point mass. The function must be safe to call
+ * from several threads at once.
+ */
+class DeterministicCPT : public CPTModel {
+public:
+    /**
+     * Function from parent states (in CPT order) to the node state
+     */
+    using Function = std::function<size_t(const size_t* parentStates)>;
+
+private:
+    // Node state per parent configuration
+    Function function;
+
+public:
+    /**
+     * Constructor with dimensions and function
+     * @param dims Vector of dimensions (last is node, others are parents)
+     * @param fn Function from parent states to the node state
+     */
+    DeterministicCPT(const std::vector<size_t>& dims, Function fn)
+        : CPTModel(dims), function(std::move(fn)) {
+        if (!function) {
+            throw std::runtime_error("Deterministic CPT needs a function");
+        }
+    }
+
+    Kind getKind() const override {
+        return Kind::Deterministic;
+    }
+
+    /**
+     * Node state for a parent configuration
+     * @param parentStates State index of each parent, in CPT order
+     * @return State index of the node
+     */
+    size_t getState(const size_t* parentStates) const {
+        size_t state = function(parentStates);
+        if (state >= getNumNodeStates()) {
+            throw std::runtime_error("Deterministic CPT function returned an invalid state");
+        }
+        return state;
+    }
+
+    void fillRow(const size_t* parentStates, double* out) const override {
+        std::fill(out, out + getNumNodeStates(), 0.0);
+        out[getState(parentStates)] = 1.0;
+    }
+
+    double getProbability(const size_t* parentStates, size_t nodeState) const override {
+        return (getState(parentStates) == nodeState) ? 1.0 : 0.0;
+    }
+
+    size_t getStoredValues() const override {
+        return 0;
+    }
+};
+
+/**
+ * NoisyMaxCPT models a node whose state is the maximum of independent
+ * contributions: each parent in state x_i raises the node to a level drawn
+ * from its own distribution, and a leak adds a background cause. Node
+ * state 0 is the absent (lowest) level, so
+ *   P(Y <= y | x) = leak(Y <= y) * prod_i P(Z_i <= y | x_i).
+ * With binary parents and node this is noisy-OR.
+ */
+class NoisyMaxCPT : public CPTModel {
+private:
+    // Cumulative distribution of each parent's contribution: for parent i,
+    // parentState * card + y holds P(Z_i <= y | x_i = parentState)
+    std::vector<std::vector<double>> parentCdf;
+    // Cumulative distribution of the leak
+    std::vector<double> leakCdf;
+
+    /**
+     * Cumulative sums of a distribution, with the last entry exactly 1
+     */
+    std::vector<double> cumulative(const std::vector<double>& distribution) const {
+        checkDistribution(distribution);
+        std::vector<double> cdf(distribution.size());
+        double sum = 0.0;
+        for (size_t y = 0; y < distribution.size(); ++y) {
+            sum += distribution[y];
+            cdf[y] = sum;
+        }
+        if (std::fabs(sum - 1.0) > 1e-9) {
+            throw std::runtime_error("Noisy-MAX distributions must sum to 1");
+        }
+        cdf.back() = 1.0;
+        return cdf;
+    }
+
+    /**
+     * P(Y <= y | parents) as a product of the cumulative terms
+     */
+    double jointCdf(const size_t* parentStates, size_t y) const {
+        size_t card = getNumNodeStates();
+        double cdf = leakCdf[y];
+        for (size_t i = 0; i < parentCdf.size(); ++i) {
+            cdf *= parentCdf[i][parentStates[i] * card + y];
+        }
+        return cdf;
+    }
+
+public:
+    /**
+     * Constructor with dimensions
+     * Every parent state and the leak start as causing level 0 only.
+     * @param dims Vector of dimensions (last is node, others are parents)
+     */
+    explicit NoisyMaxCPT(const std::vector<size_t>& dims)
+        : CPTModel(dims), leakCdf(dims.back(), 1.0) {
+        for (size_t i = 0; i < getNumParents(); ++i) {
+            parentCdf.emplace_back(dims[i] * getNumNodeStates(), 1.0);
+        }
+    }
+
+    /**
+     * Build a noisy-OR over binary parents (state 1 = cause present)
+     * @param linkProbabilities P(node = 1 | only parent i present) per parent
+     * @param leak P(node = 1 | no parent present)
+     * @return Noisy-OR model over a binary node
+     */
+    static NoisyMaxCPT noisyOr(const std::vector<double>& linkProbabilities, double leak) {
+        NoisyMaxCPT model(std::vector<size_t>(linkProbabilities.size() + 1, 2));
+        model.setLeak({1.0 - leak, leak});
+        for (size_t i = 0; i < linkProbabilities.size(); ++i) {
+            model.setParentEffect(i, 1, {1.0 - linkProbabilities[i], linkProbabilities[i]});
+        }
+        return model;
+    }
+
+    Kind getKind() const override {
+        return Kind::NoisyMax;
+    }
+
+    /**
+     * Set the distribution of the level caused by the leak
+     * @param distribution One probability per node state
+     */
+    void setLeak(const std::vector<double>& distribution) {
+        leakCdf = cumulative(distribution);
+    }
+
+    /**
+     * Set the distribution of the level a parent state causes on its own
+     * @param parent Parent position in CPT order
+     * @param parentState State of that parent
+     * @param distribution One probability per node state
+     */
+    void setParentEffect(size_t parent, size_t parentState, const std::vector<double>& distribution) {
+        if (parent >= getNumParents() || parentState >= dimensions[parent]) {
+            throw std::runtime_error("Noisy-MAX parent state out of bounds");
+        }
+        std::vector<double> cdf = cumulative(distribution);
+        std::copy(cdf.begin(), cdf.end(), parentCdf[parent].begin() + parentState * getNumNodeStates());
+    }
+
+    /**
+     * Cumulative distribution of one parent's contribution
+     * @param parent Parent position in CPT order
+     * @return P(Z <= y | parent state) stored as parentState * card + y
+     */
+    const std::vector<double>& getParentCdf(size_t parent) const {
+        return parentCdf[parent];
+    }
+
+    /**
+     * Cumulative distribution of the leak
+     * @return P(leak level <= y) per node state
+     */
+    const std::vector<double>& getLeakCdf() const {
+        return leakCdf;
+    }
+
+    void fillRow(const size_t* parentStates, double* out) const override {
+        double previous = 0.0;
+        for (size_t y = 0; y < getNumNodeStates(); ++y) {
+            double cdf = jointCdf(parentStates, y);
+            out[y] = cdf - previous;
+            previous = cdf;
+        }
+    }
+
+    double getProbability(const size_t* parentStates, size_t nodeState) const override {
+        double cdf = jointCdf(parentStates, nodeState);
+        return (nodeState == 0) ? cdf : cdf - jointCdf(parentStates, nodeState - 1);
+    }
+
+    size_t getStoredValues() const override {
+        size_t count = leakCdf.size();
+        for (const std::vector<double>& cdf : parentCdf) {
+            count += cdf.size();
+        }
+        return count;
+    }
+};
+
+#endif // CPT_MODEL_HPP
@@ -0,0 +1,416 @@
+/*
+ * elimination_order.hpp - Elimination ordering heuristics and cost model
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements the moral graph of a Bayesian network, greedy
+ * elimination-order heuristics (min-degree, min-fill, weighted min-fill),
+ * barren-node pruning, and a cost model that predicts the work done by
+ * variable elimination before it runs.
+ */
+
+#ifndef ELIMINATION_ORDER_HPP
+#define ELIMINATION_ORDER_HPP
+
+// Vector container
+#include <vector>
+// Set container for adjacency
+#include <set>
+// Algorithm utilities
+#include <algorithm>
+// Exception handling
+#include <stdexcept>
+
+/**
+ * Greedy heuristics for choosing the next variable to eliminate
+ */
+enum class EliminationHeuristic {
+    MinDegree,        // Fewest neighbors in the current graph
+    MinFill,          // Fewest fill-in edges added by elimination
+    WeightedMinFill   // Fill-in edges weighted by cardinality products
+};
+
+/**
+ * Predicted cost of a variable elimination run
+ */
+struct EliminationCost {
+    double maxFactorSize = 1.0;  // Entries of the largest intermediate factor
+    double totalFlops = 0.0;     // Multiplications and additions performed
+    size_t inducedWidth = 0;     // Largest elimination clique size minus one
+};
+
+/**
+ * MoralGraph stores the undirected moral graph of a DAG over dense
+ * variable indices: every node is connected to its parents, and parents
+ * sharing a child are connected to each other.
+ */
+class MoralGraph {
+private:
+    // Adjacency set per variable
+    std::vector<std::set<int>> adjacency;
+    // Whether a variable takes part in the graph
+    std::vector<bool> active;
+
+public:
+    /**
+     * Constructor with number of variables (all inactive, no edges)
+     * @param numVariables Number of variables
+     */
+    explicit MoralGraph(size_t numVariables = 0)
+        : adjacency(numVariables), active(numVariables, false) {}
+
+    /**
+     * Build the moral graph of the included variables from a CSR parent array
+     * @param offsets numVariables + 1 row offsets into indices
+     * @param indices Concatenated parent indices
+     * @param include Variables to include (others and their edges are dropped)
+     * @return Moral graph over the included variables
+     */
+    static MoralGraph fromCSR(const std::vector<size_t>& offsets,
+                              const std::vector<int>& indices,
+                              const std::vector<bool>& include) {
+        MoralGraph graph(include.size());
+        std::vector<int> family;
+        for (size_t v = 0; v < include.size(); ++v) {
+            if (!include[v]) {
+                continue;
+            }
+            graph.active[v] = true;
+            family.clear();
+            for (size_t k = offsets[v]; k < offsets[v + 1]; ++k) {
+                if (include[indices[k]]) {
+                    family.push_back(indices[k]);
+                }
+            }
+            family.push_back(static_cast<int>(v));
+            // Connect every pair in the family (marries co-parents)
+            for (size_t i = 0; i < family.size(); ++i) {
+                for (size_t j = i + 1; j < family.size(); ++j) {
+                    graph.addEdge(family[i], family[j]);
+                }
+            }
+        }
+        return graph;
+    }
+
+    /**
+     * Build the interaction graph of a set of factor scopes
+     * Variables sharing a scope are connected; for the CPT factors of a
+     * network this is its moral graph.
+     * @param numVariables Number of variable slots
+     * @param scopes Variable scope of each factor
+     * @return Graph over the variables that appear in some scope
+     */
+    static MoralGraph fromScopes(size_t numVariables, const std::vector<std::vector<int>>& scopes) {
+        MoralGraph graph(numVariables);
+        for (const std::vector<int>& scope : scopes) {
+            for (size_t i = 0; i < scope.size(); ++i) {
+                graph.active[scope[i]] = true;
+                for (size_t j = i + 1; j < scope.size(); ++j) {
+                    graph.addEdge(scope[i], scope[j]);
+                }
+            }
+        }
+        return graph;
+    }
+
+    /**
+     * Build the moral graph of the included variables
+     * @param parents Parent indices per variable
+     * @param include Variables to include (others and their edges are dropped)
+     * @return Moral graph over the included variables
+     */
+    static MoralGraph fromParents(const std::vector<std::vector<int>>& parents,
+                                  const std::vector<bool>& include) {
+        std::vector<size_t> offsets;
+        std::vector<int> indices;
+        toCSR(parents, offsets, indices);
+        return fromCSR(offsets, indices, include);
+    }
+
+    /**
+     * Flatten per-variable parent lists into a CSR array
+     * @param parents Parent indices per variable
+     * @param offsets Output row offsets (numVariables + 1)
+     * @param indices Output concatenated parent indices
+     */
+    static void toCSR(const std::vector<std::vector<int>>& parents,
+                      std::vector<size_t>& offsets,
+                      std::vector<int>& indices) {
+        offsets.assign(1, 0);
+        indices.clear();
+        for (const auto& list : parents) {
+            indices.insert(indices.end(), list.begin(), list.end());
+            offsets.push_back(indices.size());
+        }
+    }
+
+    /**
+     * Add an undirected edge
+     * @param a First variable
+     * @param b Second variable
+     */
+    void addEdge(int a, int b) {
+        if (a == b) {
+            return;
+        }
+        adjacency[a].insert(b);
+        adjacency[b].insert(a);
+        active[a] = true;
+        active[b] = true;
+    }
+
+    /**
+     * Remove a variable and all its edges
+     * @param v Variable to remove
+     */
+    void removeVariable(int v) {
+        for (int n : adjacency[v]) {
+            adjacency[n].erase(v);
+        }
+        adjacency[v].clear();
+        active[v] = false;
+    }
+
+    /**
+     * Get neighbors of a variable
+     * @param v Variable index
+     * @return Set of neighbor indices
+     */
+    const std::set<int>& neighbors(int v) const {
+        return adjacency[v];
+    }
+
+    /**
+     * Check whether a variable is part of the graph
+     * @param v Variable index
+     * @return True if active
+     */
+    bool isActive(int v) const {
+        return active[v];
+    }
+
+    /**
+     * Get number of variable slots
+     * @return Number of variables
+     */
+    size_t size() const {
+        return adjacency.size();
+    }
+};
+
+/**
+ * EliminationOrdering computes greedy elimination orders on a moral graph
+ * and simulates variable elimination symbolically to estimate its cost.
+ */
+class EliminationOrdering {
+private:
+    /**
+     * Score a variable under a heuristic (lower is better)
+     */
+    static double score(const MoralGraph& graph,
+                        const std::vector<size_t>& cardinalities,
+                        int v,
+                        EliminationHeuristic heuristic) {
+        const std::set<int>& nbrs = graph.neighbors(v);
+        if (heuristic == EliminationHeuristic::MinDegree) {
+            return static_cast<double>(nbrs.size());
+        }
+        double fill = 0.0;
+        for (auto i = nbrs.begin(); i != nbrs.end(); ++i) {
+            auto j = i;
+            for (++j; j != nbrs.end(); ++j) {
+                if (graph.neighbors(*i).count(*j) == 0) {
+                    fill += (heuristic == EliminationHeuristic::WeightedMinFill)
+                                ? static_cast<double>(cardinalities[*i] * cardinalities[*j])
+                                : 1.0;
+                }
+            }
+        }
+        return fill;
+    }
+
+    /**
+     * Size of the clique formed by a variable and its neighbors (tie-breaker)
+     */
+    static double cliqueWeight(const MoralGraph& graph,
+                               const std::vector<size_t>& cardinalities,
+                               int v) {
+        double weight = static_cast<double>(cardinalities[v]);
+        for (int n : graph.neighbors(v)) {
+            weight *= static_cast<double>(cardinalities[n]);
+        }
+        return weight;
+    }
+
+public:
+    /**
+     * Compute a greedy elimination order
+     * Eliminating a variable connects all its remaining neighbors; scores are
+     * refreshed only for variables within two hops of the eliminated one.
+     * @param graph Moral graph (copied and consumed during simulation)
+     * @param cardinalities Cardinality per variable
+     * @param toEliminate Variables to eliminate
+     * @param heuristic Greedy scoring rule
+     * @return Variables of toEliminate in elimination order
+     */
+    static std::vector<int> compute(MoralGraph graph,
+                                    const std::vector<size_t>& cardinalities,
+                                    const std::vector<int>& toEliminate,
+                                    EliminationHeuristic heuristic) {
+        std::vector<int> order;
+        std::vector<bool> pending(graph.size(), false);
+        std::vector<double> scores(graph.size(), 0.0);
+        std::vector<double> weights(graph.size(), 0.0);
+        for (int v : toEliminate) {
+            pending[v] = true;
+            scores[v] = score(graph, cardinalities, v, heuristic);
+            weights[v] = cliqueWeight(graph, cardinalities, v);
+        }
+
+        for (size_t step = 0; step < toEliminate.size(); ++step) {
+            // Pick the best pending variable (ties: smaller clique, then index)
+            int best = -1;
+            for (int v : toEliminate) {
+                if (!pending[v]) {
+                    continue;
+                }
+                if (best == -1 || scores[v] < scores[best] ||
+                    (scores[v] == scores[best] && weights[v] < weights[best])) {
+                    best = v;
+                }
+            }
+            order.push_back(best);
+            pending[best] = false;
+
+            // Connect the neighbors, then drop the variable
+            std::vector<int> nbrs(graph.neighbors(best).begin(), graph.neighbors(best).end());
+            for (size_t i = 0; i < nbrs.size(); ++i) {
+                for (size_t j = i + 1; j < nbrs.size(); ++j) {
+                    graph.addEdge(nbrs[i], nbrs[j]);
+                }
+            }
+            graph.removeVariable(best);
+
+            // Refresh scores in the two-hop neighborhood
+            std::set<int> touched(nbrs.begin(), nbrs.end());
+            for (int n : nbrs) {
+                touched.insert(graph.neighbors(n).begin(), graph.neighbors(n).end());
+            }
+            for (int v : touched) {
+                if (pending[v]) {
+                    scores[v] = score(graph, cardinalities, v, heuristic);
+                    weights[v] = cliqueWeight(graph, cardinalities, v);
+                }
+            }
+        }
+        return order;
+    }
+
+    /**
+     * Simulate variable elimination over factor scopes
+     * Counts one operation per entry of every intermediate product and per
+     * entry summed out, which mirrors the dense Factor implementation.
+     * @param scopes Variable scope of each initial factor
+     * @param cardinalities Cardinality per variable
+     * @param order Elimination order
+     * @return Predicted cost, including the final product over what remains
+     */
+    static EliminationCost estimateCost(std::vector<std::vector<int>> scopes,
+                                        const std::vector<size_t>& cardinalities,
+                                        const std::vector<int>& order) {
+        EliminationCost cost;
+        auto scopeSize = [&](const std::vector<int>& scope) {
+            double size = 1.0;
+            for (int v : scope) {
+                size *= static_cast<double>(cardinalities[v]);
+            }
+            return size;
+        };
+        // Multiply a list of scopes pairwise, accumulating cost
+        auto multiply = [&](const std::vector<std::vector<int>>& parts) {
+            std::vector<int> combined;
+            for (size_t i = 0; i < parts.size(); ++i) {
+                for (int v : parts[i]) {
+                    if (std::find(combined.begin(), combined.end(), v) == combined.end()) {
+                        combined.push_back(v);
+                    }
+                }
+                double size = scopeSize(combined);
+                cost.totalFlops += size;
+                cost.maxFactorSize = std::max(cost.maxFactorSize, size);
+            }
+            return combined;
+        };
+
+        for (int var : order) {
+            std::vector<std::vector<int>> involved, remaining;
+            for (const auto& scope : scopes) {
+                if (std::find(scope.begin(), scope.end(), var) != scope.end()) {
+                    involved.push_back(scope);
+                } else {
+                    remaining.push_back(scope);
+                }
+            }
+            if (involved.empty()) {
+                continue;
+            }
+            std::vector<int> combined = multiply(involved);
+            cost.inducedWidth = std::max(cost.inducedWidth, combined.size() - 1);
+            // Summing out touches every entry of the combined factor
+            cost.totalFlops += scopeSize(combined);
+            combined.erase(std::find(combined.begin(), combined.end(), var));
+            remaining.push_back(combined);
+            scopes.swap(remaining);
+        }
+        if (!scopes.empty()) {
+            multiply(scopes);
+        }
+        return cost;
+    }
+
+    /**
+     * Ancestral closure used for barren-node pruning
+     * Any node that is not an ancestor of (or in) the seed set is barren: it
+     * sums to one and can be removed without changing the query answer.
+     * @param offsets numVariables + 1 row offsets of the CSR parent array
+     * @param indices Concatenated parent indices
+     * @param seeds Query and evidence variables
+     * @return Mask of variables that must be kept
+     */
+    static std::vector<bool> ancestralSet(const std::vector<size_t>& offsets,
+                                          const std::vector<int>& indices,
+                                          const std::vector<int>& seeds) {
+        std::vector<bool> keep(offsets.size() - 1, false);
+        std::vector<int> stack(seeds.begin(), seeds.end());
+        while (!stack.empty()) {
+            int v = stack.back();
+            stack.pop_back();
+            if (keep[v]) {
+                continue;
+            }
+            keep[v] = true;
+            for (size_t k = offsets[v]; k < offsets[v + 1]; ++k) {
+                if (!keep[indices[k]]) {
+                    stack.push_back(indices[k]);
+                }
+            }
+        }
+        return keep;
+    }
+
+    /**
+     * Ancestral closure over per-variable parent lists
+     * @param parents Parent indices per variable
+     * @param seeds Query and evidence variables
+     * @return Mask of variables that must be kept
+     */
+    static std::vector<bool> ancestralSet(const std::vector<std::vector<int>>& parents,
+                                          const std::vector<int>& seeds) {
+        std::vector<size_t> offsets;
+        std::vector<int> indices;
+        MoralGraph::toCSR(parents, offsets, indices);
+        return ancestralSet(offsets, indices, seeds);
+    }
+};
+
+#endif // ELIMINATION_ORDER_HPP
@@ -0,0 +1,539 @@
+/*
+ * factor.hpp - Dense factor implementation for exact inference
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements dense factors over integer variable indices together
+ * with the product, marginalization, maximization and evidence reduction
+ * operations used by variable elimination. Factors are templated on a numeric policy (see
+ * numeric_policy.hpp); Factor is the double instantiation.
+ */
+
+#ifndef FACTOR_HPP
+#define FACTOR_HPP
+
+// Parallel execution of large products
+#include "thread_pool.hpp"
+// Numeric backends
+#include "numeric_policy.hpp"
+// Factor counters of profiled queries
+#include "instrumentation.hpp"
+// Per-thread scratch for kernel temporaries
+#include "inference_workspace.hpp"
+// Unrolled loops for small state counts
+#include "small_kernels.hpp"
+// Vector container
+#include <vector>
+// Exception handling
+#include <stdexcept>
+// Algorithm utilities
+#include <algorithm>
+
+/**
+ * BasicFactor class stores a function over a set of discrete variables.
+ * Values are kept in a flat row-major array (the last variable varies
+ * fastest), matching the layout of ConditionalProbabilityTable, so a CPT
+ * converts to a factor without reordering. Arithmetic goes through Policy.
+ */
+template <typename Policy>
+class BasicFactor {
+public:
+    // Number type of the values
+    using Value = typename Policy::Value;
+
+private:
+    // Variable indices in storage order
+    std::vector<int> variables;
+    // Cardinality of each variable
+    std::vector<size_t> cardinalities;
+    // Stride of each variable in the flat value array
+    std::vector<size_t> strides;
+    // Flat storage of factor values
+    std::vector<Value> values;
+
+    /**
+     * Calculate row-major strides from cardinalities
+     */
+    void calculateStrides() {
+        strides.resize(variables.size());
+        size_t stride = 1;
+        for (int i = static_cast<int>(variables.size()) - 1; i >= 0; --i) {
+            strides[i] = stride;
+            stride *= cardinalities[i];
+        }
+    }
+
+    // Tag of the constructor that leaves the scope to the caller
+    struct EmptyScope {};
+
+    /**
+     * Constructor without variables or values; the operations below fill
+     * in the scope and call allocate(), so scopes are built in place
+     */
+    explicit BasicFactor(EmptyScope) {}
+
+    /**
+     * Size strides and zeroed values for the current scope
+     */
+    void allocate() {
+        size_t total = 1;
+        for (size_t card : cardinalities) {
+            total *= card;
+        }
+        values.assign(total, Policy::zero());
+        calculateStrides();
+        LBN_FACTOR(total, total * sizeof(Value));
+    }
+
+    /**
+     * Allocate a result over this scope without the variable at a position
+     * @param pos Storage position of the dropped variable
+     * @return Zeroed factor
+     */
+    BasicFactor withoutPosition(int pos) const {
+        BasicFactor result{EmptyScope()};
+        result.variables.reserve(variables.size() - 1);
+        result.cardinalities.reserve(variables.size() - 1);
+        for (size_t i = 0; i < variables.size(); ++i) {
+            if (static_cast<int>(i) != pos) {
+                result.variables.push_back(variables[i]);
+                result.cardinalities.push_back(cardinalities[i]);
+            }
+        }
+        result.allocate();
+        return result;
+    }
+
+    /**
+     * Write product entries [begin, end) of a row-major result
+     * The odometer starts at entry begin with operand offsets indexA and
+     * indexB. Card is the state count of the last result variable, or 0
+     * for the generic walk; with a fixed Card each whole run of the last
+     * variable is written by an unrolled loop and the odometer advances
+     * once per run instead of once per entry.
+     */
+    template <size_t Card>
+    static void productRange(const Value* a,
+                             const Value* b,
+                             Value* out,
+                             const size_t* cards,
+                             const size_t* strideA,
+                             const size_t* strideB,
+                             size_t numVars,
+                             size_t* assignment,
+                             size_t indexA,
+                             size_t indexB,
+                             size_t begin,
+                             size_t end) {
+        // Advance the odometer from variable top downwards
+        auto carry = [&](int top) {
+            for (int v = top; v >= 0; --v) {
+                assignment[v]++;
+                indexA += strideA[v];
+                indexB += strideB[v];
+                if (assignment[v] < cards[v]) {
+                    break;
+                }
+                indexA -= cards[v] * strideA[v];
+                indexB -= cards[v] * strideB[v];
+                assignment[v] = 0;
+            }
+        };
+        int last = static_cast<int>(numVars) - 1;
+        size_t i = begin;
+        if constexpr (Card != 0) {
+            size_t runA = strideA[last];
+            size_t runB = strideB[last];
+            while (i + Card <= end) {
+                if (assignment[last] != 0) {
+                    // Chunk boundary inside a run: step to the next run
+                    out[i++] = Policy::multiply(a[indexA], b[indexB]);
+                    carry(last);
+                    continue;
+                }
+                for (size_t s = 0; s < Card; ++s) {
+                    out[i + s] = Policy::multiply(a[indexA + s * runA], b[indexB + s * runB]);
+                }
+                i += Card;
+                carry(last - 1);
+            }
+        }
+        for (; i < end; ++i) {
+            out[i] = Policy::multiply(a[indexA], b[indexB]);
+            carry(last);
+        }
+    }
+
+public:
+    /**
+     * Default constructor: the scalar unit factor (no variables, value 1)
+     */
+    BasicFactor() : values(1, Policy::one()) {}
+
+    /**
+     * Constructor with scope; all values initialized to zero
+     * @param vars Variable indices in storage order
+     * @param cards Cardinality of each variable
+     */
+    BasicFactor(const std::vector<int>& vars, const std::vector<size_t>& cards)
+        : variables(vars), cardinalities(cards) {
+        if (variables.size() != cardinalities.size()) {
+            throw std::runtime_error("Factor scope and cardinality size mismatch");
+        }
+        allocate();
+    }
+
+    // Factors with at least this many entries are split across a thread pool
+    static constexpr size_t kParallelMinEntries = size_t(1) << 15;
+    // Entries per parallel task
+    static constexpr size_t kParallelChunk = size_t(1) << 13;
+
+    /**
+     * Constructor with scope and values
+     * @param vars Variable indices in storage order
+     * @param cards Cardinality of each variable
+     * @param vals Flat row-major values (size must equal product of cards)
+     */
+    BasicFactor(const std::vector<int>& vars,
+                const std::vector<size_t>& cards,
+                const std::vector<Value>& vals)
+        : BasicFactor(vars, cards) {
+        if (vals.size() != values.size()) {
+            throw std::runtime_error("Factor value count does not match scope");
+        }
+        values = vals;
+    }
+
+    /**
+     * Get variable indices in storage order
+     * @return Vector of variable indices
+     */
+    const std::vector<int>& getVariables() const {
+        return variables;
+    }
+
+    /**
+     * Get cardinalities in storage order
+     * @return Vector of cardinalities
+     */
+    const std::vector<size_t>& getCardinalities() const {
+        return cardinalities;
+    }
+
+    /**
+     * Get strides in storage order
+     * @return Vector of strides
+     */
+    const std::vector<size_t>& getStrides() const {
+        return strides;
+    }
+
+    /**
+     * Get flat values
+     * @return Vector of values
+     */
+    const std::vector<Value>& getValues() const {
+        return values;
+    }
+
+    /**
+     * Get mutable flat values
+     * @return Vector of values
+     */
+    std::vector<Value>& getValues() {
+        return values;
+    }
+
+    /**
+     * Get number of entries
+     * @return Number of values in the factor
+     */
+    size_t size() const {
+        return values.size();
+    }
+
+    /**
+     * Find the storage position of a variable
+     * @param var Variable index
+     * @return Position in scope, or -1 if not present
+     */
+    int position(int var) const {
+        for (size_t i = 0; i < variables.size(); ++i) {
+            if (variables[i] == var) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * Check whether a variable is in the scope
+     * @param var Variable index
+     * @return True if the factor depends on var
+     */
+    bool contains(int var) const {
+        return position(var) != -1;
+    }
+
+    /**
+     * Factor product
+     * The result scope is this factor's variables followed by the variables
+     * of other that are not already present.
+     * @param other Factor to multiply with
+     * @param pool Optional thread pool; large results are filled in
+     *             parallel chunks with the same values as a serial run
+     * @return Product factor
+     */
+    BasicFactor product(const BasicFactor& other, ThreadPool* pool = nullptr) const {
+        BasicFactor result{EmptyScope()};
+        result.variables.reserve(variables.size() + other.variables.size());
+        result.cardinalities.reserve(variables.size() + other.variables.size());
+        result.variables = variables;
+        result.cardinalities = cardinalities;
+        for (size_t i = 0; i < other.variables.size(); ++i) {
+            if (!contains(other.variables[i])) {
+                result.variables.push_back(other.variables[i]);
+                result.cardinalities.push_back(other.cardinalities[i]);
+            }
+        }
+        result.allocate();
+        const std::vector<int>& resultVars = result.variables;
+        const std::vector<size_t>& resultCards = result.cardinalities;
+
+        // Stride of each result variable inside each operand (0 if absent)
+        InferenceWorkspace::Frame frame;
+        size_t numVars = resultVars.size();
+        ScratchVector<size_t> strideA(numVars, 0, frame.resource()), strideB(numVars, 0, frame.resource());
+        for (size_t i = 0; i < numVars; ++i) {
+            int posA = position(resultVars[i]);
+            int posB = other.position(resultVars[i]);
+            if (posA != -1) strideA[i] = strides[posA];
+            if (posB != -1) strideB[i] = other.strides[posB];
+        }
+
+        // Walk a range of the result in row-major order, tracking operand offsets
+        auto fill = [&](size_t begin, size_t end) {
+            InferenceWorkspace::Frame chunkFrame;
+            ScratchVector<size_t> assignment(numVars, 0, chunkFrame.resource());
+            size_t indexA = 0, indexB = 0;
+            for (size_t v = 0; v < numVars; ++v) {
+                assignment[v] = (begin / result.strides[v]) % resultCards[v];
+                indexA += assignment[v] * strideA[v];
+                indexB += assignment[v] * strideB[v];
+            }
+            kernels::withCardinality(numVars == 0 ? 0 : resultCards[numVars - 1], [&](auto fixed) {
+                productRange<decltype(fixed)::value>(values.data(), other.values.data(), result.values.data(),
+                                                     resultCards.data(), strideA.data(), strideB.data(), numVars,
+                                                     assignment.data(), indexA, indexB, begin, end);
+            });
+        };
+        size_t total = result.values.size();
+        if (pool != nullptr && total >= kParallelMinEntries) {
+            pool->parallelFor(0, (total + kParallelChunk - 1) / kParallelChunk, [&](size_t chunk) {
+                fill(chunk * kParallelChunk, std::min(total, (chunk + 1) * kParallelChunk));
+            });
+        } else {
+            fill(0, total);
+        }
+        return result;
+    }
+
+    /**
+     * Sum a variable out of the factor
+     * @param var Variable index to eliminate
+     * @param pool Optional thread pool; large factors are split over the
+     *             outer axis, which keeps every sum in serial order
+     * @return Factor over the remaining variables
+     */
+    BasicFactor marginalize(int var, ThreadPool* pool = nullptr) const {
+        int pos = position(var);
+        if (pos == -1) {
+            throw std::runtime_error("Variable not in factor scope");
+        }
+        BasicFactor result = withoutPosition(pos);
+
+        // View the values as [outer][card][inner] and sum the middle axis
+        size_t card = cardinalities[pos];
+        size_t inner = strides[pos];
+        size_t outer = values.size() / (card * inner);
+        auto sumBlock = [&](size_t o) {
+            Policy::sumSlices(&values[o * card * inner], card, inner, &result.values[o * inner]);
+        };
+        if (pool != nullptr && values.size() >= kParallelMinEntries && outer > 1) {
+            size_t grain = std::max<size_t>(1, kParallelChunk / (card * inner));
+            pool->parallelFor(0, outer, sumBlock, grain);
+        } else {
+            for (size_t o = 0; o < outer; ++o) {
+                sumBlock(o);
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Maximize a variable out of the factor (max-product elimination)
+     * Values are compared with operator<, which orders probabilities and
+     * their logs alike; ExactValue has no order and cannot be maximized.
+     * @param var Variable index to eliminate
+     * @return Factor over the remaining variables holding the largest
+     *         value of each slice
+     */
+    BasicFactor maximize(int var) const {
+        int pos = position(var);
+        if (pos == -1) {
+            throw std::runtime_error("Variable not in factor scope");
+        }
+        BasicFactor result = withoutPosition(pos);
+
+        // Same [outer][card][inner] view as marginalize, with max for sum
+        size_t card = cardinalities[pos];
+        size_t inner = strides[pos];
+        size_t outer = values.size() / (card * inner);
+        kernels::withCardinality(card, [&](auto fixed) {
+            for (size_t o = 0; o < outer; ++o) {
+                kernels::maxSlices<decltype(fixed)::value>(&values[o * card * inner], card, inner,
+                                                           &result.values[o * inner]);
+            }
+        });
+        return result;
+    }
+
+    /**
+     * Sum out every variable not in keep, in a single pass
+     * @param keep Variables to keep (variables not in scope are ignored)
+     * @return Factor over the kept variables, in this factor's storage order
+     */
+    BasicFactor project(const std::vector<int>& keep) const {
+        InferenceWorkspace::Frame frame;
+        BasicFactor result{EmptyScope()};
+        ScratchVector<char> kept(variables.size(), 0, frame.resource());
+        for (size_t i = 0; i < variables.size(); ++i) {
+            if (std::find(keep.begin(), keep.end(), variables[i]) != keep.end()) {
+                kept[i] = 1;
+                result.variables.push_back(variables[i]);
+                result.cardinalities.push_back(cardinalities[i]);
+            }
+        }
+        result.allocate();
+
+        // Stride of each source variable in the result (0 if summed out)
+        size_t numVars = variables.size();
+        ScratchVector<size_t> outStride(numVars, 0, frame.resource());
+        for (size_t i = 0, k = 0; i < numVars; ++i) {
+            if (kept[i]) {
+                outStride[i] = result.strides[k++];
+            }
+        }
+
+        ScratchVector<size_t> assignment(numVars, 0, frame.resource());
+        size_t outIndex = 0;
+        for (size_t i = 0; i < values.size(); ++i) {
+            result.values[outIndex] = Policy::add(result.values[outIndex], values[i]);
+            for (int v = static_cast<int>(numVars) - 1; v >= 0; --v) {
+                assignment[v]++;
+                outIndex += outStride[v];
+                if (assignment[v] < cardinalities[v]) {
+                    break;
+                }
+                outIndex -= cardinalities[v] * outStride[v];
+                assignment[v] = 0;
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Reduce the factor to an observed state of a variable
+     * @param var Variable index that is observed
+     * @param state Observed state index
+     * @return Factor over the remaining variables
+     */
+    BasicFactor reduce(int var, size_t state) const {
+        int pos = position(var);
+        if (pos == -1) {
+            return *this;
+        }
+        if (state >= cardinalities[pos]) {
+            throw std::runtime_error("Evidence state out of bounds");
+        }
+        BasicFactor result = withoutPosition(pos);
+
+        // Copy the slice [outer][state][inner]
+        size_t card = cardinalities[pos];
+        size_t inner = strides[pos];
+        size_t outer = values.size() / (card * inner);
+        for (size_t o = 0; o < outer; ++o) {
+            const Value* slice = &values[(o * card + state) * inner];
+            std::copy(slice, slice + inner, &result.values[o * inner]);
+        }
+        return result;
+    }
+
+    /**
+     * Zero every entry where var is not in the given state
+     * Keeps the variable in scope (used for observed query variables).
+     * @param var Variable index that is observed
+     * @param state Observed state index
+     */
+    void applyIndicator(int var, size_t state) {
+        int pos = position(var);
+        if (pos == -1) {
+            return;
+        }
+        size_t card = cardinalities[pos];
+        size_t inner = strides[pos];
+        for (size_t i = 0; i < values.size(); ++i) {
+            if ((i / inner) % card != state) {
+                values[i] = Policy::zero();
+            }
+        }
+    }
+
+    /**
+     * Sum of all entries
+     * @return Total mass of the factor
+     */
+    Value sum() const {
+        return Policy::sum(values.data(), values.size());
+    }
+
+    /**
+     * Normalize the factor so its entries sum to 1.0
+     * Leaves the factor unchanged if its mass is negligible under Policy:
+     * zero (impossible evidence) or non-finite. Any positive mass is
+     * normalized, however small, so long evidence still sums to 1.
+     */
+    void normalize() {
+        Value total = sum();
+        if (!Policy::isNegligible(total)) {
+            for (Value& v : values) {
+                v = Policy::divide(v, total);
+            }
+        }
+    }
+
+    /**
+     * Get value for a full assignment of the scope
+     * @param states State index per variable, in storage order
+     * @return Factor value
+     */
+    Value getValue(const std::vector<size_t>& states) const {
+        if (states.size() != variables.size()) {
+            throw std::runtime_error("Index dimension mismatch");
+        }
+        size_t index = 0;
+        for (size_t i = 0; i < states.size(); ++i) {
+            if (states[i] >= cardinalities[i]) {
+                throw std::runtime_error("Index out of bounds");
+            }
+            index += states[i] * strides[i];
+        }
+        return values[index];
+    }
+};
+
+/**
+ * Factor over IEEE doubles, used by every inference engine
+ */
+using Factor = BasicFactor<DoublePolicy>;
+
+#endif // FACTOR_HPP
@@ -0,0 +1,261 @@
+/*
+ * inference_session.hpp - Incremental evidence on a calibrated junction tree
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements InferenceSession, which keeps the Shafer-Shenoy
+ * messages of a junction tree between queries. Observing or retracting a
+ * variable only invalidates the messages that depend on its home clique,
+ * and messages are recomputed lazily along the path a query needs.
+ */
+
+#ifndef INFERENCE_SESSION_HPP
+#define INFERENCE_SESSION_HPP
+
+// Junction tree
+#include "junction_tree.hpp"
+// Dense factors
+#include "factor.hpp"
+// Vector container
+#include <vector>
+// String operations
+#include <string>
+// Map container
+#include <map>
+// Shared tree ownership
+#include <memory>
+// Exception handling
+#include <stdexcept>
+
+/**
+ * InferenceSession holds evidence and cached messages for one junction tree.
+ * The session pins the tree (and its compiled snapshot), so later changes
+ * to the network do not affect it. A session is not thread-safe; use one
+ * session per thread.
+ */
+class InferenceSession {
+private:
+    // Tree the messages belong to
+    std::shared_ptr<const JunctionTree> tree;
+    // Observed state per variable, or -1
+    std::vector<int> evidenceState;
+    // Clique potentials with evidence entered
+    std::vector<Factor> local;
+    // Message from each clique to its parent, and whether it is current
+    std::vector<Factor> upward;
+    std::vector<bool> upwardValid;
+    // Message from each parent into the clique, and whether it is current
+    std::vector<Factor> downward;
+    std::vector<bool> downwardValid;
+    // Clique beliefs, and whether they are current
+    std::vector<Factor> beliefs;
+    std::vector<bool> beliefValid;
+    // Number of messages computed so far
+    size_t messageUpdates = 0;
+
+    /**
+     * Record a changed local potential at a clique
+     * The upward messages on the path to the root depend on it, and so does
+     * every downward message into a clique whose subtree excludes it.
+     */
+    void invalidateFrom(int changed) {
+        local[changed] = tree->localPotential(changed, evidenceState);
+        std::vector<bool> onPath(tree->numCliques(), false);
+        for (int c = changed; c != -1; c = tree->clique(c).parent) {
+            onPath[c] = true;
+            upwardValid[c] = false;
+        }
+        for (size_t c = 0; c < tree->numCliques(); ++c) {
+            if (!onPath[c]) {
+                downwardValid[c] = false;
+            }
+            beliefValid[c] = false;
+        }
+    }
+
+    /**
+     * Make the message from a clique to its parent current
+     */
+    const Factor& ensureUpward(int c) {
+        if (!upwardValid[c]) {
+            Factor belief = local[c];
+            for (int ch : tree->clique(c).children) {
+                belief = belief.product(ensureUpward(ch));
+            }
+            upward[c] = belief.project(tree->clique(c).separator);
+            LBN_COUNT(MessagesSent, 1);
+            upwardValid[c] = true;
+            messageUpdates++;
+        }
+        return upward[c];
+    }
+
+    /**
+     * Make the message from a clique's parent into the clique current
+     */
+    const Factor& ensureDownward(int c) {
+        if (!downwardValid[c]) {
+            int p = tree->clique(c).parent;
+            Factor message = local[p];
+            if (tree->clique(p).parent != -1) {
+                message = message.product(ensureDownward(p));
+            }
+            for (int sibling : tree->clique(p).children) {
+                if (sibling != c) {
+                    message = message.product(ensureUpward(sibling));
+                }
+            }
+            downward[c] = message.project(tree->clique(c).separator);
+            LBN_COUNT(MessagesSent, 1);
+            downwardValid[c] = true;
+            messageUpdates++;
+        }
+        return downward[c];
+    }
+
+    /**
+     * Make a clique belief current
+     */
+    const Factor& ensureBelief(int c) {
+        if (!beliefValid[c]) {
+            Factor belief = local[c];
+            if (tree->clique(c).parent != -1) {
+                belief = belief.product(ensureDownward(c));
+            }
+            for (int ch : tree->clique(c).children) {
+                belief = belief.product(ensureUpward(ch));
+            }
+            beliefs[c] = belief;
+            beliefValid[c] = true;
+        }
+        return beliefs[c];
+    }
+
+    /**
+     * Set or clear the evidence on a variable
+     */
+    void setEvidence(int v, int state) {
+        if (evidenceState[v] == state) {
+            return;
+        }
+        evidenceState[v] = state;
+        invalidateFrom(tree->homeClique(v));
+    }
+
+public:
+    /**
+     * Constructor with a junction tree; starts without evidence
+     * @param junctionTree Tree to run on (shared, never modified)
+     */
+    explicit InferenceSession(std::shared_ptr<const JunctionTree> junctionTree)
+        : tree(std::move(junctionTree)) {
+        size_t numCliques = tree->numCliques();
+        evidenceState.assign(tree->network()->numNodes(), -1);
+        local.resize(numCliques);
+        for (size_t c = 0; c < numCliques; ++c) {
+            local[c] = tree->localPotential(static_cast<int>(c), evidenceState);
+        }
+        upward.resize(numCliques);
+        downward.resize(numCliques);
+        beliefs.resize(numCliques);
+        upwardValid.assign(numCliques, false);
+        downwardValid.assign(numCliques, false);
+        beliefValid.assign(numCliques, false);
+    }
+
+    /**
+     * Observe a node in a state (replaces any previous observation)
+     * @param nodeId ID of the node
+     * @param state Observed state name
+     */
+    void observe(const std::string& nodeId, const std::string& state) {
+        const CompiledNetwork& net = *tree->network();
+        int v = net.requireIndex(nodeId);
+        int stateIdx = net.stateIndex(v, state);
+        if (stateIdx == -1) {
+            throw std::runtime_error("Invalid state for node " + nodeId);
+        }
+        setEvidence(v, stateIdx);
+    }
+
+    /**
+     * Retract the observation of a node (no effect if it is unobserved)
+     * @param nodeId ID of the node
+     */
+    void retract(const std::string& nodeId) {
+        setEvidence(tree->network()->requireIndex(nodeId), -1);
+    }
+
+    /**
+     * Retract every observation
+     */
+    void retractAll() {
+        for (size_t v = 0; v < evidenceState.size(); ++v) {
+            setEvidence(static_cast<int>(v), -1);
+        }
+    }
+
+    /**
+     * Posterior marginal of a node given the current evidence
+     * @param nodeId ID of the node
+     * @return Map of state name to probability
+     */
+    std::map<std::string, double> marginal(const std::string& nodeId) {
+        const CompiledNetwork& net = *tree->network();
+        int v = net.requireIndex(nodeId);
+        Factor belief = ensureBelief(tree->homeClique(v)).project({v});
+        belief.normalize();
+
+        std::map<std::string, double> result;
+        for (size_t s = 0; s < net.cardinality(v); ++s) {
+            result[net.states(v)[s]] = belief.getValues()[s];
+        }
+        return result;
+    }
+
+    /**
+     * Probability of the current evidence
+     * @return P(evidence)
+     */
+    double evidenceProbability() {
+        double probability = 1.0;
+        for (size_t c = 0; c < tree->numCliques(); ++c) {
+            if (tree->clique(static_cast<int>(c)).parent == -1) {
+                probability *= ensureBelief(static_cast<int>(c)).sum();
+            }
+        }
+        return probability;
+    }
+
+    /**
+     * Get the current evidence
+     * @return Map of observed node IDs to their states
+     */
+    std::map<std::string, std::string> getEvidence() const {
+        const CompiledNetwork& net = *tree->network();
+        std::map<std::string, std::string> evidence;
+        for (size_t v = 0; v < evidenceState.size(); ++v) {
+            if (evidenceState[v] != -1) {
+                evidence[net.nodeId(static_cast<int>(v))] = net.states(static_cast<int>(v))[evidenceState[v]];
+            }
+        }
+        return evidence;
+    }
+
+    /**
+     * Get number of messages computed since the session was created
+     * @return Message count (a full two-pass calibration costs 2 per edge)
+     */
+    size_t getMessageUpdates() const {
+        return messageUpdates;
+    }
+
+    /**
+     * Get the junction tree of the session
+     * @return Shared pointer to the tree
+     */
+    const std::shared_ptr<const JunctionTree>& getJunctionTree() const {
+        return tree;
+    }
+};
+
+#endif // INFERENCE_SESSION_HPP
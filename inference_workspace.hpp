@@ -0,0 +1,252 @@
+/*
+ * inference_workspace.hpp - Per-thread arenas for inference scratch memory
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements InferenceWorkspace, a monotonic arena exposed as a
+ * std::pmr::memory_resource. Factor kernels and engines take their
+ * temporaries (odometers, stride tables, scope masks) from the current
+ * thread's workspace inside a Frame, which rewinds the arena in O(1) when
+ * it closes; blocks are kept, so a warmed-up workspace serves every later
+ * query without touching the heap. Each thread, including every pool
+ * worker, has its own workspace, so allocation never contends. Callers may
+ * install their own workspace (e.g. one per request thread, reserved up
+ * front) with InferenceWorkspace::Scope.
+ */
+
+#ifndef INFERENCE_WORKSPACE_HPP
+#define INFERENCE_WORKSPACE_HPP
+
+// Polymorphic allocators and memory resources
+#include <memory_resource>
+// Vector container
+#include <vector>
+// Block ownership
+#include <memory>
+// std::max
+#include <algorithm>
+// Pointer arithmetic
+#include <cstdint>
+// Sizes
+#include <cstddef>
+
+/**
+ * Vector whose storage comes from a workspace
+ */
+template <typename T>
+using ScratchVector = std::pmr::vector<T>;
+
+/**
+ * InferenceWorkspace is a bump allocator over a list of retained blocks.
+ * deallocate() is a no-op; memory is recycled by rewinding to a Frame's
+ * mark or by reset(). A workspace is used by one thread at a time.
+ */
+class InferenceWorkspace : public std::pmr::memory_resource {
+private:
+    struct Block {
+        std::unique_ptr<unsigned char[]> data;
+        size_t size = 0;
+    };
+
+    // Retained blocks; blocks after the current one are empty and reused first
+    std::vector<Block> blocks;
+    // Block being filled and the bytes used in it
+    size_t currentBlock = 0;
+    size_t offset = 0;
+    // Bytes handed out since the last reset, and the largest such total
+    size_t inUse = 0;
+    size_t peak = 0;
+
+    // Size of the first block allocated on demand
+    static constexpr size_t kInitialBlock = size_t(1) << 16;
+
+    /**
+     * Try to carve bytes from a block at the current offset
+     * @return Pointer, or nullptr if the block is too small
+     */
+    void* carve(size_t bytes, size_t alignment) {
+        Block& block = blocks[currentBlock];
+        uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+        uintptr_t aligned = (base + offset + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+        size_t end = static_cast<size_t>(aligned - base) + bytes;
+        if (end > block.size) {
+            return nullptr;
+        }
+        inUse += end - offset;
+        peak = std::max(peak, inUse);
+        offset = end;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        if (!blocks.empty()) {
+            if (void* p = carve(bytes, alignment)) {
+                return p;
+            }
+            // Move on to the next retained block that fits, or add one
+            while (currentBlock + 1 < blocks.size()) {
+                ++currentBlock;
+                offset = 0;
+                if (void* p = carve(bytes, alignment)) {
+                    return p;
+                }
+            }
+        }
+        size_t size = std::max(blocks.empty() ? kInitialBlock : 2 * blocks.back().size, bytes + alignment);
+        Block block;
+        block.data.reset(new unsigned char[size]);
+        block.size = size;
+        blocks.push_back(std::move(block));
+        currentBlock = blocks.size() - 1;
+        offset = 0;
+        return carve(bytes, alignment);
+    }
+
+    void do_deallocate(void*, size_t, size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    /**
+     * Thread's installed workspace (null: use the thread's own)
+     */
+    static InferenceWorkspace*& installed() {
+        static thread_local InferenceWorkspace* workspace = nullptr;
+        return workspace;
+    }
+
+public:
+    InferenceWorkspace() = default;
+
+    /**
+     * Constructor with memory reserved up front
+     * @param bytes Capacity of the first block
+     */
+    explicit InferenceWorkspace(size_t bytes) {
+        reserve(bytes);
+    }
+
+    InferenceWorkspace(const InferenceWorkspace&) = delete;
+    InferenceWorkspace& operator=(const InferenceWorkspace&) = delete;
+
+    /**
+     * Make sure the arena holds at least this many bytes without growing
+     * Only allowed while nothing is allocated (after reset()).
+     * @param bytes Capacity to reserve
+     */
+    void reserve(size_t bytes) {
+        if (capacity() >= bytes) {
+            return;
+        }
+        Block block;
+        block.data.reset(new unsigned char[bytes]);
+        block.size = bytes;
+        blocks.clear();
+        blocks.push_back(std::move(block));
+        currentBlock = 0;
+        offset = 0;
+    }
+
+    /**
+     * Release every allocation at once; blocks are kept
+     * When the last run needed several blocks they are replaced by one
+     * block of their total size, so the next run fits in a single block.
+     */
+    void reset() {
+        if (blocks.size() > 1) {
+            size_t total = capacity();
+            blocks.clear();
+            reserve(total);
+        }
+        currentBlock = 0;
+        offset = 0;
+        inUse = 0;
+    }
+
+    /**
+     * Get total bytes of the retained blocks
+     */
+    size_t capacity() const {
+        size_t total = 0;
+        for (const Block& block : blocks) {
+            total += block.size;
+        }
+        return total;
+    }
+
+    /**
+     * Get the largest number of bytes in use at once since construction
+     */
+    size_t peakUsage() const {
+        return peak;
+    }
+
+    /**
+     * Get the workspace engines on this thread allocate from
+     * This is the workspace installed by a Scope, or else the thread's
+     * own, created on first use and freed when the thread exits.
+     */
+    static InferenceWorkspace& current() {
+        InferenceWorkspace* workspace = installed();
+        if (workspace != nullptr) {
+            return *workspace;
+        }
+        static thread_local InferenceWorkspace own;
+        return own;
+    }
+
+    /**
+     * Frame marks the arena and rewinds it to the mark when it closes
+     * Allocations made inside the frame must not outlive it. Frames nest.
+     */
+    class Frame {
+    private:
+        InferenceWorkspace& workspace;
+        size_t block;
+        size_t offset;
+        size_t inUse;
+
+    public:
+        explicit Frame(InferenceWorkspace& ws = InferenceWorkspace::current())
+            : workspace(ws), block(ws.currentBlock), offset(ws.offset), inUse(ws.inUse) {}
+
+        ~Frame() {
+            workspace.currentBlock = block;
+            workspace.offset = offset;
+            workspace.inUse = inUse;
+        }
+
+        Frame(const Frame&) = delete;
+        Frame& operator=(const Frame&) = delete;
+
+        /**
+         * Get the frame's memory resource
+         */
+        std::pmr::memory_resource* resource() const {
+            return &workspace;
+        }
+    };
+
+    /**
+     * Scope installs a caller-owned workspace on this thread for its lifetime
+     * Pool workers keep allocating from their own workspaces.
+     */
+    class Scope {
+    private:
+        InferenceWorkspace* previous;
+
+    public:
+        explicit Scope(InferenceWorkspace& workspace) : previous(installed()) {
+            installed() = &workspace;
+        }
+
+        ~Scope() {
+            installed() = previous;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+};
+
+#endif // INFERENCE_WORKSPACE_HPP
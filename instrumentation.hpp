@@ -0,0 +1,318 @@
+/*
+ * instrumentation.hpp - Compile-time toggleable inference profiling
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements the profiling surface of the inference engines:
+ * hot paths mark phases with LBN_PHASE and bump counters with LBN_COUNT,
+ * and profile() runs a query with a recorder attached and returns its
+ * InferenceStats (per-phase wall time, factors created, messages sent, CPT
+ * entries read, bytes allocated) next to the result. Stats export to the
+ * Chrome trace-event JSON format read by chrome://tracing and Perfetto.
+ *
+ * Recording is compiled in with -DLBN_INSTRUMENTATION=1. Without it the
+ * macros expand to nothing, so the engines carry no timers, counters or
+ * thread-local lookups, and profile() only runs the query.
+ */
+
+#ifndef INSTRUMENTATION_HPP
+#define INSTRUMENTATION_HPP
+
+// Vector container
+#include <vector>
+// String operations
+#include <string>
+// Trace output
+#include <ostream>
+// Phase timestamps
+#include <chrono>
+// Counters updated from pool workers
+#include <atomic>
+// Phase list lock
+#include <mutex>
+// Result and stats pair
+#include <utility>
+// Stable phase order
+#include <algorithm>
+
+#ifndef LBN_INSTRUMENTATION
+#define LBN_INSTRUMENTATION 0
+#endif
+
+/**
+ * One timed phase of a query
+ */
+struct PhaseTiming {
+    std::string name;              // Phase name (e.g. "upwardPass")
+    double startMicros = 0.0;      // Start, relative to the start of the query
+    double durationMicros = 0.0;   // Wall time
+    size_t thread = 0;             // Recording thread (0 is the first thread seen)
+};
+
+/**
+ * What a profiled query did
+ * Counters cover the query and every pool task it ran. cptLookups counts
+ * CPT entries read: a dense table fetch counts its size, a single
+ * probability counts one.
+ */
+struct InferenceStats {
+    bool enabled = false;          // Built with LBN_INSTRUMENTATION
+    double wallMicros = 0.0;       // Wall time of the whole query
+    std::vector<PhaseTiming> phases;   // In start order; nested phases overlap their parent
+    size_t factorsCreated = 0;     // Factors constructed
+    size_t factorEntries = 0;      // Sum of their sizes
+    size_t largestFactor = 0;      // Size of the largest one
+    size_t messagesSent = 0;       // Belief propagation and clique messages computed
+    size_t cptLookups = 0;         // CPT entries read
+    size_t bytesAllocated = 0;     // Bytes of factor tables and message arenas allocated
+
+    /**
+     * Total wall time of a phase over all its occurrences
+     * @param name Phase name
+     * @return Microseconds (0 if the phase did not run)
+     */
+    double phaseMicros(const std::string& name) const {
+        double total = 0.0;
+        for (const PhaseTiming& phase : phases) {
+            if (phase.name == name) {
+                total += phase.durationMicros;
+            }
+        }
+        return total;
+    }
+
+    /**
+     * Write the stats as Chrome trace-event JSON
+     * The query is one complete event with its phases nested inside, one
+     * row per thread, followed by a counter event holding the totals.
+     * @param out Output stream
+     * @param queryName Name of the enclosing query event
+     */
+    void writeChromeTrace(std::ostream& out, const std::string& queryName = "query") const {
+        auto quoted = [](const std::string& text) {
+            std::string result = "\"";
+            for (char c : text) {
+                if (c == '"' || c == '\\') {
+                    result += '\\';
+                }
+                result += c;
+            }
+            return result + "\"";
+        };
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        out << "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": "
+            << "\"lossless-bayesian-network\"}},\n";
+        out << "  {\"name\": " << quoted(queryName) << ", \"cat\": \"query\", \"ph\": \"X\", \"ts\": 0, \"dur\": "
+            << wallMicros << ", \"pid\": 1, \"tid\": 0},\n";
+        for (const PhaseTiming& phase : phases) {
+            out << "  {\"name\": " << quoted(phase.name) << ", \"cat\": \"phase\", \"ph\": \"X\", \"ts\": "
+                << phase.startMicros << ", \"dur\": " << phase.durationMicros << ", \"pid\": 1, \"tid\": "
+                << phase.thread << "},\n";
+        }
+        out << "  {\"name\": \"counters\", \"ph\": \"C\", \"ts\": " << wallMicros << ", \"pid\": 1, \"args\": {"
+            << "\"factorsCreated\": " << factorsCreated << ", \"factorEntries\": " << factorEntries
+            << ", \"largestFactor\": " << largestFactor << ", \"messagesSent\": " << messagesSent
+            << ", \"cptLookups\": " << cptLookups << ", \"bytesAllocated\": " << bytesAllocated << "}}\n";
+        out << "]}\n";
+    }
+};
+
+namespace instrumentation {
+
+/**
+ * Counters kept by a Recorder
+ */
+enum class Counter { FactorsCreated, FactorEntries, MessagesSent, CptLookups, BytesAllocated, NumCounters };
+
+/**
+ * Recorder collects the phases and counters of one query. It is shared by
+ * the query's thread and the pool workers running its tasks, so counters
+ * are atomic and phases are appended under a lock.
+ */
+class Recorder {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point origin;
+    std::atomic<size_t> counters[static_cast<size_t>(Counter::NumCounters)];
+    std::atomic<size_t> largest{0};
+    std::mutex phaseMutex;
+    std::vector<PhaseTiming> phases;
+
+public:
+    Recorder() : origin(Clock::now()) {
+        for (std::atomic<size_t>& counter : counters) {
+            counter.store(0);
+        }
+    }
+
+    /**
+     * Add to a counter
+     */
+    void add(Counter counter, size_t amount) {
+        counters[static_cast<size_t>(counter)].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    /**
+     * Record a factor table of some size
+     * @param entries Number of entries
+     * @param bytes Bytes allocated for them
+     */
+    void factor(size_t entries, size_t bytes) {
+        add(Counter::FactorsCreated, 1);
+        add(Counter::FactorEntries, entries);
+        add(Counter::BytesAllocated, bytes);
+        size_t seen = largest.load(std::memory_order_relaxed);
+        while (entries > seen && !largest.compare_exchange_weak(seen, entries, std::memory_order_relaxed)) {
+        }
+    }
+
+    /**
+     * Record a finished phase
+     */
+    void phase(const char* name, Clock::time_point start, Clock::time_point end, size_t thread) {
+        PhaseTiming timing;
+        timing.name = name;
+        timing.startMicros = std::chrono::duration<double, std::micro>(start - origin).count();
+        timing.durationMicros = std::chrono::duration<double, std::micro>(end - start).count();
+        timing.thread = thread;
+        std::lock_guard<std::mutex> lock(phaseMutex);
+        phases.push_back(std::move(timing));
+    }
+
+    /**
+     * Snapshot of everything recorded so far
+     */
+    InferenceStats stats() {
+        InferenceStats result;
+        result.enabled = true;
+        result.wallMicros = std::chrono::duration<double, std::micro>(Clock::now() - origin).count();
+        {
+            std::lock_guard<std::mutex> lock(phaseMutex);
+            result.phases = phases;
+        }
+        std::stable_sort(result.phases.begin(), result.phases.end(),
+                         [](const PhaseTiming& a, const PhaseTiming& b) { return a.startMicros < b.startMicros; });
+        auto count = [this](Counter counter) { return counters[static_cast<size_t>(counter)].load(); };
+        result.factorsCreated = count(Counter::FactorsCreated);
+        result.factorEntries = count(Counter::FactorEntries);
+        result.largestFactor = largest.load();
+        result.messagesSent = count(Counter::MessagesSent);
+        result.cptLookups = count(Counter::CptLookups);
+        result.bytesAllocated = count(Counter::BytesAllocated);
+        return result;
+    }
+};
+
+/**
+ * Recorder of the query running on this thread (null when not profiling)
+ */
+inline Recorder*& currentRecorder() {
+    static thread_local Recorder* recorder = nullptr;
+    return recorder;
+}
+
+/**
+ * Small, stable number of the calling thread for trace rows
+ */
+inline size_t threadNumber() {
+    static std::atomic<size_t> next{0};
+    static thread_local size_t number = next.fetch_add(1);
+    return number;
+}
+
+/**
+ * RecorderScope attaches a recorder to the calling thread for its lifetime
+ * and restores the previous one afterwards (profiles may nest, and pool
+ * workers adopt the recorder of the task they run).
+ */
+class RecorderScope {
+private:
+    Recorder* previous;
+
+public:
+    explicit RecorderScope(Recorder* recorder) : previous(currentRecorder()) {
+        currentRecorder() = recorder;
+    }
+
+    ~RecorderScope() {
+        currentRecorder() = previous;
+    }
+
+    RecorderScope(const RecorderScope&) = delete;
+    RecorderScope& operator=(const RecorderScope&) = delete;
+};
+
+/**
+ * PhaseTimer records the wall time of its scope as a phase
+ */
+class PhaseTimer {
+private:
+    const char* name;
+    Recorder* recorder;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit PhaseTimer(const char* phaseName) : name(phaseName), recorder(currentRecorder()) {
+        if (recorder != nullptr) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~PhaseTimer() {
+        if (recorder != nullptr) {
+            recorder->phase(name, start, std::chrono::steady_clock::now(), threadNumber());
+        }
+    }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+};
+
+} // namespace instrumentation
+
+#if LBN_INSTRUMENTATION
+#define LBN_CONCAT_IMPL(a, b) a##b
+#define LBN_CONCAT(a, b) LBN_CONCAT_IMPL(a, b)
+// Time the rest of the enclosing scope as a phase
+#define LBN_PHASE(name) ::instrumentation::PhaseTimer LBN_CONCAT(lbnPhase, __LINE__)(name)
+// Add to a counter (FactorsCreated, MessagesSent, CptLookups, ...)
+#define LBN_COUNT(counter, amount)                                                            \
+    do {                                                                                      \
+        if (::instrumentation::Recorder* lbnRecorder = ::instrumentation::currentRecorder()) { \
+            lbnRecorder->add(::instrumentation::Counter::counter, (amount));                  \
+        }                                                                                     \
+    } while (0)
+// Record a factor table of some entries and bytes
+#define LBN_FACTOR(entries, bytes)                                                            \
+    do {                                                                                      \
+        if (::instrumentation::Recorder* lbnRecorder = ::instrumentation::currentRecorder()) { \
+            lbnRecorder->factor((entries), (bytes));                                          \
+        }                                                                                     \
+    } while (0)
+#else
+#define LBN_PHASE(name) ((void)0)
+#define LBN_COUNT(counter, amount) ((void)0)
+#define LBN_FACTOR(entries, bytes) ((void)0)
+#endif
+
+/**
+ * Run a query and collect its InferenceStats
+ * Every call on the calling thread, and every pool task it submits, is
+ * recorded. Without LBN_INSTRUMENTATION the stats are empty (enabled is
+ * false).
+ * @param query Callable taking no arguments, e.g. [&] { return net.variableElimination(q, e); }
+ * @return Pair of (query result, stats)
+ */
+template <typename Query>
+auto profile(Query&& query) -> std::pair<decltype(query()), InferenceStats> {
+#if LBN_INSTRUMENTATION
+    instrumentation::Recorder recorder;
+    instrumentation::RecorderScope scope(&recorder);
+    auto result = query();
+    return std::pair<decltype(query()), InferenceStats>(std::move(result), recorder.stats());
+#else
+    return std::pair<decltype(query()), InferenceStats>(query(), InferenceStats());
+#endif
+}
+
+#endif // INSTRUMENTATION_HPP
@@ -0,0 +1,467 @@
+/*
+ * junction_tree.hpp - Junction tree (clique tree) for exact inference
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements a junction tree built once per compiled network by
+ * triangulating the moral graph, together with Shafer-Shenoy two-pass
+ * calibration. A single calibration yields the exact marginal of every
+ * variable and the probability of the evidence.
+ */
+
+#ifndef JUNCTION_TREE_HPP
+#define JUNCTION_TREE_HPP
+
+// Frozen index-based network snapshot
+#include "compiled_network.hpp"
+// Dense factors
+#include "factor.hpp"
+// Elimination ordering heuristics (triangulation)
+#include "elimination_order.hpp"
+// Parallel calibration of independent branches
+#include "thread_pool.hpp"
+// Cancellation checkpoints
+#include "async_query.hpp"
+// Vector container
+#include <vector>
+// Shared snapshot ownership
+#include <memory>
+// Algorithm utilities
+#include <algorithm>
+// Exception handling
+#include <stdexcept>
+// Level callbacks
+#include <functional>
+
+/**
+ * JunctionTree triangulates a compiled network into a forest of cliques.
+ * Every CPT is assigned to one clique, and every variable has a home clique
+ * (the smallest clique containing it) where its evidence is entered.
+ */
+class JunctionTree {
+public:
+    /**
+     * Structure representing a clique of the tree
+     */
+    struct Clique {
+        std::vector<int> variables;   // Variables in the clique (sorted)
+        std::vector<int> separator;   // Variables shared with the parent
+        int parent = -1;              // Parent clique, or -1 for a root
+        std::vector<int> children;    // Child cliques
+        Factor potential;             // Product of the assigned CPTs
+        std::vector<int> assigned;    // Variables whose CPT is assigned here (increasing)
+        std::vector<int> evidenceVars; // Variables whose home is this clique
+    };
+
+    /**
+     * Structure holding the result of one calibration
+     */
+    struct Calibration {
+        std::vector<Factor> upward;    // Message from each clique to its parent
+        std::vector<Factor> downward;  // Message from each parent into the clique
+        std::vector<std::vector<double>> marginals; // Posterior per variable
+        double evidenceProbability = 1.0;           // P(evidence)
+    };
+
+private:
+    // Snapshot the tree indexes
+    std::shared_ptr<const CompiledNetwork> net;
+    // Cliques of the forest
+    std::vector<Clique> cliques;
+    // Home clique of each variable
+    std::vector<int> home;
+    // Cliques grouped by height (leaves first); a level's upward messages are independent
+    std::vector<std::vector<int>> heightLevels;
+    // Cliques grouped by depth (roots first); a level's downward messages are independent
+    std::vector<std::vector<int>> depthLevels;
+    // Root cliques, one per tree of the forest
+    std::vector<int> roots;
+
+    /**
+     * Apply body to every clique of a level, in parallel when a pool is given
+     */
+    static void forEachClique(const std::vector<int>& level, ThreadPool* pool,
+                              const std::function<void(int)>& body) {
+        if (pool != nullptr) {
+            pool->parallelFor(0, level.size(), [&](size_t i) { body(level[i]); });
+        } else {
+            for (int c : level) {
+                body(c);
+            }
+        }
+    }
+
+    /**
+     * Check whether sorted vector a is a subset of sorted vector b
+     */
+    static bool isSubset(const std::vector<int>& a, const std::vector<int>& b) {
+        return std::includes(b.begin(), b.end(), a.begin(), a.end());
+    }
+
+    /**
+     * Set a clique's potential to the product of its assigned CPTs
+     */
+    void buildPotential(Clique& clique) const {
+        std::vector<size_t> cards;
+        for (int v : clique.variables) {
+            cards.push_back(net->cardinality(v));
+        }
+        clique.potential = Factor(clique.variables, cards);
+        std::fill(clique.potential.getValues().begin(), clique.potential.getValues().end(), 1.0);
+        for (int v : clique.assigned) {
+            clique.potential = clique.potential.product(net->cptFactor(v));
+        }
+    }
+
+public:
+    /**
+     * Build the junction tree of a compiled network
+     * Eliminating the variables in heuristic order yields one elimination
+     * clique per variable; each clique hangs below the clique of its
+     * earliest-eliminated neighbor, and cliques contained in a child are
+     * merged into it.
+     * @param network Compiled network (every CPT must be valid)
+     * @param heuristic Triangulation heuristic
+     */
+    explicit JunctionTree(std::shared_ptr<const CompiledNetwork> network,
+                          EliminationHeuristic heuristic = EliminationHeuristic::MinFill)
+        : net(std::move(network)) {
+        int numVars = static_cast<int>(net->numNodes());
+        for (int v = 0; v < numVars; ++v) {
+            net->requireCPT(v);
+        }
+
+        // Triangulate the moral graph
+        std::vector<bool> include(numVars, true);
+        MoralGraph graph = MoralGraph::fromCSR(net->getParentOffsets(), net->getParentIndices(), include);
+        std::vector<int> all(numVars);
+        for (int v = 0; v < numVars; ++v) {
+            all[v] = v;
+        }
+        std::vector<int> order = EliminationOrdering::compute(graph, net->getCardinalities(), all, heuristic);
+        std::vector<int> position(numVars, 0);
+        for (int i = 0; i < numVars; ++i) {
+            position[order[i]] = i;
+        }
+
+        // One elimination clique per step; raw clique i belongs to order[i]
+        std::vector<std::vector<int>> raw(numVars), separator(numVars);
+        std::vector<int> parent(numVars, -1);
+        for (int i = 0; i < numVars; ++i) {
+            int v = order[i];
+            std::vector<int> nbrs(graph.neighbors(v).begin(), graph.neighbors(v).end());
+            separator[i] = nbrs;
+            raw[i] = nbrs;
+            raw[i].push_back(v);
+            std::sort(raw[i].begin(), raw[i].end());
+            for (int n : nbrs) {
+                if (parent[i] == -1 || position[n] < parent[i]) {
+                    parent[i] = position[n];
+                }
+            }
+            for (size_t a = 0; a < nbrs.size(); ++a) {
+                for (size_t b = a + 1; b < nbrs.size(); ++b) {
+                    graph.addEdge(nbrs[a], nbrs[b]);
+                }
+            }
+            graph.removeVariable(v);
+        }
+        std::vector<std::vector<int>> kids(numVars);
+        for (int i = 0; i < numVars; ++i) {
+            if (parent[i] != -1) {
+                kids[parent[i]].push_back(i);
+            }
+        }
+
+        // Merge every clique that is contained in one of its children
+        std::vector<int> mergedInto(numVars, -1);
+        for (int p = 0; p < numVars; ++p) {
+            for (int ch : kids[p]) {
+                if (!isSubset(raw[p], raw[ch])) {
+                    continue;
+                }
+                mergedInto[p] = ch;
+                parent[ch] = parent[p];
+                separator[ch] = separator[p];
+                for (int other : kids[p]) {
+                    if (other != ch) {
+                        parent[other] = ch;
+                        kids[ch].push_back(other);
+                    }
+                }
+                if (parent[p] != -1) {
+                    std::replace(kids[parent[p]].begin(), kids[parent[p]].end(), p, ch);
+                }
+                break;
+            }
+        }
+        auto resolve = [&](int i) {
+            while (mergedInto[i] != -1) {
+                i = mergedInto[i];
+            }
+            return i;
+        };
+
+        // Compact the surviving cliques
+        std::vector<int> cliqueId(numVars, -1);
+        for (int i = 0; i < numVars; ++i) {
+            if (mergedInto[i] == -1) {
+                cliqueId[i] = static_cast<int>(cliques.size());
+                cliques.emplace_back();
+                cliques.back().variables = raw[i];
+            }
+        }
+        for (int i = 0; i < numVars; ++i) {
+            if (mergedInto[i] != -1) {
+                continue;
+            }
+            Clique& clique = cliques[cliqueId[i]];
+            std::sort(separator[i].begin(), separator[i].end());
+            clique.separator = separator[i];
+            if (parent[i] != -1) {
+                clique.parent = cliqueId[parent[i]];
+                cliques[clique.parent].children.push_back(cliqueId[i]);
+            }
+        }
+
+        // Clique potentials: each CPT goes to the first-eliminated family member
+        for (int v = 0; v < numVars; ++v) {
+            int first = position[v];
+            for (int p : net->parents(v)) {
+                first = std::min(first, position[p]);
+            }
+            cliques[cliqueId[resolve(first)]].assigned.push_back(v);
+        }
+        for (Clique& clique : cliques) {
+            buildPotential(clique);
+        }
+
+        // Home clique of each variable: the smallest clique containing it
+        home.assign(numVars, -1);
+        for (size_t c = 0; c < cliques.size(); ++c) {
+            for (int v : cliques[c].variables) {
+                if (home[v] == -1 || cliques[c].potential.size() < cliques[home[v]].potential.size()) {
+                    home[v] = static_cast<int>(c);
+                }
+            }
+        }
+        for (int v = 0; v < numVars; ++v) {
+            cliques[home[v]].evidenceVars.push_back(v);
+        }
+
+        // Schedules: depth from the roots down, height from the leaves up
+        std::vector<int> depth(cliques.size(), 0), height(cliques.size(), 0);
+        std::vector<int> preOrder;
+        for (size_t c = 0; c < cliques.size(); ++c) {
+            if (cliques[c].parent == -1) {
+                roots.push_back(static_cast<int>(c));
+            }
+        }
+        std::vector<int> stack(roots.rbegin(), roots.rend());
+        while (!stack.empty()) {
+            int c = stack.back();
+            stack.pop_back();
+            preOrder.push_back(c);
+            for (int ch : cliques[c].children) {
+                depth[ch] = depth[c] + 1;
+                stack.push_back(ch);
+            }
+        }
+        for (auto it = preOrder.rbegin(); it != preOrder.rend(); ++it) {
+            int p = cliques[*it].parent;
+            if (p != -1) {
+                height[p] = std::max(height[p], height[*it] + 1);
+            }
+        }
+        for (int c : preOrder) {
+            if (static_cast<size_t>(depth[c]) >= depthLevels.size()) {
+                depthLevels.resize(depth[c] + 1);
+            }
+            if (static_cast<size_t>(height[c]) >= heightLevels.size()) {
+                heightLevels.resize(height[c] + 1);
+            }
+            depthLevels[depth[c]].push_back(c);
+            heightLevels[height[c]].push_back(c);
+        }
+    }
+
+    /**
+     * Rebase the tree on a snapshot with the same structure
+     * The cliques, schedules and home cliques are kept; only the cliques
+     * holding a CPT that differs between the snapshots recompute their
+     * potential, so a CPT update does not triangulate again. The result is
+     * the tree the constructor would build for the new snapshot.
+     * @param next Snapshot with the same nodes and parents
+     * @return Tree over the new snapshot
+     */
+    std::shared_ptr<const JunctionTree> withNetwork(std::shared_ptr<const CompiledNetwork> next) const {
+        if (!next->sameStructure(*net)) {
+            throw std::runtime_error("Junction tree can only be rebased on the same structure");
+        }
+        std::shared_ptr<JunctionTree> tree = std::make_shared<JunctionTree>(*this);
+        tree->net = std::move(next);
+        for (Clique& clique : tree->cliques) {
+            bool changed = false;
+            for (int v : clique.assigned) {
+                tree->net->requireCPT(v);
+                changed = changed || tree->net->cpt(v) != net->cpt(v) || tree->net->cptModel(v) != net->cptModel(v);
+            }
+            if (changed) {
+                tree->buildPotential(clique);
+            }
+        }
+        return tree;
+    }
+
+    /**
+     * Calibrate the tree for one evidence set
+     * Runs an upward (collect) and a downward (distribute) Shafer-Shenoy
+     * pass; messages are left unnormalized so P(evidence) is exact. With a
+     * pool, the cliques of each level run in parallel and large clique
+     * products are split across threads; the results are identical to a
+     * serial calibration.
+     * @param evidenceState Observed state per variable, or -1
+     * @param pool Optional thread pool
+     * @return Messages, every variable's posterior, and P(evidence)
+     */
+    Calibration calibrate(const std::vector<int>& evidenceState, ThreadPool* pool = nullptr) const {
+        if (evidenceState.size() != net->numNodes()) {
+            throw std::runtime_error("Evidence size does not match network");
+        }
+        LBN_PHASE("calibrate");
+        size_t numCliques = cliques.size();
+        Calibration result;
+        result.upward.resize(numCliques);
+        result.downward.resize(numCliques);
+        std::vector<Factor> local(numCliques);
+        for (size_t c = 0; c < numCliques; ++c) {
+            local[c] = localPotential(static_cast<int>(c), evidenceState);
+        }
+
+        // Collect: children send to parents, one height level at a time
+        size_t completedLevels = 0;
+        size_t totalLevels = heightLevels.size() + depthLevels.size();
+        {
+            LBN_PHASE("collect");
+            for (const std::vector<int>& level : heightLevels) {
+                QueryControl::checkpoint(completedLevels++, totalLevels);
+                forEachClique(level, pool, [&](int c) {
+                    if (cliques[c].parent == -1) {
+                        return;
+                    }
+                    Factor belief = local[c];
+                    for (int ch : cliques[c].children) {
+                        belief = belief.product(result.upward[ch], pool);
+                    }
+                    result.upward[c] = belief.project(cliques[c].separator);
+                    LBN_COUNT(MessagesSent, 1);
+                });
+            }
+        }
+
+        // Distribute: parents send to children, then form clique beliefs
+        std::vector<Factor> beliefs(numCliques);
+        {
+            LBN_PHASE("distribute");
+            for (const std::vector<int>& level : depthLevels) {
+                QueryControl::checkpoint(completedLevels++, totalLevels);
+                forEachClique(level, pool, [&](int c) {
+                    Factor inbound = local[c];
+                    if (cliques[c].parent != -1) {
+                        inbound = inbound.product(result.downward[c], pool);
+                    }
+                    const std::vector<int>& children = cliques[c].children;
+                    for (size_t i = 0; i < children.size(); ++i) {
+                        Factor message = inbound;
+                        for (size_t j = 0; j < children.size(); ++j) {
+                            if (j != i) {
+                                message = message.product(result.upward[children[j]], pool);
+                            }
+                        }
+                        result.downward[children[i]] = message.project(cliques[children[i]].separator);
+                        LBN_COUNT(MessagesSent, 1);
+                    }
+                    beliefs[c] = inbound;
+                    for (int ch : children) {
+                        beliefs[c] = beliefs[c].product(result.upward[ch], pool);
+                    }
+                });
+            }
+        }
+        for (int root : roots) {
+            result.evidenceProbability *= beliefs[root].sum();
+        }
+
+        // Read each marginal off its home clique
+        result.marginals.resize(net->numNodes());
+        for (size_t v = 0; v < net->numNodes(); ++v) {
+            Factor marginal = beliefs[home[v]].project({static_cast<int>(v)});
+            marginal.normalize();
+            result.marginals[v] = marginal.getValues();
+        }
+        return result;
+    }
+
+    /**
+     * Clique potential with the evidence entered at this clique
+     * @param c Clique index
+     * @param evidenceState Observed state per variable, or -1
+     * @return Assigned CPT product times the home-variable indicators
+     */
+    Factor localPotential(int c, const std::vector<int>& evidenceState) const {
+        Factor local = cliques[c].potential;
+        for (int v : cliques[c].evidenceVars) {
+            if (evidenceState[v] != -1) {
+                local.applyIndicator(v, static_cast<size_t>(evidenceState[v]));
+            }
+        }
+        return local;
+    }
+
+    /**
+     * Get the snapshot this tree was built from
+     * @return Shared pointer to the compiled network
+     */
+    const std::shared_ptr<const CompiledNetwork>& network() const {
+        return net;
+    }
+
+    /**
+     * Get number of cliques
+     * @return Number of cliques in the forest
+     */
+    size_t numCliques() const {
+        return cliques.size();
+    }
+
+    /**
+     * Get a clique
+     * @param c Clique index
+     * @return Reference to the clique
+     */
+    const Clique& clique(int c) const {
+        return cliques[c];
+    }
+
+    /**
+     * Get the home clique of a variable
+     * @param v Variable index
+     * @return Index of the smallest clique containing v
+     */
+    int homeClique(int v) const {
+        return home[v];
+    }
+
+    /**
+     * Get the largest clique table size
+     * @return Entries of the largest clique potential
+     */
+    size_t maxCliqueSize() const {
+        size_t largest = 0;
+        for (const Clique& clique : cliques) {
+            largest = std::max(largest, clique.potential.size());
+        }
+        return largest;
+    }
+};
+
+#endif // JUNCTION_TREE_HPP
@@ -0,0 +1,212 @@
+/*
+ * message_store.hpp - Flat, edge-indexed message buffers for belief propagation
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements MessageStore, which keeps every lambda and pi
+ * message of a belief propagation run in one preallocated arena. Messages
+ * are addressed by directed-edge ID (the CSR parent edge of a compiled
+ * network) and are contiguous, state-indexed slices, so message passing
+ * reads and writes plain doubles and allocates nothing after setup.
+ */
+
+#ifndef MESSAGE_STORE_HPP
+#define MESSAGE_STORE_HPP
+
+// Compiled network (edge layout)
+#include "compiled_network.hpp"
+// Vector container
+#include <vector>
+// std::fill, std::copy, std::max
+#include <algorithm>
+// Exceptions
+#include <stdexcept>
+
+/**
+ * MessageStore holds two messages per edge, lambda (child -> parent) and
+ * pi (parent -> child), each over the states of the edge's parent.
+ * A double-buffered store reads from the front buffer and writes to a back
+ * buffer until swapBuffers() (flooding schedules) or until single messages
+ * are published (residual schedules); a single-buffered store writes in
+ * place.
+ */
+class MessageStore {
+private:
+    // Slice offsets: edge e spans [offsets[e], offsets[e + 1]) of each half
+    std::vector<size_t> offsets;
+    // Front buffer: all lambda slices, then all pi slices
+    std::vector<double> front;
+    // Back buffer (empty when single-buffered)
+    std::vector<double> back;
+    // Longest message
+    size_t maxLength = 0;
+
+    /**
+     * Buffer that writes go to
+     */
+    std::vector<double>& target() {
+        return back.empty() ? front : back;
+    }
+
+public:
+    /**
+     * Default constructor: no edges
+     */
+    MessageStore() : offsets(1, 0) {}
+
+    /**
+     * Constructor with one message length per edge
+     * @param lengths Number of states of each edge's messages
+     * @param doubleBuffered Whether writes go to a separate back buffer
+     */
+    explicit MessageStore(const std::vector<size_t>& lengths, bool doubleBuffered = false)
+        : offsets(1, 0) {
+        offsets.reserve(lengths.size() + 1);
+        for (size_t length : lengths) {
+            offsets.push_back(offsets.back() + length);
+            maxLength = std::max(maxLength, length);
+        }
+        front.assign(2 * offsets.back(), 0.0);
+        if (doubleBuffered) {
+            back.assign(front.size(), 0.0);
+        }
+        LBN_COUNT(BytesAllocated, (front.size() + back.size()) * sizeof(double));
+    }
+
+    /**
+     * Build the store for every edge of a compiled network
+     * @param net Compiled network; edge e links getParentIndices()[e] to its child
+     * @param doubleBuffered Whether writes go to a separate back buffer
+     * @return Store with messages over each edge's parent states
+     */
+    static MessageStore forNetwork(const CompiledNetwork& net, bool doubleBuffered = false) {
+        std::vector<size_t> lengths;
+        lengths.reserve(net.getParentIndices().size());
+        for (int parent : net.getParentIndices()) {
+            lengths.push_back(net.cardinality(parent));
+        }
+        return MessageStore(lengths, doubleBuffered);
+    }
+
+    /**
+     * Get number of edges
+     * @return Number of directed edges
+     */
+    size_t numEdges() const {
+        return offsets.size() - 1;
+    }
+
+    /**
+     * Get the length of an edge's messages
+     * @param e Edge ID
+     * @return Number of states
+     */
+    size_t length(size_t e) const {
+        return offsets[e + 1] - offsets[e];
+    }
+
+    /**
+     * Get the length of the longest message
+     * @return Largest number of states over all edges
+     */
+    size_t getMaxLength() const {
+        return maxLength;
+    }
+
+    /**
+     * Check whether writes go to a back buffer
+     * @return True if double-buffered
+     */
+    bool isDoubleBuffered() const {
+        return !back.empty();
+    }
+
+    /**
+     * Current lambda message of an edge (child -> parent)
+     * @param e Edge ID
+     * @return Pointer to length(e) values
+     */
+    const double* lambda(size_t e) const {
+        return front.data() + offsets[e];
+    }
+
+    /**
+     * Current pi message of an edge (parent -> child)
+     * @param e Edge ID
+     * @return Pointer to length(e) values
+     */
+    const double* pi(size_t e) const {
+        return front.data() + offsets.back() + offsets[e];
+    }
+
+    /**
+     * Writable lambda message of an edge (the back buffer when double-buffered)
+     * @param e Edge ID
+     * @return Pointer to length(e) values
+     */
+    double* writeLambda(size_t e) {
+        return target().data() + offsets[e];
+    }
+
+    /**
+     * Writable pi message of an edge (the back buffer when double-buffered)
+     * @param e Edge ID
+     * @return Pointer to length(e) values
+     */
+    double* writePi(size_t e) {
+        return target().data() + offsets.back() + offsets[e];
+    }
+
+    /**
+     * Set every lambda message to all ones and every pi message to uniform,
+     * in both buffers
+     */
+    void reset() {
+        size_t total = offsets.back();
+        for (size_t e = 0; e < numEdges(); ++e) {
+            double uniform = 1.0 / static_cast<double>(length(e));
+            std::fill(front.begin() + offsets[e], front.begin() + offsets[e + 1], 1.0);
+            std::fill(front.begin() + total + offsets[e], front.begin() + total + offsets[e + 1], uniform);
+        }
+        if (!back.empty()) {
+            std::copy(front.begin(), front.end(), back.begin());
+        }
+    }
+
+    /**
+     * Publish the pending lambda message of one edge (residual schedules)
+     * No-op when single-buffered.
+     * @param e Edge ID
+     */
+    void publishLambda(size_t e) {
+        if (!back.empty()) {
+            std::copy(back.begin() + offsets[e], back.begin() + offsets[e + 1], front.begin() + offsets[e]);
+        }
+    }
+
+    /**
+     * Publish the pending pi message of one edge (residual schedules)
+     * No-op when single-buffered.
+     * @param e Edge ID
+     */
+    void publishPi(size_t e) {
+        if (!back.empty()) {
+            size_t half = offsets.back();
+            std::copy(back.begin() + half + offsets[e], back.begin() + half + offsets[e + 1],
+                      front.begin() + half + offsets[e]);
+        }
+    }
+
+    /**
+     * Publish the writes of a sweep: the back buffer becomes current, and
+     * the new back buffer starts as a copy of it so unwritten messages carry
+     * over. No-op when single-buffered.
+     */
+    void swapBuffers() {
+        if (!back.empty()) {
+            front.swap(back);
+            std::copy(front.begin(), front.end(), back.begin());
+        }
+    }
+};
+
+#endif // MESSAGE_STORE_HPP
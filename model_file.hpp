@@ -0,0 +1,385 @@
+/*
+ * model_file.hpp - Binary, memory-mapped model file format
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements the versioned binary model format. A file holds a
+ * fixed header, a string table, the CSR structure of the compiled network
+ * and 64-byte aligned CPT blocks stored as exact IEEE doubles. Loading maps
+ * the file read-only, so the CPT blocks of the resulting CompiledNetwork
+ * point straight into the mapping and are never copied or parsed.
+ *
+ * Layout (all integers in native byte order, checked by byteOrder):
+ *   Header
+ *   String table: per node its ID, name and state names, each as a
+ *                 uint32 length followed by the bytes
+ *   Structure:    uint64 cardinalities[n], uint64 parentOffsets[n + 1],
+ *                 uint64 cptOffsets[n], uint8 cptStatus[n] (padded to 8),
+ *                 int32 parentIndices[m]
+ *   CPT section:  64-byte aligned, one aligned block per valid CPT
+ */
+
+#ifndef MODEL_FILE_HPP
+#define MODEL_FILE_HPP
+
+// Compiled network snapshot
+#include "compiled_network.hpp"
+// Vector container
+#include <vector>
+// String operations
+#include <string>
+// Shared ownership of the mapping
+#include <memory>
+// File output
+#include <fstream>
+// Fixed-width integers
+#include <cstdint>
+// Memory copy and comparison
+#include <cstring>
+// Algorithm utilities
+#include <algorithm>
+// Exception handling
+#include <stdexcept>
+// File descriptors
+#include <fcntl.h>
+#include <unistd.h>
+// File size
+#include <sys/stat.h>
+// Memory mapping
+#include <sys/mman.h>
+
+/**
+ * ModelFile reads and writes compiled networks in the binary model format
+ */
+class ModelFile {
+public:
+    // Current format version
+    static constexpr uint32_t kVersion = 1;
+    // Written as-is; reads back differently on a machine of other endianness
+    static constexpr uint32_t kByteOrder = 0x01020304;
+
+    /**
+     * Structure of the fixed file header
+     */
+    struct Header {
+        char magic[8];              // "LBNMODEL"
+        uint32_t version;           // Format version
+        uint32_t byteOrder;         // kByteOrder as written
+        uint64_t numNodes;          // Number of variables
+        uint64_t numParents;        // Number of CSR parent entries
+        uint64_t stringsOffset;     // Byte offset of the string table
+        uint64_t structureOffset;   // Byte offset of the structure section
+        uint64_t cptOffset;         // Byte offset of the CPT section
+        uint64_t cptCount;          // Doubles in the CPT section
+        uint64_t fileSize;          // Total file size in bytes
+    };
+
+private:
+    /**
+     * Get the magic bytes every model file starts with
+     */
+    static const char* magic() {
+        return "LBNMODEL";
+    }
+
+    /**
+     * Round a byte offset up to a multiple of an alignment
+     */
+    static uint64_t alignUp(uint64_t offset, uint64_t alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    /**
+     * Append raw bytes to a buffer
+     */
+    static void appendBytes(std::vector<char>& buffer, const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        buffer.insert(buffer.end(), bytes, bytes + size);
+    }
+
+    /**
+     * Append a length-prefixed string to a buffer
+     */
+    static void appendString(std::vector<char>& buffer, const std::string& text) {
+        uint32_t length = static_cast<uint32_t>(text.size());
+        appendBytes(buffer, &length, sizeof(length));
+        appendBytes(buffer, text.data(), text.size());
+    }
+
+    /**
+     * Bounds-checked reader over a mapped byte range
+     */
+    class Reader {
+    private:
+        const char* base;
+        uint64_t position;
+        uint64_t limit;
+        const std::string& filename;
+
+    public:
+        Reader(const char* data, uint64_t begin, uint64_t end, const std::string& file)
+            : base(data), position(begin), limit(end), filename(file) {
+            if (begin > end) {
+                throw std::runtime_error("Corrupt model file header: " + filename);
+            }
+        }
+
+        /**
+         * Pointer to the next count bytes, advancing past them
+         */
+        const char* take(uint64_t count) {
+            if (count > limit - position) {
+                throw std::runtime_error("Truncated model file: " + filename);
+            }
+            const char* data = base + position;
+            position += count;
+            return data;
+        }
+
+        /**
+         * Read a length-prefixed string
+         */
+        std::string readString() {
+            uint32_t length;
+            std::memcpy(&length, take(sizeof(length)), sizeof(length));
+            const char* data = take(length);
+            return std::string(data, length);
+        }
+
+        /**
+         * Read an array of trivially copyable values
+         */
+        template <typename T>
+        void readArray(std::vector<T>& values, uint64_t count) {
+            if (count > (limit - position) / sizeof(T)) {
+                throw std::runtime_error("Truncated model file: " + filename);
+            }
+            values.resize(count);
+            std::memcpy(values.data(), take(count * sizeof(T)), count * sizeof(T));
+        }
+
+        /**
+         * Skip to a multiple of an alignment
+         */
+        void align(uint64_t alignment) {
+            take(alignUp(position, alignment) - position);
+        }
+    };
+
+public:
+    /**
+     * Check whether a file starts with the model file magic
+     * @param filename Path of the file
+     * @return True if the file is a binary model file
+     */
+    static bool isModelFile(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        char bytes[8] = {};
+        file.read(bytes, sizeof(bytes));
+        return file.gcount() == static_cast<std::streamsize>(sizeof(bytes)) &&
+               std::memcmp(bytes, magic(), sizeof(bytes)) == 0;
+    }
+
+    /**
+     * Write a compiled network to a binary model file
+     * @param net Compiled network
+     * @param filename Output filename
+     */
+    static void write(const CompiledNetwork& net, const std::string& filename) {
+        size_t numNodes = net.numNodes();
+        Header header = {};
+        std::memcpy(header.magic, magic(), sizeof(header.magic));
+        header.version = kVersion;
+        header.byteOrder = kByteOrder;
+        header.numNodes = numNodes;
+        header.numParents = net.getParentIndices().size();
+
+        // String table
+        std::vector<char> buffer(sizeof(Header));
+        header.stringsOffset = buffer.size();
+        for (size_t v = 0; v < numNodes; ++v) {
+            int i = static_cast<int>(v);
+            appendString(buffer, net.nodeId(i));
+            appendString(buffer, net.nodeName(i));
+            for (const std::string& state : net.states(i)) {
+                appendString(buffer, state);
+            }
+        }
+
+        // Structure
+        buffer.resize(alignUp(buffer.size(), 8), 0);
+        header.structureOffset = buffer.size();
+        std::vector<uint64_t> cardinalities(net.getCardinalities().begin(), net.getCardinalities().end());
+        std::vector<uint64_t> offsets(net.getParentOffsets().begin(), net.getParentOffsets().end());
+        std::vector<uint64_t> cptOffsets(numNodes, 0);
+        std::vector<uint8_t> status(numNodes);
+        uint64_t cptCount = 0;
+        for (size_t v = 0; v < numNodes; ++v) {
+            status[v] = static_cast<uint8_t>(net.getCPTStatus(static_cast<int>(v)));
+            if (net.getCPTStatus(static_cast<int>(v)) == CompiledNetwork::CPTStatus::Valid) {
+                cptOffsets[v] = cptCount;
+                cptCount += alignUp(net.cptSize(static_cast<int>(v)),
+                                    CompiledNetwork::kAlignment / sizeof(double));
+            }
+        }
+        appendBytes(buffer, cardinalities.data(), cardinalities.size() * sizeof(uint64_t));
+        appendBytes(buffer, offsets.data(), offsets.size() * sizeof(uint64_t));
+        appendBytes(buffer, cptOffsets.data(), cptOffsets.size() * sizeof(uint64_t));
+        appendBytes(buffer, status.data(), status.size());
+        buffer.resize(alignUp(buffer.size(), 8), 0);
+        appendBytes(buffer, net.getParentIndices().data(), net.getParentIndices().size() * sizeof(int32_t));
+
+        // CPT section (dense blocks are written straight from the snapshot,
+        // structured models are expanded)
+        buffer.resize(alignUp(buffer.size(), CompiledNetwork::kAlignment), 0);
+        header.cptOffset = buffer.size();
+        header.cptCount = cptCount;
+        header.fileSize = header.cptOffset + cptCount * sizeof(double);
+        std::memcpy(buffer.data(), &header, sizeof(Header));
+
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot open file for writing: " + filename);
+        }
+        file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        std::vector<char> padding(CompiledNetwork::kAlignment, 0);
+        std::vector<double> expanded;
+        for (size_t v = 0; v < numNodes; ++v) {
+            int i = static_cast<int>(v);
+            if (net.getCPTStatus(i) != CompiledNetwork::CPTStatus::Valid) {
+                continue;
+            }
+            size_t bytes = net.cptSize(i) * sizeof(double);
+            file.write(reinterpret_cast<const char*>(net.denseCPT(i, expanded)), static_cast<std::streamsize>(bytes));
+            size_t padded = alignUp(bytes, CompiledNetwork::kAlignment);
+            file.write(padding.data(), static_cast<std::streamsize>(padded - bytes));
+        }
+        if (!file) {
+            throw std::runtime_error("Failed to write model file: " + filename);
+        }
+    }
+
+    /**
+     * Map a binary model file into a compiled network
+     * Names and structure are decoded; CPT blocks alias the read-only mapping,
+     * which stays alive as long as the snapshot does.
+     * @param filename Path of the model file
+     * @return Shared pointer to the compiled network
+     */
+    static std::shared_ptr<const CompiledNetwork> map(const std::string& filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error("Cannot open file for reading: " + filename);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(Header))) {
+            ::close(fd);
+            throw std::runtime_error("Not a model file: " + filename);
+        }
+        size_t size = static_cast<size_t>(info.st_size);
+        void* address = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED) {
+            throw std::runtime_error("Cannot map model file: " + filename);
+        }
+        std::shared_ptr<const void> mapping(address, [size](const void* p) {
+            ::munmap(const_cast<void*>(p), size);
+        });
+        const char* base = static_cast<const char*>(address);
+
+        Header header;
+        std::memcpy(&header, base, sizeof(Header));
+        if (std::memcmp(header.magic, magic(), sizeof(header.magic)) != 0) {
+            throw std::runtime_error("Not a model file: " + filename);
+        }
+        if (header.byteOrder != kByteOrder) {
+            throw std::runtime_error("Model file has a different byte order: " + filename);
+        }
+        if (header.version != kVersion) {
+            throw std::runtime_error("Unsupported model file version " +
+                                     std::to_string(header.version) + ": " + filename);
+        }
+        if (header.fileSize != size || header.cptOffset > size ||
+            header.cptOffset % CompiledNetwork::kAlignment != 0 ||
+            header.cptCount > (size - header.cptOffset) / sizeof(double)) {
+            throw std::runtime_error("Corrupt model file header: " + filename);
+        }
+
+        std::shared_ptr<CompiledNetwork> net = std::make_shared<CompiledNetwork>();
+        uint64_t n = header.numNodes;
+
+        // Structure first: the string table needs the cardinalities
+        Reader structure(base, header.structureOffset, header.cptOffset, filename);
+        std::vector<uint64_t> cardinalities, offsets, cptOffsets;
+        std::vector<uint8_t> status;
+        std::vector<int32_t> parents;
+        structure.readArray(cardinalities, n);
+        structure.readArray(offsets, n + 1);
+        structure.readArray(cptOffsets, n);
+        structure.readArray(status, n);
+        structure.align(8);
+        structure.readArray(parents, header.numParents);
+        if (offsets[0] != 0 || offsets[n] != header.numParents) {
+            throw std::runtime_error("Corrupt parent array in model file: " + filename);
+        }
+
+        // Names (bounds every cardinality by the file size)
+        Reader strings(base, header.stringsOffset, header.structureOffset, filename);
+        net->nodeIds.resize(n);
+        net->nodeNames.resize(n);
+        net->stateNames.resize(n);
+        for (uint64_t v = 0; v < n; ++v) {
+            net->nodeIds[v] = strings.readString();
+            net->nodeNames[v] = strings.readString();
+            for (uint64_t s = 0; s < cardinalities[v]; ++s) {
+                net->stateNames[v].push_back(strings.readString());
+            }
+            if (!net->indexById.emplace(net->nodeIds[v], static_cast<int>(v)).second) {
+                throw std::runtime_error("Duplicate node " + net->nodeIds[v] + " in model file: " + filename);
+            }
+        }
+
+        net->cardinalities.assign(cardinalities.begin(), cardinalities.end());
+        net->parentIndices.assign(parents.begin(), parents.end());
+        net->cptData.assign(n, nullptr);
+        net->cptSizes.assign(n, 0);
+        net->cptStatus.assign(n, CompiledNetwork::CPTStatus::Missing);
+        net->cptModels.assign(n, nullptr);
+        const double* cptBase = reinterpret_cast<const double*>(base + header.cptOffset);
+        for (uint64_t v = 0; v < n; ++v) {
+            if (offsets[v + 1] < offsets[v] || offsets[v + 1] > header.numParents) {
+                throw std::runtime_error("Corrupt parent array in model file: " + filename);
+            }
+            for (uint64_t e = offsets[v]; e < offsets[v + 1]; ++e) {
+                // Indices are topological, so every parent precedes its child
+                if (parents[e] < 0 || static_cast<uint64_t>(parents[e]) >= v) {
+                    throw std::runtime_error("Corrupt parent array in model file: " + filename);
+                }
+            }
+            net->parentOffsets.push_back(offsets[v + 1]);
+            size_t entries = net->appendFamilyStrides(static_cast<int>(v));
+
+            if (status[v] > static_cast<uint8_t>(CompiledNetwork::CPTStatus::Mismatch)) {
+                throw std::runtime_error("Corrupt CPT status in model file: " + filename);
+            }
+            net->cptStatus[v] = static_cast<CompiledNetwork::CPTStatus>(status[v]);
+            if (net->cptStatus[v] == CompiledNetwork::CPTStatus::Valid) {
+                uint64_t limit = header.cptCount;
+                for (uint64_t e = offsets[v]; e < offsets[v + 1] && limit > 0; ++e) {
+                    limit /= std::max<uint64_t>(1, cardinalities[parents[e]]);
+                }
+                if (cardinalities[v] > limit || cptOffsets[v] > header.cptCount ||
+                    entries > header.cptCount - cptOffsets[v]) {
+                    throw std::runtime_error("CPT block out of range in model file: " + filename);
+                }
+                net->cptData[v] = cptBase + cptOffsets[v];
+                net->cptSizes[v] = entries;
+            }
+        }
+
+        net->buildChildIndex();
+        net->storage.push_back(mapping);
+        return net;
+    }
+};
+
+#endif // MODEL_FILE_HPP
@@ -0,0 +1,140 @@
+/*
+ * model_snapshot.hpp - Versioned, copy-on-write publication of compiled models
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements SnapshotPublisher, the publication point of a
+ * network's immutable ModelSnapshots. Readers load the current snapshot
+ * with one atomic shared_ptr load and never take a lock; a query keeps the
+ * snapshot it started on alive, so it finishes on that version however many
+ * versions are published meanwhile, and the old version is freed when its
+ * last reader lets go (RCU with reference counts for grace periods).
+ * Writers are serialized by one lock: they build the next CompiledNetwork,
+ * typically derived from the current one so unchanged CPT storage is
+ * shared, and swap it in with a new version number.
+ */
+
+#ifndef MODEL_SNAPSHOT_HPP
+#define MODEL_SNAPSHOT_HPP
+
+// Index-based network snapshot
+#include "compiled_network.hpp"
+// Shared snapshot ownership and atomic publication
+#include <memory>
+// Version counter
+#include <atomic>
+// Writer lock
+#include <mutex>
+// Fixed-width integers
+#include <cstdint>
+
+/**
+ * One published version of a model
+ */
+struct ModelSnapshot {
+    std::shared_ptr<const CompiledNetwork> network;  // Immutable compiled model
+    uint64_t version = 0;                            // Model version it was published as
+};
+
+/**
+ * SnapshotPublisher holds the current ModelSnapshot of a network
+ * The snapshot pointer is only accessed with atomic loads and stores.
+ * Copying a publisher shares the current snapshot (it is immutable) and
+ * copies the version; the lock is never shared.
+ */
+class SnapshotPublisher {
+private:
+    // Current snapshot (null until built, and after a structural change)
+    mutable std::shared_ptr<const ModelSnapshot> current;
+    // Latest model version, published or not
+    std::atomic<uint64_t> version{0};
+    // Serializes writers and lazy builds
+    mutable std::mutex writeMutex;
+
+public:
+    SnapshotPublisher() = default;
+
+    SnapshotPublisher(const SnapshotPublisher& other) : current(other.load()), version(other.getVersion()) {}
+
+    SnapshotPublisher& operator=(const SnapshotPublisher& other) {
+        if (this != &other) {
+            std::shared_ptr<const ModelSnapshot> snapshot = other.load();
+            uint64_t otherVersion = other.getVersion();
+            std::lock_guard<std::mutex> lock(writeMutex);
+            version.store(otherVersion);
+            std::atomic_store(&current, snapshot);
+        }
+        return *this;
+    }
+
+    /**
+     * Get the current snapshot without blocking
+     * @return Snapshot, or null if the model changed since the last build
+     */
+    std::shared_ptr<const ModelSnapshot> load() const {
+        return std::atomic_load(&current);
+    }
+
+    /**
+     * Get the latest model version
+     */
+    uint64_t getVersion() const {
+        return version.load();
+    }
+
+    /**
+     * Get the current snapshot, building it first if there is none
+     * At most one thread builds; the others wait for its result.
+     * @param build Callable returning the compiled network of the current model
+     * @return Current snapshot
+     */
+    template <typename Build>
+    std::shared_ptr<const ModelSnapshot> acquire(Build build) const {
+        std::shared_ptr<const ModelSnapshot> snapshot = load();
+        if (snapshot) {
+            return snapshot;
+        }
+        std::lock_guard<std::mutex> lock(writeMutex);
+        snapshot = load();
+        if (!snapshot) {
+            snapshot = std::make_shared<const ModelSnapshot>(ModelSnapshot{build(), version.load()});
+            std::atomic_store(&current, snapshot);
+        }
+        return snapshot;
+    }
+
+    /**
+     * Publish the next version under the writer lock
+     * @param derive Callable taking the current network (null if none is
+     *               built) and returning the next one; returning null
+     *               leaves the next version to be built on first use
+     * @return The new version
+     */
+    template <typename Derive>
+    uint64_t update(Derive derive) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        std::shared_ptr<const ModelSnapshot> previous = load();
+        std::shared_ptr<const CompiledNetwork> next =
+            derive(previous ? previous->network : std::shared_ptr<const CompiledNetwork>());
+        uint64_t nextVersion = version.load() + 1;
+        version.store(nextVersion);
+        std::atomic_store(&current, next ? std::make_shared<const ModelSnapshot>(ModelSnapshot{next, nextVersion})
+                                         : std::shared_ptr<const ModelSnapshot>());
+        return nextVersion;
+    }
+
+    /**
+     * Drop the snapshot after a structural change and bump the version
+     */
+    void invalidate() {
+        update([](const std::shared_ptr<const CompiledNetwork>&) { return std::shared_ptr<const CompiledNetwork>(); });
+    }
+
+    /**
+     * Lock out writers and lazy builds (e.g. to read the source maps)
+     */
+    std::unique_lock<std::mutex> lockWriters() const {
+        return std::unique_lock<std::mutex>(writeMutex);
+    }
+};
+
+#endif // MODEL_SNAPSHOT_HPP
@@ -0,0 +1,1318 @@
+/*
+ * model_text.hpp - Streaming text model formats
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements the human-readable NODES / EDGES / CPTS format and
+ * importers for the BIF and XMLBIF interchange formats. Input is read in
+ * fixed-size chunks and probabilities are written straight into the
+ * ConditionalProbabilityTable storage, so no file is ever held in memory
+ * as a whole. Parse errors carry the line and column they occurred at.
+ * Probabilities are written in the shortest decimal form that reads back
+ * to the same double, so a save/load round trip is lossless.
+ */
+
+#ifndef MODEL_TEXT_HPP
+#define MODEL_TEXT_HPP
+
+// Node structure
+#include "node.hpp"
+// Conditional Probability Table
+#include "cpt.hpp"
+// Vector container
+#include <vector>
+// String operations
+#include <string>
+// Map container
+#include <map>
+// Stream input/output
+#include <istream>
+#include <ostream>
+// Number parsing
+#include <cstdlib>
+#include <charconv>
+// Symbol lookup table
+#include <array>
+// Number formatting
+#include <cstdio>
+// Character classes
+#include <cctype>
+// Memory move for chunk compaction
+#include <cstring>
+// Finite checks
+#include <cmath>
+// Algorithm utilities
+#include <algorithm>
+// Exception handling
+#include <stdexcept>
+
+/**
+ * ParseError reports malformed model input with its position
+ */
+class ParseError : public std::runtime_error {
+private:
+    // Description without the position
+    std::string detail;
+    // 1-based position of the error
+    size_t line;
+    size_t column;
+
+public:
+    /**
+     * Constructor with message and position
+     * @param message Description of the problem
+     * @param lineNumber 1-based line
+     * @param columnNumber 1-based column
+     * @param source Name of the input (file name), or empty
+     */
+    ParseError(const std::string& message, size_t lineNumber, size_t columnNumber,
+               const std::string& source = "")
+        : std::runtime_error((source.empty() ? "" : source + ": ") + "line " + std::to_string(lineNumber) +
+                             ", column " + std::to_string(columnNumber) + ": " + message),
+          detail(message), line(lineNumber), column(columnNumber) {}
+
+    /**
+     * Get the description without the position
+     * @return Error message
+     */
+    const std::string& getDetail() const {
+        return detail;
+    }
+
+    /**
+     * Get line of the error
+     * @return 1-based line number
+     */
+    size_t getLine() const {
+        return line;
+    }
+
+    /**
+     * Get column of the error
+     * @return 1-based column number
+     */
+    size_t getColumn() const {
+        return column;
+    }
+};
+
+/**
+ * CharStream reads an input stream in fixed-size chunks and tracks the
+ * line and column of the next character
+ */
+class CharStream {
+public:
+    // Bytes read from the underlying stream at a time
+    static constexpr size_t kChunkSize = 1 << 16;
+
+private:
+    std::istream& in;
+    std::vector<char> buffer;
+    size_t position = 0;
+    size_t count = 0;
+    size_t line = 1;
+    size_t column = 1;
+
+    /**
+     * Make at least need characters available, compacting the buffer
+     * @return True if they are available (false near the end of input)
+     */
+    bool ensure(size_t need) {
+        if (count - position >= need) {
+            return true;
+        }
+        size_t left = count - position;
+        std::memmove(buffer.data(), buffer.data() + position, left);
+        position = 0;
+        count = left;
+        while (count < need && in) {
+            in.read(buffer.data() + count, static_cast<std::streamsize>(buffer.size() - count));
+            count += static_cast<size_t>(in.gcount());
+        }
+        return count >= need;
+    }
+
+public:
+    /**
+     * Constructor with the stream to read
+     * @param input Input stream
+     */
+    explicit CharStream(std::istream& input) : in(input), buffer(kChunkSize) {}
+
+    /**
+     * Look at an upcoming character without consuming it
+     * @param ahead Characters to skip (0 is the next one)
+     * @return Character value, or -1 at the end of input
+     */
+    int peek(size_t ahead = 0) {
+        if (position + ahead < count || ensure(ahead + 1)) {
+            return static_cast<unsigned char>(buffer[position + ahead]);
+        }
+        return -1;
+    }
+
+    /**
+     * Consume the next character
+     * @return Character value, or -1 at the end of input
+     */
+    int get() {
+        if (position == count && !ensure(1)) {
+            return -1;
+        }
+        char c = buffer[position++];
+        if (c == '\n') {
+            line++;
+            column = 1;
+        } else {
+            column++;
+        }
+        return static_cast<unsigned char>(c);
+    }
+
+    /**
+     * Append characters to text while they satisfy a predicate, copying
+     * straight from the buffer (the predicate must reject '\n')
+     * @param accept Predicate on a character value
+     * @param text String to append to
+     */
+    template <typename Pred>
+    void readWhile(Pred accept, std::string& text) {
+        while (position < count || ensure(1)) {
+            size_t start = position;
+            while (position < count && accept(static_cast<unsigned char>(buffer[position]))) {
+                position++;
+            }
+            text.append(buffer.data() + start, position - start);
+            column += position - start;
+            if (position < count) {
+                return;
+            }
+        }
+    }
+
+    /**
+     * Consume text if it comes next
+     * @param text Expected characters
+     * @return True if they were consumed
+     */
+    bool accept(const char* text) {
+        size_t length = std::strlen(text);
+        for (size_t i = 0; i < length; ++i) {
+            if (peek(i) != static_cast<unsigned char>(text[i])) {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < length; ++i) {
+            get();
+        }
+        return true;
+    }
+
+    /**
+     * Build an error at the current position
+     * @param message Description of the problem
+     * @return Parse error to throw
+     */
+    ParseError error(const std::string& message) const {
+        return ParseError(message, line, column);
+    }
+
+    size_t getLine() const { return line; }
+    size_t getColumn() const { return column; }
+};
+
+/**
+ * Structure holding one lexical token
+ */
+struct Token {
+    enum class Kind {
+        End,     // End of input
+        Word,    // Bare word (names, numbers, keywords)
+        Quoted,  // Double-quoted string; never a keyword
+        Symbol   // Single punctuation character
+    };
+
+    Kind kind = Kind::End;
+    std::string text;
+    size_t line = 0;
+    size_t column = 0;
+
+    /**
+     * Check for a bare word or symbol with the given text
+     */
+    bool is(const char* value) const {
+        return (kind == Kind::Word || kind == Kind::Symbol) && text == value;
+    }
+};
+
+/**
+ * TokenStream splits a CharStream into words, quoted strings and symbols
+ */
+class TokenStream {
+public:
+    /**
+     * Comment syntax of the format
+     */
+    enum class Comments {
+        Hash,   // '#' to end of line
+        CStyle  // '//' to end of line and '/* ... */'
+    };
+
+private:
+    CharStream& chars;
+    // Characters that form single-character symbols
+    std::array<bool, 256> isSymbol{};
+    Comments comments;
+    Token lookahead;
+    bool hasLookahead = false;
+
+    /**
+     * Check for an ASCII whitespace character
+     */
+    static bool isSpace(int c) {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    /**
+     * Check whether a comment starts at the next character
+     */
+    bool atComment() {
+        int c = chars.peek();
+        if (comments == Comments::Hash) {
+            return c == '#';
+        }
+        return c == '/' && (chars.peek(1) == '/' || chars.peek(1) == '*');
+    }
+
+    /**
+     * Skip whitespace and comments
+     */
+    void skipSpace() {
+        while (true) {
+            int c = chars.peek();
+            if (isSpace(c)) {
+                chars.get();
+            } else if (atComment()) {
+                if (comments == Comments::CStyle && chars.peek(1) == '*') {
+                    size_t line = chars.getLine();
+                    size_t column = chars.getColumn();
+                    chars.get();
+                    chars.get();
+                    while (!chars.accept("*/")) {
+                        if (chars.get() == -1) {
+                            throw ParseError("unterminated comment", line, column);
+                        }
+                    }
+                } else {
+                    while (chars.peek() != -1 && chars.peek() != '\n') {
+                        chars.get();
+                    }
+                }
+            } else {
+                return;
+            }
+        }
+    }
+
+    /**
+     * Read the next token from the character stream
+     */
+    Token readToken() {
+        skipSpace();
+        Token token;
+        token.line = chars.getLine();
+        token.column = chars.getColumn();
+        int c = chars.peek();
+        if (c == -1) {
+            return token;
+        }
+        if (c == '"') {
+            chars.get();
+            token.kind = Token::Kind::Quoted;
+            while ((c = chars.get()) != '"') {
+                if (c == -1) {
+                    throw ParseError("unterminated string", token.line, token.column);
+                }
+                if (c == '\\') {
+                    c = chars.get();
+                    if (c == 'n') {
+                        c = '\n';
+                    } else if (c == 't') {
+                        c = '\t';
+                    } else if (c == 'r') {
+                        c = '\r';
+                    } else if (c == 'x' && std::isxdigit(chars.peek()) && std::isxdigit(chars.peek(1))) {
+                        char hex[3] = {static_cast<char>(chars.get()), static_cast<char>(chars.get()), 0};
+                        c = static_cast<int>(std::strtol(hex, nullptr, 16));
+                    } else if (c != '"' && c != '\\') {
+                        throw chars.error("invalid escape sequence");
+                    }
+                }
+                token.text.push_back(static_cast<char>(c));
+            }
+            return token;
+        }
+        if (isSymbol[c]) {
+            token.kind = Token::Kind::Symbol;
+            token.text.push_back(static_cast<char>(chars.get()));
+            return token;
+        }
+        // Words stop at whitespace, quotes, symbols and comments; '#' and '/'
+        // only end a word where they start a comment
+        token.kind = Token::Kind::Word;
+        auto wordChar = [this](int ch) {
+            return !isSpace(ch) && ch != '"' && ch != '#' && ch != '/' && !isSymbol[ch];
+        };
+        while (true) {
+            chars.readWhile(wordChar, token.text);
+            c = chars.peek();
+            if ((c != '#' && c != '/') || isSymbol[c] || atComment()) {
+                return token;
+            }
+            token.text.push_back(static_cast<char>(chars.get()));
+        }
+    }
+
+public:
+    /**
+     * Constructor with character source, symbol set and comment syntax
+     * @param source Character stream to tokenize
+     * @param symbolChars Characters that are tokens on their own
+     * @param commentStyle Comment syntax
+     */
+    TokenStream(CharStream& source, const std::string& symbolChars, Comments commentStyle)
+        : chars(source), comments(commentStyle) {
+        for (char c : symbolChars) {
+            isSymbol[static_cast<unsigned char>(c)] = true;
+        }
+    }
+
+    /**
+     * Look at the next token without consuming it
+     */
+    const Token& peek() {
+        if (!hasLookahead) {
+            lookahead = readToken();
+            hasLookahead = true;
+        }
+        return lookahead;
+    }
+
+    /**
+     * Consume the next token
+     */
+    Token next() {
+        if (!hasLookahead) {
+            return readToken();
+        }
+        hasLookahead = false;
+        return std::move(lookahead);
+    }
+
+    /**
+     * Consume a symbol if it comes next
+     * @return True if it was consumed
+     */
+    bool accept(const char* symbol) {
+        if (peek().kind == Token::Kind::Symbol && peek().text == symbol) {
+            next();
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Build an error at a token
+     */
+    static ParseError error(const Token& token, const std::string& message) {
+        std::string found = (token.kind == Token::Kind::End) ? "end of input" : "'" + token.text + "'";
+        return ParseError(message + " (found " + found + ")", token.line, token.column);
+    }
+
+    /**
+     * Consume a given symbol or keyword, or throw
+     */
+    Token expect(const char* value) {
+        Token token = next();
+        if (!token.is(value)) {
+            throw error(token, std::string("expected '") + value + "'");
+        }
+        return token;
+    }
+
+    /**
+     * Check that a token is a name (bare word or quoted string), or throw
+     */
+    static const Token& requireName(const Token& token, const std::string& what) {
+        if (token.kind != Token::Kind::Word && token.kind != Token::Kind::Quoted) {
+            throw error(token, "expected " + what);
+        }
+        return token;
+    }
+
+    /**
+     * Consume a name (bare word or quoted string), or throw
+     */
+    std::string expectName(const std::string& what) {
+        Token token = next();
+        return requireName(token, what).text;
+    }
+
+    /**
+     * Consume a non-negative integer, or throw
+     */
+    size_t expectCount(const std::string& what) {
+        Token token = next();
+        bool digits = token.kind == Token::Kind::Word && !token.text.empty() && token.text.size() < 19 &&
+                      std::all_of(token.text.begin(), token.text.end(),
+                                  [](char c) { return std::isdigit(static_cast<unsigned char>(c)); });
+        if (!digits) {
+            throw error(token, "expected " + what);
+        }
+        return static_cast<size_t>(std::strtoull(token.text.c_str(), nullptr, 10));
+    }
+
+    /**
+     * Consume a probability, or throw
+     */
+    double expectProbability() {
+        Token token = next();
+        double value;
+        if (token.kind != Token::Kind::Word || !parseProbability(token.text, value)) {
+            throw error(token, "expected a probability in [0, 1]");
+        }
+        return value;
+    }
+
+    /**
+     * Parse a probability (decimal or hex float) in [0, 1]
+     * @param text Number text
+     * @param value Parsed value
+     * @return True if the whole text is a valid probability
+     */
+    static bool parseProbability(const std::string& text, double& value) {
+        if (text.empty()) {
+            return false;
+        }
+        bool parsed = false;
+#if defined(__cpp_lib_to_chars)
+        // Correctly rounded like strtod, without its locale overhead
+        const char* last = text.data() + text.size();
+        std::from_chars_result result = std::from_chars(text.data(), last, value);
+        parsed = result.ec == std::errc() && result.ptr == last;
+#endif
+        if (!parsed) {
+            // Hex floats and other forms from_chars does not take
+            char* end = nullptr;
+            value = std::strtod(text.c_str(), &end);
+            parsed = *end == '\0';
+        }
+        return parsed && std::isfinite(value) && value >= 0.0 && value <= 1.0;
+    }
+};
+
+/**
+ * ModelText reads and writes networks in text formats
+ */
+class ModelText {
+public:
+    /**
+     * Structure holding a parsed model, ready to install in a network
+     */
+    struct ParsedModel {
+        std::map<std::string, Node> nodes;
+        std::map<std::string, ConditionalProbabilityTable> cpts;
+    };
+
+private:
+    /**
+     * CptFiller writes probabilities listed in a file's variable order into
+     * a CPT laid out over the node's sorted parent set, then the node
+     */
+    class CptFiller {
+    private:
+        double* target;
+        // Cardinality and CPT stride of each variable, in file order
+        std::vector<size_t> cards;
+        std::vector<size_t> strides;
+        std::vector<size_t> counter;
+        size_t offset = 0;
+        size_t remaining;
+
+    public:
+        CptFiller(ConditionalProbabilityTable& cpt,
+                  const std::vector<size_t>& fileCards,
+                  const std::vector<size_t>& fileStrides)
+            : target(cpt.data()), cards(fileCards), strides(fileStrides),
+              counter(fileCards.size(), 0), remaining(cpt.getTotalSize()) {}
+
+        /**
+         * Store the next value in file order
+         */
+        void push(double value) {
+            target[offset] = value;
+            remaining--;
+            for (int d = static_cast<int>(cards.size()) - 1; d >= 0; --d) {
+                offset += strides[d];
+                if (++counter[d] < cards[d]) {
+                    break;
+                }
+                offset -= counter[d] * strides[d];
+                counter[d] = 0;
+            }
+        }
+
+        size_t getRemaining() const {
+            return remaining;
+        }
+    };
+
+    /**
+     * Structure describing a CPT family as declared in a file
+     */
+    struct Family {
+        std::vector<std::string> parents;  // Parents in file order
+        std::vector<size_t> parentCards;   // Their cardinalities
+        std::vector<size_t> parentStrides; // Their strides in the CPT
+        size_t childCard = 0;
+    };
+
+    /**
+     * Attach declared parents to a node and allocate its CPT
+     * @param model Model being parsed (parents must exist)
+     * @param child Node ID
+     * @param parents Declared parents, in file order
+     * @param where Token to report errors at
+     * @param family Filled with the declared layout
+     * @return Zeroed CPT over the sorted parent set, then the node
+     */
+    static ConditionalProbabilityTable makeFamily(ParsedModel& model, const std::string& child,
+                                                  const std::vector<std::string>& parents,
+                                                  const Token& where, Family& family) {
+        Node& node = model.nodes.at(child);
+        for (const std::string& parent : parents) {
+            if (parent == child) {
+                throw TokenStream::error(where, "node " + child + " cannot be its own parent");
+            }
+            if (node.parentIds.count(parent)) {
+                throw TokenStream::error(where, "parent " + parent + " listed twice");
+            }
+            node.addParent(parent);
+        }
+
+        std::vector<size_t> dims;
+        for (const std::string& parent : node.parentIds) {
+            dims.push_back(model.nodes.at(parent).getNumStates());
+        }
+        dims.push_back(node.getNumStates());
+        std::vector<size_t> strides(dims.size(), 1);
+        for (int d = static_cast<int>(dims.size()) - 2; d >= 0; --d) {
+            strides[d] = strides[d + 1] * dims[d + 1];
+        }
+
+        family.parents = parents;
+        family.parentCards.clear();
+        family.parentStrides.clear();
+        for (const std::string& parent : parents) {
+            size_t sorted = static_cast<size_t>(std::distance(node.parentIds.begin(), node.parentIds.find(parent)));
+            family.parentCards.push_back(dims[sorted]);
+            family.parentStrides.push_back(strides[sorted]);
+        }
+        family.childCard = node.getNumStates();
+        return ConditionalProbabilityTable(dims);
+    }
+
+    /**
+     * Require that a node exists in the model being parsed
+     */
+    static void requireNode(const ParsedModel& model, const Token& token) {
+        if (model.nodes.find(token.text) == model.nodes.end()) {
+            throw TokenStream::error(token, "unknown node");
+        }
+    }
+
+    /**
+     * Quote a name if it would not read back as the same bare word
+     */
+    static std::string quote(const std::string& text) {
+        bool plain = !text.empty() && text != "NODES" && text != "EDGES" && text != "CPTS" && text != "->";
+        for (char c : text) {
+            unsigned char u = static_cast<unsigned char>(c);
+            if (std::isspace(u) || u < 0x20 || c == '"' || c == '\\' || c == '#') {
+                plain = false;
+            }
+        }
+        if (plain) {
+            return text;
+        }
+        std::string quoted = "\"";
+        for (char c : text) {
+            unsigned char u = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\') {
+                quoted.push_back('\\');
+                quoted.push_back(c);
+            } else if (c == '\n') {
+                quoted += "\\n";
+            } else if (c == '\t') {
+                quoted += "\\t";
+            } else if (c == '\r') {
+                quoted += "\\r";
+            } else if (u < 0x20) {
+                char hex[5];
+                std::snprintf(hex, sizeof(hex), "\\x%02x", u);
+                quoted += hex;
+            } else {
+                quoted.push_back(c);
+            }
+        }
+        return quoted + "\"";
+    }
+
+    /**
+     * Format a probability in the shortest form that reads back exactly
+     */
+    static std::string formatProbability(double value) {
+        char text[32];
+        for (int precision = 15; precision <= 17; ++precision) {
+            std::snprintf(text, sizeof(text), "%.*g", precision, value);
+            if (std::strtod(text, nullptr) == value) {
+                break;
+            }
+        }
+        return text;
+    }
+
+    /**
+     * Bounds-checked product of CPT dimensions
+     */
+    static size_t checkedSize(const std::vector<size_t>& dims, const Token& where) {
+        size_t total = 1;
+        for (size_t dim : dims) {
+            if (dim != 0 && total > (size_t(1) << 40) / dim) {
+                throw TokenStream::error(where, "CPT is too large");
+            }
+            total *= dim;
+        }
+        return total;
+    }
+
+    /**
+     * Skip BIF tokens up to and including the next ';'
+     */
+    static void skipStatement(TokenStream& tokens) {
+        while (true) {
+            Token token = tokens.next();
+            if (token.kind == Token::Kind::End) {
+                throw TokenStream::error(token, "expected ';'");
+            }
+            if (token.is(";")) {
+                return;
+            }
+        }
+    }
+
+    /**
+     * Read BIF probabilities separated by optional commas up to ';'
+     * @param tokens Token stream
+     * @param count Number of values expected
+     * @param store Called with each value
+     */
+    template <typename Store>
+    static void readBifValues(TokenStream& tokens, size_t count, Store store) {
+        for (size_t i = 0; i < count; ++i) {
+            if (i > 0) {
+                tokens.accept(",");
+            }
+            store(tokens.expectProbability());
+        }
+        tokens.expect(";");
+    }
+
+    /**
+     * Parse a BIF probability block
+     */
+    static void readBifProbability(TokenStream& tokens, ParsedModel& model) {
+        tokens.expect("(");
+        Token childToken = tokens.next();
+        TokenStream::requireName(childToken, "variable name");
+        requireNode(model, childToken);
+        std::string child = childToken.text;
+
+        // "( child | p1, p2 )", or the older "( child p1 p2 )"
+        std::vector<std::string> parents;
+        tokens.accept("|");
+        while (!tokens.accept(")")) {
+            tokens.accept(",");
+            Token parent = tokens.next();
+            TokenStream::requireName(parent, "parent name or ')'");
+            requireNode(model, parent);
+            parents.push_back(parent.text);
+        }
+        if (model.cpts.count(child)) {
+            throw TokenStream::error(childToken, "probability of " + child + " defined twice");
+        }
+        Family family;
+        ConditionalProbabilityTable cpt = makeFamily(model, child, parents, childToken, family);
+        const Node& node = model.nodes.at(child);
+        double* data = cpt.data();
+
+        tokens.expect("{");
+        while (!tokens.accept("}")) {
+            Token entry = tokens.next();
+            if (entry.is("table")) {
+                // Row-major over (child, parents...): the child varies slowest
+                std::vector<size_t> cards = {family.childCard};
+                std::vector<size_t> strides = {1};
+                cards.insert(cards.end(), family.parentCards.begin(), family.parentCards.end());
+                strides.insert(strides.end(), family.parentStrides.begin(), family.parentStrides.end());
+                CptFiller filler(cpt, cards, strides);
+                readBifValues(tokens, cpt.getTotalSize(), [&](double value) { filler.push(value); });
+            } else if (entry.is("default")) {
+                // Same child distribution for every parent configuration
+                std::vector<double> row;
+                readBifValues(tokens, family.childCard, [&](double value) { row.push_back(value); });
+                for (size_t i = 0; i < cpt.getTotalSize(); ++i) {
+                    data[i] = row[i % family.childCard];
+                }
+            } else if (entry.is("(")) {
+                size_t base = 0;
+                for (size_t k = 0; k < parents.size(); ++k) {
+                    if (k > 0) {
+                        tokens.accept(",");
+                    }
+                    Token state = tokens.next();
+                    TokenStream::requireName(state, "state of " + parents[k]);
+                    int index = model.nodes.at(parents[k]).getStateIndex(state.text);
+                    if (index == -1) {
+                        throw TokenStream::error(state, "unknown state of " + parents[k]);
+                    }
+                    base += static_cast<size_t>(index) * family.parentStrides[k];
+                }
+                tokens.expect(")");
+                size_t s = 0;
+                readBifValues(tokens, family.childCard, [&](double value) { data[base + s++] = value; });
+            } else if (entry.is("property")) {
+                skipStatement(tokens);
+            } else {
+                throw TokenStream::error(entry, "expected table, default, '(' or '}' in probability of " + node.name);
+            }
+        }
+        model.cpts.emplace(child, std::move(cpt));
+    }
+
+    /**
+     * Parse a BIF variable block
+     */
+    static void readBifVariable(TokenStream& tokens, ParsedModel& model) {
+        Token nameToken = tokens.next();
+        TokenStream::requireName(nameToken, "variable name");
+        std::vector<std::string> states;
+        tokens.expect("{");
+        while (!tokens.accept("}")) {
+            Token entry = tokens.next();
+            if (entry.is("type")) {
+                tokens.expect("discrete");
+                tokens.expect("[");
+                size_t count = tokens.expectCount("number of states");
+                tokens.expect("]");
+                tokens.expect("{");
+                while (!tokens.accept("}")) {
+                    if (!states.empty()) {
+                        tokens.accept(",");
+                    }
+                    states.push_back(tokens.expectName("state name"));
+                }
+                tokens.expect(";");
+                if (states.size() != count) {
+                    throw TokenStream::error(entry, "variable " + nameToken.text + " declares " +
+                                             std::to_string(count) + " states but lists " +
+                                             std::to_string(states.size()));
+                }
+            } else if (entry.is("property")) {
+                skipStatement(tokens);
+            } else {
+                throw TokenStream::error(entry, "expected type, property or '}'");
+            }
+        }
+        if (!model.nodes.emplace(nameToken.text, Node(nameToken.text, states)).second) {
+            throw TokenStream::error(nameToken, "variable defined twice");
+        }
+    }
+
+    /**
+     * Compare two tag names case-insensitively
+     */
+    static bool sameTag(const std::string& a, const char* b) {
+        size_t length = std::strlen(b);
+        if (a.size() != length) {
+            return false;
+        }
+        for (size_t i = 0; i < length; ++i) {
+            if (std::toupper(static_cast<unsigned char>(a[i])) != std::toupper(static_cast<unsigned char>(b[i]))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Minimal streaming XML reader: tags and character data, skipping
+     * declarations, comments, processing instructions and CDATA
+     */
+    class XmlReader {
+    public:
+        /**
+         * Structure holding one element tag
+         */
+        struct Tag {
+            std::string name;
+            bool closing = false;
+            bool selfClosing = false;
+            size_t line = 0;
+            size_t column = 0;
+        };
+
+    private:
+        CharStream& chars;
+
+        /**
+         * Skip characters up to and including a terminator
+         */
+        void skipPast(const char* terminator, const char* what) {
+            while (!chars.accept(terminator)) {
+                if (chars.get() == -1) {
+                    throw chars.error(std::string("unterminated ") + what);
+                }
+            }
+        }
+
+        /**
+         * Decode an entity reference after '&'
+         */
+        char readEntity() {
+            std::string name;
+            int c;
+            while ((c = chars.get()) != ';') {
+                if (c == -1 || name.size() > 8) {
+                    throw chars.error("malformed entity reference");
+                }
+                name.push_back(static_cast<char>(c));
+            }
+            if (name == "lt") return '<';
+            if (name == "gt") return '>';
+            if (name == "amp") return '&';
+            if (name == "quot") return '"';
+            if (name == "apos") return '\'';
+            if (name.size() > 1 && name[0] == '#') {
+                long code = (name[1] == 'x') ? std::strtol(name.c_str() + 2, nullptr, 16)
+                                             : std::strtol(name.c_str() + 1, nullptr, 10);
+                if (code > 0 && code < 128) {
+                    return static_cast<char>(code);
+                }
+            }
+            throw chars.error("unsupported entity &" + name + ";");
+        }
+
+    public:
+        explicit XmlReader(CharStream& source) : chars(source) {}
+
+        /**
+         * Advance to the next element tag, skipping character data
+         * @param tag Filled with the tag
+         * @return False at the end of input
+         */
+        bool nextTag(Tag& tag) {
+            while (true) {
+                int c = chars.get();
+                if (c == -1) {
+                    return false;
+                }
+                if (c != '<') {
+                    continue;
+                }
+                if (chars.accept("!--")) {
+                    skipPast("-->", "comment");
+                } else if (chars.accept("![CDATA[")) {
+                    skipPast("]]>", "CDATA section");
+                } else if (chars.accept("?")) {
+                    skipPast("?>", "processing instruction");
+                } else if (chars.accept("!")) {
+                    // DOCTYPE, possibly with an internal subset in brackets
+                    int depth = 0;
+                    while ((c = chars.get()) != '>' || depth > 0) {
+                        if (c == -1) {
+                            throw chars.error("unterminated declaration");
+                        }
+                        depth += (c == '[') - (c == ']');
+                    }
+                } else {
+                    tag = Tag();
+                    tag.line = chars.getLine();
+                    tag.column = chars.getColumn() - 1;
+                    tag.closing = chars.accept("/");
+                    while ((c = chars.peek()) != -1 && !std::isspace(c) && c != '/' && c != '>') {
+                        tag.name.push_back(static_cast<char>(chars.get()));
+                    }
+                    // Attributes are not needed by XMLBIF readers
+                    while ((c = chars.get()) != '>') {
+                        if (c == -1) {
+                            throw ParseError("unterminated tag", tag.line, tag.column);
+                        }
+                        if (c == '"' || c == '\'') {
+                            int quoteChar = c;
+                            while ((c = chars.get()) != quoteChar) {
+                                if (c == -1) {
+                                    throw ParseError("unterminated attribute", tag.line, tag.column);
+                                }
+                            }
+                        }
+                        tag.selfClosing = (c == '/');
+                    }
+                    if (tag.name.empty()) {
+                        throw ParseError("missing tag name", tag.line, tag.column);
+                    }
+                    return true;
+                }
+            }
+        }
+
+        /**
+         * Read character data up to the next tag, trimmed
+         */
+        std::string readText() {
+            std::string text;
+            int c;
+            while ((c = chars.peek()) != -1 && c != '<') {
+                chars.get();
+                text.push_back((c == '&') ? readEntity() : static_cast<char>(c));
+            }
+            size_t first = text.find_first_not_of(" \t\r\n");
+            if (first == std::string::npos) {
+                return std::string();
+            }
+            return text.substr(first, text.find_last_not_of(" \t\r\n") - first + 1);
+        }
+
+        /**
+         * Stream whitespace-separated words of character data up to the next tag
+         * @param onWord Called with each word and its line and column
+         */
+        template <typename OnWord>
+        void readWords(OnWord onWord) {
+            std::string word;
+            size_t line = 0;
+            size_t column = 0;
+            int c;
+            while (true) {
+                c = chars.peek();
+                if (c == -1 || c == '<' || std::isspace(c)) {
+                    if (!word.empty()) {
+                        onWord(word, line, column);
+                        word.clear();
+                    }
+                    if (c == -1 || c == '<') {
+                        return;
+                    }
+                    chars.get();
+                    continue;
+                }
+                if (word.empty()) {
+                    line = chars.getLine();
+                    column = chars.getColumn();
+                }
+                chars.get();
+                word.push_back((c == '&') ? readEntity() : static_cast<char>(c));
+            }
+        }
+
+        ParseError error(const Tag& tag, const std::string& message) const {
+            return ParseError(message, tag.line, tag.column);
+        }
+    };
+
+    /**
+     * Parse an XMLBIF VARIABLE element
+     */
+    static void readXmlVariable(XmlReader& xml, const XmlReader::Tag& start, ParsedModel& model) {
+        std::string name;
+        std::vector<std::string> states;
+        XmlReader::Tag tag;
+        while (true) {
+            if (!xml.nextTag(tag)) {
+                throw xml.error(start, "unterminated VARIABLE element");
+            }
+            if (tag.closing && sameTag(tag.name, "VARIABLE")) {
+                break;
+            }
+            if (tag.closing || tag.selfClosing) {
+                continue;
+            }
+            if (sameTag(tag.name, "NAME")) {
+                name = xml.readText();
+            } else if (sameTag(tag.name, "OUTCOME") || sameTag(tag.name, "VALUE")) {
+                states.push_back(xml.readText());
+            }
+        }
+        if (name.empty()) {
+            throw xml.error(start, "VARIABLE without NAME");
+        }
+        if (!model.nodes.emplace(name, Node(name, states)).second) {
+            throw xml.error(start, "variable " + name + " defined twice");
+        }
+    }
+
+    /**
+     * Parse an XMLBIF DEFINITION (or PROBABILITY) element
+     */
+    static void readXmlDefinition(XmlReader& xml, const XmlReader::Tag& start, ParsedModel& model) {
+        std::string child;
+        std::vector<std::string> parents;
+        bool table = false;
+        XmlReader::Tag tag;
+        while (true) {
+            if (!xml.nextTag(tag)) {
+                throw xml.error(start, "unterminated " + start.name + " element");
+            }
+            if (tag.closing && sameTag(tag.name, start.name.c_str())) {
+                break;
+            }
+            if (tag.closing || tag.selfClosing) {
+                continue;
+            }
+            if (sameTag(tag.name, "FOR") || sameTag(tag.name, "GIVEN")) {
+                std::string name = xml.readText();
+                if (model.nodes.find(name) == model.nodes.end()) {
+                    throw xml.error(tag, "unknown variable " + name);
+                }
+                if (sameTag(tag.name, "FOR")) {
+                    child = name;
+                } else {
+                    parents.push_back(name);
+                }
+            } else if (sameTag(tag.name, "TABLE")) {
+                if (child.empty()) {
+                    throw xml.error(tag, "TABLE before FOR");
+                }
+                if (model.cpts.count(child)) {
+                    throw xml.error(tag, "probability of " + child + " defined twice");
+                }
+                Token where;
+                where.line = tag.line;
+                where.column = tag.column;
+                where.text = tag.name;
+                where.kind = Token::Kind::Word;
+                Family family;
+                ConditionalProbabilityTable cpt = makeFamily(model, child, parents, where, family);
+
+                // Row-major over (parents..., child): the child varies fastest
+                std::vector<size_t> cards = family.parentCards;
+                std::vector<size_t> strides = family.parentStrides;
+                cards.push_back(family.childCard);
+                strides.push_back(1);
+                CptFiller filler(cpt, cards, strides);
+                xml.readWords([&](const std::string& word, size_t line, size_t column) {
+                    double value;
+                    if (!TokenStream::parseProbability(word, value)) {
+                        throw ParseError("expected a probability in [0, 1] (found '" + word + "')", line, column);
+                    }
+                    if (filler.getRemaining() == 0) {
+                        throw ParseError("too many values in TABLE of " + child, line, column);
+                    }
+                    filler.push(value);
+                });
+                if (filler.getRemaining() != 0) {
+                    throw xml.error(tag, "TABLE of " + child + " needs " +
+                                    std::to_string(cpt.getTotalSize()) + " values");
+                }
+                model.cpts.emplace(child, std::move(cpt));
+                table = true;
+            }
+        }
+        if (!table) {
+            throw xml.error(start, start.name + " without TABLE");
+        }
+    }
+
+public:
+    /**
+     * Write a network in the NODES / EDGES / CPTS text format
+     * @param out Output stream
+     * @param nodes Map of node ID to Node
+     * @param cpts Map of node ID to CPT
+     */
+    static void write(std::ostream& out,
+                      const std::map<std::string, Node>& nodes,
+                      const std::map<std::string, ConditionalProbabilityTable>& cpts) {
+        out << "# Lossless Bayesian Network\n";
+        out << "# Copyright (C) 2025, Shyamal Chandra\n\n";
+
+        // Nodes: ID, name, number of states, state names
+        out << "NODES\n";
+        for (const auto& pair : nodes) {
+            const Node& node = pair.second;
+            out << quote(pair.first) << " " << quote(node.name) << " " << node.states.size();
+            for (const std::string& state : node.states) {
+                out << " " << quote(state);
+            }
+            out << "\n";
+        }
+
+        // Edges: parent -> child
+        out << "\nEDGES\n";
+        for (const auto& pair : nodes) {
+            for (const std::string& parentId : pair.second.parentIds) {
+                out << quote(parentId) << " -> " << quote(pair.first) << "\n";
+            }
+        }
+
+        // CPTs: node ID, dimensions, then one row per parent configuration
+        out << "\nCPTS\n";
+        for (const auto& pair : cpts) {
+            const ConditionalProbabilityTable& cpt = pair.second;
+            const std::vector<size_t>& dims = cpt.getDimensions();
+            out << quote(pair.first) << "\n" << dims.size();
+            for (size_t dim : dims) {
+                out << " " << dim;
+            }
+            out << "\n";
+
+            const std::vector<double>& probs = cpt.getProbabilities();
+            size_t rowLength = dims.empty() ? 1 : dims.back();
+            for (size_t i = 0; i < probs.size(); ++i) {
+                out << formatProbability(probs[i]) << ((i + 1) % rowLength == 0 ? "\n" : " ");
+            }
+        }
+        if (!out) {
+            throw std::runtime_error("Failed to write model text");
+        }
+    }
+
+    /**
+     * Read a network in the NODES / EDGES / CPTS text format
+     * @param input Input stream
+     * @return Parsed nodes and CPTs
+     */
+    static ParsedModel read(std::istream& input) {
+        CharStream chars(input);
+        TokenStream tokens(chars, "", TokenStream::Comments::Hash);
+        ParsedModel model;
+        enum class Section { None, Nodes, Edges, Cpts } section = Section::None;
+
+        while (true) {
+            Token token = tokens.next();
+            if (token.kind == Token::Kind::End) {
+                break;
+            }
+            if (token.is("NODES") || token.is("EDGES") || token.is("CPTS")) {
+                section = token.is("NODES") ? Section::Nodes
+                        : token.is("EDGES") ? Section::Edges : Section::Cpts;
+                continue;
+            }
+            TokenStream::requireName(token, "node ID");
+
+            if (section == Section::None) {
+                throw TokenStream::error(token, "expected NODES, EDGES or CPTS");
+            } else if (section == Section::Nodes) {
+                std::string name = tokens.expectName("node name");
+                size_t count = tokens.expectCount("number of states");
+                std::vector<std::string> states;
+                for (size_t s = 0; s < count; ++s) {
+                    states.push_back(tokens.expectName("state name"));
+                }
+                if (!model.nodes.emplace(token.text, Node(name, states)).second) {
+                    throw TokenStream::error(token, "node defined twice");
+                }
+            } else if (section == Section::Edges) {
+                requireNode(model, token);
+                tokens.expect("->");
+                Token child = tokens.next();
+                TokenStream::requireName(child, "child node ID");
+                requireNode(model, child);
+                if (child.text == token.text) {
+                    throw TokenStream::error(child, "self-loop");
+                }
+                model.nodes.at(child.text).addParent(token.text);
+            } else {
+                requireNode(model, token);
+                if (model.cpts.count(token.text)) {
+                    throw TokenStream::error(token, "CPT defined twice");
+                }
+                size_t numDims = tokens.expectCount("number of dimensions");
+                std::vector<size_t> dims;
+                for (size_t d = 0; d < numDims; ++d) {
+                    dims.push_back(tokens.expectCount("dimension"));
+                }
+                checkedSize(dims, token);
+
+                // Values go straight into the table, one token at a time
+                ConditionalProbabilityTable cpt(dims);
+                double* data = cpt.data();
+                for (size_t i = 0; i < cpt.getTotalSize(); ++i) {
+                    data[i] = tokens.expectProbability();
+                }
+                model.cpts.emplace(token.text, std::move(cpt));
+            }
+        }
+        return model;
+    }
+
+    /**
+     * Import a network in the BIF interchange format
+     * Nodes are named after their variables; properties are ignored.
+     * @param input Input stream
+     * @return Parsed nodes and CPTs
+     */
+    static ParsedModel readBif(std::istream& input) {
+        CharStream chars(input);
+        TokenStream tokens(chars, "{}()[],;|", TokenStream::Comments::CStyle);
+        ParsedModel model;
+        while (true) {
+            Token token = tokens.next();
+            if (token.kind == Token::Kind::End) {
+                break;
+            }
+            if (token.is("network")) {
+                // Name, then a block of properties
+                while (!tokens.accept("{")) {
+                    TokenStream::requireName(tokens.next(), "'{'");
+                }
+                while (!tokens.accept("}")) {
+                    tokens.expect("property");
+                    skipStatement(tokens);
+                }
+            } else if (token.is("variable")) {
+                readBifVariable(tokens, model);
+            } else if (token.is("probability")) {
+                readBifProbability(tokens, model);
+            } else {
+                throw TokenStream::error(token, "expected network, variable or probability");
+            }
+        }
+        return model;
+    }
+
+    /**
+     * Import a network in the XMLBIF interchange format
+     * Nodes are named after their variables; properties are ignored.
+     * @param input Input stream
+     * @return Parsed nodes and CPTs
+     */
+    static ParsedModel readXmlBif(std::istream& input) {
+        CharStream chars(input);
+        XmlReader xml(chars);
+        ParsedModel model;
+        XmlReader::Tag tag;
+        while (xml.nextTag(tag)) {
+            if (tag.closing || tag.selfClosing) {
+                continue;
+            }
+            if (sameTag(tag.name, "VARIABLE")) {
+                readXmlVariable(xml, tag, model);
+            } else if (sameTag(tag.name, "DEFINITION") || sameTag(tag.name, "PROBABILITY")) {
+                readXmlDefinition(xml, tag, model);
+            }
+        }
+        return model;
+    }
+};
+
+#endif // MODEL_TEXT_HPP
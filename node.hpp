@@ -12,14 +12,15 @@
 #include <string>
 // Vector container
 #include <vector>
-// Set container for parent IDs
+// Set container for parent and child IDs
 #include <set>
 // Map container for state indices
 #include <map>
 
 /**
  * Node class represents a variable in the Bayesian network.
- * Each node has a name, possible states, and maintains parent relationships.
+ * Each node has a name, possible states, and maintains parent and child
+ * relationships; BayesianNetwork keeps both directions in sync.
  */
 class Node {
 public:
@@ -29,6 +30,8 @@ public:
     std::vector<std::string> states;
     // Set of parent node IDs (for DAG structure)
     std::set<std::string> parentIds;
+    // Set of child node IDs (reverse adjacency of parentIds)
+    std::set<std::string> childIds;
     // Map state names to indices for fast lookup
     std::map<std::string, int> stateIndexMap;
 
@@ -109,6 +112,39 @@ public:
     size_t getNumParents() const {
         return parentIds.size();
     }
+
+    /**
+     * Add a child node
+     * @param childId ID of the child node
+     */
+    void addChild(const std::string& childId) {
+        childIds.insert(childId);
+    }
+
+    /**
+     * Remove a child node
+     * @param childId ID of the child node
+     */
+    void removeChild(const std::string& childId) {
+        childIds.erase(childId);
+    }
+
+    /**
+     * Check if node has a specific child
+     * @param childId ID of the child node
+     * @return True if child exists, false otherwise
+     */
+    bool hasChild(const std::string& childId) const {
+        return childIds.find(childId) != childIds.end();
+    }
+
+    /**
+     * Get number of children
+     * @return Number of child nodes
+     */
+    size_t getNumChildren() const {
+        return childIds.size();
+    }
 };
 
 #endif // NODE_HPP
@@ -0,0 +1,625 @@
+/*
+ * numeric_policy.hpp - Numeric backends for factor arithmetic
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements the numeric policies the factor code is templated
+ * on: plain double, log-space double with a log-sum-exp reduction,
+ * compensated (Neumaier) summation, and exact rational arithmetic for
+ * audit runs. The policy is a template argument, so the double path
+ * compiles to the same loops as untemplated code.
+ *
+ * A policy provides:
+ *   Value                       number type stored in factors
+ *   kSigned                     whether negative values are representable
+ *   zero(), one()               additive and multiplicative identities
+ *   fromDouble(p), toDouble(v)  conversion from and to probabilities
+ *   multiply, add, divide       binary operations on values
+ *   sum(values, count)          total of an array
+ *   sumSlices(block, card, inner, out)
+ *                               out[r] = sum_s block[s * inner + r] for
+ *                               r < inner (out holds zero() on entry)
+ *   isNegligible(total)         normalization leaves the values unchanged
+ */
+
+#ifndef NUMERIC_POLICY_HPP
+#define NUMERIC_POLICY_HPP
+
+// Small fixed-cardinality kernels
+#include "small_kernels.hpp"
+// Scratch buffers for the slice reductions
+#include "inference_workspace.hpp"
+// Vector container
+#include <vector>
+// String operations
+#include <string>
+// Fixed-width integers
+#include <cstdint>
+// Mathematical operations
+#include <cmath>
+// Infinity
+#include <limits>
+// Exception handling
+#include <stdexcept>
+// Algorithm utilities
+#include <algorithm>
+
+/**
+ * DoublePolicy computes with IEEE doubles, exactly as the untemplated code
+ */
+struct DoublePolicy {
+    using Value = double;
+    static constexpr bool kSigned = true;
+
+    static double zero() { return 0.0; }
+    static double one() { return 1.0; }
+    static double fromDouble(double p) { return p; }
+    static double toDouble(double v) { return v; }
+    static double multiply(double a, double b) { return a * b; }
+    static double add(double a, double b) { return a + b; }
+    static double divide(double a, double b) { return a / b; }
+
+    static double sum(const double* values, size_t count) {
+        double total = 0.0;
+        for (size_t i = 0; i < count; ++i) {
+            total += values[i];
+        }
+        return total;
+    }
+
+    // Unrolled for 2 to 4 slices; the same additions in the same order
+    static void sumSlices(const double* block, size_t card, size_t inner, double* out) {
+        kernels::withCardinality(card, [&](auto fixed) {
+            kernels::sumSlices<decltype(fixed)::value>(block, card, inner, out);
+        });
+    }
+
+    // Any positive finite mass can be normalized, however small; only a
+    // zero (impossible evidence) or non-finite mass cannot
+    static bool isNegligible(double total) { return !(total > 0.0 && std::isfinite(total)); }
+};
+
+/**
+ * LogPolicy stores the natural logarithm of every value, so long products
+ * of small probabilities cannot underflow. Sums use log-sum-exp shifted by
+ * the largest term; sumSlices runs each pass over contiguous rows so the
+ * compiler can vectorize it. Only non-negative values are representable.
+ */
+struct LogPolicy {
+    using Value = double;
+    static constexpr bool kSigned = false;
+
+    static double zero() { return -std::numeric_limits<double>::infinity(); }
+    static double one() { return 0.0; }
+
+    static double fromDouble(double p) {
+        if (!(p >= 0.0)) {
+            throw std::runtime_error("Log-space values must be non-negative");
+        }
+        return std::log(p);
+    }
+
+    static double toDouble(double v) { return std::exp(v); }
+    static double multiply(double a, double b) { return a + b; }
+    static double divide(double a, double b) { return a - b; }
+
+    static double add(double a, double b) {
+        double high = std::max(a, b);
+        if (high == zero()) {
+            return high;
+        }
+        return high + std::log1p(std::exp(std::min(a, b) - high));
+    }
+
+    static double sum(const double* values, size_t count) {
+        double high = zero();
+        for (size_t i = 0; i < count; ++i) {
+            high = std::max(high, values[i]);
+        }
+        if (high == zero()) {
+            return high;
+        }
+        double total = 0.0;
+        for (size_t i = 0; i < count; ++i) {
+            total += std::exp(values[i] - high);
+        }
+        return high + std::log(total);
+    }
+
+    static void sumSlices(const double* block, size_t card, size_t inner, double* out) {
+        // out holds zero() on entry, so it collects the shifts; the totals
+        // come from the thread's workspace
+        InferenceWorkspace::Frame frame;
+        ScratchVector<double> total(inner, 0.0, frame.resource());
+        for (size_t s = 0; s < card; ++s) {
+            const double* slice = block + s * inner;
+            for (size_t r = 0; r < inner; ++r) {
+                out[r] = std::max(out[r], slice[r]);
+            }
+        }
+        // A row of zeros keeps shift 0, so every exp below is exp(-inf) = 0
+        for (size_t r = 0; r < inner; ++r) {
+            out[r] = (out[r] == zero()) ? 0.0 : out[r];
+        }
+        for (size_t s = 0; s < card; ++s) {
+            const double* slice = block + s * inner;
+            for (size_t r = 0; r < inner; ++r) {
+                total[r] += std::exp(slice[r] - out[r]);
+            }
+        }
+        for (size_t r = 0; r < inner; ++r) {
+            out[r] += std::log(total[r]);
+        }
+    }
+
+    // Any mass that is not exactly zero can be normalized
+    static bool isNegligible(double total) { return total == zero(); }
+};
+
+/**
+ * KahanPolicy computes with doubles but accumulates every summation with
+ * Neumaier's compensated algorithm, so the rounding error of a sum does
+ * not grow with the number of terms. Products are plain IEEE products.
+ * The compensation is optimized away under -ffast-math.
+ */
+struct KahanPolicy {
+    using Value = double;
+    static constexpr bool kSigned = true;
+
+    static double zero() { return 0.0; }
+    static double one() { return 1.0; }
+    static double fromDouble(double p) { return p; }
+    static double toDouble(double v) { return v; }
+    static double multiply(double a, double b) { return a * b; }
+    static double add(double a, double b) { return a + b; }
+    static double divide(double a, double b) { return a / b; }
+
+    /**
+     * Add x to a running total, collecting the lost low-order bits
+     */
+    static void accumulate(double& total, double& compensation, double x) {
+        double t = total + x;
+        compensation += (std::fabs(total) >= std::fabs(x)) ? (total - t) + x : (x - t) + total;
+        total = t;
+    }
+
+    static double sum(const double* values, size_t count) {
+        double total = 0.0, compensation = 0.0;
+        for (size_t i = 0; i < count; ++i) {
+            accumulate(total, compensation, values[i]);
+        }
+        return total + compensation;
+    }
+
+    static void sumSlices(const double* block, size_t card, size_t inner, double* out) {
+        InferenceWorkspace::Frame frame;
+        ScratchVector<double> compensation(inner, 0.0, frame.resource());
+        for (size_t s = 0; s < card; ++s) {
+            const double* slice = block + s * inner;
+            for (size_t r = 0; r < inner; ++r) {
+                accumulate(out[r], compensation[r], slice[r]);
+            }
+        }
+        for (size_t r = 0; r < inner; ++r) {
+            out[r] += compensation[r];
+        }
+    }
+
+    // Only a zero or non-finite mass cannot be normalized, as with DoublePolicy
+    static bool isNegligible(double total) { return !(total > 0.0 && std::isfinite(total)); }
+};
+
+/**
+ * BigUnsigned is an arbitrary-precision unsigned integer stored as
+ * little-endian 32-bit limbs without leading zero limbs
+ */
+class BigUnsigned {
+private:
+    // Limbs, least significant first
+    std::vector<uint32_t> limbs;
+
+    /**
+     * Drop leading zero limbs
+     */
+    void trim() {
+        while (!limbs.empty() && limbs.back() == 0) {
+            limbs.pop_back();
+        }
+    }
+
+public:
+    /**
+     * Constructor from a machine integer
+     * @param value Initial value (default 0)
+     */
+    explicit BigUnsigned(uint64_t value = 0) {
+        while (value != 0) {
+            limbs.push_back(static_cast<uint32_t>(value));
+            value >>= 32;
+        }
+    }
+
+    bool isZero() const {
+        return limbs.empty();
+    }
+
+    /**
+     * Number of significant bits (0 for zero)
+     */
+    size_t bitLength() const {
+        if (limbs.empty()) {
+            return 0;
+        }
+        size_t bits = 32 * (limbs.size() - 1);
+        for (uint32_t top = limbs.back(); top != 0; top >>= 1) {
+            ++bits;
+        }
+        return bits;
+    }
+
+    /**
+     * Number of trailing zero bits (0 for zero)
+     */
+    size_t trailingZeros() const {
+        for (size_t i = 0; i < limbs.size(); ++i) {
+            if (limbs[i] != 0) {
+                size_t bits = 32 * i;
+                for (uint32_t low = limbs[i]; (low & 1u) == 0; low >>= 1) {
+                    ++bits;
+                }
+                return bits;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * Three-way comparison
+     * @return Negative, zero or positive as a is less, equal or greater
+     */
+    static int compare(const BigUnsigned& a, const BigUnsigned& b) {
+        if (a.limbs.size() != b.limbs.size()) {
+            return (a.limbs.size() < b.limbs.size()) ? -1 : 1;
+        }
+        for (size_t i = a.limbs.size(); i-- > 0;) {
+            if (a.limbs[i] != b.limbs[i]) {
+                return (a.limbs[i] < b.limbs[i]) ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    friend BigUnsigned operator+(const BigUnsigned& a, const BigUnsigned& b) {
+        BigUnsigned result;
+        size_t n = std::max(a.limbs.size(), b.limbs.size());
+        result.limbs.resize(n + 1, 0);
+        uint64_t carry = 0;
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t sum = carry;
+            sum += (i < a.limbs.size()) ? a.limbs[i] : 0u;
+            sum += (i < b.limbs.size()) ? b.limbs[i] : 0u;
+            result.limbs[i] = static_cast<uint32_t>(sum);
+            carry = sum >> 32;
+        }
+        result.limbs[n] = static_cast<uint32_t>(carry);
+        result.trim();
+        return result;
+    }
+
+    /**
+     * Difference a - b (requires a >= b)
+     */
+    friend BigUnsigned operator-(const BigUnsigned& a, const BigUnsigned& b) {
+        if (compare(a, b) < 0) {
+            throw std::runtime_error("Unsigned subtraction underflow");
+        }
+        BigUnsigned result = a;
+        int64_t borrow = 0;
+        for (size_t i = 0; i < result.limbs.size(); ++i) {
+            int64_t diff = static_cast<int64_t>(result.limbs[i]) - borrow -
+                           ((i < b.limbs.size()) ? static_cast<int64_t>(b.limbs[i]) : 0);
+            borrow = (diff < 0) ? 1 : 0;
+            result.limbs[i] = static_cast<uint32_t>(diff + (borrow << 32));
+        }
+        result.trim();
+        return result;
+    }
+
+    friend BigUnsigned operator*(const BigUnsigned& a, const BigUnsigned& b) {
+        BigUnsigned result;
+        if (a.isZero() || b.isZero()) {
+            return result;
+        }
+        result.limbs.assign(a.limbs.size() + b.limbs.size(), 0);
+        for (size_t i = 0; i < a.limbs.size(); ++i) {
+            uint64_t carry = 0;
+            for (size_t j = 0; j < b.limbs.size(); ++j) {
+                uint64_t cur = result.limbs[i + j] + carry +
+                               static_cast<uint64_t>(a.limbs[i]) * b.limbs[j];
+                result.limbs[i + j] = static_cast<uint32_t>(cur);
+                carry = cur >> 32;
+            }
+            result.limbs[i + b.limbs.size()] = static_cast<uint32_t>(carry);
+        }
+        result.trim();
+        return result;
+    }
+
+    /**
+     * Multiply by 2^bits
+     */
+    BigUnsigned shiftedLeft(size_t bits) const {
+        BigUnsigned result;
+        if (isZero()) {
+            return result;
+        }
+        size_t whole = bits / 32, part = bits % 32;
+        result.limbs.assign(limbs.size() + whole + 1, 0);
+        for (size_t i = 0; i < limbs.size(); ++i) {
+            uint64_t shifted = static_cast<uint64_t>(limbs[i]) << part;
+            result.limbs[i + whole] |= static_cast<uint32_t>(shifted);
+            result.limbs[i + whole + 1] |= static_cast<uint32_t>(shifted >> 32);
+        }
+        result.trim();
+        return result;
+    }
+
+    /**
+     * Divide by 2^bits, discarding the remainder
+     */
+    BigUnsigned shiftedRight(size_t bits) const {
+        BigUnsigned result;
+        size_t whole = bits / 32, part = bits % 32;
+        if (whole >= limbs.size()) {
+            return result;
+        }
+        result.limbs.assign(limbs.size() - whole, 0);
+        for (size_t i = whole; i < limbs.size(); ++i) {
+            uint64_t pair = limbs[i];
+            if (i + 1 < limbs.size()) {
+                pair |= static_cast<uint64_t>(limbs[i + 1]) << 32;
+            }
+            result.limbs[i - whole] = static_cast<uint32_t>(pair >> part);
+        }
+        result.trim();
+        return result;
+    }
+
+    /**
+     * Decimal representation
+     */
+    std::string toString() const {
+        if (isZero()) {
+            return "0";
+        }
+        std::string digits;
+        BigUnsigned rest = *this;
+        while (!rest.isZero()) {
+            // Divide by 10^9 and emit the nine low digits
+            uint64_t remainder = 0;
+            for (size_t i = rest.limbs.size(); i-- > 0;) {
+                uint64_t cur = (remainder << 32) | rest.limbs[i];
+                rest.limbs[i] = static_cast<uint32_t>(cur / 1000000000u);
+                remainder = cur % 1000000000u;
+            }
+            rest.trim();
+            for (int d = 0; d < 9 && (remainder != 0 || !rest.isZero()); ++d) {
+                digits.push_back(static_cast<char>('0' + remainder % 10));
+                remainder /= 10;
+            }
+        }
+        std::reverse(digits.begin(), digits.end());
+        return digits;
+    }
+};
+
+/**
+ * ExactValue is an exact signed rational number. Doubles are dyadic
+ * rationals, so sums and products of CPT entries stay exact; only the
+ * final normalization divides by a general denominator. Fractions are
+ * reduced by common powers of two, not by a full GCD.
+ */
+class ExactValue {
+private:
+    // Sign (false for zero)
+    bool negative = false;
+    // Magnitude is numerator / denominator
+    BigUnsigned numerator;
+    BigUnsigned denominator{1};
+
+    /**
+     * Remove common factors of two and canonicalize zero
+     */
+    void reduce() {
+        if (numerator.isZero()) {
+            negative = false;
+            denominator = BigUnsigned(1);
+            return;
+        }
+        size_t common = std::min(numerator.trailingZeros(), denominator.trailingZeros());
+        if (common > 0) {
+            numerator = numerator.shiftedRight(common);
+            denominator = denominator.shiftedRight(common);
+        }
+    }
+
+public:
+    /**
+     * Default constructor: the value 0
+     */
+    ExactValue() = default;
+
+    /**
+     * Convert a finite double exactly
+     * @param p Value to convert
+     * @return The same number as an exact rational
+     */
+    static ExactValue fromDouble(double p) {
+        if (!std::isfinite(p)) {
+            throw std::runtime_error("Exact values must be finite");
+        }
+        ExactValue value;
+        if (p == 0.0) {
+            return value;
+        }
+        value.negative = p < 0.0;
+        int exponent = 0;
+        double fraction = std::frexp(std::fabs(p), &exponent);
+        // |p| = mantissa * 2^(exponent - 53) with an integer mantissa
+        value.numerator = BigUnsigned(static_cast<uint64_t>(std::ldexp(fraction, 53)));
+        exponent -= 53;
+        if (exponent >= 0) {
+            value.numerator = value.numerator.shiftedLeft(static_cast<size_t>(exponent));
+        } else {
+            value.denominator = BigUnsigned(1).shiftedLeft(static_cast<size_t>(-exponent));
+        }
+        value.reduce();
+        return value;
+    }
+
+    /**
+     * Nearest double (correctly rounded unless the result is subnormal)
+     * @return Rounded value
+     */
+    double toDouble() const {
+        if (numerator.isZero()) {
+            return 0.0;
+        }
+        // Scale so that q = floor(numerator * 2^shift / denominator) has 63 or 64 bits
+        long shift = 63 - (static_cast<long>(numerator.bitLength()) - static_cast<long>(denominator.bitLength()));
+        BigUnsigned remainder = (shift > 0) ? numerator.shiftedLeft(static_cast<size_t>(shift)) : numerator;
+        BigUnsigned divisor = (shift < 0) ? denominator.shiftedLeft(static_cast<size_t>(-shift)) : denominator;
+        uint64_t quotient = 0;
+        for (int bit = 63; bit >= 0; --bit) {
+            BigUnsigned step = divisor.shiftedLeft(static_cast<size_t>(bit));
+            if (BigUnsigned::compare(remainder, step) >= 0) {
+                remainder = remainder - step;
+                quotient |= uint64_t(1) << bit;
+            }
+        }
+        // A sticky bit below the 53 kept bits makes the conversion round correctly
+        if (!remainder.isZero()) {
+            quotient |= 1u;
+        }
+        double magnitude = std::ldexp(static_cast<double>(quotient), static_cast<int>(-shift));
+        return negative ? -magnitude : magnitude;
+    }
+
+    bool isZero() const {
+        return numerator.isZero();
+    }
+
+    bool isNegative() const {
+        return negative;
+    }
+
+    const BigUnsigned& getNumerator() const {
+        return numerator;
+    }
+
+    const BigUnsigned& getDenominator() const {
+        return denominator;
+    }
+
+    /**
+     * Exact representation as "numerator/denominator" in decimal
+     */
+    std::string toString() const {
+        std::string text = (negative ? "-" : "") + numerator.toString();
+        if (BigUnsigned::compare(denominator, BigUnsigned(1)) != 0) {
+            text += "/" + denominator.toString();
+        }
+        return text;
+    }
+
+    friend ExactValue operator*(const ExactValue& a, const ExactValue& b) {
+        ExactValue result;
+        result.negative = a.negative != b.negative;
+        result.numerator = a.numerator * b.numerator;
+        result.denominator = a.denominator * b.denominator;
+        result.reduce();
+        return result;
+    }
+
+    friend ExactValue operator/(const ExactValue& a, const ExactValue& b) {
+        if (b.isZero()) {
+            throw std::runtime_error("Exact division by zero");
+        }
+        ExactValue result;
+        result.negative = a.negative != b.negative;
+        result.numerator = a.numerator * b.denominator;
+        result.denominator = a.denominator * b.numerator;
+        result.reduce();
+        return result;
+    }
+
+    friend ExactValue operator+(const ExactValue& a, const ExactValue& b) {
+        BigUnsigned left = a.numerator, right = b.numerator;
+        ExactValue result;
+        result.denominator = a.denominator;
+        if (BigUnsigned::compare(a.denominator, b.denominator) != 0) {
+            left = a.numerator * b.denominator;
+            right = b.numerator * a.denominator;
+            result.denominator = a.denominator * b.denominator;
+        }
+        if (a.negative == b.negative) {
+            result.numerator = left + right;
+            result.negative = a.negative;
+        } else if (BigUnsigned::compare(left, right) >= 0) {
+            result.numerator = left - right;
+            result.negative = a.negative;
+        } else {
+            result.numerator = right - left;
+            result.negative = b.negative;
+        }
+        result.reduce();
+        return result;
+    }
+
+    friend bool operator==(const ExactValue& a, const ExactValue& b) {
+        return a.negative == b.negative &&
+               BigUnsigned::compare(a.numerator * b.denominator, b.numerator * a.denominator) == 0;
+    }
+
+    friend bool operator!=(const ExactValue& a, const ExactValue& b) {
+        return !(a == b);
+    }
+};
+
+/**
+ * ExactPolicy computes with exact rationals, for audit runs that must not
+ * round at all; it is orders of magnitude slower than DoublePolicy
+ */
+struct ExactPolicy {
+    using Value = ExactValue;
+    static constexpr bool kSigned = true;
+
+    static ExactValue zero() { return ExactValue(); }
+    static ExactValue one() { return ExactValue::fromDouble(1.0); }
+    static ExactValue fromDouble(double p) { return ExactValue::fromDouble(p); }
+    static double toDouble(const ExactValue& v) { return v.toDouble(); }
+    static ExactValue multiply(const ExactValue& a, const ExactValue& b) { return a * b; }
+    static ExactValue add(const ExactValue& a, const ExactValue& b) { return a + b; }
+    static ExactValue divide(const ExactValue& a, const ExactValue& b) { return a / b; }
+
+    static ExactValue sum(const ExactValue* values, size_t count) {
+        ExactValue total;
+        for (size_t i = 0; i < count; ++i) {
+            total = total + values[i];
+        }
+        return total;
+    }
+
+    static void sumSlices(const ExactValue* block, size_t card, size_t inner, ExactValue* out) {
+        for (size_t s = 0; s < card; ++s) {
+            const ExactValue* slice = block + s * inner;
+            for (size_t r = 0; r < inner; ++r) {
+                out[r] = out[r] + slice[r];
+            }
+        }
+    }
+
+    // Only an exactly zero mass cannot be normalized
+    static bool isNegligible(const ExactValue& total) { return total.isZero(); }
+};
+
+#endif // NUMERIC_POLICY_HPP
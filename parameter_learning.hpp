@@ -0,0 +1,369 @@
+/*
+ * parameter_learning.hpp - Streaming sufficient statistics for CPT learning
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements the data side of parameter learning: DatasetReader
+ * streams a CSV dataset in fixed-size chunks of state indices, and
+ * SufficientStatistics accumulates family counts laid out like the CPTs
+ * they estimate, so memory is bounded by the chunk and the CPT sizes, not
+ * by the number of rows. Complete families are counted in parallel slices
+ * that are merged in a fixed order; BayesianNetwork::learnParameters adds
+ * the expected counts of rows with missing values (EM) and turns counts
+ * into maximum likelihood or Dirichlet-smoothed CPTs.
+ */
+
+#ifndef PARAMETER_LEARNING_HPP
+#define PARAMETER_LEARNING_HPP
+
+// Compiled network (families, strides, state names)
+#include "compiled_network.hpp"
+// Parallel counting
+#include "thread_pool.hpp"
+// CSV positions in errors
+#include "model_text.hpp"
+// Vector container
+#include <vector>
+// String operations
+#include <string>
+// Input streams
+#include <istream>
+// Exceptions
+#include <stdexcept>
+
+/**
+ * Options of learnParameters
+ */
+struct LearningOptions {
+    double pseudoCount = 0.0;    // Dirichlet count added to every CPT entry (0: maximum likelihood)
+    size_t chunkRows = 65536;    // Rows parsed and counted at a time
+    size_t maxIterations = 50;   // EM iterations when values are missing
+    double tolerance = 1e-6;     // EM stops once no probability moves by more than this
+};
+
+/**
+ * Outcome of learnParameters
+ */
+struct LearningResult {
+    size_t rows = 0;             // Data rows read per pass
+    size_t incompleteRows = 0;   // Rows with a missing value in some family
+    size_t iterations = 0;       // EM iterations run (0 for complete data)
+    bool converged = true;       // Last EM iteration moved less than the tolerance
+    double maxChange = 0.0;      // Largest probability change of the last EM iteration
+};
+
+/**
+ * DatasetReader reads a CSV file whose header names network nodes and
+ * whose fields are state names. Columns that are not nodes are ignored,
+ * nodes without a column are missing in every row, and empty fields, "?"
+ * and "NA" are missing values. Fields may be wrapped in double quotes.
+ */
+class DatasetReader {
+private:
+    // Source stream
+    std::istream& in;
+    // Compiled network the states refer to
+    const CompiledNetwork& net;
+    // Variable of each column, or -1 for ignored columns
+    std::vector<int> columnVars;
+    // Stream position of the first data row
+    std::istream::pos_type dataStart;
+    // Current line (1-based) and the line of the first data row
+    size_t line = 0;
+    size_t firstDataLine = 0;
+    // Line buffer and field positions, reused across rows
+    std::string text;
+    std::vector<std::pair<size_t, size_t>> fields;
+
+    /**
+     * Split the current line at commas into trimmed, unquoted fields
+     */
+    void splitFields() {
+        fields.clear();
+        size_t start = 0;
+        while (true) {
+            size_t end = text.find(',', start);
+            size_t stop = end == std::string::npos ? text.size() : end;
+            size_t first = start;
+            size_t last = stop;
+            while (first < last && (text[first] == ' ' || text[first] == '\t')) {
+                ++first;
+            }
+            while (last > first && (text[last - 1] == ' ' || text[last - 1] == '\t' || text[last - 1] == '\r')) {
+                --last;
+            }
+            if (last - first >= 2 && text[first] == '"' && text[last - 1] == '"') {
+                ++first;
+                --last;
+            }
+            fields.emplace_back(first, last - first);
+            if (end == std::string::npos) {
+                break;
+            }
+            start = end + 1;
+        }
+    }
+
+    /**
+     * Check whether a field holds a missing value
+     */
+    bool isMissing(const std::pair<size_t, size_t>& field) const {
+        return field.second == 0 || text.compare(field.first, field.second, "?") == 0 ||
+               text.compare(field.first, field.second, "NA") == 0;
+    }
+
+public:
+    /**
+     * Constructor: reads the header row
+     * @param input Stream positioned at the header
+     * @param network Compiled network the columns refer to
+     */
+    DatasetReader(std::istream& input, const CompiledNetwork& network) : in(input), net(network) {
+        while (std::getline(in, text)) {
+            ++line;
+            if (text.find_first_not_of(" \t\r") != std::string::npos) {
+                break;
+            }
+        }
+        if (!in && text.find_first_not_of(" \t\r") == std::string::npos) {
+            throw std::runtime_error("Dataset has no header row");
+        }
+        splitFields();
+        std::vector<bool> seen(net.numNodes(), false);
+        for (const auto& field : fields) {
+            int var = net.indexOf(text.substr(field.first, field.second));
+            if (var != -1) {
+                if (seen[var]) {
+                    throw ParseError("Duplicate column " + net.nodeId(var), line, field.first + 1);
+                }
+                seen[var] = true;
+            }
+            columnVars.push_back(var);
+        }
+        firstDataLine = line;
+        dataStart = in.tellg();
+    }
+
+    /**
+     * Read the next rows
+     * @param maxRows Largest number of rows to read
+     * @param states Output: rows * numNodes() state indices, -1 when missing
+     * @return Number of rows read (0 at the end of the data)
+     */
+    size_t readChunk(size_t maxRows, std::vector<int>& states) {
+        size_t numVars = net.numNodes();
+        states.assign(maxRows * numVars, -1);
+        size_t rows = 0;
+        while (rows < maxRows && std::getline(in, text)) {
+            ++line;
+            if (text.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            splitFields();
+            if (fields.size() != columnVars.size()) {
+                throw ParseError("Expected " + std::to_string(columnVars.size()) + " fields, found " +
+                                 std::to_string(fields.size()), line, 1);
+            }
+            int* row = &states[rows * numVars];
+            for (size_t c = 0; c < fields.size(); ++c) {
+                int var = columnVars[c];
+                if (var == -1 || isMissing(fields[c])) {
+                    continue;
+                }
+                int state = net.stateIndex(var, text.substr(fields[c].first, fields[c].second));
+                if (state == -1) {
+                    throw ParseError("Unknown state '" + text.substr(fields[c].first, fields[c].second) +
+                                     "' for node " + net.nodeId(var), line, fields[c].first + 1);
+                }
+                row[var] = state;
+            }
+            ++rows;
+        }
+        states.resize(rows * numVars);
+        return rows;
+    }
+
+    /**
+     * Return to the first data row for another pass
+     */
+    void rewind() {
+        in.clear();
+        if (dataStart == std::istream::pos_type(-1) || !in.seekg(dataStart)) {
+            throw std::runtime_error("Dataset stream is not seekable; EM needs several passes");
+        }
+        line = firstDataLine;
+    }
+};
+
+/**
+ * SufficientStatistics holds one count per CPT entry of every node, in the
+ * row-major layout of the node's CPT (parents in CPT order, then the node).
+ */
+class SufficientStatistics {
+private:
+    // Compiled network the counts refer to
+    const CompiledNetwork* net = nullptr;
+    // Start of each node's counts in the flat array (numNodes + 1 entries)
+    std::vector<size_t> offsets;
+    // Flat counts
+    std::vector<double> counts;
+
+public:
+    // Complete families are counted in this many slices, merged in order,
+    // so the counts do not depend on the thread count
+    static constexpr size_t kSlices = 16;
+
+    /**
+     * Default constructor: no nodes
+     */
+    SufficientStatistics() : offsets(1, 0) {}
+
+    /**
+     * Constructor with zero counts for every family of a network
+     * @param network Compiled network
+     */
+    explicit SufficientStatistics(const CompiledNetwork& network) : net(&network), offsets(1, 0) {
+        for (size_t v = 0; v < network.numNodes(); ++v) {
+            size_t size = network.cardinality(static_cast<int>(v));
+            for (int parent : network.parents(static_cast<int>(v))) {
+                size *= network.cardinality(parent);
+            }
+            offsets.push_back(offsets.back() + size);
+        }
+        counts.assign(offsets.back(), 0.0);
+    }
+
+    /**
+     * Get the counts of a node's family
+     * @param v Variable index
+     * @return Pointer to one count per CPT entry
+     */
+    double* family(int v) {
+        return counts.data() + offsets[v];
+    }
+
+    const double* family(int v) const {
+        return counts.data() + offsets[v];
+    }
+
+    /**
+     * Get the number of entries of a node's family
+     * @param v Variable index
+     * @return CPT size of the node
+     */
+    size_t familySize(int v) const {
+        return offsets[v + 1] - offsets[v];
+    }
+
+    /**
+     * Get all counts
+     * @return Flat counts of every family
+     */
+    const std::vector<double>& getCounts() const {
+        return counts;
+    }
+
+    /**
+     * Add another table of the same network
+     * @param other Counts to add
+     */
+    void add(const SufficientStatistics& other) {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            counts[i] += other.counts[i];
+        }
+    }
+
+    /**
+     * CPT entry of a node's family under a row of states
+     * @param v Variable index
+     * @param row State per variable
+     * @return Entry index, or -1 if a family member is missing
+     */
+    long entry(int v, const int* row) const {
+        ArrayView<int> parents = net->parents(v);
+        ArrayView<size_t> strides = net->strides(v);
+        if (row[v] < 0) {
+            return -1;
+        }
+        size_t index = static_cast<size_t>(row[v]) * strides[parents.size()];
+        for (size_t i = 0; i < parents.size(); ++i) {
+            if (row[parents[i]] < 0) {
+                return -1;
+            }
+            index += static_cast<size_t>(row[parents[i]]) * strides[i];
+        }
+        return static_cast<long>(index);
+    }
+
+    /**
+     * Count every fully observed family of a chunk of rows
+     * Rows are split into kSlices contiguous slices, each counted into its
+     * own table (in parallel when a pool is given), and the tables are
+     * added in slice order.
+     * @param states Rows of state indices, -1 when missing
+     * @param rows Number of rows
+     * @param pool Optional thread pool
+     * @return Number of rows with a missing value in some family
+     */
+    size_t countObserved(const std::vector<int>& states, size_t rows, ThreadPool* pool) {
+        LBN_PHASE("countObserved");
+        size_t numVars = net->numNodes();
+        std::vector<SufficientStatistics> slices(kSlices, SufficientStatistics(*net));
+        std::vector<size_t> incomplete(kSlices, 0);
+        auto countSlice = [&](size_t s) {
+            size_t begin = rows * s / kSlices;
+            size_t end = rows * (s + 1) / kSlices;
+            for (size_t r = begin; r < end; ++r) {
+                const int* row = &states[r * numVars];
+                bool complete = true;
+                for (size_t v = 0; v < numVars; ++v) {
+                    long index = slices[s].entry(static_cast<int>(v), row);
+                    if (index != -1) {
+                        slices[s].family(static_cast<int>(v))[index] += 1.0;
+                    } else {
+                        complete = false;
+                    }
+                }
+                incomplete[s] += complete ? 0 : 1;
+            }
+        };
+        if (pool != nullptr) {
+            pool->parallelFor(0, kSlices, countSlice);
+        } else {
+            for (size_t s = 0; s < kSlices; ++s) {
+                countSlice(s);
+            }
+        }
+        size_t total = 0;
+        for (size_t s = 0; s < kSlices; ++s) {
+            add(slices[s]);
+            total += incomplete[s];
+        }
+        return total;
+    }
+
+    /**
+     * Estimate a node's CPT from its counts
+     * Each row is (count + pseudoCount) normalized; rows without any mass
+     * become uniform.
+     * @param v Variable index
+     * @param pseudoCount Dirichlet count added to every entry
+     * @return Row-major probabilities in CPT layout
+     */
+    std::vector<double> estimate(int v, double pseudoCount) const {
+        size_t card = net->cardinality(v);
+        std::vector<double> table(family(v), family(v) + familySize(v));
+        for (size_t row = 0; row < table.size(); row += card) {
+            double total = 0.0;
+            for (size_t x = 0; x < card; ++x) {
+                table[row + x] += pseudoCount;
+                total += table[row + x];
+            }
+            for (size_t x = 0; x < card; ++x) {
+                table[row + x] = total > 0.0 ? table[row + x] / total : 1.0 / static_cast<double>(card);
+            }
+        }
+        return table;
+    }
+};
+
+#endif // PARAMETER_LEARNING_HPP
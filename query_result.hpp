@@ -0,0 +1,369 @@
+/*
+ * query_result.hpp - Flat, index-keyed query results
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements the compact result types of the exact engines:
+ * JointTable, the normalized joint of a variable elimination query, and
+ * Marginals, the posterior of every node from one calibration. Both keep
+ * their probabilities as one contiguous array of doubles with variable and
+ * stride metadata, and hold the CompiledNetwork they were computed on, so
+ * node and state names are only looked up when a caller asks for them.
+ * toMap() gives the nested string-map forms of the older API.
+ */
+
+#ifndef QUERY_RESULT_HPP
+#define QUERY_RESULT_HPP
+
+// Index-based network snapshot for names
+#include "compiled_network.hpp"
+// Dense factors
+#include "factor.hpp"
+// Vector container
+#include <vector>
+// String operations
+#include <string>
+// Map container
+#include <map>
+// Shared snapshot
+#include <memory>
+// Sorting variables
+#include <algorithm>
+// Exception handling
+#include <stdexcept>
+
+/**
+ * JointTable is a probability table over query variables
+ * Variables are in ascending compiled index (topological) order, whatever
+ * the order of the query, and values are row-major with the last
+ * variable varying fastest.
+ */
+class JointTable {
+private:
+    std::shared_ptr<const CompiledNetwork> net;
+    std::vector<int> variables;
+    std::vector<size_t> cardinalities;
+    std::vector<size_t> strides;
+    std::vector<double> values;
+
+public:
+    /**
+     * Default constructor: the empty-scope table holding probability 1
+     */
+    JointTable() : values(1, 1.0) {}
+
+    /**
+     * Constructor from a factor over compiled variable indices
+     * @param network Snapshot the factor's variables refer to
+     * @param factor Table to copy, in any variable order
+     */
+    JointTable(std::shared_ptr<const CompiledNetwork> network, const Factor& factor)
+        : net(std::move(network)), variables(factor.getVariables()) {
+        std::sort(variables.begin(), variables.end());
+        size_t numVars = variables.size();
+        cardinalities.resize(numVars);
+        strides.resize(numVars);
+        std::vector<size_t> source(numVars);
+        for (size_t i = 0; i < numVars; ++i) {
+            int pos = factor.position(variables[i]);
+            cardinalities[i] = factor.getCardinalities()[pos];
+            source[i] = factor.getStrides()[pos];
+        }
+        size_t stride = 1;
+        for (int i = static_cast<int>(numVars) - 1; i >= 0; --i) {
+            strides[i] = stride;
+            stride *= cardinalities[i];
+        }
+
+        // Odometer over the sorted scope, tracking the offset in the factor
+        values.resize(factor.size());
+        std::vector<size_t> states(numVars, 0);
+        size_t offset = 0;
+        for (size_t i = 0; i < values.size(); ++i) {
+            values[i] = factor.getValues()[offset];
+            for (int v = static_cast<int>(numVars) - 1; v >= 0; --v) {
+                if (++states[v] < cardinalities[v]) {
+                    offset += source[v];
+                    break;
+                }
+                offset -= (cardinalities[v] - 1) * source[v];
+                states[v] = 0;
+            }
+        }
+    }
+
+    /**
+     * Get number of entries
+     */
+    size_t size() const {
+        return values.size();
+    }
+
+    /**
+     * Get compiled indices of the variables
+     */
+    const std::vector<int>& getVariables() const {
+        return variables;
+    }
+
+    /**
+     * Get number of states of each variable
+     */
+    const std::vector<size_t>& getCardinalities() const {
+        return cardinalities;
+    }
+
+    /**
+     * Get row-major stride of each variable
+     */
+    const std::vector<size_t>& getStrides() const {
+        return strides;
+    }
+
+    /**
+     * Get probabilities in row-major order
+     */
+    const std::vector<double>& getValues() const {
+        return values;
+    }
+
+    /**
+     * Get the network snapshot the table was computed on
+     */
+    const CompiledNetwork& network() const {
+        if (!net) {
+            throw std::runtime_error("Joint table has no network");
+        }
+        return *net;
+    }
+
+    /**
+     * Get node IDs of the variables, in table order
+     */
+    std::vector<std::string> getNodeIds() const {
+        std::vector<std::string> ids;
+        for (int var : variables) {
+            ids.push_back(network().nodeId(var));
+        }
+        return ids;
+    }
+
+    /**
+     * Probability of a joint state given by state indices
+     * @param states State index of each variable, in table order
+     * @return Probability
+     */
+    double value(const std::vector<size_t>& states) const {
+        if (states.size() != variables.size()) {
+            throw std::runtime_error("Joint state size mismatch");
+        }
+        size_t index = 0;
+        for (size_t i = 0; i < states.size(); ++i) {
+            if (states[i] >= cardinalities[i]) {
+                throw std::runtime_error("Joint state index out of bounds");
+            }
+            index += states[i] * strides[i];
+        }
+        return values[index];
+    }
+
+    /**
+     * Probability of a joint state given by names
+     * @param assignment Map of every query node ID to a state
+     * @return Probability
+     */
+    double probability(const std::map<std::string, std::string>& assignment) const {
+        if (assignment.size() != variables.size()) {
+            throw std::runtime_error("Assignment must name exactly the table's nodes");
+        }
+        std::vector<size_t> states(variables.size());
+        for (size_t i = 0; i < variables.size(); ++i) {
+            const std::string& nodeId = network().nodeId(variables[i]);
+            auto it = assignment.find(nodeId);
+            if (it == assignment.end()) {
+                throw std::runtime_error("Assignment is missing node " + nodeId);
+            }
+            int state = network().stateIndex(variables[i], it->second);
+            if (state == -1) {
+                throw std::runtime_error("State " + it->second + " does not exist for node " + nodeId);
+            }
+            states[i] = static_cast<size_t>(state);
+        }
+        return value(states);
+    }
+
+    /**
+     * Named joint state of an entry
+     * @param index Row-major entry index
+     * @return Map of node ID to state
+     */
+    std::map<std::string, std::string> assignment(size_t index) const {
+        if (index >= values.size()) {
+            throw std::runtime_error("Joint table index out of bounds");
+        }
+        std::map<std::string, std::string> result;
+        for (size_t i = 0; i < variables.size(); ++i) {
+            result[network().nodeId(variables[i])] = network().states(variables[i])[(index / strides[i]) % cardinalities[i]];
+        }
+        return result;
+    }
+
+    /**
+     * Nested string-map form (variableElimination's result type)
+     * @return Map of query assignments to their probabilities
+     */
+    std::map<std::map<std::string, std::string>, double> toMap() const {
+        std::map<std::map<std::string, std::string>, double> result;
+        for (size_t i = 0; i < values.size(); ++i) {
+            result.emplace_hint(result.end(), assignment(i), values[i]);
+        }
+        return result;
+    }
+
+    /**
+     * Estimated heap footprint (for the result cache)
+     */
+    size_t footprint() const {
+        return sizeof(JointTable) + variables.size() * (sizeof(int) + 2 * sizeof(size_t)) +
+               values.size() * sizeof(double);
+    }
+};
+
+/**
+ * Marginals holds the posterior distribution of every node of a network
+ * Distributions are stored back to back in compiled index order, with
+ * CSR offsets: node v's states are values[offsets[v]] .. values[offsets[v + 1]).
+ */
+class Marginals {
+private:
+    std::shared_ptr<const CompiledNetwork> net;
+    std::vector<size_t> offsets;
+    std::vector<double> values;
+
+    /**
+     * Map of state name to probability of one node
+     */
+    std::map<std::string, double> namedDistribution(int v) const {
+        const std::vector<std::string>& states = network().states(v);
+        std::map<std::string, double> result;
+        for (size_t s = 0; s < states.size(); ++s) {
+            result.emplace_hint(result.end(), states[s], values[offsets[v] + s]);
+        }
+        return result;
+    }
+
+public:
+    /**
+     * Default constructor: marginals of the empty network
+     */
+    Marginals() : offsets(1, 0) {}
+
+    /**
+     * Constructor with zeroed distributions for every node of a snapshot
+     * @param network Snapshot the marginals refer to
+     */
+    explicit Marginals(std::shared_ptr<const CompiledNetwork> network) : net(std::move(network)) {
+        offsets.reserve(net->numNodes() + 1);
+        offsets.push_back(0);
+        for (size_t v = 0; v < net->numNodes(); ++v) {
+            offsets.push_back(offsets.back() + net->cardinality(static_cast<int>(v)));
+        }
+        values.assign(offsets.back(), 0.0);
+    }
+
+    /**
+     * Get number of nodes
+     */
+    size_t size() const {
+        return offsets.size() - 1;
+    }
+
+    /**
+     * Get CSR offsets of the distributions
+     */
+    const std::vector<size_t>& getOffsets() const {
+        return offsets;
+    }
+
+    /**
+     * Get every distribution, back to back
+     */
+    const std::vector<double>& getValues() const {
+        return values;
+    }
+
+    /**
+     * Get the network snapshot the marginals were computed on
+     */
+    const CompiledNetwork& network() const {
+        if (!net) {
+            throw std::runtime_error("Marginals have no network");
+        }
+        return *net;
+    }
+
+    /**
+     * Get a node's distribution by compiled index
+     * @param v Compiled index
+     * @return View of the node's state probabilities
+     */
+    ArrayView<double> probabilities(int v) const {
+        if (v < 0 || static_cast<size_t>(v) >= size()) {
+            throw std::runtime_error("Node index out of bounds");
+        }
+        return ArrayView<double>(values.data() + offsets[v], offsets[v + 1] - offsets[v]);
+    }
+
+    /**
+     * Get a node's distribution by compiled index for writing
+     * @param v Compiled index
+     * @return Pointer to the node's first state probability
+     */
+    double* mutableProbabilities(int v) {
+        return values.data() + offsets[v];
+    }
+
+    /**
+     * Posterior probability of one state
+     * @param nodeId Node ID
+     * @param state State name
+     * @return Probability
+     */
+    double probability(const std::string& nodeId, const std::string& state) const {
+        int v = network().requireIndex(nodeId);
+        int s = network().stateIndex(v, state);
+        if (s == -1) {
+            throw std::runtime_error("State " + state + " does not exist for node " + nodeId);
+        }
+        return values[offsets[v] + s];
+    }
+
+    /**
+     * Named distribution of one node
+     * @param nodeId Node ID
+     * @return Map of state to probability
+     */
+    std::map<std::string, double> distribution(const std::string& nodeId) const {
+        return namedDistribution(network().requireIndex(nodeId));
+    }
+
+    /**
+     * Nested string-map form (computeAllMarginals' result type)
+     * @return Map of node ID to state -> probability
+     */
+    std::map<std::string, std::map<std::string, double>> toMap() const {
+        std::map<std::string, std::map<std::string, double>> result;
+        for (size_t v = 0; v < size(); ++v) {
+            result.emplace(network().nodeId(static_cast<int>(v)), namedDistribution(static_cast<int>(v)));
+        }
+        return result;
+    }
+
+    /**
+     * Estimated heap footprint (for the result cache)
+     */
+    size_t footprint() const {
+        return sizeof(Marginals) + offsets.size() * sizeof(size_t) + values.size() * sizeof(double);
+    }
+};
+
+#endif // QUERY_RESULT_HPP
@@ -0,0 +1,221 @@
+/*
+ * relevance.hpp - Query-specific relevance reduction of a compiled network
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements RelevantSubnetwork, a view over a CompiledNetwork
+ * holding only the nodes whose CPTs a query needs. The requisite view runs
+ * Bayes-ball (Shachter 1998) from the query variables over the parent and
+ * child indices: it keeps the ancestral closure of query and evidence with
+ * barren nodes removed and d-separated components cut, which is exact for
+ * any result normalized over the query. The ancestral view keeps every
+ * ancestor of query and evidence, as unnormalized results (P(evidence),
+ * joint MAP probabilities) need. Neither copies a CPT: the view indexes
+ * the snapshot it keeps alive.
+ */
+
+#ifndef RELEVANCE_HPP
+#define RELEVANCE_HPP
+
+// Index-based network snapshot
+#include "compiled_network.hpp"
+// Barren-node pruning
+#include "elimination_order.hpp"
+// Vector container
+#include <vector>
+// Shared snapshot ownership
+#include <memory>
+// std::pair
+#include <utility>
+
+/**
+ * Which nodes a query keeps
+ */
+enum class Relevance {
+    Ancestral,  // Ancestors of query and evidence (unnormalized results)
+    Requisite   // Bayes-ball requisite nodes (results normalized over the query)
+};
+
+/**
+ * RelevantSubnetwork is the set of nodes a query needs, over one snapshot
+ * Engines iterate nodes() instead of every node of the network.
+ */
+class RelevantSubnetwork {
+private:
+    std::shared_ptr<const CompiledNetwork> net;
+    // Kept flag per variable of net
+    std::vector<bool> kept;
+    // Kept variables in index (topological) order
+    std::vector<int> keptNodes;
+    // Observed variables the query depends on, in index order
+    std::vector<int> observations;
+
+    RelevantSubnetwork(std::shared_ptr<const CompiledNetwork> network, std::vector<bool> mask)
+        : net(std::move(network)), kept(std::move(mask)) {}
+
+public:
+    RelevantSubnetwork() = default;
+
+    /**
+     * Requisite nodes of P(query | evidence) by Bayes-ball
+     * A ball starts at each query variable as if sent by a child. At an
+     * unobserved node it passes on to the children and, when it came from a
+     * child, to the parents; at an observed node it bounces back to the
+     * parents when it came from a parent and stops when it came from a
+     * child. A node needs its CPT when the ball leaves it towards its
+     * parents. Observed query variables are treated as unobserved, so their
+     * point mass is applied to an exact conditional.
+     * @param network Compiled network
+     * @param queryVars Query variable indices
+     * @param evidenceState Observed state per variable, or -1
+     * @return View of the requisite nodes
+     */
+    static RelevantSubnetwork fromBayesBall(std::shared_ptr<const CompiledNetwork> network,
+                                            const std::vector<int>& queryVars,
+                                            const std::vector<int>& evidenceState) {
+        size_t numVars = network->numNodes();
+        std::vector<bool> isQuery(numVars, false);
+        for (int v : queryVars) {
+            isQuery[v] = true;
+        }
+        // Marks: ball sent to the parents (top), to the children (bottom)
+        std::vector<bool> top(numVars, false);
+        std::vector<bool> bottom(numVars, false);
+        std::vector<bool> visited(numVars, false);
+        std::vector<std::pair<int, bool>> stack;
+        for (int v : queryVars) {
+            stack.emplace_back(v, true);
+        }
+        while (!stack.empty()) {
+            int v = stack.back().first;
+            bool fromChild = stack.back().second;
+            stack.pop_back();
+            visited[v] = true;
+            bool observed = !isQuery[v] && evidenceState[v] != -1;
+            if (observed) {
+                if (!fromChild && !top[v]) {
+                    top[v] = true;
+                    for (int p : network->parents(v)) {
+                        stack.emplace_back(p, true);
+                    }
+                }
+                continue;
+            }
+            if (fromChild && !top[v]) {
+                top[v] = true;
+                for (int p : network->parents(v)) {
+                    stack.emplace_back(p, true);
+                }
+            }
+            if (!bottom[v]) {
+                bottom[v] = true;
+                for (int c : network->children(v)) {
+                    stack.emplace_back(c, false);
+                }
+            }
+        }
+
+        RelevantSubnetwork view(std::move(network), std::move(top));
+        for (size_t v = 0; v < numVars; ++v) {
+            if (view.kept[v]) {
+                view.keptNodes.push_back(static_cast<int>(v));
+            }
+            if (visited[v] && !isQuery[v] && evidenceState[v] != -1) {
+                view.observations.push_back(static_cast<int>(v));
+            }
+        }
+        return view;
+    }
+
+    /**
+     * Ancestral closure of query and evidence (barren nodes removed)
+     * @param network Compiled network
+     * @param queryVars Query variable indices
+     * @param evidenceState Observed state per variable, or -1
+     * @return View of the query and evidence variables and their ancestors
+     */
+    static RelevantSubnetwork fromAncestors(std::shared_ptr<const CompiledNetwork> network,
+                                            const std::vector<int>& queryVars,
+                                            const std::vector<int>& evidenceState) {
+        std::vector<int> seeds = queryVars;
+        for (size_t v = 0; v < evidenceState.size(); ++v) {
+            if (evidenceState[v] != -1) {
+                seeds.push_back(static_cast<int>(v));
+            }
+        }
+        std::vector<bool> mask = EliminationOrdering::ancestralSet(network->getParentOffsets(),
+                                                                   network->getParentIndices(), seeds);
+        RelevantSubnetwork view(std::move(network), std::move(mask));
+        for (size_t v = 0; v < view.kept.size(); ++v) {
+            if (view.kept[v]) {
+                view.keptNodes.push_back(static_cast<int>(v));
+                if (evidenceState[v] != -1) {
+                    view.observations.push_back(static_cast<int>(v));
+                }
+            }
+        }
+        return view;
+    }
+
+    /**
+     * Build the view a query needs
+     * @param mode Ancestral or requisite nodes
+     * @param network Compiled network
+     * @param queryVars Query variable indices
+     * @param evidenceState Observed state per variable, or -1
+     * @return View of the relevant nodes
+     */
+    static RelevantSubnetwork build(Relevance mode,
+                                    std::shared_ptr<const CompiledNetwork> network,
+                                    const std::vector<int>& queryVars,
+                                    const std::vector<int>& evidenceState) {
+        return mode == Relevance::Requisite ? fromBayesBall(std::move(network), queryVars, evidenceState)
+                                            : fromAncestors(std::move(network), queryVars, evidenceState);
+    }
+
+    /**
+     * Get the snapshot the view indexes
+     */
+    const std::shared_ptr<const CompiledNetwork>& network() const {
+        return net;
+    }
+
+    /**
+     * Whether a variable is kept
+     * @param v Variable index
+     */
+    bool contains(int v) const {
+        return kept[v];
+    }
+
+    /**
+     * Get the kept flag of every variable
+     */
+    const std::vector<bool>& mask() const {
+        return kept;
+    }
+
+    /**
+     * Get the kept variables in index order
+     */
+    const std::vector<int>& nodes() const {
+        return keptNodes;
+    }
+
+    /**
+     * Get the observed variables the query depends on, in index order
+     * Requisite views include observed parents of kept nodes, whose own
+     * CPTs may be dropped.
+     */
+    const std::vector<int>& requisiteEvidence() const {
+        return observations;
+    }
+
+    /**
+     * Get the number of kept variables
+     */
+    size_t size() const {
+        return keptNodes.size();
+    }
+};
+
+#endif // RELEVANCE_HPP
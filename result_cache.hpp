@@ -0,0 +1,317 @@
+/*
+ * result_cache.hpp - Bounded LRU cache of query results
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements ResultCache, a thread-safe least-recently-used
+ * cache for inference results. Keys hold the query and the evidence as
+ * integer node and state indices; entries are tagged with the model
+ * version they were computed for, and the whole cache is dropped as soon
+ * as a lookup sees a newer version. Memory use is bounded by an estimate
+ * of each result's footprint.
+ */
+
+#ifndef RESULT_CACHE_HPP
+#define RESULT_CACHE_HPP
+
+// Vector container
+#include <vector>
+// String operations
+#include <string>
+// Map container
+#include <map>
+// Recency list
+#include <list>
+// Hash index over keys
+#include <unordered_map>
+// Fixed-width integers
+#include <cstdint>
+// Type-erased shared results
+#include <memory>
+// Cache lock
+#include <mutex>
+
+/**
+ * ResultCache maps canonical query keys to shared, immutable results.
+ * Copying a cache copies its capacity only, so two networks never share
+ * entries.
+ */
+class ResultCache {
+public:
+    /**
+     * Operation a cached result belongs to
+     */
+    enum class Kind : uint8_t {
+        Elimination,              // variableElimination
+        Marginals,                // computeAllMarginals
+        BeliefPropagation,        // beliefPropagation with tracing
+        ReverseBeliefPropagation  // reverseBeliefPropagation with tracing
+    };
+
+    /**
+     * Canonical query key
+     */
+    struct Key {
+        Kind kind = Kind::Elimination;
+        std::vector<int> query;     // Query node indices
+        std::vector<int> evidence;  // (node, state) pairs by increasing node
+
+        bool operator==(const Key& other) const {
+            return kind == other.kind && query == other.query && evidence == other.evidence;
+        }
+    };
+
+    /**
+     * Counters and usage of the cache
+     */
+    struct Stats {
+        size_t hits = 0;       // Lookups answered from the cache
+        size_t misses = 0;     // Lookups that had to compute
+        size_t evictions = 0;  // Entries dropped to stay within capacity
+        size_t entries = 0;    // Entries currently held
+        size_t bytes = 0;      // Estimated bytes currently held
+        size_t capacity = 0;   // Byte budget (0 disables the cache)
+    };
+
+private:
+    /**
+     * Hash of a key: mixes every index with a 64-bit multiplier
+     */
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            uint64_t hash = 0x9e3779b97f4a7c15ull ^ static_cast<uint64_t>(key.kind);
+            auto mix = [&hash](int value) {
+                hash ^= static_cast<uint64_t>(static_cast<uint32_t>(value)) + 0x9e3779b97f4a7c15ull +
+                        (hash << 6) + (hash >> 2);
+            };
+            for (int v : key.query) {
+                mix(v);
+            }
+            mix(-1);
+            for (int v : key.evidence) {
+                mix(v);
+            }
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    /**
+     * Structure holding one cached result
+     */
+    struct Entry {
+        Key key;
+        std::shared_ptr<const void> value;
+        size_t bytes;
+    };
+
+    // Entries, most recently used first
+    std::list<Entry> entries;
+    // Key -> position in entries
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+    // Byte budget and bytes in use
+    size_t capacity = 0;
+    size_t bytesUsed = 0;
+    // Model version the entries were computed for
+    uint64_t version = 0;
+    // Counters
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    // Guards everything above (const queries may run concurrently)
+    mutable std::mutex mutex;
+
+    /**
+     * Drop every entry if the model has changed since they were stored
+     * Versions only move forward: a query still running on an older
+     * snapshot neither reads nor stores entries of the newer model.
+     * @return False if the given version is older than the entries
+     */
+    bool syncVersion(uint64_t modelVersion) {
+        if (modelVersion < version) {
+            return false;
+        }
+        if (modelVersion > version) {
+            entries.clear();
+            index.clear();
+            bytesUsed = 0;
+            version = modelVersion;
+        }
+        return true;
+    }
+
+    /**
+     * Evict least recently used entries until the budget holds
+     */
+    void evictTo(size_t limit) {
+        while (bytesUsed > limit && !entries.empty()) {
+            bytesUsed -= entries.back().bytes;
+            index.erase(entries.back().key);
+            entries.pop_back();
+            ++evictions;
+        }
+    }
+
+public:
+    /**
+     * Constructor with byte budget
+     * @param capacityBytes Budget in bytes (0 disables the cache)
+     */
+    explicit ResultCache(size_t capacityBytes = 0) : capacity(capacityBytes) {}
+
+    /**
+     * Copy constructor: same budget, no entries
+     */
+    ResultCache(const ResultCache& other) : capacity(other.getCapacity()) {}
+
+    /**
+     * Copy assignment: same budget, no entries
+     */
+    ResultCache& operator=(const ResultCache& other) {
+        if (this != &other) {
+            size_t newCapacity = other.getCapacity();
+            std::lock_guard<std::mutex> lock(mutex);
+            entries.clear();
+            index.clear();
+            bytesUsed = 0;
+            version = 0;
+            capacity = newCapacity;
+        }
+        return *this;
+    }
+
+    /**
+     * Get the byte budget
+     * @return Capacity in bytes (0 when disabled)
+     */
+    size_t getCapacity() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return capacity;
+    }
+
+    /**
+     * Set the byte budget, evicting entries that no longer fit
+     * @param capacityBytes Budget in bytes (0 disables and empties the cache)
+     */
+    void setCapacity(size_t capacityBytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        capacity = capacityBytes;
+        evictTo(capacity);
+    }
+
+    /**
+     * Drop every entry and reset the counters
+     */
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        index.clear();
+        bytesUsed = 0;
+        hits = misses = evictions = 0;
+    }
+
+    /**
+     * Get counters and usage
+     * @return Snapshot of the statistics
+     */
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats stats;
+        stats.hits = hits;
+        stats.misses = misses;
+        stats.evictions = evictions;
+        stats.entries = entries.size();
+        stats.bytes = bytesUsed;
+        stats.capacity = capacity;
+        return stats;
+    }
+
+    /**
+     * Look up a result and mark it most recently used
+     * @param modelVersion Current model version
+     * @param key Canonical query key
+     * @return Cached result, or null on a miss
+     */
+    template <typename T>
+    std::shared_ptr<const T> find(uint64_t modelVersion, const Key& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!syncVersion(modelVersion)) {
+            ++misses;
+            return std::shared_ptr<const T>();
+        }
+        auto it = index.find(key);
+        if (it == index.end()) {
+            ++misses;
+            return std::shared_ptr<const T>();
+        }
+        ++hits;
+        entries.splice(entries.begin(), entries, it->second);
+        return std::static_pointer_cast<const T>(it->second->value);
+    }
+
+    /**
+     * Store a result as the most recently used entry
+     * Results larger than the whole budget are not stored.
+     * @param modelVersion Model version the result was computed for
+     * @param key Canonical query key
+     * @param value Result to share
+     * @param bytes Estimated footprint of the result
+     */
+    template <typename T>
+    void insert(uint64_t modelVersion, Key key, std::shared_ptr<const T> value, size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!syncVersion(modelVersion)) {
+            return;
+        }
+        bytes += sizeof(Entry) + (key.query.size() + key.evidence.size()) * sizeof(int);
+        if (bytes > capacity) {
+            return;
+        }
+        auto it = index.find(key);
+        if (it != index.end()) {
+            bytesUsed -= it->second->bytes;
+            entries.erase(it->second);
+            index.erase(it);
+        }
+        entries.push_front(Entry{key, std::static_pointer_cast<const void>(value), bytes});
+        index.emplace(std::move(key), entries.begin());
+        bytesUsed += bytes;
+        evictTo(capacity);
+    }
+
+    /**
+     * Estimated heap footprint of result values
+     */
+    static size_t footprint(double) {
+        return sizeof(double);
+    }
+
+    static size_t footprint(const std::string& text) {
+        // Short strings live inside the object
+        return sizeof(std::string) + (text.size() > 15 ? text.size() + 1 : 0);
+    }
+
+    template <typename A, typename B>
+    static size_t footprint(const std::pair<A, B>& pair) {
+        return footprint(pair.first) + footprint(pair.second);
+    }
+
+    template <typename K, typename V>
+    static size_t footprint(const std::map<K, V>& map) {
+        // Each tree node carries three pointers and a colour besides the pair
+        size_t bytes = sizeof(map);
+        for (const auto& pair : map) {
+            bytes += 4 * sizeof(void*) + footprint(pair.first) + footprint(pair.second);
+        }
+        return bytes;
+    }
+
+    template <typename T>
+    static size_t footprint(const std::vector<T>& vector) {
+        size_t bytes = sizeof(vector);
+        for (const T& item : vector) {
+            bytes += footprint(item);
+        }
+        return bytes;
+    }
+};
+
+#endif // RESULT_CACHE_HPP
@@ -0,0 +1,535 @@
+/*
+ * sampling.hpp - Approximate inference by sampling
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements forward (logic) sampling, likelihood weighting and
+ * Gibbs sampling over a compiled network. Random numbers come from a
+ * counter-based generator (Philox4x32-10) addressed by sample and node, so
+ * a run is reproducible from its seed whatever the thread count. Samples
+ * are drawn in batches held as structure-of-arrays buffers (one column of
+ * states per node), and running estimates with confidence intervals are
+ * reported after every round so callers can stop at a deadline.
+ */
+
+#ifndef SAMPLING_HPP
+#define SAMPLING_HPP
+
+// Frozen index-based network snapshot
+#include "compiled_network.hpp"
+// Parallel batches
+#include "thread_pool.hpp"
+// Cancellation checkpoints
+#include "async_query.hpp"
+// Vector container
+#include <vector>
+// Fixed-width integers
+#include <cstdint>
+// Shared snapshot ownership
+#include <memory>
+// Progress callbacks
+#include <functional>
+// Time limits
+#include <chrono>
+// std::sqrt
+#include <cmath>
+// std::min, std::max
+#include <algorithm>
+// Exception handling
+#include <stdexcept>
+
+/**
+ * CounterRNG is the Philox4x32-10 counter-based generator: every draw is a
+ * pure function of (seed, stream, index), so draws need no shared state
+ * and any partition of the work reproduces the same numbers.
+ */
+class CounterRNG {
+private:
+    // Key derived from the seed
+    uint32_t key0;
+    uint32_t key1;
+
+    /**
+     * High and low words of a 32 x 32 bit product
+     */
+    static void multiply(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo) {
+        uint64_t product = static_cast<uint64_t>(a) * b;
+        hi = static_cast<uint32_t>(product >> 32);
+        lo = static_cast<uint32_t>(product);
+    }
+
+public:
+    /**
+     * Constructor with seed
+     * @param seed Seed of every stream
+     */
+    explicit CounterRNG(uint64_t seed = 0)
+        : key0(static_cast<uint32_t>(seed)), key1(static_cast<uint32_t>(seed >> 32)) {}
+
+    /**
+     * Generate the 128-bit block of a counter
+     * @param stream High 64 bits of the counter
+     * @param index Low 64 bits of the counter
+     * @param out Four random words
+     */
+    void block(uint64_t stream, uint64_t index, uint32_t out[4]) const {
+        uint32_t c0 = static_cast<uint32_t>(index);
+        uint32_t c1 = static_cast<uint32_t>(index >> 32);
+        uint32_t c2 = static_cast<uint32_t>(stream);
+        uint32_t c3 = static_cast<uint32_t>(stream >> 32);
+        uint32_t k0 = key0;
+        uint32_t k1 = key1;
+        for (int round = 0; round < 10; ++round) {
+            uint32_t hi0, lo0, hi1, lo1;
+            multiply(0xD2511F53u, c0, hi0, lo0);
+            multiply(0xCD9E8D57u, c2, hi1, lo1);
+            uint32_t n0 = hi1 ^ c1 ^ k0;
+            uint32_t n2 = hi0 ^ c3 ^ k1;
+            c0 = n0;
+            c1 = lo1;
+            c2 = n2;
+            c3 = lo0;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+        out[0] = c0;
+        out[1] = c1;
+        out[2] = c2;
+        out[3] = c3;
+    }
+
+    /**
+     * Uniform double in [0, 1) with 53 random bits
+     * @param stream Stream (e.g. sample or chain number)
+     * @param index Draw within the stream
+     */
+    double uniform(uint64_t stream, uint64_t index) const {
+        uint32_t words[4];
+        block(stream, index, words);
+        uint64_t bits = (static_cast<uint64_t>(words[0]) << 21) ^ (words[1] >> 11);
+        return static_cast<double>(bits & ((uint64_t(1) << 53) - 1)) * (1.0 / 9007199254740992.0);
+    }
+};
+
+/**
+ * Sampling algorithms
+ */
+enum class SamplingMethod {
+    Forward,              // Logic sampling; samples contradicting the evidence are rejected
+    LikelihoodWeighting,  // Evidence clamped, samples weighted by its likelihood
+    Gibbs                 // Markov chains resampling one node from its Markov blanket
+};
+
+/**
+ * Controls of a sampling run
+ */
+struct SamplingOptions {
+    SamplingMethod method = SamplingMethod::LikelihoodWeighting;
+    uint64_t seed = 0;
+    size_t maxSamples = 100000;   // Samples to draw (Gibbs: recorded sweeps over all chains)
+    size_t batchSize = 1024;      // Samples per batch (Gibbs: sweeps per chain per round)
+    size_t batchesPerRound = 8;   // Batches between running estimates
+    size_t chains = 8;            // Gibbs chains
+    size_t burnIn = 100;          // Gibbs sweeps discarded per chain
+    double zScore = 1.96;         // Confidence interval width in standard errors
+    double timeLimit = 0.0;       // Seconds before stopping after the current round (0: none)
+};
+
+/**
+ * Sampler runs one sampling query on a compiled network. Work is split
+ * into fixed batches and reduced in batch order, so estimates do not
+ * depend on the thread pool.
+ */
+class Sampler {
+public:
+    /**
+     * Running estimate, by variable index
+     */
+    struct Estimate {
+        std::vector<std::vector<double>> marginals;   // Posterior estimate per state
+        std::vector<std::vector<double>> halfWidths;  // Confidence interval half-widths
+        size_t samples = 0;                           // Samples drawn
+        double effectiveSamples = 0.0;                // Effective sample size
+        double seconds = 0.0;                         // Time since the run started
+    };
+
+private:
+    /**
+     * Weighted state counts of one batch or chain
+     */
+    struct Accumulator {
+        std::vector<double> counts;  // Flat, stateOffsets[v] + state
+        double weight = 0.0;         // Sum of weights
+        double squaredWeight = 0.0;  // Sum of squared weights
+        size_t samples = 0;          // Samples recorded
+    };
+
+    /**
+     * Buffers of one batch slot (reused every round)
+     */
+    struct Batch {
+        std::vector<uint32_t> states;   // Node-major: states[v * batchSize + s]
+        std::vector<double> weights;    // One weight per sample
+        Accumulator sum;
+    };
+
+    /**
+     * State of one Gibbs chain
+     */
+    struct Chain {
+        std::vector<uint32_t> state;    // Current state per node
+        std::vector<double> weights;    // Scratch: conditional over a node's states
+        uint64_t draws = 0;             // Counter of the chain's stream
+        Accumulator sum;
+    };
+
+    // Snapshot being sampled
+    std::shared_ptr<const CompiledNetwork> net;
+    // Observed state per node, or -1
+    std::vector<int> evidence;
+    // Run controls
+    SamplingOptions options;
+    // Random numbers by (sample or chain, draw)
+    CounterRNG rng;
+    // Dense CPT of every node (structured CPTs are expanded once)
+    std::vector<const double*> tables;
+    std::vector<std::vector<double>> expanded;
+    // Offset of each node's states in the flat count arrays
+    std::vector<size_t> stateOffsets;
+
+    /**
+     * Draw a state from an (unnormalized) row
+     */
+    static uint32_t draw(const double* row, size_t card, double u) {
+        double total = 0.0;
+        for (size_t x = 0; x < card; ++x) {
+            total += row[x];
+        }
+        double target = u * total;
+        double cumulative = 0.0;
+        uint32_t last = 0;
+        for (size_t x = 0; x < card; ++x) {
+            if (row[x] > 0.0) {
+                cumulative += row[x];
+                last = static_cast<uint32_t>(x);
+                if (target < cumulative) {
+                    break;
+                }
+            }
+        }
+        return last;
+    }
+
+    /**
+     * Draw one batch of forward or likelihood-weighted samples
+     * @param first Global index of the batch's first sample
+     * @param count Samples in the batch
+     */
+    void sampleBatch(uint64_t first, size_t count, Batch& batch) const {
+        size_t width = options.batchSize;
+        std::fill(batch.weights.begin(), batch.weights.begin() + count, 1.0);
+        bool weighted = options.method == SamplingMethod::LikelihoodWeighting;
+        for (size_t v = 0; v < net->numNodes(); ++v) {
+            int var = static_cast<int>(v);
+            ArrayView<int> parents = net->parents(var);
+            ArrayView<size_t> strides = net->strides(var);
+            size_t card = net->cardinality(var);
+            uint32_t* column = batch.states.data() + v * width;
+            for (size_t s = 0; s < count; ++s) {
+                size_t offset = 0;
+                for (size_t k = 0; k < parents.size(); ++k) {
+                    offset += batch.states[static_cast<size_t>(parents[k]) * width + s] * strides[k];
+                }
+                const double* row = tables[v] + offset;
+                if (evidence[v] != -1 && weighted) {
+                    column[s] = static_cast<uint32_t>(evidence[v]);
+                    batch.weights[s] *= row[evidence[v]];
+                    continue;
+                }
+                column[s] = draw(row, card, rng.uniform(first + s, v));
+                if (evidence[v] != -1 && column[s] != static_cast<uint32_t>(evidence[v])) {
+                    batch.weights[s] = 0.0;
+                }
+            }
+            LBN_COUNT(CptLookups, count * card);
+        }
+        Accumulator& sum = batch.sum;
+        for (size_t s = 0; s < count; ++s) {
+            double w = batch.weights[s];
+            sum.weight += w;
+            sum.squaredWeight += w * w;
+            if (w == 0.0) {
+                continue;
+            }
+            for (size_t v = 0; v < net->numNodes(); ++v) {
+                sum.counts[stateOffsets[v] + batch.states[v * width + s]] += w;
+            }
+        }
+        sum.samples += count;
+    }
+
+    /**
+     * Advance a Gibbs chain by a number of sweeps
+     * @param record Whether the sweeps are counted (false during burn-in)
+     */
+    void advanceChain(uint64_t chainIndex, Chain& chain, size_t sweeps, bool record) const {
+        for (size_t sweep = 0; sweep < sweeps; ++sweep) {
+            for (size_t v = 0; v < net->numNodes(); ++v) {
+                if (evidence[v] != -1) {
+                    continue;
+                }
+                int var = static_cast<int>(v);
+                size_t card = net->cardinality(var);
+                // P(x | parents) times each child's CPT entry given x
+                const double* row = tables[v] + rowOffset(var, chain.state.data());
+                for (size_t x = 0; x < card; ++x) {
+                    chain.weights[x] = row[x];
+                }
+                ArrayView<int> children = net->children(var);
+                ArrayView<size_t> edges = net->childEdges(var);
+                for (size_t k = 0; k < children.size(); ++k) {
+                    int c = children[k];
+                    size_t slot = edges[k] - net->getParentOffsets()[c];
+                    size_t stride = net->strides(c)[slot];
+                    size_t base = rowOffset(c, chain.state.data()) - chain.state[v] * stride + chain.state[c];
+                    for (size_t x = 0; x < card; ++x) {
+                        chain.weights[x] *= tables[c][base + x * stride];
+                    }
+                }
+                LBN_COUNT(CptLookups, card * (children.size() + 1));
+                double total = 0.0;
+                for (size_t x = 0; x < card; ++x) {
+                    total += chain.weights[x];
+                }
+                // A zero-probability neighbourhood keeps the current state
+                if (total > 0.0) {
+                    chain.state[v] = draw(chain.weights.data(), card, rng.uniform(chainIndex, chain.draws));
+                }
+                ++chain.draws;
+            }
+            if (record) {
+                for (size_t v = 0; v < net->numNodes(); ++v) {
+                    chain.sum.counts[stateOffsets[v] + chain.state[v]] += 1.0;
+                }
+                chain.sum.weight += 1.0;
+                chain.sum.squaredWeight += 1.0;
+                ++chain.sum.samples;
+            }
+        }
+    }
+
+    /**
+     * Offset of a node's CPT row given the states of its parents
+     */
+    size_t rowOffset(int v, const uint32_t* state) const {
+        ArrayView<int> parents = net->parents(v);
+        ArrayView<size_t> strides = net->strides(v);
+        size_t offset = 0;
+        for (size_t k = 0; k < parents.size(); ++k) {
+            offset += state[parents[k]] * strides[k];
+        }
+        return offset;
+    }
+
+    /**
+     * Estimate from weighted counts: self-normalized means, with intervals
+     * from the effective sample size (sum w)^2 / sum w^2
+     */
+    Estimate weightedEstimate(const Accumulator& total) const {
+        Estimate estimate = emptyEstimate();
+        estimate.samples = total.samples;
+        estimate.effectiveSamples = (total.squaredWeight > 0.0) ? total.weight * total.weight / total.squaredWeight : 0.0;
+        if (total.weight <= 0.0) {
+            return estimate;
+        }
+        for (size_t v = 0; v < net->numNodes(); ++v) {
+            for (size_t x = 0; x < estimate.marginals[v].size(); ++x) {
+                double p = total.counts[stateOffsets[v] + x] / total.weight;
+                estimate.marginals[v][x] = p;
+                estimate.halfWidths[v][x] = options.zScore * std::sqrt(p * (1.0 - p) / estimate.effectiveSamples);
+            }
+        }
+        return estimate;
+    }
+
+    /**
+     * Estimate from Gibbs chains: pooled means, with intervals from the
+     * spread of the per-chain means (autocorrelation included)
+     */
+    Estimate chainEstimate(const std::vector<Chain>& chains) const {
+        Estimate estimate = emptyEstimate();
+        size_t numChains = chains.size();
+        for (const Chain& chain : chains) {
+            estimate.samples += chain.sum.samples;
+        }
+        estimate.effectiveSamples = static_cast<double>(estimate.samples);
+        if (estimate.samples == 0) {
+            return estimate;
+        }
+        for (size_t v = 0; v < net->numNodes(); ++v) {
+            for (size_t x = 0; x < estimate.marginals[v].size(); ++x) {
+                double pooled = 0.0;
+                for (const Chain& chain : chains) {
+                    pooled += chain.sum.counts[stateOffsets[v] + x];
+                }
+                double mean = pooled / static_cast<double>(estimate.samples);
+                double spread = 0.0;
+                for (const Chain& chain : chains) {
+                    double chainMean = chain.sum.counts[stateOffsets[v] + x] / static_cast<double>(chain.sum.samples);
+                    spread += (chainMean - mean) * (chainMean - mean);
+                }
+                estimate.marginals[v][x] = mean;
+                estimate.halfWidths[v][x] = (numChains > 1)
+                    ? options.zScore * std::sqrt(spread / static_cast<double>((numChains - 1) * numChains))
+                    : 0.0;
+            }
+        }
+        return estimate;
+    }
+
+    /**
+     * All-zero estimate shaped like the network
+     */
+    Estimate emptyEstimate() const {
+        Estimate estimate;
+        for (size_t v = 0; v < net->numNodes(); ++v) {
+            estimate.marginals.emplace_back(net->cardinality(static_cast<int>(v)), 0.0);
+            estimate.halfWidths.emplace_back(net->cardinality(static_cast<int>(v)), 0.0);
+        }
+        return estimate;
+    }
+
+    /**
+     * Zeroed accumulator sized for the network
+     */
+    Accumulator emptyAccumulator() const {
+        Accumulator sum;
+        sum.counts.assign(stateOffsets.back(), 0.0);
+        return sum;
+    }
+
+public:
+    /**
+     * Constructor
+     * @param network Compiled network (every CPT must be valid)
+     * @param evidenceState Observed state per variable, or -1
+     * @param samplingOptions Method, seed, sample budget and batching
+     */
+    Sampler(std::shared_ptr<const CompiledNetwork> network,
+            std::vector<int> evidenceState,
+            const SamplingOptions& samplingOptions)
+        : net(std::move(network)), evidence(std::move(evidenceState)), options(samplingOptions),
+          rng(samplingOptions.seed) {
+        if (options.batchSize == 0 || options.batchesPerRound == 0 || options.chains == 0) {
+            throw std::runtime_error("Sampling batch size, batches per round and chains must be positive");
+        }
+        size_t numNodes = net->numNodes();
+        tables.resize(numNodes);
+        expanded.resize(numNodes);
+        stateOffsets.assign(1, 0);
+        for (size_t v = 0; v < numNodes; ++v) {
+            tables[v] = net->denseCPT(static_cast<int>(v), expanded[v]);
+            stateOffsets.push_back(stateOffsets.back() + net->cardinality(static_cast<int>(v)));
+        }
+    }
+
+    /**
+     * Run until the sample budget, the time limit, or the progress callback
+     * stops it
+     * @param pool Thread pool for batches or chains (null runs serially)
+     * @param progress Called with the running estimate after every round;
+     *                 returning false stops the run
+     * @return Final estimate
+     */
+    Estimate run(ThreadPool* pool, const std::function<bool(const Estimate&)>& progress = nullptr) const {
+        LBN_PHASE("sample");
+        auto start = std::chrono::steady_clock::now();
+        auto elapsed = [&start]() {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        };
+        auto forEach = [pool](size_t count, const std::function<void(size_t)>& body) {
+            if (pool != nullptr) {
+                pool->parallelFor(0, count, body);
+            } else {
+                for (size_t i = 0; i < count; ++i) {
+                    body(i);
+                }
+            }
+        };
+        auto finished = [&](Estimate& estimate) {
+            QueryControl::checkpoint(estimate.samples, options.maxSamples);
+            estimate.seconds = elapsed();
+            bool keepGoing = !progress || progress(estimate);
+            return !keepGoing || estimate.samples >= options.maxSamples ||
+                   (options.timeLimit > 0.0 && estimate.seconds >= options.timeLimit);
+        };
+        size_t numNodes = net->numNodes();
+
+        if (options.method == SamplingMethod::Gibbs) {
+            std::vector<Chain> chains(options.chains);
+            forEach(chains.size(), [&](size_t c) {
+                Chain& chain = chains[c];
+                chain.sum = emptyAccumulator();
+                chain.weights.resize(*std::max_element(net->getCardinalities().begin(),
+                                                       net->getCardinalities().end()));
+                // Start from a likelihood-weighted draw (evidence clamped)
+                chain.state.resize(numNodes);
+                for (size_t v = 0; v < numNodes; ++v) {
+                    const double* row = tables[v] + rowOffset(static_cast<int>(v), chain.state.data());
+                    chain.state[v] = (evidence[v] != -1)
+                        ? static_cast<uint32_t>(evidence[v])
+                        : draw(row, net->cardinality(static_cast<int>(v)), rng.uniform(c, chain.draws++));
+                }
+                advanceChain(c, chain, options.burnIn, false);
+            });
+            Estimate estimate = chainEstimate(chains);
+            while (estimate.samples < options.maxSamples) {
+                size_t remaining = options.maxSamples - estimate.samples;
+                size_t sweeps = std::min(options.batchSize, (remaining + chains.size() - 1) / chains.size());
+                forEach(chains.size(), [&](size_t c) { advanceChain(c, chains[c], sweeps, true); });
+                estimate = chainEstimate(chains);
+                if (finished(estimate)) {
+                    break;
+                }
+            }
+            estimate.seconds = elapsed();
+            return estimate;
+        }
+
+        std::vector<Batch> batches(options.batchesPerRound);
+        for (Batch& batch : batches) {
+            batch.states.resize(numNodes * options.batchSize);
+            batch.weights.resize(options.batchSize);
+        }
+        Accumulator total = emptyAccumulator();
+        Estimate estimate = weightedEstimate(total);
+        while (total.samples < options.maxSamples) {
+            uint64_t first = total.samples;
+            size_t remaining = options.maxSamples - total.samples;
+            forEach(batches.size(), [&](size_t b) {
+                Batch& batch = batches[b];
+                batch.sum = emptyAccumulator();
+                size_t offset = b * options.batchSize;
+                if (offset < remaining) {
+                    sampleBatch(first + offset, std::min(options.batchSize, remaining - offset), batch);
+                }
+            });
+            // Reduce in batch order so sums do not depend on scheduling
+            for (const Batch& batch : batches) {
+                for (size_t i = 0; i < total.counts.size(); ++i) {
+                    total.counts[i] += batch.sum.counts[i];
+                }
+                total.weight += batch.sum.weight;
+                total.squaredWeight += batch.sum.squaredWeight;
+                total.samples += batch.sum.samples;
+            }
+            estimate = weightedEstimate(total);
+            if (finished(estimate)) {
+                break;
+            }
+        }
+        estimate.seconds = elapsed();
+        return estimate;
+    }
+};
+
+#endif // SAMPLING_HPP
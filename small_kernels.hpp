@@ -0,0 +1,227 @@
+/*
+ * small_kernels.hpp - Kernels specialized for small fixed state counts
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements the inner loops of the factor and message kernels
+ * with the state count (2, 3 or 4) or the parent count (1 to 4) as a
+ * template parameter, so the compiler unrolls them and keeps the running
+ * sums in registers. Card 0 selects the generic loop over a runtime count.
+ * withCardinality() and withParentCount() pick the instance at run time.
+ * Every instance performs the same IEEE operations in the same order as
+ * the generic loop, so results are bit-identical whichever one runs.
+ */
+
+#ifndef SMALL_KERNELS_HPP
+#define SMALL_KERNELS_HPP
+
+// std::integral_constant
+#include <type_traits>
+// std::copy, std::fill
+#include <algorithm>
+// Sizes
+#include <cstddef>
+
+namespace kernels {
+
+// Largest state count with its own kernel instance
+constexpr size_t kMaxFixedCardinality = 4;
+// Largest parent count with its own row-weight instance
+constexpr size_t kMaxFixedParents = 4;
+
+/**
+ * Call kernel with std::integral_constant<size_t, card> for card 2 to 4,
+ * and with std::integral_constant<size_t, 0> (generic) otherwise
+ */
+template <typename Kernel>
+inline void withCardinality(size_t card, Kernel&& kernel) {
+    switch (card) {
+        case 2: kernel(std::integral_constant<size_t, 2>()); break;
+        case 3: kernel(std::integral_constant<size_t, 3>()); break;
+        case 4: kernel(std::integral_constant<size_t, 4>()); break;
+        default: kernel(std::integral_constant<size_t, 0>()); break;
+    }
+}
+
+/**
+ * Call kernel with std::integral_constant<size_t, count> for count 1 to 4,
+ * and with std::integral_constant<size_t, 0> (generic) otherwise
+ */
+template <typename Kernel>
+inline void withParentCount(size_t count, Kernel&& kernel) {
+    switch (count) {
+        case 1: kernel(std::integral_constant<size_t, 1>()); break;
+        case 2: kernel(std::integral_constant<size_t, 2>()); break;
+        case 3: kernel(std::integral_constant<size_t, 3>()); break;
+        case 4: kernel(std::integral_constant<size_t, 4>()); break;
+        default: kernel(std::integral_constant<size_t, 0>()); break;
+    }
+}
+
+/**
+ * Row likelihoods of a CPT: out[r] = sum_x table[r * card + x] * lambda[x]
+ * @param card Runtime state count (used when Card is 0)
+ */
+template <size_t Card>
+inline void rowLikelihoods(const double* table, const double* lambda, size_t numRows, size_t card, double* out) {
+    const size_t n = Card != 0 ? Card : card;
+    for (size_t r = 0; r < numRows; ++r) {
+        const double* row = table + r * n;
+        double likelihood = 0.0;
+        for (size_t x = 0; x < n; ++x) {
+            likelihood += row[x] * lambda[x];
+        }
+        out[r] = likelihood;
+    }
+}
+
+/**
+ * Causal support of a CPT: out[x] = sum_r table[r * card + x] * weights[r]
+ * @param card Runtime state count (used when Card is 0)
+ */
+template <size_t Card>
+inline void causalSupport(const double* table, const double* weights, size_t numRows, size_t card, double* out) {
+    if constexpr (Card != 0) {
+        double sum[Card] = {};
+        for (size_t r = 0; r < numRows; ++r) {
+            for (size_t x = 0; x < Card; ++x) {
+                sum[x] += table[r * Card + x] * weights[r];
+            }
+        }
+        std::copy(sum, sum + Card, out);
+    } else {
+        std::fill(out, out + card, 0.0);
+        for (size_t r = 0; r < numRows; ++r) {
+            for (size_t x = 0; x < card; ++x) {
+                out[x] += table[r * card + x] * weights[r];
+            }
+        }
+    }
+}
+
+/**
+ * Elementwise product in place: acc[x] *= factor[x]
+ * @param card Runtime state count (used when Card is 0)
+ */
+template <size_t Card>
+inline void multiplyInto(double* acc, const double* factor, size_t card) {
+    const size_t n = Card != 0 ? Card : card;
+    for (size_t x = 0; x < n; ++x) {
+        acc[x] *= factor[x];
+    }
+}
+
+/**
+ * Sum of row terms into the parent state each row belongs to
+ * Rows are viewed as [outer][parentCard][inner]:
+ * out[u] = sum over rows r of parent state u of weights[r] * likelihood[r].
+ * @param parentCard Runtime state count of the parent (used when Card is 0)
+ * @param inner Rows per parent state in each block (the parent's row stride)
+ */
+template <size_t Card>
+inline void accumulateParent(const double* weights,
+                             const double* likelihood,
+                             size_t numRows,
+                             size_t parentCard,
+                             size_t inner,
+                             double* out) {
+    const size_t n = Card != 0 ? Card : parentCard;
+    std::fill(out, out + n, 0.0);
+    for (size_t r = 0; r < numRows;) {
+        for (size_t u = 0; u < n; ++u) {
+            for (size_t end = r + inner; r < end; ++r) {
+                out[u] += weights[r] * likelihood[r];
+            }
+        }
+    }
+}
+
+/**
+ * Row weights of a family: weights[r] = prod_{k != skipSlot} pi[k][u_k(r)]
+ * NumParents levels of nested loops replace the odometer; the product of
+ * the outer levels is carried down, multiplied in parent order as before.
+ */
+template <size_t Depth, size_t NumParents>
+inline double* rowWeightsLevel(const double* const* pi, const size_t* cards, int skipSlot, double partial, double* out) {
+    if constexpr (Depth == NumParents) {
+        *out = partial;
+        return out + 1;
+    } else {
+        for (size_t u = 0; u < cards[Depth]; ++u) {
+            double weight = static_cast<int>(Depth) == skipSlot ? partial : partial * pi[Depth][u];
+            out = rowWeightsLevel<Depth + 1, NumParents>(pi, cards, skipSlot, weight, out);
+        }
+        return out;
+    }
+}
+
+/**
+ * Row weights of a family with NumParents parents (1 to 4)
+ * @param pi Incoming pi message of each parent
+ * @param cards State count of each parent
+ * @param skipSlot Parent slot left out of the product (-1 for none)
+ * @param weights Output, one weight per parent configuration in CPT row order
+ */
+template <size_t NumParents>
+inline void rowWeights(const double* const* pi, const size_t* cards, int skipSlot, double* weights) {
+    static_assert(NumParents >= 1 && NumParents <= kMaxFixedParents, "No fixed row-weight kernel");
+    rowWeightsLevel<0, NumParents>(pi, cards, skipSlot, 1.0, weights);
+}
+
+/**
+ * Sum of card slices of a block: out[r] += sum_s block[s * inner + r]
+ * Each output is accumulated over s in increasing order, as in
+ * DoublePolicy::sumSlices, but in one pass over out.
+ * @param card Runtime slice count (used when Card is 0)
+ */
+template <size_t Card>
+inline void sumSlices(const double* block, size_t card, size_t inner, double* out) {
+    if constexpr (Card != 0) {
+        for (size_t r = 0; r < inner; ++r) {
+            double sum = out[r];
+            for (size_t s = 0; s < Card; ++s) {
+                sum += block[s * inner + r];
+            }
+            out[r] = sum;
+        }
+    } else {
+        for (size_t s = 0; s < card; ++s) {
+            const double* slice = block + s * inner;
+            for (size_t r = 0; r < inner; ++r) {
+                out[r] += slice[r];
+            }
+        }
+    }
+}
+
+/**
+ * Largest of card slices of a block: out[r] = max_s block[s * inner + r]
+ * Ties keep the first slice (values are compared with operator<).
+ * @param card Runtime slice count (used when Card is 0)
+ */
+template <size_t Card, typename Value>
+inline void maxSlices(const Value* block, size_t card, size_t inner, Value* out) {
+    if constexpr (Card != 0) {
+        for (size_t r = 0; r < inner; ++r) {
+            Value best = block[r];
+            for (size_t s = 1; s < Card; ++s) {
+                if (best < block[s * inner + r]) {
+                    best = block[s * inner + r];
+                }
+            }
+            out[r] = best;
+        }
+    } else {
+        std::copy(block, block + inner, out);
+        for (size_t s = 1; s < card; ++s) {
+            for (size_t r = 0; r < inner; ++r) {
+                if (out[r] < block[s * inner + r]) {
+                    out[r] = block[s * inner + r];
+                }
+            }
+        }
+    }
+}
+
+} // namespace kernels
+
+#endif // SMALL_KERNELS_HPP
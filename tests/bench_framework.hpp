@@ -0,0 +1,202 @@
+/*
+ * bench_framework.hpp - Benchmark harness for Bayesian Network engines
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * Times repeated runs of an operation and records latency percentiles,
+ * throughput, peak resident memory and heap allocations, then writes the
+ * results as JSON and compares them with a baseline run
+ */
+
+#ifndef BENCH_FRAMEWORK_HPP
+#define BENCH_FRAMEWORK_HPP
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <sys/resource.h>
+
+// Heap allocation counters; the benchmark executable replaces operator new
+// to update them (see benchmarks.cpp)
+struct AllocationCounter {
+    static inline std::atomic<size_t> allocations{0};
+    static inline std::atomic<size_t> bytes{0};
+};
+
+// Result of one benchmark
+struct BenchResult {
+    std::string network;       // Network name (e.g. "chain-1000x2")
+    std::string engine;        // Engine name (e.g. "ve")
+    size_t nodes = 0;          // Nodes in the network
+    size_t edges = 0;          // Edges in the network
+    size_t iterations = 0;     // Timed runs
+    double p50 = 0.0;          // Latency percentiles in milliseconds
+    double p90 = 0.0;
+    double p99 = 0.0;
+    double mean = 0.0;         // Mean latency in milliseconds
+    double throughput = 0.0;   // Runs per second
+    size_t peakRssKb = 0;      // Peak resident set size during the runs
+    double allocationsPerRun = 0.0;
+    double bytesPerRun = 0.0;
+
+    std::string key() const { return network + "/" + engine; }
+};
+
+// Benchmark suite class
+class BenchSuite {
+private:
+    std::vector<BenchResult> results;
+    std::string suiteName;
+    double timeBudgetMs;       // Time spent timing each benchmark
+    size_t minIterations;
+    size_t maxIterations;
+    std::string filter;        // Only run benchmarks whose key contains this
+
+    // Reset the kernel's peak RSS mark to the current RSS (Linux); elsewhere
+    // the process-wide peak is reported
+    static void resetPeakRss() {
+        std::ofstream clearRefs("/proc/self/clear_refs");
+        if (clearRefs) {
+            clearRefs << "5";
+        }
+    }
+
+    // Peak resident set size in KiB since the last reset
+    static size_t peakRssKb() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 6, "VmHWM:") == 0) {
+                return static_cast<size_t>(std::stoull(line.substr(6)));
+            }
+        }
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<size_t>(usage.ru_maxrss);
+    }
+
+    // Percentile of sorted samples (nearest rank)
+    static double percentile(const std::vector<double>& sorted, double p) {
+        size_t rank = static_cast<size_t>(p * static_cast<double>(sorted.size()) + 0.999999);
+        rank = std::max<size_t>(1, std::min(rank, sorted.size()));
+        return sorted[rank - 1];
+    }
+
+public:
+    BenchSuite(const std::string& name, double budgetMs = 500.0, size_t minRuns = 5, size_t maxRuns = 1000)
+        : suiteName(name), timeBudgetMs(budgetMs), minIterations(minRuns), maxIterations(maxRuns) {}
+
+    void setFilter(const std::string& text) { filter = text; }
+
+    // Run a benchmark: one untimed warm-up, then timed runs until the time
+    // budget is spent (at least minIterations, at most maxIterations)
+    void run(const std::string& network, const std::string& engine, size_t nodes, size_t edges,
+             std::function<void()> body) {
+        BenchResult result;
+        result.network = network;
+        result.engine = engine;
+        result.nodes = nodes;
+        result.edges = edges;
+        if (!filter.empty() && result.key().find(filter) == std::string::npos) {
+            return;
+        }
+
+        body();
+        resetPeakRss();
+        size_t allocationsBefore = AllocationCounter::allocations.load();
+        size_t bytesBefore = AllocationCounter::bytes.load();
+        std::vector<double> samples;
+        double elapsed = 0.0;
+        while (samples.size() < maxIterations && (samples.size() < minIterations || elapsed < timeBudgetMs)) {
+            auto start = std::chrono::steady_clock::now();
+            body();
+            auto end = std::chrono::steady_clock::now();
+            double ms = std::chrono::duration<double, std::milli>(end - start).count();
+            samples.push_back(ms);
+            elapsed += ms;
+        }
+        double runs = static_cast<double>(samples.size());
+        result.iterations = samples.size();
+        result.allocationsPerRun = static_cast<double>(AllocationCounter::allocations.load() - allocationsBefore) / runs;
+        result.bytesPerRun = static_cast<double>(AllocationCounter::bytes.load() - bytesBefore) / runs;
+        result.peakRssKb = peakRssKb();
+        std::sort(samples.begin(), samples.end());
+        result.p50 = percentile(samples, 0.50);
+        result.p90 = percentile(samples, 0.90);
+        result.p99 = percentile(samples, 0.99);
+        result.mean = elapsed / runs;
+        result.throughput = elapsed > 0.0 ? 1000.0 * runs / elapsed : 0.0;
+        results.push_back(result);
+
+        std::cout << "  " << std::left << std::setw(34) << result.key() << std::right << std::fixed
+                  << std::setprecision(3) << " p50 " << std::setw(10) << result.p50 << "ms"
+                  << "  p99 " << std::setw(10) << result.p99 << "ms"
+                  << "  " << std::setprecision(0) << std::setw(9) << result.allocationsPerRun << " allocs"
+                  << "  " << std::setw(8) << result.peakRssKb << " KiB" << std::endl;
+    }
+
+    const std::vector<BenchResult>& getResults() const { return results; }
+
+    // Write every result as JSON, one benchmark object per line
+    void writeJson(std::ostream& out, size_t threads) const {
+        out << "{\n  \"suite\": \"" << suiteName << "\",\n  \"threads\": " << threads
+            << ",\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchResult& r = results[i];
+            out << std::setprecision(6) << std::defaultfloat
+                << "    {\"name\": \"" << r.key() << "\", \"network\": \"" << r.network
+                << "\", \"engine\": \"" << r.engine << "\", \"nodes\": " << r.nodes
+                << ", \"edges\": " << r.edges << ", \"iterations\": " << r.iterations
+                << ", \"p50_ms\": " << r.p50 << ", \"p90_ms\": " << r.p90 << ", \"p99_ms\": " << r.p99
+                << ", \"mean_ms\": " << r.mean << ", \"throughput_per_s\": " << r.throughput
+                << ", \"peak_rss_kb\": " << r.peakRssKb << ", \"allocations_per_run\": " << r.allocationsPerRun
+                << ", \"bytes_per_run\": " << r.bytesPerRun << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+
+    // Read name -> p50 from a file written by writeJson
+    static std::map<std::string, double> readBaseline(std::istream& in) {
+        std::map<std::string, double> baseline;
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t name = line.find("\"name\": \"");
+            size_t p50 = line.find("\"p50_ms\": ");
+            if (name == std::string::npos || p50 == std::string::npos) {
+                continue;
+            }
+            name += 9;
+            baseline[line.substr(name, line.find('"', name) - name)] = std::stod(line.substr(p50 + 10));
+        }
+        return baseline;
+    }
+
+    // Compare median latencies with a baseline; returns the number of
+    // benchmarks slower than (1 + maxSlowdown) times their baseline
+    size_t compare(const std::map<std::string, double>& baseline, double maxSlowdown) const {
+        size_t regressions = 0;
+        std::cout << "\nComparison with baseline (gate: +" << std::fixed << std::setprecision(0)
+                  << 100.0 * maxSlowdown << "% p50):" << std::endl;
+        for (const BenchResult& r : results) {
+            auto it = baseline.find(r.key());
+            if (it == baseline.end() || it->second <= 0.0) {
+                continue;
+            }
+            double ratio = r.p50 / it->second;
+            bool regressed = ratio > 1.0 + maxSlowdown;
+            regressions += regressed ? 1 : 0;
+            std::cout << "  " << (regressed ? "✗ " : "✓ ") << std::left << std::setw(34) << r.key()
+                      << std::right << std::setprecision(2) << " x" << ratio << std::endl;
+        }
+        return regressions;
+    }
+};
+
+#endif // BENCH_FRAMEWORK_HPP
@@ -0,0 +1,401 @@
+/*
+ * benchmarks.cpp - Benchmark suite for the inference engines
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * Runs variable elimination, the junction tree, loopy belief propagation,
+ * sampling and MPE on synthetic networks of growing size (chains,
+ * polytrees, grids, random DAGs with bounded in-degree) and on classic
+ * models, and writes latency, throughput, memory and allocation figures as
+ * JSON. With --baseline, exits non-zero when a median latency regressed.
+ *
+ * Usage: benchmarks [--quick] [--json FILE] [--baseline FILE]
+ *                   [--max-slowdown X] [--filter TEXT] [--threads N]
+ *                   [--models DIR]
+ */
+
+#include "bench_framework.hpp"
+#include "../bayesian_network.hpp"
+#include <vector>
+#include <string>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Count every heap allocation of the process for the harness
+void* operator new(std::size_t size) {
+    AllocationCounter::allocations.fetch_add(1, std::memory_order_relaxed);
+    AllocationCounter::bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    AllocationCounter::allocations.fetch_add(1, std::memory_order_relaxed);
+    AllocationCounter::bytes.fetch_add(size, std::memory_order_relaxed);
+    size_t align = static_cast<size_t>(alignment);
+    size_t rounded = (std::max<size_t>(size, 1) + align - 1) / align * align;
+    if (void* p = std::aligned_alloc(align, rounded)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// Every delete frees through one out-of-line function, so the compiler
+// does not pair an inlined free() with the replaced operator new
+__attribute__((noinline)) void releaseBlock(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p) noexcept { releaseBlock(p); }
+void operator delete(void* p, std::size_t) noexcept { releaseBlock(p); }
+void operator delete(void* p, std::align_val_t) noexcept { releaseBlock(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { releaseBlock(p); }
+
+// Benchmark network with the evidence and query used for every engine
+struct BenchNetwork {
+    std::string name;
+    BayesianNetwork network;
+    std::map<std::string, std::string> evidence;
+    std::string query;
+    size_t edges = 0;
+};
+
+// Zero-padded node ID so IDs sort in creation order
+std::string nodeName(size_t i) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "X%05zu", i);
+    return buffer;
+}
+
+// Add n nodes with card states each
+void addNodes(BayesianNetwork& network, size_t n, size_t card) {
+    std::vector<std::string> states;
+    for (size_t s = 0; s < card; ++s) {
+        states.push_back("s" + std::to_string(s));
+    }
+    for (size_t i = 0; i < n; ++i) {
+        network.addNode(nodeName(i), nodeName(i), states);
+    }
+}
+
+// Fill every CPT with rows drawn from a counter-based stream, so a given
+// seed always builds the same network
+void setRandomCPTs(BayesianNetwork& network, uint64_t seed) {
+    std::shared_ptr<const CompiledNetwork> net = network.compile();
+    CounterRNG rng(seed);
+    for (size_t v = 0; v < net->numNodes(); ++v) {
+        int var = static_cast<int>(v);
+        std::vector<size_t> dims;
+        for (int parent : net->parents(var)) {
+            dims.push_back(net->cardinality(parent));
+        }
+        dims.push_back(net->cardinality(var));
+        ConditionalProbabilityTable cpt(dims);
+        size_t card = net->cardinality(var);
+        for (size_t row = 0; row < cpt.getTotalSize(); row += card) {
+            double total = 0.0;
+            for (size_t x = 0; x < card; ++x) {
+                cpt.data()[row + x] = 0.05 + rng.uniform(v, row + x);
+                total += cpt.data()[row + x];
+            }
+            for (size_t x = 0; x < card; ++x) {
+                cpt.data()[row + x] /= total;
+            }
+        }
+        network.setCPT(net->nodeId(var), cpt);
+    }
+}
+
+// Observe up to five leaves (state 0) and query the first node
+void chooseQuery(BenchNetwork& bench) {
+    std::vector<std::string> ids = bench.network.getNodeIds();
+    bench.query = ids.front();
+    for (auto it = ids.rbegin(); it != ids.rend() && bench.evidence.size() < 5; ++it) {
+        if (*it != bench.query && bench.network.getChildren(*it).empty()) {
+            bench.evidence[*it] = bench.network.getNode(*it).states.front();
+        }
+    }
+    bench.edges = 0;
+    for (const std::string& id : ids) {
+        bench.edges += bench.network.getNode(id).getNumParents();
+    }
+}
+
+// Chain X0 -> X1 -> ... -> X(n-1)
+BenchNetwork makeChain(size_t n, size_t card) {
+    BenchNetwork bench;
+    bench.name = "chain-" + std::to_string(n) + "x" + std::to_string(card);
+    bench.network.beginBatch();
+    addNodes(bench.network, n, card);
+    for (size_t i = 1; i < n; ++i) {
+        bench.network.addEdge(nodeName(i - 1), nodeName(i));
+    }
+    bench.network.commit();
+    setRandomCPTs(bench.network, n);
+    chooseQuery(bench);
+    return bench;
+}
+
+// Random tree with randomly oriented edges (a polytree: nodes can have
+// several parents, but the skeleton has no loops)
+BenchNetwork makePolytree(size_t n, size_t card, uint64_t seed) {
+    BenchNetwork bench;
+    bench.name = "polytree-" + std::to_string(n) + "x" + std::to_string(card);
+    CounterRNG rng(seed);
+    bench.network.beginBatch();
+    addNodes(bench.network, n, card);
+    for (size_t i = 1; i < n; ++i) {
+        size_t j = static_cast<size_t>(rng.uniform(0, i) * static_cast<double>(i));
+        if (rng.uniform(1, i) < 0.5) {
+            bench.network.addEdge(nodeName(j), nodeName(i));
+        } else {
+            bench.network.addEdge(nodeName(i), nodeName(j));
+        }
+    }
+    bench.network.commit();
+    setRandomCPTs(bench.network, seed);
+    chooseQuery(bench);
+    return bench;
+}
+
+// rows x cols grid; each cell depends on the cells above and to the left
+BenchNetwork makeGrid(size_t rows, size_t cols, size_t card) {
+    BenchNetwork bench;
+    bench.name = "grid-" + std::to_string(rows) + "x" + std::to_string(cols) + "x" + std::to_string(card);
+    bench.network.beginBatch();
+    addNodes(bench.network, rows * cols, card);
+    for (size_t r = 0; r < rows; ++r) {
+        for (size_t c = 0; c < cols; ++c) {
+            if (r > 0) {
+                bench.network.addEdge(nodeName((r - 1) * cols + c), nodeName(r * cols + c));
+            }
+            if (c > 0) {
+                bench.network.addEdge(nodeName(r * cols + c - 1), nodeName(r * cols + c));
+            }
+        }
+    }
+    bench.network.commit();
+    setRandomCPTs(bench.network, rows * cols);
+    chooseQuery(bench);
+    return bench;
+}
+
+// Random DAG: each node takes up to maxInDegree parents among the window
+// nodes before it, which bounds the treewidth by the window
+BenchNetwork makeRandomDag(size_t n, size_t maxInDegree, size_t card, uint64_t seed, size_t window = 8) {
+    BenchNetwork bench;
+    bench.name = "dag-" + std::to_string(n) + "x" + std::to_string(card) + "-k" + std::to_string(maxInDegree);
+    CounterRNG rng(seed);
+    bench.network.beginBatch();
+    addNodes(bench.network, n, card);
+    for (size_t i = 1; i < n; ++i) {
+        size_t span = std::min(i, window);
+        size_t count = static_cast<size_t>(rng.uniform(0, i) * static_cast<double>(std::min(span, maxInDegree) + 1));
+        for (size_t k = 0; k < count; ++k) {
+            size_t j = i - 1 - static_cast<size_t>(rng.uniform(k + 1, i) * static_cast<double>(span));
+            bench.network.addEdge(nodeName(j), nodeName(i));
+        }
+    }
+    bench.network.commit();
+    setRandomCPTs(bench.network, seed);
+    chooseQuery(bench);
+    return bench;
+}
+
+// Set a CPT from flat values (parents in ID order, then the node)
+void setTable(BayesianNetwork& network, const std::string& id, const std::vector<double>& values) {
+    std::shared_ptr<const CompiledNetwork> net = network.compile();
+    int var = net->requireIndex(id);
+    std::vector<size_t> dims;
+    for (int parent : net->parents(var)) {
+        dims.push_back(net->cardinality(parent));
+    }
+    dims.push_back(net->cardinality(var));
+    network.setCPT(id, ConditionalProbabilityTable(dims, values.data()));
+}
+
+// Lauritzen and Spiegelhalter's chest clinic (ASIA)
+BenchNetwork makeAsia() {
+    BenchNetwork bench;
+    bench.name = "asia";
+    BayesianNetwork& n = bench.network;
+    for (const char* id : {"Asia", "Tub", "Smoke", "Lung", "Bronc", "Either", "Xray", "Dysp"}) {
+        n.addNode(id, id, {"yes", "no"});
+    }
+    n.addEdge("Asia", "Tub");
+    n.addEdge("Smoke", "Lung");
+    n.addEdge("Smoke", "Bronc");
+    n.addEdge("Lung", "Either");
+    n.addEdge("Tub", "Either");
+    n.addEdge("Either", "Xray");
+    n.addEdge("Bronc", "Dysp");
+    n.addEdge("Either", "Dysp");
+    setTable(n, "Asia", {0.01, 0.99});
+    setTable(n, "Tub", {0.05, 0.95, 0.01, 0.99});
+    setTable(n, "Smoke", {0.5, 0.5});
+    setTable(n, "Lung", {0.1, 0.9, 0.01, 0.99});
+    setTable(n, "Bronc", {0.6, 0.4, 0.3, 0.7});
+    setTable(n, "Either", {1.0, 0.0, 1.0, 0.0, 1.0, 0.0, 0.0, 1.0});
+    setTable(n, "Xray", {0.98, 0.02, 0.05, 0.95});
+    setTable(n, "Dysp", {0.9, 0.1, 0.8, 0.2, 0.7, 0.3, 0.1, 0.9});
+    bench.evidence = {{"Xray", "yes"}, {"Dysp", "yes"}};
+    bench.query = "Lung";
+    bench.edges = 8;
+    return bench;
+}
+
+// Pearl's burglary alarm, as in exampleAlarmNetwork
+BenchNetwork makeBurglary() {
+    BenchNetwork bench;
+    bench.name = "burglary";
+    BayesianNetwork& n = bench.network;
+    for (const char* id : {"Burglary", "Earthquake", "Alarm", "JohnCalls", "MaryCalls"}) {
+        n.addNode(id, id, {"False", "True"});
+    }
+    n.addEdge("Burglary", "Alarm");
+    n.addEdge("Earthquake", "Alarm");
+    n.addEdge("Alarm", "JohnCalls");
+    n.addEdge("Alarm", "MaryCalls");
+    setTable(n, "Burglary", {0.999, 0.001});
+    setTable(n, "Earthquake", {0.998, 0.002});
+    setTable(n, "Alarm", {0.999, 0.001, 0.06, 0.94, 0.05, 0.95, 0.02, 0.98});
+    setTable(n, "JohnCalls", {0.95, 0.05, 0.10, 0.90});
+    setTable(n, "MaryCalls", {0.99, 0.01, 0.30, 0.70});
+    bench.evidence = {{"JohnCalls", "True"}, {"MaryCalls", "True"}};
+    bench.query = "Burglary";
+    bench.edges = 4;
+    return bench;
+}
+
+// Classic bnlearn models (ALARM, Insurance, ...) from BIF files, if present
+std::vector<BenchNetwork> loadModels(const std::string& directory) {
+    std::vector<BenchNetwork> models;
+    for (const char* name : {"alarm", "insurance", "child", "hailfinder"}) {
+        std::string path = directory + "/" + name + ".bif";
+        std::ifstream probe(path);
+        if (!probe) {
+            continue;
+        }
+        BenchNetwork bench;
+        bench.name = name;
+        bench.network.loadFromFile(path);
+        chooseQuery(bench);
+        models.push_back(std::move(bench));
+    }
+    return models;
+}
+
+// Time every engine on one network
+void runEngines(BenchSuite& suite, const BenchNetwork& bench) {
+    const BayesianNetwork& network = bench.network;
+    size_t nodes = network.getNodeIds().size();
+    std::vector<std::string> query = {bench.query};
+    suite.run(bench.name, "ve", nodes, bench.edges, [&]() {
+        network.variableElimination(query, bench.evidence);
+    });
+    suite.run(bench.name, "junction_tree", nodes, bench.edges, [&]() {
+        network.computeAllMarginals(bench.evidence);
+    });
+    suite.run(bench.name, "mpe", nodes, bench.edges, [&]() {
+        network.mostProbableExplanation(bench.evidence);
+    });
+    suite.run(bench.name, "loopy_bp", nodes, bench.edges, [&]() {
+        network.loopyBeliefPropagation(bench.evidence);
+    });
+    SamplingOptions sampling;
+    sampling.seed = 7;
+    sampling.maxSamples = std::max<size_t>(1000, std::min<size_t>(20000, 2000000 / nodes));
+    suite.run(bench.name, "sampling", nodes, bench.edges, [&]() {
+        network.sampleMarginals(bench.evidence, sampling);
+    });
+}
+
+int main(int argc, char** argv) {
+    bool quick = false;
+    std::string jsonPath;
+    std::string baselinePath;
+    std::string modelDir = "tests/models";
+    std::string filter;
+    double maxSlowdown = 0.25;
+    size_t threads = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << std::endl;
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (arg == "--quick") {
+            quick = true;
+        } else if (arg == "--json") {
+            jsonPath = value();
+        } else if (arg == "--baseline") {
+            baselinePath = value();
+        } else if (arg == "--max-slowdown") {
+            maxSlowdown = std::stod(value());
+        } else if (arg == "--filter") {
+            filter = value();
+        } else if (arg == "--threads") {
+            threads = std::stoul(value());
+        } else if (arg == "--models") {
+            modelDir = value();
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 2;
+        }
+    }
+
+    std::cout << "=== Benchmarks ===" << std::endl;
+    BenchSuite suite("Benchmarks", quick ? 100.0 : 500.0, quick ? 3 : 5);
+    suite.setFilter(filter);
+
+    // Classic models, then synthetic families in order of size
+    std::vector<BenchNetwork> networks;
+    networks.push_back(makeBurglary());
+    networks.push_back(makeAsia());
+    for (BenchNetwork& model : loadModels(modelDir)) {
+        networks.push_back(std::move(model));
+    }
+    std::vector<size_t> chainSizes = quick ? std::vector<size_t>{100} : std::vector<size_t>{100, 1000, 10000};
+    for (size_t n : chainSizes) {
+        networks.push_back(makeChain(n, 2));
+    }
+    networks.push_back(makeChain(quick ? 100 : 1000, 4));
+    for (size_t n : quick ? std::vector<size_t>{100} : std::vector<size_t>{100, 1000}) {
+        networks.push_back(makePolytree(n, 3, 11));
+    }
+    for (size_t side : quick ? std::vector<size_t>{4} : std::vector<size_t>{4, 6, 8}) {
+        networks.push_back(makeGrid(side, side, 2));
+    }
+    for (size_t n : quick ? std::vector<size_t>{50} : std::vector<size_t>{50, 200, 1000}) {
+        networks.push_back(makeRandomDag(n, 3, 2, 23));
+    }
+
+    for (BenchNetwork& bench : networks) {
+        bench.network.setThreadCount(threads);
+        std::cout << "\n" << bench.name << ":" << std::endl;
+        runEngines(suite, bench);
+    }
+
+    if (!jsonPath.empty()) {
+        std::ofstream out(jsonPath);
+        suite.writeJson(out, threads);
+        std::cout << "\nResults written to " << jsonPath << std::endl;
+    }
+    if (!baselinePath.empty()) {
+        std::ifstream in(baselinePath);
+        if (!in) {
+            std::cerr << "Cannot open baseline " << baselinePath << std::endl;
+            return 2;
+        }
+        size_t regressions = suite.compare(BenchSuite::readBaseline(in), maxSlowdown);
+        if (regressions > 0) {
+            std::cout << regressions << " benchmark(s) regressed" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
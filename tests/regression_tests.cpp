@@ -10,6 +10,7 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <cmath>
 
 void runMedicalDiagnosisRegression(TestSuite& suite) {
     suite.runTest("Medical diagnosis example regression", []() {
@@ -211,6 +212,92 @@ void runCPTNormalizationRegression(TestSuite& suite) {
     });
 }
 
+/**
+ * Build root R with 40 observed children: P(evidence) is about 1e-12
+ * @param network Empty network to fill
+ * @param evidence Filled with every child observed
+ */
+void buildLongEvidenceStar(BayesianNetwork& network, std::map<std::string, std::string>& evidence) {
+    network.addNode("R", "Root", {"T", "F"});
+    ConditionalProbabilityTable prior({2});
+    prior.setProbability({}, 0, 0.35);
+    prior.setProbability({}, 1, 0.65);
+    network.setCPT("R", prior);
+    ConditionalProbabilityTable link({2, 2});
+    link.setProbability({0}, 0, 0.5);
+    link.setProbability({0}, 1, 0.5);
+    link.setProbability({1}, 0, 0.5);
+    link.setProbability({1}, 1, 0.5);
+    for (int i = 0; i < 40; ++i) {
+        std::string id = "C" + std::to_string(i);
+        network.addNode(id, id, {"T", "F"});
+        network.addEdge("R", id);
+        network.setCPT(id, link);
+        evidence[id] = "T";
+    }
+}
+
+void runLongEvidenceRegression(TestSuite& suite) {
+    suite.runTest("Posteriors under long evidence sum to 1", []() {
+        BayesianNetwork network;
+        std::map<std::string, std::string> evidence;
+        buildLongEvidenceStar(network, evidence);
+
+        auto exact = network.variableElimination<LogPolicy>({"R"}, evidence);
+        double expected = std::exp(exact[{{"R", "T"}}]);
+        auto joint = network.variableElimination({"R"}, evidence);
+        auto marginals = network.computeAllMarginals(evidence);
+        auto beliefs = network.beliefPropagation({"R"}, evidence).first;
+        double jointSum = joint[{{"R", "T"}}] + joint[{{"R", "F"}}];
+        double marginalSum = marginals["R"]["T"] + marginals["R"]["F"];
+        double beliefSum = beliefs["R"]["T"] + beliefs["R"]["F"];
+
+        return TestSuite::assertEqual(expected, 0.35, 1e-12, "Log-space posterior") &&
+               TestSuite::assertEqual(jointSum, 1.0, 1e-12, "Variable elimination sums to 1") &&
+               TestSuite::assertEqual(joint[{{"R", "T"}}], expected, 1e-12, "Variable elimination") &&
+               TestSuite::assertEqual(marginalSum, 1.0, 1e-12, "Junction tree marginals sum to 1") &&
+               TestSuite::assertEqual(marginals["R"]["T"], expected, 1e-12, "Junction tree marginal") &&
+               TestSuite::assertEqual(beliefSum, 1.0, 1e-12, "Belief propagation sums to 1");
+    });
+    suite.runTest("Batched posteriors under long evidence sum to 1", []() {
+        BayesianNetwork network;
+        std::map<std::string, std::string> evidence;
+        buildLongEvidenceStar(network, evidence);
+        double expected = std::exp(network.variableElimination<LogPolicy>({"R"}, evidence)[{{"R", "T"}}]);
+
+        std::vector<BayesianNetwork::Evidence> cases(3, evidence);
+        bool normalized = true;
+        for (auto mode : {BayesianNetwork::BatchMode::Exact, BayesianNetwork::BatchMode::Fast}) {
+            for (const auto& result : network.batchQuery(cases, {"R"}, mode)) {
+                double sum = result.at({{"R", "T"}}) + result.at({{"R", "F"}});
+                normalized = normalized && std::fabs(sum - 1.0) < 1e-12 &&
+                             std::fabs(result.at({{"R", "T"}}) - expected) < 1e-12;
+            }
+        }
+        return TestSuite::assertTrue(normalized, "Exact and fast batches sum to 1 and match LogPolicy");
+    });
+    suite.runTest("Loopy beliefs under long evidence sum to 1", []() {
+        BayesianNetwork network;
+        std::map<std::string, std::string> evidence;
+        buildLongEvidenceStar(network, evidence);
+        double expected = std::exp(network.variableElimination<LogPolicy>({"R"}, evidence)[{{"R", "T"}}]);
+
+        bool normalized = true;
+        for (auto schedule : {LoopySchedule::Flooding, LoopySchedule::Residual}) {
+            LoopyOptions options;
+            options.schedule = schedule;
+            LoopyResult result = network.loopyBeliefPropagation(evidence, options);
+            for (const auto& belief : result.beliefs) {
+                double sum = belief.second.at("T") + belief.second.at("F");
+                normalized = normalized && std::fabs(sum - 1.0) < 1e-12;
+            }
+            normalized = normalized && result.converged &&
+                         std::fabs(result.beliefs.at("R").at("T") - expected) < 1e-12;
+        }
+        return TestSuite::assertTrue(normalized, "Flooding and residual beliefs sum to 1 and match LogPolicy");
+    });
+}
+
 int main() {
     std::cout << "=== Regression Tests ===" << std::endl;
     
@@ -228,6 +315,9 @@ int main() {
     std::cout << "\nCPT Normalization Regression:" << std::endl;
     runCPTNormalizationRegression(suite);
     
+    std::cout << "\nLong Evidence Regression:" << std::endl;
+    runLongEvidenceRegression(suite);
+    
     suite.printSummary();
     
     return suite.allPassed() ? 0 : 1;
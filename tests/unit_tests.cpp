@@ -8,10 +8,40 @@
 #include "test_framework.hpp"
 #include "../node.hpp"
 #include "../cpt.hpp"
+#include "../cpt_model.hpp"
+#include "../factor.hpp"
+#include "../numeric_policy.hpp"
+#include "../elimination_order.hpp"
+#include "../junction_tree.hpp"
+#include "../inference_session.hpp"
+#include "../thread_pool.hpp"
+#include "../model_file.hpp"
+#include "../model_text.hpp"
+#include "../result_cache.hpp"
+#include "../message_store.hpp"
+#include "../sampling.hpp"
+#include "../parameter_learning.hpp"
+#include "../instrumentation.hpp"
+#include "../inference_workspace.hpp"
+#include "../small_kernels.hpp"
+#include "../async_query.hpp"
+#include "../relevance.hpp"
+#include "../batch_scoring.hpp"
 #include "../bayesian_network.hpp"
 #include <vector>
 #include <string>
 #include <map>
+#include <cstdint>
+#include <cmath>
+#include <atomic>
+#include <fstream>
+#include <cstdio>
+#include <sstream>
+#include <functional>
+#include <thread>
+#include <future>
+#include <set>
+#include <cstring>
 
 void runNodeTests(TestSuite& suite) {
     suite.runTest("Node construction", []() {
@@ -101,6 +131,37 @@ void runCPTTests(TestSuite& suite) {
         return TestSuite::assertTrue(cpt.isValid());
     });
 
+    suite.runTest("CPT pointer and row access", []() {
+        ConditionalProbabilityTable cpt({2, 3, 2});
+        for (size_t a = 0; a < 2; ++a) {
+            for (size_t b = 0; b < 3; ++b) {
+                size_t parents[2] = {a, b};
+                cpt.setProbability(parents, 2, 0, 0.1 * static_cast<double>(a * 3 + b + 1));
+                cpt.setProbability(parents, 2, 1, 0.2);
+            }
+        }
+        size_t parents[2] = {1, 2};
+        size_t offset = cpt.getRowOffset(parents, 2);
+        const double* row = cpt.getRow(offset);
+        bool access = offset == cpt.getRowOffsetUnchecked(parents) &&
+                      row[0] == cpt.getProbability({1, 2}, 0) &&
+                      cpt.getProbabilityUnchecked(parents, 1) == 0.2 &&
+                      cpt.getNumParentConfigurations() == size_t(6) && cpt.getNumNodeStates() == size_t(2);
+        
+        size_t outOfRange[2] = {2, 0};
+        bool checked = TestSuite::assertThrows([&]() { cpt.getProbability(outOfRange, 2, 0); }) &&
+                       TestSuite::assertThrows([&]() { cpt.getProbability(parents, 1, 0); }) &&
+                       TestSuite::assertThrows([&]() { cpt.setProbability(parents, 2, 2, 0.5); });
+        
+        // Row sweep normalizes each parent configuration on its own
+        cpt.normalize();
+        double first = 0.1 / (0.1 + 0.2);
+        return TestSuite::assertTrue(access, "Row access") &&
+               TestSuite::assertTrue(checked, "Bounds checks") &&
+               TestSuite::assertTrue(cpt.isValid(), "Normalized") &&
+               TestSuite::assertEqual(cpt.getProbability({0, 0}, 0), first);
+    });
+
     suite.runTest("CPT invalid probability range", []() {
         std::vector<size_t> dims = {1, 2};
         ConditionalProbabilityTable cpt(dims);
@@ -117,6 +178,1016 @@ void runCPTTests(TestSuite& suite) {
     });
 }
 
+void runCPTModelTests(TestSuite& suite) {
+    suite.runTest("Structured CPT models match dense tables", []() {
+        // Sparse: every row is impossible except one
+        SparseCPT sparse({3, 2, 2});
+        sparse.setRow({1, 0}, {0.3, 0.7});
+        ConditionalProbabilityTable sparseDense = sparse.toDense();
+        size_t row[] = {1, 0};
+        bool sparseOk = sparse.getStoredValues() == size_t(4) &&
+                        sparse.getProbability(row, 1) == 0.7 &&
+                        sparseDense.getProbability({1, 0}, 1) == 0.7 &&
+                        sparseDense.getProbability({2, 1}, 0) == 0.0;
+
+        // Context-specific: B only matters when A = 1
+        ContextSpecificCPT rules({2, 2, 2});
+        rules.addRule({0, ContextSpecificCPT::kAny}, {0.9, 0.1});
+        rules.addRule({1, 1}, {0.4, 0.6});
+        rules.addRule({ContextSpecificCPT::kAny, ContextSpecificCPT::kAny}, {0.2, 0.8});
+        ConditionalProbabilityTable rulesDense = rules.toDense();
+        bool rulesOk = rulesDense.getProbability({0, 1}, 0) == 0.9 &&
+                       rulesDense.getProbability({1, 1}, 1) == 0.6 &&
+                       rulesDense.getProbability({1, 0}, 1) == 0.8;
+
+        // Deterministic: exclusive or
+        DeterministicCPT parity({2, 2, 2}, [](const size_t* x) { return x[0] ^ x[1]; });
+        ConditionalProbabilityTable parityDense = parity.toDense();
+        bool parityOk = parity.getStoredValues() == size_t(0) &&
+                        parityDense.getProbability({1, 0}, 1) == 1.0 &&
+                        parityDense.getProbability({1, 1}, 1) == 0.0;
+
+        // Noisy-OR: P(absent | both causes) = (1 - leak) * (1 - p0) * (1 - p1)
+        NoisyMaxCPT noisyOr = NoisyMaxCPT::noisyOr({0.8, 0.6}, 0.1);
+        ConditionalProbabilityTable orDense = noisyOr.toDense();
+        size_t both[] = {1, 1};
+        bool orOk = std::fabs(orDense.getProbability({1, 1}, 0) - 0.9 * 0.2 * 0.4) < 1e-15 &&
+                    std::fabs(noisyOr.getProbability(both, 1) - (1.0 - 0.9 * 0.2 * 0.4)) < 1e-15 &&
+                    std::fabs(orDense.getProbability({0, 0}, 1) - 0.1) < 1e-15 && orDense.isValid();
+
+        // Noisy-MAX over a three-level node
+        NoisyMaxCPT noisyMax({2, 3});
+        noisyMax.setParentEffect(0, 1, {0.2, 0.5, 0.3});
+        noisyMax.setLeak({0.9, 0.1, 0.0});
+        size_t present[] = {1};
+        bool maxOk = std::fabs(noisyMax.getProbability(present, 0) - 0.18) < 1e-15 &&
+                     std::fabs(noisyMax.getProbability(present, 1) - (0.9 * 0.7 + 0.1 * 0.7 - 0.18)) < 1e-15 &&
+                     std::fabs(noisyMax.getProbability(present, 2) - 0.3) < 1e-15;
+
+        bool rejects = false;
+        try {
+            sparse.setRow({1, 0}, {0.3, 1.7});
+        } catch (const std::runtime_error&) {
+            rejects = true;
+        }
+        return TestSuite::assertTrue(sparseOk, "Sparse rows") &&
+               TestSuite::assertTrue(rulesOk, "First matching rule") &&
+               TestSuite::assertTrue(parityOk, "Deterministic point masses") &&
+               TestSuite::assertTrue(orOk, "Noisy-OR rows") &&
+               TestSuite::assertTrue(maxOk, "Noisy-MAX rows") &&
+               TestSuite::assertTrue(rejects, "Invalid distribution rejected");
+    });
+
+    suite.runTest("Noisy-OR elimination matches the dense table", []() {
+        // Fourteen causes of one effect, and a dense child of the effect
+        const size_t numCauses = 14;
+        BayesianNetwork structured, dense;
+        std::vector<double> links;
+        for (BayesianNetwork* network : {&structured, &dense}) {
+            network->addNode("Y", "Effect", {"no", "yes"});
+            network->addNode("Z", "Report", {"no", "yes"});
+            network->addEdge("Y", "Z");
+            ConditionalProbabilityTable report({2, 2});
+            report.setProbability({0}, 0, 0.95);
+            report.setProbability({0}, 1, 0.05);
+            report.setProbability({1}, 0, 0.2);
+            report.setProbability({1}, 1, 0.8);
+            network->setCPT("Z", report);
+            for (size_t i = 0; i < numCauses; ++i) {
+                std::string id = std::string("C") + char('0' + i / 10) + char('0' + i % 10);
+                network->addNode(id, id, {"absent", "present"});
+                network->addEdge(id, "Y");
+                ConditionalProbabilityTable prior({2});
+                double p = 0.05 + 0.03 * static_cast<double>(i);
+                prior.setProbability({}, 0, 1.0 - p);
+                prior.setProbability({}, 1, p);
+                network->setCPT(id, prior);
+                if (network == &structured) {
+                    links.push_back(0.3 + 0.04 * static_cast<double>(i));
+                }
+            }
+        }
+        auto model = std::make_shared<NoisyMaxCPT>(NoisyMaxCPT::noisyOr(links, 0.01));
+        structured.setCPT("Y", model);
+        dense.setCPT("Y", model->toDense());
+
+        bool close = true;
+        std::vector<BayesianNetwork::Evidence> cases = {
+            {{"Y", "yes"}}, {{"Z", "yes"}, {"C03", "present"}}, {{"Y", "no"}, {"C00", "absent"}}};
+        for (const auto& evidence : cases) {
+            auto a = structured.variableElimination({"C07"}, evidence);
+            auto b = dense.variableElimination({"C07"}, evidence);
+            for (const auto& entry : b) {
+                close = close && std::fabs(a[entry.first] - entry.second) < 1e-12;
+            }
+        }
+        auto y = structured.variableElimination({"Y"}, {{"C05", "present"}});
+        auto yDense = dense.variableElimination({"Y"}, {{"C05", "present"}});
+        close = close && std::fabs(y[{{"Y", "yes"}}] - yDense[{{"Y", "yes"}}]) < 1e-12;
+
+        // Batches replay the same decomposition bit for bit
+        auto batch = structured.batchQuery(cases, {"C07"});
+        bool identical = true;
+        for (size_t i = 0; i < cases.size(); ++i) {
+            identical = identical && batch[i] == structured.variableElimination({"C07"}, cases[i]);
+        }
+
+        // The decomposition never builds the 2^15-entry family table
+        double structuredSize = structured.estimateEliminationCost({"C07"}, cases[0]).maxFactorSize;
+        double denseSize = dense.estimateEliminationCost({"C07"}, cases[0]).maxFactorSize;
+        auto net = structured.compile();
+        int yIndex = net->indexOf("Y");
+        bool shared = net->cptModel(yIndex) == model.get() && net->cpt(yIndex) == nullptr &&
+                      net->isDecomposable(yIndex);
+
+        std::map<std::string, std::string> assignment = {{"Y", "yes"}, {"Z", "no"}};
+        for (size_t i = 0; i < numCauses; ++i) {
+            assignment[std::string("C") + char('0' + i / 10) + char('0' + i % 10)] = (i % 3 == 0) ? "present" : "absent";
+        }
+        bool joint = std::fabs(structured.computeJointProbability(assignment) -
+                               dense.computeJointProbability(assignment)) < 1e-15;
+        return TestSuite::assertTrue(close, "Posteriors within 1e-12") &&
+               TestSuite::assertTrue(identical, "Batch equals elimination") &&
+               TestSuite::assertTrue(structuredSize < denseSize, "Smaller intermediate factors") &&
+               TestSuite::assertTrue(shared, "Model shared by the snapshot") &&
+               TestSuite::assertTrue(joint, "Joint probability");
+    });
+}
+
+void runFactorTests(TestSuite& suite) {
+    suite.runTest("Factor product", []() {
+        Factor a({0}, {2}, {0.6, 0.4});
+        Factor b({0, 1}, {2, 2}, {0.9, 0.1, 0.2, 0.8});
+        Factor p = a.product(b);
+        
+        return TestSuite::assertEqual(p.size(), size_t(4)) &&
+               TestSuite::assertEqual(p.getValue({0, 0}), 0.54) &&
+               TestSuite::assertEqual(p.getValue({0, 1}), 0.06) &&
+               TestSuite::assertEqual(p.getValue({1, 0}), 0.08) &&
+               TestSuite::assertEqual(p.getValue({1, 1}), 0.32);
+    });
+
+    suite.runTest("Factor marginalization", []() {
+        Factor f({0, 1}, {2, 3}, {0.1, 0.2, 0.3, 0.4, 0.5, 0.6});
+        Factor m0 = f.marginalize(0);
+        Factor m1 = f.marginalize(1);
+        
+        return TestSuite::assertEqual(m0.getValue({0}), 0.5) &&
+               TestSuite::assertEqual(m0.getValue({2}), 0.9) &&
+               TestSuite::assertEqual(m1.getValue({0}), 0.6) &&
+               TestSuite::assertEqual(m1.getValue({1}), 1.5);
+    });
+
+    suite.runTest("Factor maximization", []() {
+        Factor f({0, 1}, {2, 3}, {0.1, 0.7, 0.3, 0.4, 0.5, 0.2});
+        Factor m0 = f.maximize(0);
+        Factor m1 = f.maximize(1);
+        
+        return TestSuite::assertEqual(m0.getValue({0}), 0.4) &&
+               TestSuite::assertEqual(m0.getValue({1}), 0.7) &&
+               TestSuite::assertEqual(m0.getValue({2}), 0.3) &&
+               TestSuite::assertEqual(m1.getValue({0}), 0.7) &&
+               TestSuite::assertEqual(m1.getValue({1}), 0.5);
+    });
+
+    suite.runTest("Factor evidence reduction", []() {
+        Factor f({0, 1}, {2, 3}, {0.1, 0.2, 0.3, 0.4, 0.5, 0.6});
+        Factor r = f.reduce(1, 2);
+        
+        return TestSuite::assertEqual(r.getVariables().size(), size_t(1)) &&
+               TestSuite::assertEqual(r.getValue({0}), 0.3) &&
+               TestSuite::assertEqual(r.getValue({1}), 0.6);
+    });
+
+    suite.runTest("Factor projection", []() {
+        Factor f({0, 1, 2}, {2, 3, 2}, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12});
+        Factor p = f.project({2, 0});
+        
+        // Kept variables stay in storage order; variable 1 is summed out
+        return TestSuite::assertTrue(p.getVariables() == std::vector<int>({0, 2})) &&
+               TestSuite::assertEqual(p.getValue({0, 0}), 9.0) &&
+               TestSuite::assertEqual(p.getValue({1, 1}), 30.0) &&
+               TestSuite::assertEqual(f.project({}).getValue({}), 78.0);
+    });
+
+    suite.runTest("Batch lane kernels match Factor bit for bit", []() {
+        // 11 lanes cover the vector bodies (8, 4 or 2 wide) and a scalar tail
+        const size_t lanes = 11;
+        std::vector<double> table(18);
+        for (size_t i = 0; i < table.size(); ++i) {
+            table[i] = 0.05 + 0.1 * static_cast<double>(i % 7) + 0.003 * static_cast<double>(i);
+        }
+        Factor f({0, 1, 2}, {2, 3, 3}, table);
+        Factor g({1, 3}, {3, 2}, {0.9, 0.1, 0.4, 0.6, 0.25, 0.75});
+        std::vector<int> states(lanes);
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            states[lane] = static_cast<int>(lane % 3);
+        }
+        BatchFactor batch = BatchFactor(f, lanes).reduce(2, states).product(BatchFactor(g, lanes)).marginalize(1);
+        batch.normalize();
+
+        bool identical = batch.numLanes() == lanes;
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            Factor single = f.reduce(2, lane % 3).product(g).marginalize(1);
+            single.normalize();
+            identical = identical && single.getVariables() == batch.getVariables();
+            for (size_t i = 0; identical && i < single.size(); ++i) {
+                identical = single.getValues()[i] == batch.value(i, lane);
+            }
+        }
+        // Builds with SIMD=1 must select a vector kernel
+        bool kernel = true;
+#if LBN_EXPECT_SIMD
+        kernel = std::string(BatchFactor::kernelName()) != "scalar";
+#endif
+        return TestSuite::assertTrue(identical, std::string("Lanes equal Factor with the ") +
+                                                    BatchFactor::kernelName() + " kernel") &&
+               TestSuite::assertTrue(kernel, "SIMD build selects a vector kernel");
+    });
+}
+
+void runNumericPolicyTests(TestSuite& suite) {
+    suite.runTest("Exact values round like IEEE arithmetic", []() {
+        ExactValue a = ExactValue::fromDouble(0.1);
+        ExactValue b = ExactValue::fromDouble(0.2);
+        ExactValue sum = a + b;
+        bool exact = sum != ExactValue::fromDouble(0.3) && sum.toDouble() == 0.1 + 0.2 &&
+                     (sum / sum) == ExactPolicy::one() && (a + (ExactValue() + a) * ExactValue::fromDouble(-1.0)).isZero();
+        bool text = ExactValue::fromDouble(0.5).toString() == "1/2" &&
+                    ExactValue::fromDouble(-3.0).toString() == "-3" &&
+                    (ExactValue::fromDouble(1.0) / ExactValue::fromDouble(3.0)).toDouble() == 1.0 / 3.0;
+        double logSum = LogPolicy::sum(std::vector<double>{std::log(0.25), std::log(0.5), LogPolicy::zero()}.data(), 3);
+        bool logSpace = std::fabs(logSum - std::log(0.75)) < 1e-15 &&
+                        LogPolicy::add(LogPolicy::zero(), LogPolicy::zero()) == LogPolicy::zero();
+        std::vector<double> terms(1000, 0.1);
+        terms.insert(terms.begin(), 1e8);
+        bool compensated = KahanPolicy::sum(terms.data(), terms.size()) == 1e8 + 100.0;
+        return TestSuite::assertTrue(exact, "Exact sums and quotients") &&
+               TestSuite::assertTrue(text, "Exact rational text") &&
+               TestSuite::assertTrue(logSpace, "Log-sum-exp") &&
+               TestSuite::assertTrue(compensated, "Compensated summation");
+    });
+
+    suite.runTest("Long evidence chains do not underflow", []() {
+        // Every observed transition has probability 0.1, so P(e) = 0.5 * 0.1^328
+        const size_t length = 330;
+        BayesianNetwork network;
+        std::map<std::string, std::string> evidence;
+        for (size_t i = 0; i < length; ++i) {
+            std::string id = "X" + std::to_string(1000 + i);
+            network.addNode(id, id, {"s0", "s1"});
+            if (i == 0) {
+                ConditionalProbabilityTable prior({2});
+                prior.setProbability({}, 0, 0.5);
+                prior.setProbability({}, 1, 0.5);
+                network.setCPT(id, prior);
+                continue;
+            }
+            network.addEdge("X" + std::to_string(999 + i), id);
+            ConditionalProbabilityTable transition({2, 2});
+            for (size_t x = 0; x < 2; ++x) {
+                transition.setProbability({x}, x, 0.9);
+                transition.setProbability({x}, 1 - x, 0.1);
+            }
+            network.setCPT(id, transition);
+            evidence[id] = (i % 2 == 0) ? "s0" : "s1";
+        }
+        double expectedLog = std::log(0.5) + static_cast<double>(length - 2) * std::log(0.1);
+
+        bool underflows = network.computeEvidenceProbability<DoublePolicy>(evidence) == 0.0;
+        double logEvidence = network.computeEvidenceProbability<LogPolicy>(evidence);
+        ExactValue exactEvidence = network.computeEvidenceProbability<ExactPolicy>(evidence);
+        bool evidenceOk = std::fabs(logEvidence - expectedLog) < 1e-9 * std::fabs(expectedLog) &&
+                          !exactEvidence.isZero();
+
+        auto logPosterior = network.variableElimination<LogPolicy>({"X1000"}, evidence);
+        auto exactPosterior = network.variableElimination<ExactPolicy>({"X1000"}, evidence);
+        ExactValue total = exactPosterior[{{"X1000", "s0"}}] + exactPosterior[{{"X1000", "s1"}}];
+        bool posteriorOk = std::fabs(std::exp(logPosterior[{{"X1000", "s1"}}]) - 0.9) < 1e-12 &&
+                           std::fabs(exactPosterior[{{"X1000", "s1"}}].toDouble() - 0.9) < 1e-15 &&
+                           total == ExactPolicy::one();
+
+        // Short queries agree with the double path
+        std::map<std::string, std::string> shortEvidence = {{"X1003", "s1"}};
+        auto plain = network.variableElimination({"X1001"}, shortEvidence);
+        auto kahan = network.variableElimination<KahanPolicy>({"X1001"}, shortEvidence);
+        auto exact = network.variableElimination<ExactPolicy>({"X1001"}, shortEvidence);
+        bool agree = true;
+        for (const auto& entry : plain) {
+            agree = agree && std::fabs(kahan[entry.first] - entry.second) < 1e-15 &&
+                    std::fabs(exact[entry.first].toDouble() - entry.second) < 1e-15;
+        }
+        return TestSuite::assertTrue(underflows, "Double evidence underflows") &&
+               TestSuite::assertTrue(evidenceOk, "Log and exact P(evidence)") &&
+               TestSuite::assertTrue(posteriorOk, "Log and exact posteriors") &&
+               TestSuite::assertTrue(agree, "Kahan and exact match double");
+    });
+}
+
+void runMessageStoreTests(TestSuite& suite) {
+    suite.runTest("Message store slices one arena by edge", []() {
+        BayesianNetwork network;
+        network.addNode("A", "A", {"a0", "a1", "a2"});
+        network.addNode("B", "B", {"b0", "b1"});
+        network.addNode("C", "C", {"c0", "c1"});
+        network.addEdge("A", "C");
+        network.addEdge("B", "C");
+        auto net = network.compile();
+        
+        MessageStore store = MessageStore::forNetwork(*net);
+        store.reset();
+        bool layout = store.numEdges() == size_t(2) && store.getMaxLength() == size_t(3) &&
+                      !store.isDoubleBuffered();
+        for (size_t e = 0; e < store.numEdges(); ++e) {
+            size_t length = net->cardinality(net->getParentIndices()[e]);
+            layout = layout && store.length(e) == length && store.lambda(e)[length - 1] == 1.0 &&
+                     store.pi(e)[0] == 1.0 / static_cast<double>(length) &&
+                     (e == 0 || store.lambda(e) == store.lambda(e - 1) + store.length(e - 1));
+        }
+        // Single-buffered writes land in place
+        store.writeLambda(1)[0] = 0.25;
+        bool inPlace = store.lambda(1)[0] == 0.25 && store.pi(1)[0] != 0.25;
+        
+        // Double-buffered writes appear after swapBuffers; unwritten messages carry over
+        MessageStore flooding({2, 2}, true);
+        flooding.reset();
+        flooding.writePi(0)[1] = 0.75;
+        bool hidden = flooding.pi(0)[1] == 0.5;
+        flooding.swapBuffers();
+        flooding.writeLambda(1)[0] = 0.5;
+        flooding.swapBuffers();
+        bool published = flooding.isDoubleBuffered() && flooding.pi(0)[1] == 0.75 &&
+                         flooding.lambda(1)[0] == 0.5 && flooding.lambda(0)[0] == 1.0;
+        return TestSuite::assertTrue(layout, "Edge slices") &&
+               TestSuite::assertTrue(inPlace, "In-place writes") &&
+               TestSuite::assertTrue(hidden && published, "Double buffering");
+    });
+}
+
+void runSamplingTests(TestSuite& suite) {
+    suite.runTest("Counter RNG matches Philox known answers", []() {
+        uint32_t zero[4];
+        CounterRNG(0).block(0, 0, zero);
+        uint32_t ones[4];
+        CounterRNG(~uint64_t(0)).block(~uint64_t(0), ~uint64_t(0), ones);
+        bool known = zero[0] == 0x6627e8d5u && zero[1] == 0xe169c58du && zero[2] == 0xbc57ac4cu &&
+                     zero[3] == 0x9b00dbd8u && ones[0] == 0x408f276du && ones[1] == 0x41c83b0eu &&
+                     ones[2] == 0xa20bc7c6u && ones[3] == 0x6d5451fdu;
+        CounterRNG rng(7);
+        double mean = 0.0;
+        bool range = true;
+        for (uint64_t i = 0; i < 10000; ++i) {
+            double u = rng.uniform(3, i);
+            range = range && u >= 0.0 && u < 1.0;
+            mean += u / 10000.0;
+        }
+        return TestSuite::assertTrue(known, "Philox4x32-10 test vectors") &&
+               TestSuite::assertTrue(range && std::fabs(mean - 0.5) < 0.01, "Uniform doubles");
+    });
+
+    suite.runTest("Sampling is reproducible across thread counts", []() {
+        BayesianNetwork network;
+        network.addNode("A", "A", {"a0", "a1"});
+        network.addNode("B", "B", {"b0", "b1", "b2"});
+        network.addEdge("A", "B");
+        ConditionalProbabilityTable aCPT({2});
+        aCPT.setProbability({}, 0, 0.4);
+        aCPT.setProbability({}, 1, 0.6);
+        network.setCPT("A", aCPT);
+        ConditionalProbabilityTable bCPT({2, 3});
+        bCPT.setProbability({0}, 0, 0.2);
+        bCPT.setProbability({0}, 1, 0.5);
+        bCPT.setProbability({0}, 2, 0.3);
+        bCPT.setProbability({1}, 0, 0.6);
+        bCPT.setProbability({1}, 1, 0.1);
+        bCPT.setProbability({1}, 2, 0.3);
+        network.setCPT("B", bCPT);
+        
+        std::map<std::string, std::string> evidence = {{"B", "b1"}};
+        bool same = true;
+        for (SamplingMethod method : {SamplingMethod::Forward, SamplingMethod::LikelihoodWeighting, SamplingMethod::Gibbs}) {
+            SamplingOptions options;
+            options.method = method;
+            options.seed = 99;
+            options.maxSamples = 5000;
+            options.batchSize = 256;
+            SamplingResult serial = network.sampleMarginals(evidence, options);
+            network.setThreadCount(3);
+            SamplingResult parallel = network.sampleMarginals(evidence, options);
+            network.setThreadCount(1);
+            same = same && serial.marginals == parallel.marginals && serial.halfWidths == parallel.halfWidths &&
+                   serial.samples == parallel.samples && serial.marginals["B"]["b1"] == 1.0;
+        }
+        // Running estimates stream until the callback stops the run
+        SamplingOptions options;
+        options.maxSamples = 1000000;
+        options.batchSize = 100;
+        options.batchesPerRound = 2;
+        size_t rounds = 0;
+        SamplingResult stopped = network.sampleMarginals(evidence, options, [&](const SamplingResult& running) {
+            ++rounds;
+            return running.samples < 1000;
+        });
+        bool streamed = rounds == 5 && stopped.samples == 1000 && stopped.effectiveSamples > 0.0;
+        return TestSuite::assertTrue(same, "Same estimates with 1 and 3 threads") &&
+               TestSuite::assertTrue(streamed, "Progress callback stops the run");
+    });
+}
+
+void runEliminationOrderTests(TestSuite& suite) {
+    suite.runTest("Moral graph marries co-parents", []() {
+        // 0 -> 2 <- 1
+        std::vector<std::vector<int>> parents = {{}, {}, {0, 1}};
+        MoralGraph graph = MoralGraph::fromParents(parents, {true, true, true});
+        
+        return TestSuite::assertTrue(graph.neighbors(0).count(1) == 1) &&
+               TestSuite::assertEqual(graph.neighbors(2).size(), size_t(2));
+    });
+
+    suite.runTest("Min-fill avoids fill-in on a star", []() {
+        // Star centered at 0: eliminating a leaf adds no fill, the hub adds three
+        MoralGraph graph(4);
+        graph.addEdge(0, 1);
+        graph.addEdge(0, 2);
+        graph.addEdge(0, 3);
+        std::vector<size_t> cards(4, 2);
+        auto order = EliminationOrdering::compute(graph, cards, {0, 1, 2}, EliminationHeuristic::MinFill);
+        
+        return TestSuite::assertEqual(order.size(), size_t(3)) &&
+               TestSuite::assertTrue(order[0] != 0, "Hub should not be eliminated first");
+    });
+
+    suite.runTest("Cost estimate on a chain", []() {
+        // Factors {0}, {0,1}, {1,2}; eliminate 0 then 1, keep 2
+        std::vector<size_t> cards = {2, 3, 2};
+        EliminationCost cost = EliminationOrdering::estimateCost({{0}, {0, 1}, {1, 2}}, cards, {0, 1});
+        
+        return TestSuite::assertEqual(cost.maxFactorSize, 6.0) &&
+               TestSuite::assertEqual(cost.inducedWidth, size_t(1)) &&
+               TestSuite::assertTrue(cost.totalFlops > 0.0);
+    });
+
+    suite.runTest("Ancestral set prunes barren nodes", []() {
+        // 0 -> 1 -> 2, 0 -> 3; query {1}
+        std::vector<std::vector<int>> parents = {{}, {0}, {1}, {0}};
+        auto keep = EliminationOrdering::ancestralSet(parents, {1});
+        
+        return TestSuite::assertTrue(keep[0] && keep[1]) &&
+               TestSuite::assertFalse(keep[2] || keep[3]);
+    });
+}
+
+void runThreadPoolTests(TestSuite& suite) {
+    suite.runTest("Thread pool parallel loop and futures", []() {
+        ThreadPool pool(4);
+        std::vector<long> squares(10000, 0);
+        pool.parallelFor(0, squares.size(), [&](size_t i) {
+            squares[i] = static_cast<long>(i * i);
+        }, 64);
+        bool loop = true;
+        for (size_t i = 0; i < squares.size(); ++i) {
+            loop = loop && squares[i] == static_cast<long>(i * i);
+        }
+        
+        // Nested loops run on the same pool without deadlocking
+        std::atomic<int> count{0};
+        pool.parallelFor(0, 8, [&](size_t) {
+            pool.parallelFor(0, 100, [&](size_t) { count.fetch_add(1); });
+        });
+        
+        std::future<int> answer = pool.submit([]() { return 42; });
+        
+        return TestSuite::assertTrue(loop, "Every index visited once") &&
+               TestSuite::assertEqual(count.load(), 800) &&
+               TestSuite::assertEqual(answer.get(), 42) &&
+               TestSuite::assertEqual(pool.size(), size_t(4));
+    });
+
+    suite.runTest("Thread pool propagates exceptions", []() {
+        ThreadPool pool(3);
+        return TestSuite::assertThrows([&]() {
+            pool.parallelFor(0, 100, [](size_t i) {
+                if (i == 57) {
+                    throw std::runtime_error("failed iteration");
+                }
+            });
+        });
+    });
+
+    suite.runTest("Parallel factor product is bit-identical", []() {
+        // 2^16 entries: above the parallel threshold
+        std::vector<int> varsA, varsB;
+        std::vector<size_t> cardsA, cardsB;
+        for (int v = 0; v < 10; ++v) {
+            varsA.push_back(v);
+            cardsA.push_back(2);
+        }
+        for (int v = 6; v < 16; ++v) {
+            varsB.push_back(v);
+            cardsB.push_back(2);
+        }
+        Factor a(varsA, cardsA), b(varsB, cardsB);
+        for (size_t i = 0; i < a.size(); ++i) a.getValues()[i] = 0.001 * static_cast<double>(i % 97 + 1);
+        for (size_t i = 0; i < b.size(); ++i) b.getValues()[i] = 0.01 * static_cast<double>(i % 89 + 1);
+        
+        ThreadPool pool(4);
+        Factor serial = a.product(b);
+        Factor parallel = a.product(b, &pool);
+        
+        return TestSuite::assertEqual(serial.size(), size_t(1) << 16) &&
+               TestSuite::assertTrue(serial.getValues() == parallel.getValues(), "Product") &&
+               TestSuite::assertTrue(serial.marginalize(3).getValues() ==
+                                     parallel.marginalize(3, &pool).getValues(), "Marginal");
+    });
+}
+
+void runJunctionTreeTests(TestSuite& suite) {
+    // Binary chain X0 -> ... -> X39 with evidence on X1..X39 alternating
+    // T and F, so P(evidence) is far below 1e-10
+    auto longChain = [](BayesianNetwork& network, std::map<std::string, std::string>& evidence) {
+        network.beginBatch();
+        for (int i = 0; i < 40; ++i) {
+            network.addNode("X" + std::to_string(i), "X" + std::to_string(i), {"T", "F"});
+            if (i > 0) {
+                network.addEdge("X" + std::to_string(i - 1), "X" + std::to_string(i));
+            }
+        }
+        network.commit();
+        ConditionalProbabilityTable root({2});
+        root.setProbability({}, 0, 0.3);
+        root.setProbability({}, 1, 0.7);
+        network.setCPT("X0", root);
+        ConditionalProbabilityTable link({2, 2});
+        link.setProbability({0}, 0, 0.9);
+        link.setProbability({0}, 1, 0.1);
+        link.setProbability({1}, 0, 0.2);
+        link.setProbability({1}, 1, 0.8);
+        for (int i = 1; i < 40; ++i) {
+            network.setCPT("X" + std::to_string(i), link);
+            evidence["X" + std::to_string(i)] = i % 2 == 0 ? "T" : "F";
+        }
+    };
+    suite.runTest("Junction tree structure on a loop", []() {
+        // A -> B, A -> C, B -> D, C -> D: the moral graph is a 4-cycle plus B-C
+        BayesianNetwork network;
+        for (const char* id : {"A", "B", "C", "D"}) {
+            network.addNode(id, id, {"F", "T"});
+        }
+        network.addEdge("A", "B");
+        network.addEdge("A", "C");
+        network.addEdge("B", "D");
+        network.addEdge("C", "D");
+        ConditionalProbabilityTable root({2});
+        root.setProbability({}, 0, 0.4);
+        root.setProbability({}, 1, 0.6);
+        network.setCPT("A", root);
+        ConditionalProbabilityTable single({2, 2});
+        single.setProbability({0}, 0, 0.9);
+        single.setProbability({0}, 1, 0.1);
+        single.setProbability({1}, 0, 0.3);
+        single.setProbability({1}, 1, 0.7);
+        network.setCPT("B", single);
+        network.setCPT("C", single);
+        ConditionalProbabilityTable noisy({2, 2, 2});
+        noisy.setProbability({0, 0}, 0, 1.0);
+        noisy.setProbability({0, 1}, 1, 0.8);
+        noisy.setProbability({0, 1}, 0, 0.2);
+        noisy.setProbability({1, 0}, 1, 0.8);
+        noisy.setProbability({1, 0}, 0, 0.2);
+        noisy.setProbability({1, 1}, 1, 0.96);
+        noisy.setProbability({1, 1}, 0, 0.04);
+        network.setCPT("D", noisy);
+        
+        std::shared_ptr<const JunctionTree> tree = network.compileJunctionTree();
+        bool structure = tree->numCliques() == size_t(2) && tree->maxCliqueSize() == size_t(8);
+        bool cached = network.compileJunctionTree() == tree;
+        
+        // All marginals from one calibration agree with variable elimination
+        std::map<std::string, std::string> evidence = {{"D", "T"}};
+        auto marginals = network.computeAllMarginals(evidence);
+        bool exact = true;
+        for (const char* id : {"A", "B", "C"}) {
+            auto ve = network.variableElimination({id}, evidence);
+            exact = exact && std::abs(marginals[id]["T"] - ve[{{id, "T"}}]) < 1e-12;
+        }
+        double pd = network.variableElimination({"D"}, {})[{{"D", "T"}}];
+        
+        return TestSuite::assertTrue(structure, "Two cliques of three variables") &&
+               TestSuite::assertTrue(cached, "Tree reused until the model changes") &&
+               TestSuite::assertTrue(exact, "Marginals match variable elimination") &&
+               TestSuite::assertEqual(network.computeEvidenceProbability(evidence), pd, 1e-12);
+    });
+    suite.runTest("Junction tree follows the elimination heuristic", []() {
+        // A -> B -> E, A -> C -> D -> E, E -> F: the 5-cycle A-B-E-D-C needs
+        // two chords, which min-fill and weighted min-fill place differently
+        BayesianNetwork network;
+        std::map<std::string, size_t> cards = {{"A", 2}, {"B", 3}, {"C", 5}, {"D", 5}, {"E", 5}, {"F", 5}};
+        for (const auto& pair : cards) {
+            std::vector<std::string> states;
+            for (size_t s = 0; s < pair.second; ++s) {
+                states.push_back("s" + std::to_string(s));
+            }
+            network.addNode(pair.first, pair.first, states);
+        }
+        std::vector<std::pair<std::string, std::string>> edges = {
+            {"A", "B"}, {"A", "C"}, {"B", "E"}, {"C", "D"}, {"D", "E"}, {"E", "F"}};
+        for (const auto& edge : edges) {
+            network.addEdge(edge.first, edge.second);
+        }
+        for (const auto& pair : cards) {
+            std::vector<size_t> dims;
+            for (const std::string& parentId : network.getNode(pair.first).parentIds) {
+                dims.push_back(cards[parentId]);
+            }
+            dims.push_back(pair.second);
+            size_t size = 1;
+            for (size_t dim : dims) {
+                size *= dim;
+            }
+            std::vector<double> uniform(size, 1.0 / static_cast<double>(pair.second));
+            network.setCPT(pair.first, ConditionalProbabilityTable(dims, uniform.data()));
+        }
+        auto cliques = [](const JunctionTree& tree) {
+            std::set<std::vector<int>> sets;
+            for (size_t c = 0; c < tree.numCliques(); ++c) {
+                sets.insert(tree.clique(static_cast<int>(c)).variables);
+            }
+            return sets;
+        };
+
+        network.setEliminationHeuristic(EliminationHeuristic::MinFill);
+        std::shared_ptr<const JunctionTree> minFill = network.compileJunctionTree();
+        network.setEliminationHeuristic(EliminationHeuristic::WeightedMinFill);
+        std::shared_ptr<const JunctionTree> weighted = network.compileJunctionTree();
+        JunctionTree expected(network.compile(), EliminationHeuristic::WeightedMinFill);
+        return TestSuite::assertTrue(cliques(*minFill) != cliques(*weighted), "Cliques change with the heuristic") &&
+               TestSuite::assertTrue(cliques(*weighted) == cliques(expected), "Cliques of the new heuristic");
+    });
+    suite.runTest("Junction tree marginals stay normalized under long evidence", [&]() {
+        BayesianNetwork network;
+        std::map<std::string, std::string> evidence;
+        longChain(network, evidence);
+        std::shared_ptr<const JunctionTree> tree = network.compileJunctionTree();
+        const CompiledNetwork& net = *tree->network();
+
+        // Every node observed: calibrated marginals are point masses
+        std::vector<int> states(net.numNodes(), -1);
+        for (const auto& pair : evidence) {
+            int v = net.requireIndex(pair.first);
+            states[v] = net.stateIndex(v, pair.second);
+        }
+        states[net.requireIndex("X0")] = 0;
+        JunctionTree::Calibration all = tree->calibrate(states);
+        bool normalized = all.evidenceProbability > 0.0 && all.evidenceProbability < 1e-15;
+        for (size_t v = 0; v < net.numNodes(); ++v) {
+            normalized = normalized && std::abs(all.marginals[v][0] + all.marginals[v][1] - 1.0) < 1e-12;
+        }
+
+        // X0 unobserved: its marginal matches log-space elimination
+        auto marginals = network.computeAllMarginals(evidence);
+        double expected = std::exp(network.variableElimination<LogPolicy>({"X0"}, evidence)[{{"X0", "T"}}]);
+        return TestSuite::assertTrue(normalized, "Every calibrated marginal sums to 1") &&
+               TestSuite::assertEqual(marginals["X0"]["T"] + marginals["X0"]["F"], 1.0, 1e-12,
+                                      "Unobserved marginal sums to 1") &&
+               TestSuite::assertEqual(marginals["X0"]["T"], expected, 1e-12, "Marginal matches LogPolicy");
+    });
+    suite.runTest("Inference session incremental updates", []() {
+        // Complete binary tree of 127 nodes: node i has parent (i - 1) / 2
+        BayesianNetwork network;
+        for (int i = 0; i < 127; ++i) {
+            network.addNode("N" + std::to_string(i), "N" + std::to_string(i), {"F", "T"});
+            if (i > 0) {
+                network.addEdge("N" + std::to_string((i - 1) / 2), "N" + std::to_string(i));
+            }
+        }
+        ConditionalProbabilityTable root({2});
+        root.setProbability({}, 0, 0.5);
+        root.setProbability({}, 1, 0.5);
+        network.setCPT("N0", root);
+        for (int i = 1; i < 127; ++i) {
+            double stay = 0.6 + 0.003 * i;
+            ConditionalProbabilityTable cpt({2, 2});
+            cpt.setProbability({0}, 0, stay);
+            cpt.setProbability({0}, 1, 1.0 - stay);
+            cpt.setProbability({1}, 0, 1.0 - stay);
+            cpt.setProbability({1}, 1, stay);
+            network.setCPT("N" + std::to_string(i), cpt);
+        }
+        
+        InferenceSession session = network.createSession();
+        size_t numCliques = session.getJunctionTree()->numCliques();
+        session.marginal("N64");
+        
+        // One leaf observation, then a query at another leaf
+        size_t before = session.getMessageUpdates();
+        session.observe("N126", "T");
+        auto posterior = session.marginal("N64");
+        size_t pathCost = session.getMessageUpdates() - before;
+        auto expected = network.computeAllMarginals({{"N126", "T"}});
+        
+        // Retraction restores the prior without a full sweep
+        session.retract("N126");
+        auto prior = session.marginal("N64");
+        auto expectedPrior = network.computeAllMarginals({});
+        
+        return TestSuite::assertTrue(numCliques >= size_t(100), "Tree has 100+ cliques") &&
+               TestSuite::assertTrue(pathCost < numCliques / 4, "Update costs about one path") &&
+               TestSuite::assertEqual(posterior["T"], expected["N64"]["T"], 1e-12) &&
+               TestSuite::assertEqual(prior["T"], expectedPrior["N64"]["T"], 1e-12) &&
+               TestSuite::assertTrue(session.getEvidence().empty());
+    });
+    suite.runTest("Session beliefs stay normalized as evidence accumulates", [&]() {
+        BayesianNetwork network;
+        std::map<std::string, std::string> evidence;
+        longChain(network, evidence);
+        InferenceSession session = network.createSession();
+        bool normalized = true;
+        for (int i = 1; i < 40; ++i) {
+            std::string id = "X" + std::to_string(i);
+            session.observe(id, evidence[id]);
+            auto belief = session.marginal("X0");
+            normalized = normalized && std::abs(belief["T"] + belief["F"] - 1.0) < 1e-12;
+        }
+        auto posterior = session.marginal("X0");
+        double expected = std::exp(network.variableElimination<LogPolicy>({"X0"}, evidence)[{{"X0", "T"}}]);
+
+        // Retracting half the evidence agrees with a fresh calibration
+        for (int i = 21; i < 40; ++i) {
+            std::string id = "X" + std::to_string(i);
+            session.retract(id);
+            evidence.erase(id);
+        }
+        auto retracted = session.marginal("X10");
+        auto fresh = network.computeAllMarginals(evidence);
+        return TestSuite::assertTrue(normalized, "Beliefs sum to 1 after every observation") &&
+               TestSuite::assertEqual(posterior["T"], expected, 1e-12, "Posterior matches LogPolicy") &&
+               TestSuite::assertEqual(retracted["T"] + retracted["F"], 1.0, 1e-12, "Retracted beliefs sum to 1") &&
+               TestSuite::assertEqual(retracted["T"], fresh["X10"]["T"], 1e-12, "Retraction matches recalibration");
+    });
+}
+
+void runModelFileTests(TestSuite& suite) {
+    suite.runTest("Binary model file round trip", []() {
+        BayesianNetwork network;
+        network.addNode("A", "Cause A", {"a0", "a1"});
+        network.addNode("B", "Cause B", {"b0", "b1", "b2"});
+        network.addNode("C", "Effect", {"c0", "c1"});
+        network.addNode("D", "Unset", {"d0", "d1"});
+        network.addEdge("A", "C");
+        network.addEdge("B", "C");
+        ConditionalProbabilityTable aCPT({2});
+        aCPT.setProbability({}, 0, 0.1);
+        aCPT.setProbability({}, 1, 0.9);
+        ConditionalProbabilityTable bCPT({3});
+        bCPT.setProbability({}, 0, 1.0 / 3.0);
+        bCPT.setProbability({}, 1, 1.0 / 7.0);
+        bCPT.setProbability({}, 2, 1.0 - 1.0 / 3.0 - 1.0 / 7.0);
+        ConditionalProbabilityTable cCPT({2, 3, 2});
+        for (size_t a = 0; a < 2; ++a) {
+            for (size_t b = 0; b < 3; ++b) {
+                double p = 0.1 + 0.13 * static_cast<double>(a * 3 + b);
+                cCPT.setProbability({a, b}, 0, p);
+                cCPT.setProbability({a, b}, 1, 1.0 - p);
+            }
+        }
+        network.setCPT("A", aCPT);
+        network.setCPT("B", bCPT);
+        network.setCPT("C", cCPT);
+        
+        std::string path = "/tmp/lbn_unit_round_trip.lbn";
+        network.saveToFile(path, BayesianNetwork::FileFormat::Binary);
+        BayesianNetwork loaded;
+        loaded.loadFromFile(path);
+        
+        auto before = network.compile();
+        auto after = loaded.compile();
+        int c = after->indexOf("C");
+        bool mapped = reinterpret_cast<uintptr_t>(after->cpt(c)) % CompiledNetwork::kAlignment == 0 &&
+                      ModelFile::isModelFile(path);
+        bool same = after->numNodes() == before->numNodes() &&
+                    after->nodeName(c) == "Effect" && after->states(after->indexOf("B"))[2] == "b2" &&
+                    after->getCPTStatus(after->indexOf("D")) == CompiledNetwork::CPTStatus::Missing &&
+                    after->getChildOffsets() == before->getChildOffsets() &&
+                    after->getChildIndices() == before->getChildIndices() &&
+                    loaded.getChildren("B") == std::vector<std::string>{"C"};
+        for (size_t v = 0; v < before->numNodes(); ++v) {
+            int w = after->indexOf(before->nodeId(static_cast<int>(v)));
+            same = same && w != -1 && before->cptSize(static_cast<int>(v)) == after->cptSize(w) &&
+                   std::equal(before->cpt(static_cast<int>(v)),
+                              before->cpt(static_cast<int>(v)) + before->cptSize(static_cast<int>(v)),
+                              after->cpt(w));
+        }
+        std::map<std::string, std::string> evidence = {{"C", "c1"}};
+        bool inference = loaded.variableElimination({"A", "B"}, evidence) ==
+                         network.variableElimination({"A", "B"}, evidence);
+        
+        // The loaded model stays editable
+        loaded.addEdge("C", "D");
+        auto edited = loaded.compile();
+        bool editable = edited != after && edited->parents(edited->indexOf("D")).size() == size_t(1);
+        std::remove(path.c_str());
+        
+        return TestSuite::assertTrue(mapped, "Mapped, aligned CPT blocks") &&
+               TestSuite::assertTrue(same, "Names, states and exact CPTs") &&
+               TestSuite::assertTrue(inference, "Inference on the loaded model") &&
+               TestSuite::assertTrue(editable, "Loaded model is editable");
+    });
+
+    suite.runTest("Binary model file CPTs stay in the mapping until edited", []() {
+        BayesianNetwork network;
+        network.addNode("A", "A", {"a0", "a1"});
+        network.addNode("B", "B", {"b0", "b1"});
+        network.addNode("C", "C", {"c0", "c1"});
+        network.addEdge("A", "B");
+        ConditionalProbabilityTable prior({2});
+        prior.setProbability({}, 0, 0.3);
+        prior.setProbability({}, 1, 0.7);
+        ConditionalProbabilityTable link({2, 2});
+        link.setProbability({0}, 0, 0.9);
+        link.setProbability({0}, 1, 0.1);
+        link.setProbability({1}, 0, 0.4);
+        link.setProbability({1}, 1, 0.6);
+        network.setCPT("A", prior);
+        network.setCPT("B", link);
+        network.setCPT("C", prior);
+        std::string path = "/tmp/lbn_unit_lazy_cpts.lbn";
+        network.saveToFile(path, BayesianNetwork::FileFormat::Binary);
+        BayesianNetwork loaded;
+        loaded.loadFromFile(path);
+        auto mapped = loaded.compile();
+        const double* mappedB = mapped->cpt(mapped->indexOf("B"));
+
+        // Replacing one CPT leaves the others in the mapping
+        ConditionalProbabilityTable flipped({2});
+        flipped.setProbability({}, 0, 0.6);
+        flipped.setProbability({}, 1, 0.4);
+        loaded.setCPT("A", flipped);
+        auto derived = loaded.compile();
+        bool shared = derived != mapped && derived->cpt(derived->indexOf("B")) == mappedB &&
+                      derived->cpt(derived->indexOf("A"))[0] == 0.6;
+
+        // Text saves and structural edits read the CPTs still in the mapping
+        network.setCPT("A", flipped);
+        std::ostringstream expectedText;
+        network.saveToStream(expectedText);
+        std::ostringstream loadedText;
+        loaded.saveToStream(loadedText);
+        loaded.addEdge("B", "C");
+        network.addEdge("B", "C");
+        auto rebuilt = loaded.compile();
+        bool kept = rebuilt->getCPTStatus(rebuilt->indexOf("B")) == CompiledNetwork::CPTStatus::Valid &&
+                    rebuilt->cpt(rebuilt->indexOf("B")) != mappedB &&
+                    rebuilt->getCPTStatus(rebuilt->indexOf("C")) == CompiledNetwork::CPTStatus::Mismatch &&
+                    loaded.variableElimination({"A"}, {{"B", "b1"}}) == network.variableElimination({"A"}, {{"B", "b1"}});
+        std::remove(path.c_str());
+
+        return TestSuite::assertTrue(shared, "Untouched CPTs read from the mapping") &&
+               TestSuite::assertTrue(loadedText.str() == expectedText.str(), "Text save includes mapped CPTs") &&
+               TestSuite::assertTrue(kept, "Structural edits copy the mapped CPTs");
+    });
+
+    suite.runTest("Binary model file rejects corrupt input", []() {
+        BayesianNetwork network;
+        network.addNode("A", "A", {"a0", "a1"});
+        ConditionalProbabilityTable aCPT({2});
+        aCPT.setProbability({}, 0, 0.5);
+        aCPT.setProbability({}, 1, 0.5);
+        network.setCPT("A", aCPT);
+        std::string path = "/tmp/lbn_unit_corrupt.lbn";
+        network.saveToFile(path, BayesianNetwork::FileFormat::Binary);
+        
+        // Drop the tail of the CPT section
+        std::ifstream in(path, std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        in.close();
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size() - 8));
+        out.close();
+        bool truncated = TestSuite::assertThrows([&]() {
+            BayesianNetwork loaded;
+            loaded.loadFromFile(path);
+        });
+        std::remove(path.c_str());
+        
+        bool missing = TestSuite::assertThrows([&]() {
+            BayesianNetwork loaded;
+            loaded.loadFromFile("/tmp/lbn_unit_does_not_exist.lbn");
+        });
+        return TestSuite::assertTrue(truncated, "Truncated file") &&
+               TestSuite::assertTrue(missing, "Missing file");
+    });
+}
+
+void runModelTextTests(TestSuite& suite) {
+    suite.runTest("Text model round trip is lossless", []() {
+        BayesianNetwork network;
+        network.addNode("NODES", "Name with \"quotes\"\tand tab", {"a b", "#c", "->"});
+        network.addNode("B", "B", {"x", "y"});
+        network.addEdge("NODES", "B");
+        ConditionalProbabilityTable aCPT({3});
+        aCPT.setProbability({}, 0, 1.0 / 3.0);
+        aCPT.setProbability({}, 1, 1.0 / 7.0);
+        aCPT.setProbability({}, 2, 4.9406564584124654e-324);
+        network.setCPT("NODES", aCPT);
+        ConditionalProbabilityTable bCPT({3, 2});
+        for (size_t i = 0; i < 3; ++i) {
+            bCPT.setProbability({i}, 0, 0.1 * static_cast<double>(i) + 0.05);
+            bCPT.setProbability({i}, 1, 0.95 - 0.1 * static_cast<double>(i));
+        }
+        network.setCPT("B", bCPT);
+        
+        std::stringstream text;
+        network.saveToStream(text);
+        BayesianNetwork loaded;
+        loaded.loadFromStream(text);
+        std::stringstream again;
+        loaded.saveToStream(again);
+        
+        auto before = network.compile();
+        auto after = loaded.compile();
+        bool exact = true;
+        for (size_t v = 0; v < before->numNodes(); ++v) {
+            int w = after->indexOf(before->nodeId(static_cast<int>(v)));
+            exact = exact && w != -1 && before->cptSize(static_cast<int>(v)) == after->cptSize(w) &&
+                    std::equal(before->cpt(static_cast<int>(v)),
+                               before->cpt(static_cast<int>(v)) + before->cptSize(static_cast<int>(v)),
+                               after->cpt(w));
+        }
+        int a = after->indexOf("NODES");
+        return TestSuite::assertTrue(exact, "Probabilities read back bit for bit") &&
+               TestSuite::assertTrue(after->nodeName(a) == "Name with \"quotes\"\tand tab" &&
+                                     after->states(a)[2] == "->", "Quoted names") &&
+               TestSuite::assertTrue(again.str() == text.str(), "Stable output");
+    });
+
+    suite.runTest("Text model errors report line and column", []() {
+        std::istringstream input("NODES\nA A 2 a0 a1\n\nCPTS\nA\n1 2\n0.5 1.5\n");
+        BayesianNetwork network;
+        network.addNode("Kept", "Kept", {"k"});
+        size_t line = 0;
+        size_t column = 0;
+        try {
+            network.loadFromStream(input);
+        } catch (const ParseError& e) {
+            line = e.getLine();
+            column = e.getColumn();
+        }
+        std::istringstream cyclic("NODES\nA A 1 a\nB B 1 b\nEDGES\nA -> B\nB -> A\n");
+        bool cycle = TestSuite::assertThrows([&]() { network.loadFromStream(cyclic); });
+        
+        // A failed load leaves the model untouched
+        return TestSuite::assertEqual(line, size_t(7)) &&
+               TestSuite::assertEqual(column, size_t(5)) &&
+               TestSuite::assertTrue(cycle, "Cycle rejected") &&
+               TestSuite::assertTrue(network.getNodeIds() == std::vector<std::string>{"Kept"}, "Model kept");
+    });
+
+    suite.runTest("BIF and XMLBIF import", []() {
+        std::string bifPath = "/tmp/lbn_unit_import.bif";
+        std::ofstream bif(bifPath);
+        bif << "network unknown {\n}\n"
+               "variable asia {\n  type discrete [ 2 ] { yes, no };\n}\n"
+               "variable tub {\n  type discrete [ 2 ] { yes, no };\n  property weight = 1 ;\n}\n"
+               "variable lung { type discrete [ 2 ] { yes, no }; }\n"
+               "variable either { type discrete [ 2 ] { yes, no }; }\n"
+               "probability ( asia ) {\n  table 0.01, 0.99;\n}\n"
+               "probability ( tub | asia ) {\n  (yes) 0.05, 0.95;\n  (no) 0.01, 0.99;\n}\n"
+               "probability ( lung ) { table 0.055, 0.945; }\n"
+               "/* deterministic OR */\n"
+               "probability ( either | tub, lung ) {\n"
+               "  (yes, yes) 1.0, 0.0;\n  (no, yes) 1.0, 0.0;\n"
+               "  (yes, no) 1.0, 0.0;\n  (no, no) 0.0, 1.0;\n}\n";
+        bif.close();
+        BayesianNetwork asia;
+        asia.loadFromFile(bifPath);
+        std::remove(bifPath.c_str());
+        auto either = asia.variableElimination({"either"}, {});
+        double expected = 1.0 - (1.0 - (0.01 * 0.05 + 0.99 * 0.01)) * (1.0 - 0.055);
+        
+        // GIVEN order (B, A) differs from the sorted parent order (A, B)
+        std::istringstream xml(
+            "<?xml version=\"1.0\"?>\n"
+            "<!DOCTYPE BIF [\n  <!ELEMENT BIF ( NETWORK )*>\n]>\n"
+            "<BIF VERSION=\"0.3\"><NETWORK><NAME>test</NAME>\n"
+            "<VARIABLE TYPE=\"nature\"><NAME>A</NAME><OUTCOME>a0</OUTCOME><OUTCOME>a1</OUTCOME></VARIABLE>\n"
+            "<VARIABLE TYPE=\"nature\"><NAME>B</NAME><OUTCOME>b0</OUTCOME><OUTCOME>b1</OUTCOME>"
+            "<PROPERTY>position = (1, 2)</PROPERTY></VARIABLE>\n"
+            "<VARIABLE TYPE=\"nature\"><NAME>C</NAME><OUTCOME>c0</OUTCOME><OUTCOME>c1</OUTCOME></VARIABLE>\n"
+            "<DEFINITION><FOR>A</FOR><TABLE>0.3 0.7</TABLE></DEFINITION>\n"
+            "<DEFINITION><FOR>B</FOR><TABLE>0.6 0.4</TABLE></DEFINITION>\n"
+            "<!-- child varies fastest -->\n"
+            "<DEFINITION><FOR>C</FOR><GIVEN>B</GIVEN><GIVEN>A</GIVEN>\n"
+            "<TABLE> 0.1 0.9  0.2 0.8  0.3 0.7  0.4 0.6 </TABLE></DEFINITION>\n"
+            "</NETWORK></BIF>\n");
+        BayesianNetwork network;
+        network.loadFromStream(xml, BayesianNetwork::FileFormat::XmlBif);
+        double c0 = network.getConditionalProbability("C", "c0", {{"A", "a0"}, {"B", "b1"}});
+        
+        return TestSuite::assertTrue(std::abs(either[{{"either", "yes"}}] - expected) < 1e-12, "BIF marginal") &&
+               TestSuite::assertEqual(c0, 0.3);
+    });
+}
+
 void runBayesianNetworkTests(TestSuite& suite) {
     suite.runTest("Network node addition", []() {
         BayesianNetwork network;
@@ -164,6 +1235,119 @@ void runBayesianNetworkTests(TestSuite& suite) {
         return throws;
     });
 
+    suite.runTest("Incremental cycle detection matches reachability", []() {
+        BayesianNetwork network;
+        const int count = 40;
+        for (int i = 0; i < count; ++i) {
+            network.addNode("V" + std::to_string(i), "V", {"a", "b"});
+        }
+        // Brute force: does 'from' reach 'to' along child links?
+        std::function<bool(const std::string&, const std::string&)> reaches =
+            [&](const std::string& from, const std::string& to) {
+                if (from == to) {
+                    return true;
+                }
+                for (const std::string& child : network.getNode(from).childIds) {
+                    if (reaches(child, to)) {
+                        return true;
+                    }
+                }
+                return false;
+            };
+        bool agrees = true;
+        uint32_t seed = 12345;
+        for (int attempt = 0; attempt < 300; ++attempt) {
+            seed = seed * 1664525u + 1013904223u;
+            std::string parent = "V" + std::to_string((seed >> 8) % count);
+            seed = seed * 1664525u + 1013904223u;
+            std::string child = "V" + std::to_string((seed >> 8) % count);
+            if (parent == child) {
+                continue;
+            }
+            bool cycle = reaches(child, parent);
+            bool threw = false;
+            try {
+                network.addEdge(parent, child);
+            } catch (const std::runtime_error&) {
+                threw = true;
+            }
+            agrees = agrees && threw == cycle && network.getNode(child).hasParent(parent) != cycle &&
+                     network.getNode(parent).hasChild(child) != cycle;
+        }
+        auto net = network.compile();
+        bool ordered = true;
+        for (size_t v = 0; v < net->numNodes(); ++v) {
+            for (int p : net->parents(static_cast<int>(v))) {
+                ordered = ordered && p < static_cast<int>(v);
+            }
+        }
+        return TestSuite::assertTrue(agrees, "Cycle answers and child lists") &&
+               TestSuite::assertTrue(ordered, "Compiled order is topological");
+    });
+
+    suite.runTest("Batch builder validates the DAG at commit", []() {
+        BayesianNetwork network;
+        network.addNode("A", "NodeA", {"True", "False"});
+        network.beginBatch();
+        network.addNode("B", "NodeB", {"True", "False"});
+        network.addNode("C", "NodeC", {"True", "False"});
+        network.addEdge("A", "B");
+        network.addEdge("B", "C");
+        network.addEdge("C", "A");  // Not checked until commit
+        bool deferred = TestSuite::assertThrows([&]() { network.compile(); });
+        bool rejected = TestSuite::assertThrows([&]() { network.commit(); });
+        // The failed batch is undone
+        bool restored = network.getNodeIds().size() == size_t(1) && network.getNode("A").getNumParents() == 0 &&
+                        network.getNode("A").getNumChildren() == 0;
+        
+        network.beginBatch();
+        network.addNode("B", "NodeB", {"True", "False"});
+        network.addEdge("A", "B");
+        network.commit();
+        bool committed = network.getNode("B").hasParent("A") && network.compile()->numNodes() == 2 &&
+                         TestSuite::assertThrows([&]() { network.addEdge("B", "A"); }) &&
+                         TestSuite::assertThrows([&]() { network.commit(); });
+        return TestSuite::assertTrue(deferred, "Queries wait for commit") &&
+               TestSuite::assertTrue(rejected, "Cycle rejected at commit") &&
+               TestSuite::assertTrue(restored, "Rollback") &&
+               TestSuite::assertTrue(committed, "Valid batch");
+    });
+
+    suite.runTest("Children index and Markov blanket", []() {
+        BayesianNetwork network;
+        for (const char* id : {"A", "B", "C", "D", "E"}) {
+            network.addNode(id, id, {"s0", "s1"});
+        }
+        network.addEdge("A", "C");
+        network.addEdge("B", "C");
+        network.addEdge("C", "D");
+        network.addEdge("E", "D");
+        network.addEdge("A", "E");
+        
+        auto net = network.compile();
+        bool csr = true;
+        for (size_t v = 0; v < net->numNodes(); ++v) {
+            int i = static_cast<int>(v);
+            ArrayView<int> children = net->children(i);
+            ArrayView<size_t> edges = net->childEdges(i);
+            csr = csr && children.size() == network.getNode(net->nodeId(i)).getNumChildren();
+            for (size_t k = 0; k < children.size(); ++k) {
+                // Each child entry names the parent edge that links back to v
+                csr = csr && net->getParentIndices()[edges[k]] == i &&
+                      edges[k] >= net->getParentOffsets()[children[k]] &&
+                      edges[k] < net->getParentOffsets()[children[k] + 1] &&
+                      (k == 0 || children[k - 1] < children[k]);
+            }
+        }
+        bool api = network.getChildren("A") == std::vector<std::string>{"C", "E"} &&
+                   network.getChildren("D").empty() &&
+                   network.getMarkovBlanket("C") == std::vector<std::string>{"A", "B", "D", "E"} &&
+                   network.getMarkovBlanket("B") == std::vector<std::string>{"A", "C"} &&
+                   TestSuite::assertThrows([&]() { network.getMarkovBlanket("Z"); });
+        return TestSuite::assertTrue(csr, "CSR children") &&
+               TestSuite::assertTrue(api, "getChildren / getMarkovBlanket");
+    });
+
     suite.runTest("Network CPT setting", []() {
         BayesianNetwork network;
         network.addNode("A", "NodeA", {"State1", "State2"});
@@ -180,6 +1364,188 @@ void runBayesianNetworkTests(TestSuite& suite) {
         return TestSuite::assertEqual(prob, 0.6);
     });
 
+    suite.runTest("Network elimination cost estimate", []() {
+        BayesianNetwork network;
+        network.addNode("A", "NodeA", {"True", "False"});
+        network.addNode("B", "NodeB", {"True", "False"});
+        network.addNode("C", "NodeC", {"True", "False"});
+        network.addEdge("A", "B");
+        network.addEdge("B", "C");
+        
+        // C is barren for a query on A with no evidence, so it needs no CPT
+        std::map<std::string, std::string> evidence;
+        EliminationCost cost = network.estimateEliminationCost({"A"}, evidence);
+        auto order = network.getEliminationOrder({"A"}, evidence);
+        
+        evidence["C"] = "True";
+        auto orderWithEvidence = network.getEliminationOrder({"A"}, evidence);
+        
+        return TestSuite::assertEqual(cost.maxFactorSize, 2.0) &&
+               TestSuite::assertEqual(order.size(), size_t(0)) &&
+               TestSuite::assertEqual(orderWithEvidence.size(), size_t(1)) &&
+               TestSuite::assertEqual(orderWithEvidence[0], std::string("B"));
+    });
+
+    suite.runTest("Compiled network snapshot", []() {
+        BayesianNetwork network;
+        network.addNode("B", "NodeB", {"Low", "Mid", "High"});
+        network.addNode("A", "NodeA", {"True", "False"});
+        network.addEdge("A", "B");
+        
+        ConditionalProbabilityTable aCPT({2});
+        aCPT.setProbability({}, 0, 0.25);
+        aCPT.setProbability({}, 1, 0.75);
+        network.setCPT("A", aCPT);
+        
+        auto net = network.compile();
+        int a = net->indexOf("A");
+        int b = net->indexOf("B");
+        
+        // Parents precede children; B has no CPT yet
+        bool structure = a < b && net->parents(b).size() == size_t(1) && net->parents(b)[0] == a &&
+                         net->cardinality(b) == size_t(3) && net->stateIndex(b, "High") == 2;
+        bool arena = reinterpret_cast<uintptr_t>(net->cpt(a)) % CompiledNetwork::kAlignment == 0 &&
+                     net->getCPTStatus(b) == CompiledNetwork::CPTStatus::Missing;
+        size_t parentState = 0;
+        bool lookup = net->probability(a, &parentState, 1) == 0.75;
+        
+        // Changing the model produces a new snapshot; the old one stays valid
+        network.setCPT("A", aCPT);
+        bool rebuilt = network.compile() != net && net->cpt(a)[0] == 0.25;
+        
+        return TestSuite::assertTrue(structure, "CSR structure") &&
+               TestSuite::assertTrue(arena, "Aligned arena") &&
+               TestSuite::assertTrue(lookup, "Index lookup") &&
+               TestSuite::assertTrue(rebuilt, "Snapshot invalidation");
+    });
+
+    suite.runTest("Bayes-ball finds active trails", []() {
+        // A -> C <- B, C -> D, A -> E
+        BayesianNetwork network;
+        for (const char* id : {"A", "B", "C", "D", "E"}) {
+            network.addNode(id, id, {"0", "1"});
+        }
+        network.addEdge("A", "C");
+        network.addEdge("B", "C");
+        network.addEdge("C", "D");
+        network.addEdge("A", "E");
+        auto net = network.compile();
+        auto reached = [&net](const std::map<std::string, int>& observed) {
+            std::vector<int> evidenceState(net->numNodes(), -1);
+            for (const auto& entry : observed) {
+                evidenceState[net->indexOf(entry.first)] = entry.second;
+            }
+            std::vector<bool> active = net->activeTrails(net->indexOf("A"), evidenceState);
+            std::string ids;
+            for (const char* id : {"A", "B", "C", "D", "E"}) {
+                ids += active[net->indexOf(id)] ? id : "";
+            }
+            return ids;
+        };
+        return TestSuite::assertEqual(reached({}), std::string("ACDE"), "Collider blocks") &&
+               TestSuite::assertEqual(reached({{"D", 0}}), std::string("ABCDE"), "Observed descendant opens") &&
+               TestSuite::assertEqual(reached({{"C", 1}}), std::string("ABCE"), "Observed collider opens, chain blocks");
+    });
+
+    suite.runTest("Influence tracing keeps the strongest bounded paths", []() {
+        // Twelve fully connected layers of four nodes: 4^10 paths per end-to-end pair
+        BayesianNetwork network;
+        const int layers = 12;
+        const int width = 4;
+        auto id = [](int layer, int k) { return "L" + std::to_string(layer) + "_" + std::to_string(k); };
+        for (int layer = 0; layer < layers; ++layer) {
+            for (int k = 0; k < width; ++k) {
+                network.addNode(id(layer, k), id(layer, k), {"off", "on"});
+                for (int p = 0; layer > 0 && p < width; ++p) {
+                    network.addEdge(id(layer - 1, p), id(layer, k));
+                }
+            }
+        }
+        for (int layer = 0; layer < layers; ++layer) {
+            for (int k = 0; k < width; ++k) {
+                size_t rows = layer == 0 ? 1 : size_t(1) << width;
+                ConditionalProbabilityTable cpt(layer == 0 ? std::vector<size_t>{2}
+                                                           : std::vector<size_t>{2, 2, 2, 2, 2});
+                double* table = cpt.getRow(0);
+                for (size_t r = 0; r < rows; ++r) {
+                    // On with probability growing with the number of active parents (and k)
+                    double on = (1.0 + static_cast<double>(__builtin_popcountll(r)) + 0.5 * k) / (2.0 + width + 2.0);
+                    table[2 * r] = 1.0 - on;
+                    table[2 * r + 1] = on;
+                }
+                network.setCPT(id(layer, k), cpt);
+            }
+        }
+        std::map<std::string, std::string> evidence = {{id(0, 0), "on"}};
+        std::vector<std::string> query = {id(layers - 1, 2), id(0, 1)};
+        TraceOptions options;
+        options.pathsPerPair = 4;
+        std::vector<BayesianNetwork::InfluenceTrace> traces = network.traceInfluence(query, evidence, options);
+        bool bounded = traces.size() == options.pathsPerPair;  // L0_1 is d-separated from L0_0
+        std::string prefix = id(0, 0) + "->";
+        bool ordered = true;
+        for (size_t i = 0; i < traces.size(); ++i) {
+            ordered = ordered && traces[i].path.compare(0, prefix.size(), prefix) == 0 &&
+                      traces[i].targetNode == id(layers - 1, 2) && traces[i].influenceStrength > 0.0 &&
+                      traces[i].influenceStrength <= 1.0 &&
+                      (i == 0 || traces[i].influenceStrength <= traces[i - 1].influenceStrength);
+        }
+        options.maxExpansions = 5;
+        bool budget = network.traceInfluence(query, evidence, options).empty();
+        auto lazy = network.beliefPropagation(query, evidence);
+        return TestSuite::assertTrue(bounded, "Top-k per pair, d-separated pair skipped") &&
+               TestSuite::assertTrue(ordered, "Strongest paths first") &&
+               TestSuite::assertTrue(budget, "Expansion budget") &&
+               TestSuite::assertTrue(lazy.second.empty(), "Tracing is opt-in");
+    });
+
+    suite.runTest("Reverse traces follow lambda messages", []() {
+        // A -> B -> D, A -> C -> D with evidence on D
+        BayesianNetwork network;
+        for (const char* id : {"A", "B", "C", "D"}) {
+            network.addNode(id, id, {"0", "1"});
+        }
+        network.addEdge("A", "B");
+        network.addEdge("A", "C");
+        network.addEdge("B", "D");
+        network.addEdge("C", "D");
+        ConditionalProbabilityTable prior({2});
+        prior.setProbability({}, 0, 0.5);
+        prior.setProbability({}, 1, 0.5);
+        ConditionalProbabilityTable strong({2, 2});
+        strong.setProbability({0}, 0, 0.95);
+        strong.setProbability({0}, 1, 0.05);
+        strong.setProbability({1}, 0, 0.05);
+        strong.setProbability({1}, 1, 0.95);
+        ConditionalProbabilityTable weak({2, 2});
+        weak.setProbability({0}, 0, 0.6);
+        weak.setProbability({0}, 1, 0.4);
+        weak.setProbability({1}, 0, 0.4);
+        weak.setProbability({1}, 1, 0.6);
+        ConditionalProbabilityTable orGate({2, 2, 2});
+        orGate.setProbability({0, 0}, 0, 0.9);
+        orGate.setProbability({0, 0}, 1, 0.1);
+        orGate.setProbability({0, 1}, 0, 0.5);
+        orGate.setProbability({0, 1}, 1, 0.5);
+        orGate.setProbability({1, 0}, 0, 0.2);
+        orGate.setProbability({1, 0}, 1, 0.8);
+        orGate.setProbability({1, 1}, 0, 0.1);
+        orGate.setProbability({1, 1}, 1, 0.9);
+        network.setCPT("A", prior);
+        network.setCPT("B", strong);
+        network.setCPT("C", weak);
+        network.setCPT("D", orGate);
+        std::map<std::string, std::string> evidence = {{"D", "1"}};
+        auto traces = network.reverseBeliefPropagation({"A"}, evidence, true).second;
+        bool paths = traces.size() == size_t(2) && traces[0].path == "D<-B<-A" && traces[1].path == "D<-C<-A" &&
+                     traces[0].influenceStrength > traces[1].influenceStrength;
+        // The lambda message reaching A says D=1 is likelier under A=1
+        bool message = paths && traces[0].stateInfluences.at("1") > traces[0].stateInfluences.at("0") &&
+                       std::abs(traces[0].stateInfluences.at("0") + traces[0].stateInfluences.at("1") - 1.0) < 1e-12;
+        return TestSuite::assertTrue(paths, "Both paths, strongest first") &&
+               TestSuite::assertTrue(message, "Per-state influence from the message");
+    });
+
     suite.runTest("Network joint probability computation", []() {
         BayesianNetwork network;
         network.addNode("A", "NodeA", {"True", "False"});
@@ -211,6 +1577,1078 @@ void runBayesianNetworkTests(TestSuite& suite) {
         
         return TestSuite::assertEqual(jointProb, expected, 1e-6);
     });
+
+    suite.runTest("Flat joint tables and marginals match the string maps", []() {
+        BayesianNetwork network;
+        network.addNode("Rain", "Rain", {"no", "yes"});
+        network.addNode("Sprinkler", "Sprinkler", {"off", "on"});
+        network.addNode("Wet", "Wet", {"dry", "damp", "soaked"});
+        network.addEdge("Rain", "Wet");
+        network.addEdge("Sprinkler", "Wet");
+        ConditionalProbabilityTable rain({2});
+        rain.setProbability({}, 0, 0.8);
+        rain.setProbability({}, 1, 0.2);
+        ConditionalProbabilityTable sprinkler({2});
+        sprinkler.setProbability({}, 0, 0.6);
+        sprinkler.setProbability({}, 1, 0.4);
+        ConditionalProbabilityTable wet({2, 2, 3});
+        double rows[4][3] = {{0.9, 0.08, 0.02}, {0.2, 0.5, 0.3}, {0.3, 0.4, 0.3}, {0.05, 0.25, 0.7}};
+        for (size_t r = 0; r < 4; ++r) {
+            for (size_t w = 0; w < 3; ++w) {
+                wet.setProbability({r / 2, r % 2}, w, rows[r][w]);
+            }
+        }
+        network.setCPT("Rain", rain);
+        network.setCPT("Sprinkler", sprinkler);
+        network.setCPT("Wet", wet);
+        std::map<std::string, std::string> evidence = {{"Wet", "soaked"}};
+
+        // Query order does not change the table, which follows the compiled order
+        JointTable table = network.computeJointTable({"Sprinkler", "Rain"}, evidence);
+        JointTable reversed = network.computeJointTable({"Rain", "Sprinkler"}, evidence);
+        auto nested = network.variableElimination({"Sprinkler", "Rain"}, evidence);
+        bool entriesMatch = table.size() == nested.size();
+        for (size_t i = 0; i < table.size(); ++i) {
+            entriesMatch = entriesMatch && nested.at(table.assignment(i)) == table.getValues()[i];
+        }
+        Marginals marginals = network.computeMarginals(evidence);
+        auto allMarginals = network.computeAllMarginals(evidence);
+        int wetIndex = marginals.network().indexOf("Wet");
+        bool threw = false;
+        try {
+            table.probability({{"Rain", "yes"}});
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+
+        return TestSuite::assertTrue(table.getVariables() == reversed.getVariables() &&
+                                         std::is_sorted(table.getVariables().begin(), table.getVariables().end()),
+                                     "Canonical order") &&
+               TestSuite::assertTrue(table.getValues() == reversed.getValues(), "Same values either way") &&
+               TestSuite::assertTrue(entriesMatch && table.toMap() == nested, "Adapter matches variableElimination") &&
+               TestSuite::assertEqual(table.probability({{"Rain", "yes"}, {"Sprinkler", "on"}}),
+                                      nested.at({{"Rain", "yes"}, {"Sprinkler", "on"}}), 1e-15) &&
+               TestSuite::assertTrue(threw, "Partial assignment rejected") &&
+               TestSuite::assertTrue(marginals.toMap() == allMarginals, "Adapter matches computeAllMarginals") &&
+               TestSuite::assertEqual(marginals.probability("Rain", "yes"), allMarginals["Rain"]["yes"], 1e-15) &&
+               TestSuite::assertEqual(marginals.probabilities(wetIndex).size(), size_t(3)) &&
+               TestSuite::assertEqual(marginals.probabilities(wetIndex)[2], 1.0, 1e-15, "Observed point mass") &&
+               TestSuite::assertEqual(marginals.getValues().size(), size_t(7));
+    });
+
+    suite.runTest("Assignments enumerate with the last node fastest", []() {
+        BayesianNetwork network;
+        network.addNode("A", "NodeA", {"a0", "a1"});
+        network.addNode("B", "NodeB", {"b0", "b1", "b2"});
+        std::vector<std::map<std::string, std::string>> assignments;
+        network.generateAssignments({"A", "B"}, assignments);
+        std::map<std::string, std::string> second = {{"A", "a0"}, {"B", "b1"}};
+        std::map<std::string, std::string> fourth = {{"A", "a1"}, {"B", "b0"}};
+        std::vector<std::map<std::string, std::string>> none;
+        network.generateAssignments({}, none);
+        return TestSuite::assertEqual(assignments.size(), size_t(6)) &&
+               TestSuite::assertTrue(assignments[1] == second && assignments[3] == fourth, "Row-major order") &&
+               TestSuite::assertEqual(none.size(), size_t(1), "Empty node list has one empty assignment");
+    });
+}
+
+void runResultCacheTests(TestSuite& suite) {
+    suite.runTest("Cached queries hit until the model changes", []() {
+        BayesianNetwork network;
+        network.addNode("A", "NodeA", {"True", "False"});
+        network.addNode("B", "NodeB", {"True", "False"});
+        network.addEdge("A", "B");
+        ConditionalProbabilityTable aCPT({2});
+        aCPT.setProbability({}, 0, 0.3);
+        aCPT.setProbability({}, 1, 0.7);
+        network.setCPT("A", aCPT);
+        ConditionalProbabilityTable bCPT({2, 2});
+        bCPT.setProbability({0}, 0, 0.9);
+        bCPT.setProbability({0}, 1, 0.1);
+        bCPT.setProbability({1}, 0, 0.2);
+        bCPT.setProbability({1}, 1, 0.8);
+        network.setCPT("B", bCPT);
+        
+        std::map<std::string, std::string> evidence = {{"B", "True"}};
+        auto uncached = network.variableElimination({"A"}, evidence);
+        network.setResultCacheCapacity(1 << 16);
+        auto first = network.variableElimination({"A"}, evidence);
+        auto second = network.variableElimination({"A", "A"}, evidence);
+        network.computeAllMarginals(evidence);
+        network.computeAllMarginals(evidence);
+        ResultCache::Stats stats = network.getResultCacheStats();
+        bool hits = first == uncached && second == uncached && stats.hits == 2 && stats.misses == 2 &&
+                    stats.entries == 2 && stats.bytes <= stats.capacity;
+        
+        // A copy keeps the budget but not the entries
+        BayesianNetwork copy = network;
+        bool separate = copy.getResultCacheStats().entries == 0 &&
+                        copy.getResultCacheStats().capacity == stats.capacity;
+        
+        uint64_t version = network.getModelVersion();
+        aCPT.setProbability({}, 0, 0.5);
+        aCPT.setProbability({}, 1, 0.5);
+        network.setCPT("A", aCPT);
+        auto changed = network.variableElimination({"A"}, evidence);
+        stats = network.getResultCacheStats();
+        bool invalidated = network.getModelVersion() > version && changed != uncached &&
+                           stats.hits == 2 && stats.misses == 3 && stats.entries == 1;
+        
+        // A budget smaller than two results keeps only the most recent one
+        network.clearResultCache();
+        network.variableElimination({"A"}, evidence);
+        size_t oneEntry = network.getResultCacheStats().bytes;
+        network.setResultCacheCapacity(oneEntry + oneEntry / 2);
+        network.variableElimination({"A"}, {{"B", "False"}});
+        network.variableElimination({"A"}, evidence);
+        stats = network.getResultCacheStats();
+        bool evicted = stats.evictions == 2 && stats.entries == 1 && stats.hits == 0;
+        
+        return TestSuite::assertTrue(hits, "Hits and canonical keys") &&
+               TestSuite::assertTrue(separate, "Copies do not share entries") &&
+               TestSuite::assertTrue(invalidated, "Version invalidation") &&
+               TestSuite::assertTrue(evicted, "LRU eviction");
+    });
+}
+
+void runParameterLearningTests(TestSuite& suite) {
+    suite.runTest("Counting gives maximum likelihood and smoothed CPTs", []() {
+        BayesianNetwork network;
+        network.addNode("A", "NodeA", {"True", "False"});
+        network.addNode("B", "NodeB", {"Low", "High"});
+        network.addEdge("A", "B");
+        
+        // Columns in any order; unknown columns are ignored
+        std::string csv = "B, Extra, A\n"
+                          "Low, 1, True\n"
+                          "High, 2, True\n"
+                          "Low, 3, True\n"
+                          "\"High\", 4, False\n";
+        std::istringstream data(csv);
+        LearningResult result = network.learnParameters(data);
+        bool mle = result.rows == 4 && result.incompleteRows == 0 && result.iterations == 0 &&
+                   TestSuite::assertEqual(network.getConditionalProbability("A", "True", {}), 0.75) &&
+                   TestSuite::assertEqual(network.getConditionalProbability("B", "Low", {{"A", "True"}}), 2.0 / 3.0) &&
+                   TestSuite::assertEqual(network.getConditionalProbability("B", "High", {{"A", "False"}}), 1.0);
+        
+        // Laplace smoothing, in small chunks on a pool
+        LearningOptions options;
+        options.pseudoCount = 1.0;
+        options.chunkRows = 3;
+        network.setThreadCount(3);
+        std::istringstream again(csv);
+        network.learnParameters(again, options);
+        network.setThreadCount(1);
+        bool smoothed = TestSuite::assertEqual(network.getConditionalProbability("A", "True", {}), 4.0 / 6.0) &&
+                        TestSuite::assertEqual(network.getConditionalProbability("B", "High", {{"A", "False"}}), 2.0 / 3.0);
+        
+        // Unknown states are reported with their position
+        bool positioned = false;
+        try {
+            std::istringstream bad("A,B\nTrue,Low\nTrue,Medium\n");
+            network.learnParameters(bad);
+        } catch (const ParseError& e) {
+            positioned = e.getLine() == 3 && e.getColumn() == 6;
+        }
+        return TestSuite::assertTrue(mle, "Maximum likelihood") &&
+               TestSuite::assertTrue(smoothed, "Dirichlet smoothing") &&
+               TestSuite::assertTrue(positioned, "Parse error position");
+    });
+    
+    suite.runTest("EM recovers CPTs from rows with missing values", []() {
+        // A -> B -> C sampled with a fixed generator; B is hidden in a third of the rows
+        const double pA = 0.3, pB[2] = {0.8, 0.25}, pC[2] = {0.1, 0.7};
+        std::ostringstream csv;
+        csv << "A,B,C\n";
+        uint64_t seed = 12345;
+        auto uniform = [&seed]() {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            return static_cast<double>(seed >> 11) / 9007199254740992.0;
+        };
+        for (int i = 0; i < 20000; ++i) {
+            int a = uniform() < pA ? 0 : 1;
+            int b = uniform() < pB[a] ? 0 : 1;
+            int c = uniform() < pC[b] ? 0 : 1;
+            bool hideB = uniform() < 1.0 / 3.0;
+            bool hideA = uniform() < 0.1;
+            csv << (hideA ? "" : (a == 0 ? "a0" : "a1")) << "," << (hideB ? "?" : (b == 0 ? "b0" : "b1")) << ","
+                << (c == 0 ? "c0" : "c1") << "\n";
+        }
+        auto learn = [&csv](size_t threads) {
+            BayesianNetwork network;
+            network.addNode("A", "A", {"a0", "a1"});
+            network.addNode("B", "B", {"b0", "b1"});
+            network.addNode("C", "C", {"c0", "c1"});
+            network.addEdge("A", "B");
+            network.addEdge("B", "C");
+            network.setThreadCount(threads);
+            LearningOptions options;
+            options.chunkRows = 4096;
+            options.tolerance = 1e-9;
+            options.maxIterations = 200;
+            std::istringstream data(csv.str());
+            LearningResult result = network.learnParameters(data, options);
+            return std::make_pair(network, result);
+        };
+        auto serial = learn(1);
+        auto parallel = learn(4);
+        BayesianNetwork& network = serial.first;
+        bool close = std::abs(network.getConditionalProbability("A", "a0", {}) - pA) < 0.02 &&
+                     std::abs(network.getConditionalProbability("B", "b0", {{"A", "a0"}}) - pB[0]) < 0.03 &&
+                     std::abs(network.getConditionalProbability("B", "b0", {{"A", "a1"}}) - pB[1]) < 0.03 &&
+                     std::abs(network.getConditionalProbability("C", "c0", {{"B", "b0"}}) - pC[0]) < 0.03 &&
+                     std::abs(network.getConditionalProbability("C", "c0", {{"B", "b1"}}) - pC[1]) < 0.03;
+        bool diagnostics = serial.second.converged && serial.second.iterations > 1 &&
+                           serial.second.rows == 20000 && serial.second.incompleteRows > 6000;
+        bool reproducible = network.getConditionalProbability("A", "a0", {}) ==
+                            parallel.first.getConditionalProbability("A", "a0", {});
+        for (const char* parent : {"a0", "a1"}) {
+            reproducible = reproducible && network.getConditionalProbability("B", "b0", {{"A", parent}}) ==
+                                           parallel.first.getConditionalProbability("B", "b0", {{"A", parent}});
+        }
+        for (const char* parent : {"b0", "b1"}) {
+            reproducible = reproducible && network.getConditionalProbability("C", "c0", {{"B", parent}}) ==
+                                           parallel.first.getConditionalProbability("C", "c0", {{"B", parent}});
+        }
+        return TestSuite::assertTrue(close, "Parameters recovered") &&
+               TestSuite::assertTrue(diagnostics, "EM diagnostics") &&
+               TestSuite::assertTrue(reproducible, "Thread count independent");
+    });
+}
+
+void runInstrumentationTests(TestSuite& suite) {
+    suite.runTest("Profiled queries match unprofiled ones", []() {
+        auto build = [](size_t threads) {
+            BayesianNetwork network;
+            network.addNode("A", "NodeA", {"a0", "a1"});
+            network.addNode("B", "NodeB", {"b0", "b1"});
+            network.addNode("C", "NodeC", {"c0", "c1"});
+            network.addEdge("A", "B");
+            network.addEdge("A", "C");
+            ConditionalProbabilityTable cptA({2});
+            cptA.setProbability({}, 0, 0.3);
+            cptA.setProbability({}, 1, 0.7);
+            ConditionalProbabilityTable cptB({2, 2});
+            cptB.setProbability({0}, 0, 0.9);
+            cptB.setProbability({0}, 1, 0.1);
+            cptB.setProbability({1}, 0, 0.2);
+            cptB.setProbability({1}, 1, 0.8);
+            network.setCPT("A", cptA);
+            network.setCPT("B", cptB);
+            network.setCPT("C", cptB);
+            network.setThreadCount(threads);
+            return network;
+        };
+        std::map<std::string, std::string> evidence = {{"B", "b1"}};
+        std::vector<std::string> query = {"C"};
+        BayesianNetwork serial = build(1);
+        BayesianNetwork parallel = build(4);
+        auto profiled = profile([&]() { return serial.beliefPropagation(query, evidence, true); });
+        auto threaded = profile([&]() { return parallel.beliefPropagation(query, evidence, true); });
+        bool same = profiled.first.first == serial.beliefPropagation(query, evidence).first;
+        const InferenceStats& stats = profiled.second;
+        if (!stats.enabled) {
+            // Compiled out: nothing is recorded
+            return TestSuite::assertTrue(same, "Same beliefs") &&
+                   TestSuite::assertTrue(stats.phases.empty() && stats.factorsCreated == 0 &&
+                                         stats.messagesSent == 0 && stats.cptLookups == 0, "Empty stats");
+        }
+        bool phases = true;
+        for (const char* name : {"computeBeliefs", "calibrate", "initializeMessages", "upwardPass",
+                                 "downwardPass", "traceInfluence"}) {
+            phases = phases && stats.phaseMicros(name) > 0.0;
+        }
+        bool counters = stats.factorsCreated > 0 && stats.largestFactor >= 4 && stats.messagesSent > 0 &&
+                        stats.cptLookups > 0 && stats.bytesAllocated > 0;
+        bool threadIndependent = threaded.second.messagesSent == stats.messagesSent &&
+                                 threaded.second.factorsCreated == stats.factorsCreated &&
+                                 threaded.second.cptLookups == stats.cptLookups;
+        return TestSuite::assertTrue(same, "Same beliefs") &&
+               TestSuite::assertTrue(phases, "Every phase timed") &&
+               TestSuite::assertTrue(counters, "Counters recorded") &&
+               TestSuite::assertTrue(threadIndependent, "Pool tasks counted");
+    });
+
+    suite.runTest("Stats export as Chrome trace events", []() {
+        InferenceStats stats;
+        stats.wallMicros = 120.0;
+        PhaseTiming phase;
+        phase.name = "upwardPass";
+        phase.startMicros = 10.0;
+        phase.durationMicros = 40.0;
+        stats.phases.push_back(phase);
+        stats.messagesSent = 7;
+        std::ostringstream trace;
+        stats.writeChromeTrace(trace, "beliefPropagation \"A\"");
+        std::string json = trace.str();
+        return TestSuite::assertTrue(json.find("\"traceEvents\"") != std::string::npos, "Trace events") &&
+               TestSuite::assertTrue(json.find("\"name\": \"upwardPass\", \"cat\": \"phase\", \"ph\": \"X\", "
+                                               "\"ts\": 10, \"dur\": 40") != std::string::npos, "Phase event") &&
+               TestSuite::assertTrue(json.find("beliefPropagation \\\"A\\\"") != std::string::npos, "Escaped name") &&
+               TestSuite::assertTrue(json.find("\"messagesSent\": 7") != std::string::npos, "Counters") &&
+               TestSuite::assertEqual(stats.phaseMicros("upwardPass"), 40.0, 1e-9, "Phase total");
+    });
+}
+
+void runInferenceWorkspaceTests(TestSuite& suite) {
+    suite.runTest("Frames rewind the arena", []() {
+        InferenceWorkspace workspace(1024);
+        void* first = nullptr;
+        void* again = nullptr;
+        {
+            InferenceWorkspace::Frame frame(workspace);
+            ScratchVector<size_t> odometer(8, 0, frame.resource());
+            first = odometer.data();
+            {
+                InferenceWorkspace::Frame inner(workspace);
+                ScratchVector<double> scratch(16, 1.0, inner.resource());
+            }
+        }
+        {
+            InferenceWorkspace::Frame frame(workspace);
+            ScratchVector<size_t> odometer(8, 0, frame.resource());
+            again = odometer.data();
+        }
+        return TestSuite::assertTrue(first == again, "Closed frames free their bytes") &&
+               TestSuite::assertTrue(workspace.peakUsage() >= 8 * sizeof(size_t) + 16 * sizeof(double),
+                                     "Nested frame stacked on its parent") &&
+               TestSuite::assertEqual(workspace.capacity(), size_t(1024));
+    });
+
+    suite.runTest("Reset keeps grown capacity in one block", []() {
+        InferenceWorkspace workspace(256);
+        std::pmr::memory_resource* resource = &workspace;
+        for (int i = 0; i < 4; ++i) {
+            (void)resource->allocate(200, alignof(double));
+        }
+        size_t grown = workspace.capacity();
+        workspace.reset();
+        void* start = resource->allocate(4 * 200, alignof(double));
+        return TestSuite::assertTrue(grown > 256, "Arena grew past its first block") &&
+               TestSuite::assertEqual(workspace.capacity(), grown, "Blocks merged, not dropped") &&
+               TestSuite::assertTrue(start != nullptr) &&
+               TestSuite::assertEqual(workspace.capacity(), grown, "Whole run fits after reset");
+    });
+
+    suite.runTest("Scope routes kernels to a caller workspace", []() {
+        InferenceWorkspace workspace;
+        Factor a({0, 1}, {2, 3}, {0.1, 0.2, 0.3, 0.4, 0.5, 0.6});
+        Factor b({1, 2}, {3, 2}, {0.9, 0.1, 0.2, 0.8, 0.5, 0.5});
+        Factor plain = a.product(b).project({0, 2});
+        bool installed = false;
+        Factor scoped;
+        {
+            InferenceWorkspace::Scope use(workspace);
+            installed = &InferenceWorkspace::current() == &workspace;
+            scoped = a.product(b).project({0, 2});
+        }
+        return TestSuite::assertTrue(installed, "Scope installs the workspace") &&
+               TestSuite::assertTrue(&InferenceWorkspace::current() != &workspace, "Scope restores the thread's own") &&
+               TestSuite::assertTrue(workspace.peakUsage() > 0, "Kernel temporaries came from the workspace") &&
+               TestSuite::assertTrue(scoped.getValues() == plain.getValues(), "Results unchanged");
+    });
+
+    suite.runTest("Log and compensated sums take scratch from the workspace", []() {
+        // Summing out variable 0 leaves rows of inner = 3 entries
+        std::vector<double> probabilities = {0.1, 0.2, 0.3, 0.4, 0.5, 0.6};
+        std::vector<double> logs;
+        for (double p : probabilities) {
+            logs.push_back(std::log(p));
+        }
+        Factor plain = Factor({0, 1}, {2, 3}, probabilities).marginalize(0);
+        InferenceWorkspace logWorkspace;
+        InferenceWorkspace kahanWorkspace;
+        BasicFactor<LogPolicy> logSum;
+        BasicFactor<KahanPolicy> kahanSum;
+        {
+            InferenceWorkspace::Scope use(logWorkspace);
+            logSum = BasicFactor<LogPolicy>({0, 1}, {2, 3}, logs).marginalize(0);
+        }
+        {
+            InferenceWorkspace::Scope use(kahanWorkspace);
+            kahanSum = BasicFactor<KahanPolicy>({0, 1}, {2, 3}, probabilities).marginalize(0);
+        }
+        bool same = kahanSum.getValues() == plain.getValues() && logSum.size() == plain.size();
+        for (size_t i = 0; i < plain.size(); ++i) {
+            same = same && std::fabs(std::exp(logSum.getValues()[i]) - plain.getValues()[i]) < 1e-15;
+        }
+        return TestSuite::assertTrue(logWorkspace.peakUsage() >= 3 * sizeof(double), "Log totals in the workspace") &&
+               TestSuite::assertTrue(kahanWorkspace.peakUsage() >= 3 * sizeof(double),
+                                     "Compensations in the workspace") &&
+               TestSuite::assertTrue(same, "Sums unchanged");
+    });
+
+    suite.runTest("Warm workspace serves repeated queries without growing", []() {
+        BayesianNetwork network;
+        std::vector<std::string> names;
+        for (int i = 0; i < 12; ++i) {
+            names.push_back("X" + std::to_string(i));
+            network.addNode(names.back(), names.back(), {"s0", "s1", "s2"});
+            if (i > 0) {
+                network.addEdge(names[i - 1], names[i]);
+            }
+        }
+        for (int i = 0; i < 12; ++i) {
+            ConditionalProbabilityTable cpt(i == 0 ? std::vector<size_t>{3} : std::vector<size_t>{3, 3});
+            size_t rows = i == 0 ? 1 : 3;
+            for (size_t r = 0; r < rows; ++r) {
+                std::vector<size_t> parents = i == 0 ? std::vector<size_t>{} : std::vector<size_t>{r};
+                cpt.setProbability(parents, 0, 0.5);
+                cpt.setProbability(parents, 1, 0.3 - 0.1 * r);
+                cpt.setProbability(parents, 2, 0.2 + 0.1 * r);
+            }
+            network.setCPT(names[i], cpt);
+        }
+        std::map<std::string, std::string> evidence = {{"X11", "s2"}};
+        auto expected = network.variableElimination({"X0"}, evidence);
+        InferenceWorkspace workspace;
+        InferenceWorkspace::Scope use(workspace);
+        auto first = network.variableElimination({"X0"}, evidence);
+        size_t warmed = workspace.capacity();
+        bool stable = true;
+        for (int i = 0; i < 5; ++i) {
+            workspace.reset();
+            stable = stable && network.variableElimination({"X0"}, evidence) == expected &&
+                     workspace.capacity() == warmed;
+        }
+        return TestSuite::assertTrue(first == expected, "Same marginals") &&
+               TestSuite::assertTrue(warmed > 0, "Workspace used") &&
+               TestSuite::assertTrue(stable, "Capacity stable across queries");
+    });
+}
+
+void runModelSnapshotTests(TestSuite& suite) {
+    // Chain A -> B -> C with P(A=True) given
+    auto build = [](double prior) {
+        BayesianNetwork network;
+        network.addNode("A", "NodeA", {"True", "False"});
+        network.addNode("B", "NodeB", {"True", "False"});
+        network.addNode("C", "NodeC", {"True", "False"});
+        network.addEdge("A", "B");
+        network.addEdge("B", "C");
+        ConditionalProbabilityTable aCPT({2});
+        aCPT.setProbability({}, 0, prior);
+        aCPT.setProbability({}, 1, 1.0 - prior);
+        ConditionalProbabilityTable bCPT({2, 2});
+        bCPT.setProbability({0}, 0, 0.9);
+        bCPT.setProbability({0}, 1, 0.1);
+        bCPT.setProbability({1}, 0, 0.2);
+        bCPT.setProbability({1}, 1, 0.8);
+        network.setCPT("A", aCPT);
+        network.setCPT("B", bCPT);
+        network.setCPT("C", bCPT);
+        return network;
+    };
+    auto prior = [](double p) {
+        ConditionalProbabilityTable cpt({2});
+        cpt.setProbability({}, 0, p);
+        cpt.setProbability({}, 1, 1.0 - p);
+        return cpt;
+    };
+
+    suite.runTest("CPT updates derive snapshots that share storage", [&]() {
+        BayesianNetwork network = build(0.3);
+        std::map<std::string, std::string> evidence = {{"C", "True"}};
+        std::shared_ptr<const ModelSnapshot> before = network.snapshot();
+        auto oldMarginals = network.computeAllMarginals(evidence);
+        network.setCPT("A", prior(0.6));
+        std::shared_ptr<const ModelSnapshot> after = network.snapshot();
+        const CompiledNetwork& oldNet = *before->network;
+        const CompiledNetwork& newNet = *after->network;
+        int a = newNet.indexOf("A");
+        int b = newNet.indexOf("B");
+
+        // The rebased junction tree matches a tree built from scratch
+        BayesianNetwork fresh = build(0.6);
+        return TestSuite::assertTrue(after->version > before->version &&
+                                         after->version == network.getModelVersion(), "New version") &&
+               TestSuite::assertTrue(newNet.cpt(b) == oldNet.cpt(b), "Unchanged CPT block shared") &&
+               TestSuite::assertTrue(newNet.cpt(a) != oldNet.cpt(a), "Changed CPT copied") &&
+               TestSuite::assertEqual(oldNet.cpt(a)[0], 0.3, 1e-15, "Old snapshot unchanged") &&
+               TestSuite::assertEqual(newNet.cpt(a)[0], 0.6, 1e-15) &&
+               TestSuite::assertTrue(network.computeAllMarginals(evidence) == fresh.computeAllMarginals(evidence),
+                                     "Rebased tree is exact") &&
+               TestSuite::assertTrue(oldMarginals != fresh.computeAllMarginals(evidence));
+    });
+
+    suite.runTest("Many updates compact the shared storage", [&]() {
+        BayesianNetwork network = build(0.3);
+        network.compile();
+        for (int i = 0; i < 100; ++i) {
+            network.setCPT("A", prior(0.01 * i));
+        }
+        BayesianNetwork fresh = build(0.99);
+        std::map<std::string, std::string> evidence = {{"B", "False"}};
+        return TestSuite::assertTrue(network.compile()->storageBlocks() <= 32, "Bounded block count") &&
+               TestSuite::assertTrue(network.variableElimination({"A"}, evidence) ==
+                                     fresh.variableElimination({"A"}, evidence));
+    });
+
+    suite.runTest("Queries finish on the snapshot they started on", [&]() {
+        BayesianNetwork network = build(0.3);
+        network.setThreadCount(2);
+        network.setResultCacheCapacity(1 << 16);
+        std::map<std::string, std::string> evidence = {{"C", "True"}};
+        std::vector<std::string> query = {"A"};
+        auto low = build(0.3).variableElimination(query, evidence);
+        auto high = build(0.6).variableElimination(query, evidence);
+        auto lowBeliefs = build(0.3).computeAllMarginals(evidence);
+        auto highBeliefs = build(0.6).computeAllMarginals(evidence);
+
+        std::atomic<bool> consistent{true};
+        std::atomic<bool> done{false};
+        std::atomic<int> reads{0};
+        auto reader = [&]() {
+            while (!done.load()) {
+                auto joint = network.variableElimination(query, evidence);
+                auto beliefs = network.computeAllMarginals(evidence);
+                if ((joint != low && joint != high) || (beliefs != lowBeliefs && beliefs != highBeliefs)) {
+                    consistent = false;
+                }
+                ++reads;
+            }
+        };
+        std::thread first(reader);
+        std::thread second(reader);
+        // Keep publishing until the readers have overlapped plenty of updates
+        for (int i = 0; i < 200 || (reads.load() < 200 && i < 200000); ++i) {
+            network.setCPT("A", prior(i % 2 == 0 ? 0.6 : 0.3));
+        }
+        network.setCPT("A", prior(0.3));
+        done = true;
+        first.join();
+        second.join();
+        return TestSuite::assertTrue(consistent.load(), "Every result belongs to one version") &&
+               TestSuite::assertTrue(network.variableElimination(query, evidence) == low, "Latest version wins");
+    });
+
+    suite.runTest("Result cache ignores stale versions", []() {
+        ResultCache cache;
+        cache.setCapacity(1 << 16);
+        ResultCache::Key key;
+        key.query = {0};
+        ResultCache::Key other;
+        other.query = {1};
+        cache.insert(5, key, std::make_shared<const double>(0.5), sizeof(double));
+        bool staleMiss = cache.find<double>(4, key) == nullptr;
+        cache.insert(4, other, std::make_shared<const double>(0.25), sizeof(double));
+        std::shared_ptr<const double> hit = cache.find<double>(5, key);
+        bool kept = hit && *hit == 0.5 && cache.find<double>(5, other) == nullptr;
+        cache.find<double>(6, key);
+        return TestSuite::assertTrue(staleMiss, "Older version misses") &&
+               TestSuite::assertTrue(kept, "Newer entries survive, stale stores are dropped") &&
+               TestSuite::assertEqual(cache.getStats().entries, size_t(0), "Newer version drops entries");
+    });
+}
+
+void runSmallKernelTests(TestSuite& suite) {
+    suite.runTest("Fixed-cardinality kernels match the generic loops bit for bit", []() {
+        CounterRNG rng(7);
+        uint64_t draws = 0;
+        bool same = true;
+        for (size_t card = 2; card <= kernels::kMaxFixedCardinality; ++card) {
+            size_t rows = 3 * card * 5;
+            std::vector<double> table(rows * card), lambda(card), weights(rows);
+            for (double& x : table) x = rng.uniform(0, draws++);
+            for (double& x : lambda) x = rng.uniform(0, draws++);
+            for (double& x : weights) x = rng.uniform(0, draws++);
+            std::vector<double> fixed(rows), generic(rows);
+            kernels::withCardinality(card, [&](auto c) {
+                constexpr size_t Card = decltype(c)::value;
+                kernels::rowLikelihoods<Card>(table.data(), lambda.data(), rows, card, fixed.data());
+                kernels::rowLikelihoods<0>(table.data(), lambda.data(), rows, card, generic.data());
+                same = same && fixed == generic;
+                kernels::causalSupport<Card>(table.data(), weights.data(), rows, card, fixed.data());
+                kernels::causalSupport<0>(table.data(), weights.data(), rows, card, generic.data());
+                same = same && std::equal(fixed.begin(), fixed.begin() + card, generic.begin());
+                kernels::accumulateParent<Card>(weights.data(), table.data(), rows, card, 5, fixed.data());
+                kernels::accumulateParent<0>(weights.data(), table.data(), rows, card, 5, generic.data());
+                same = same && std::equal(fixed.begin(), fixed.begin() + card, generic.begin());
+                std::fill(fixed.begin(), fixed.end(), 0.0);
+                std::fill(generic.begin(), generic.end(), 0.0);
+                kernels::sumSlices<Card>(table.data(), card, rows, fixed.data());
+                kernels::sumSlices<0>(table.data(), card, rows, generic.data());
+                same = same && fixed == generic;
+                kernels::maxSlices<Card>(table.data(), card, rows, fixed.data());
+                kernels::maxSlices<0>(table.data(), card, rows, generic.data());
+                same = same && fixed == generic;
+            });
+        }
+        return TestSuite::assertTrue(same);
+    });
+
+    suite.runTest("Nested row weights match the parent odometer", []() {
+        CounterRNG rng(11);
+        uint64_t draws = 0;
+        std::vector<size_t> cards = {2, 3, 2, 4};
+        std::vector<std::vector<double>> messages(cards.size());
+        const double* pi[kernels::kMaxFixedParents];
+        for (size_t k = 0; k < cards.size(); ++k) {
+            for (size_t u = 0; u < cards[k]; ++u) messages[k].push_back(rng.uniform(0, draws++));
+            pi[k] = messages[k].data();
+        }
+        bool same = true;
+        for (size_t n = 1; n <= cards.size(); ++n) {
+            size_t rows = 1;
+            for (size_t k = 0; k < n; ++k) rows *= cards[k];
+            for (int skip = -1; skip < static_cast<int>(n); ++skip) {
+                std::vector<double> fixed(rows), expected(rows);
+                kernels::withParentCount(n, [&](auto c) {
+                    if constexpr (decltype(c)::value != 0) {
+                        kernels::rowWeights<decltype(c)::value>(pi, cards.data(), skip, fixed.data());
+                    }
+                });
+                std::vector<size_t> states(n, 0);
+                for (size_t r = 0; r < rows; ++r) {
+                    expected[r] = 1.0;
+                    for (size_t k = 0; k < n; ++k) {
+                        if (static_cast<int>(k) != skip) expected[r] *= pi[k][states[k]];
+                    }
+                    for (int k = static_cast<int>(n) - 1; k >= 0 && ++states[k] == cards[k]; --k) states[k] = 0;
+                }
+                same = same && fixed == expected;
+            }
+        }
+        return TestSuite::assertTrue(same);
+    });
+
+    suite.runTest("Unrolled products match entrywise across parallel chunks", []() {
+        // 3^10 entries: pool chunks start inside runs of the last variable
+        std::vector<int> varsA = {0, 1, 2, 3, 4, 5, 6, 7, 8};
+        std::vector<size_t> cardsA(9, 3);
+        Factor a(varsA, cardsA);
+        Factor b({8, 9}, {3, 3});
+        CounterRNG rng(5);
+        uint64_t draws = 0;
+        for (size_t i = 0; i < a.size(); ++i) a.getValues()[i] = rng.uniform(0, draws++);
+        for (size_t i = 0; i < b.size(); ++i) b.getValues()[i] = rng.uniform(0, draws++);
+        ThreadPool pool(3);
+        Factor serial = a.product(b);
+        Factor parallel = a.product(b, &pool);
+        bool same = serial.getValues() == parallel.getValues();
+        std::vector<size_t> states(10, 0);
+        for (size_t i = 0; i < serial.size() && same; ++i) {
+            std::vector<size_t> statesA(states.begin(), states.begin() + 9);
+            same = serial.getValues()[i] == a.getValue(statesA) * b.getValue({states[8], states[9]});
+            for (int k = 9; k >= 0 && ++states[k] == 3; --k) states[k] = 0;
+        }
+        // Binary and quaternary last variables, with a scalar operand
+        Factor c({0, 1}, {4, 2}, {0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8});
+        Factor d({1, 2}, {2, 4}, {1, 2, 3, 4, 5, 6, 7, 8});
+        Factor cd = c.product(d);
+        Factor unit;
+        return TestSuite::assertTrue(same, "Every entry is the product of its operand entries") &&
+               TestSuite::assertEqual(cd.getValue({3, 1, 2}), 0.8 * 7.0, 1e-15) &&
+               TestSuite::assertEqual(cd.getValue({2, 0, 3}), 0.5 * 4.0, 1e-15) &&
+               TestSuite::assertTrue(c.product(unit).getValues() == c.getValues(), "Scalar product is the identity");
+    });
+}
+
+void runAsyncQueryTests(TestSuite& suite) {
+    // Binary chain X0 -> X1 -> ... -> X(n-1)
+    auto chain = [](size_t n, double prior) {
+        BayesianNetwork network;
+        network.beginBatch();
+        for (size_t i = 0; i < n; ++i) {
+            network.addNode("X" + std::to_string(i), "X" + std::to_string(i), {"T", "F"});
+            if (i > 0) {
+                network.addEdge("X" + std::to_string(i - 1), "X" + std::to_string(i));
+            }
+        }
+        network.commit();
+        ConditionalProbabilityTable root({2});
+        root.setProbability({}, 0, prior);
+        root.setProbability({}, 1, 1.0 - prior);
+        ConditionalProbabilityTable link({2, 2});
+        link.setProbability({0}, 0, 0.9);
+        link.setProbability({0}, 1, 0.1);
+        link.setProbability({1}, 0, 0.2);
+        link.setProbability({1}, 1, 0.8);
+        network.setCPT("X0", root);
+        for (size_t i = 1; i < n; ++i) {
+            network.setCPT("X" + std::to_string(i), link);
+        }
+        return network;
+    };
+    std::map<std::string, std::string> evidence = {{"X39", "T"}};
+
+    suite.runTest("Async queries match the blocking calls", [&]() {
+        BayesianNetwork network = chain(40, 0.3);
+        std::future<JointTable> joint = network.computeJointTableAsync({"X0"}, evidence);
+        std::future<Marginals> marginals = network.computeMarginalsAsync(evidence);
+        std::promise<double> called;
+        network.computeJointTableAsync({"X0"}, evidence, QueryControl(), [&](std::future<JointTable> result) {
+            called.set_value(result.get().getValues()[0]);
+        });
+        JointTable expected = network.computeJointTable({"X0"}, evidence);
+        return TestSuite::assertTrue(joint.get().getValues() == expected.getValues(), "Future result") &&
+               TestSuite::assertTrue(marginals.get().toMap() == network.computeAllMarginals(evidence),
+                                     "Marginals result") &&
+               TestSuite::assertEqual(called.get_future().get(), expected.getValues()[0], 1e-15,
+                                      "Completion gets the ready future");
+    });
+
+    suite.runTest("Cancellation and deadlines stop elimination partway", [&]() {
+        BayesianNetwork network = chain(40, 0.3);
+        std::vector<double> reported;
+        QueryControl control;
+        control.progress = [&](double fraction) {
+            reported.push_back(fraction);
+            if (fraction >= 0.5) {
+                control.token.cancel();
+            }
+        };
+        bool stopped = false;
+        try {
+            QueryControl::Scope scope(control);
+            network.computeJointTable({"X0"}, evidence);
+        } catch (const QueryCancelled& e) {
+            stopped = !e.deadlineExceeded();
+        }
+        bool partway = !reported.empty() && reported.back() >= 0.5 && reported.back() < 1.0 &&
+                       std::is_sorted(reported.begin(), reported.end());
+
+        QueryControl expired;
+        expired.token.setTimeout(-1.0);
+        bool timedOut = false;
+        try {
+            network.computeMarginalsAsync(evidence, expired).get();
+        } catch (const QueryCancelled& e) {
+            timedOut = e.deadlineExceeded();
+        }
+        QueryControl cancelled;
+        cancelled.token.cancel();
+        bool loopyStopped = false;
+        try {
+            network.submitQuery([&]() { return network.loopyBeliefPropagation(evidence); }, cancelled).get();
+        } catch (const QueryCancelled&) {
+            loopyStopped = true;
+        }
+        // Nothing of the stopped query was kept; the next one completes
+        JointTable after = network.computeJointTable({"X0"}, evidence);
+        return TestSuite::assertTrue(stopped, "Cancelled from the progress callback") &&
+               TestSuite::assertTrue(partway, "Progress rises and stops at the cancelling step") &&
+               TestSuite::assertTrue(timedOut, "Expired deadline") &&
+               TestSuite::assertTrue(loopyStopped, "Loopy belief propagation stops too") &&
+               TestSuite::assertEqual(after.getValues()[0] + after.getValues()[1], 1.0, 1e-12);
+    });
+
+    suite.runTest("Async queries answer the model as of submission", [&]() {
+        BayesianNetwork network = chain(3, 0.3);
+        std::map<std::string, std::string> none;
+        // Hold the only worker until both queries are queued and the CPT changed
+        std::promise<void> release;
+        std::shared_future<void> gate = release.get_future().share();
+        std::future<void> held = network.submitQuery([gate]() { gate.wait(); });
+        std::future<JointTable> before = network.computeJointTableAsync({"X0"}, none);
+        ConditionalProbabilityTable root({2});
+        root.setProbability({}, 0, 0.8);
+        root.setProbability({}, 1, 0.2);
+        network.setCPT("X0", root);
+        std::future<JointTable> after = network.computeJointTableAsync({"X0"}, none);
+        release.set_value();
+        held.get();
+        return TestSuite::assertEqual(before.get().getValues()[0], 0.3, 1e-12, "Submitted before the update") &&
+               TestSuite::assertEqual(after.get().getValues()[0], 0.8, 1e-12, "Submitted after the update");
+    });
+
+    suite.runTest("Destroying the network stops running and queued queries", [&]() {
+        auto network = std::make_unique<BayesianNetwork>(chain(3, 0.3));
+        std::promise<void> started;
+        std::future<bool> running = network->submitQuery([&started]() {
+            started.set_value();
+            while (true) {
+                QueryControl::checkpoint(0, 1);
+                std::this_thread::yield();
+            }
+            return true;
+        });
+        std::future<JointTable> queued = network->computeJointTableAsync({"X0"}, {});
+        started.get_future().wait();
+        network.reset();
+        auto cancelled = [](auto& future) {
+            try {
+                future.get();
+            } catch (const QueryCancelled&) {
+                return true;
+            }
+            return false;
+        };
+        return TestSuite::assertTrue(cancelled(running), "Running query cancelled") &&
+               TestSuite::assertTrue(cancelled(queued), "Queued query failed");
+    });
+}
+
+void runRelevanceTests(TestSuite& suite) {
+    // A -> B -> C, A -> D, B -> K <- E, E -> F
+    auto network = []() {
+        BayesianNetwork net;
+        net.beginBatch();
+        for (std::string id : {"A", "B", "C", "D", "E", "F", "K"}) {
+            net.addNode(id, id, {"T", "F"});
+        }
+        net.addEdge("A", "B");
+        net.addEdge("B", "C");
+        net.addEdge("A", "D");
+        net.addEdge("B", "K");
+        net.addEdge("E", "K");
+        net.addEdge("E", "F");
+        net.commit();
+        ConditionalProbabilityTable root({2});
+        root.setProbability({}, 0, 0.3);
+        root.setProbability({}, 1, 0.7);
+        net.setCPT("A", root);
+        net.setCPT("E", root);
+        std::vector<std::string> links = {"B", "C", "D", "F"};
+        for (size_t n = 0; n < links.size(); ++n) {
+            ConditionalProbabilityTable cpt({2, 2});
+            for (size_t u = 0; u < 2; ++u) {
+                double p = u == 0 ? 0.9 - 0.1 * n : 0.2 + 0.1 * n;
+                cpt.setProbability({u}, 0, p);
+                cpt.setProbability({u}, 1, 1.0 - p);
+            }
+            net.setCPT(links[n], cpt);
+        }
+        ConditionalProbabilityTable collider({2, 2, 2});
+        double noisyOr[4] = {0.99, 0.8, 0.7, 0.05};
+        for (size_t i = 0; i < 4; ++i) {
+            collider.setProbability({i / 2, i % 2}, 0, noisyOr[i]);
+            collider.setProbability({i / 2, i % 2}, 1, 1.0 - noisyOr[i]);
+        }
+        net.setCPT("K", collider);
+        return net;
+    };
+    auto idsOf = [](const BayesianNetwork& net, const std::vector<int>& vars) {
+        std::set<std::string> ids;
+        for (int v : vars) {
+            ids.insert(net.compile()->nodeId(v));
+        }
+        return ids;
+    };
+
+    suite.runTest("Bayes-ball drops barren, screened-off and d-separated nodes", [&]() {
+        BayesianNetwork net = network();
+        std::shared_ptr<const CompiledNetwork> compiled = net.compile();
+        std::vector<int> evidence(compiled->numNodes(), -1);
+        evidence[compiled->requireIndex("A")] = 0;
+        std::vector<int> query = {compiled->requireIndex("B")};
+        RelevantSubnetwork requisite = RelevantSubnetwork::fromBayesBall(compiled, query, evidence);
+        RelevantSubnetwork ancestral = RelevantSubnetwork::fromAncestors(compiled, query, evidence);
+        return TestSuite::assertTrue(idsOf(net, requisite.nodes()) == std::set<std::string>{"B"},
+                                     "Only B's CPT is requisite") &&
+               TestSuite::assertTrue(idsOf(net, requisite.requisiteEvidence()) == std::set<std::string>{"A"},
+                                     "A's observation is requisite") &&
+               TestSuite::assertTrue(idsOf(net, ancestral.nodes()) == std::set<std::string>{"A", "B"},
+                                     "Ancestral view keeps A") &&
+               TestSuite::assertTrue(net.getEliminationOrder({"B"}, {{"A", "T"}}).empty(),
+                                     "Nothing left to eliminate");
+    });
+
+    suite.runTest("Bayes-ball keeps explaining-away paths through observed colliders", [&]() {
+        BayesianNetwork net = network();
+        std::shared_ptr<const CompiledNetwork> compiled = net.compile();
+        std::vector<int> evidence(compiled->numNodes(), -1);
+        evidence[compiled->requireIndex("A")] = 0;
+        evidence[compiled->requireIndex("K")] = 1;
+        RelevantSubnetwork view =
+            RelevantSubnetwork::fromBayesBall(compiled, {compiled->requireIndex("B")}, evidence);
+        return TestSuite::assertTrue(idsOf(net, view.nodes()) == std::set<std::string>{"B", "E", "K"},
+                                     "Collider and co-parent kept") &&
+               TestSuite::assertTrue(!view.contains(compiled->requireIndex("F")), "Co-parent's child dropped") &&
+               TestSuite::assertTrue(view.network() == compiled, "View shares the snapshot");
+    });
+
+    suite.runTest("Reduced queries match junction tree marginals", [&]() {
+        BayesianNetwork net = network();
+        std::vector<std::map<std::string, std::string>> cases = {
+            {}, {{"A", "T"}}, {{"K", "F"}}, {{"A", "F"}, {"K", "T"}}, {{"C", "T"}, {"F", "F"}}};
+        bool ok = true;
+        for (const auto& evidence : cases) {
+            std::map<std::string, std::map<std::string, double>> marginals = net.computeAllMarginals(evidence);
+            for (const auto& node : marginals) {
+                JointTable joint = net.computeJointTable({node.first}, evidence);
+                ok = ok && TestSuite::assertEqual(joint.getValues()[0], node.second.at("T"), 1e-12,
+                                                  "P(" + node.first + " = T | e)");
+            }
+            ok = ok && TestSuite::assertEqual(net.computeEvidenceProbability<DoublePolicy>(evidence),
+                                              net.computeEvidenceProbability(evidence), 1e-12, "P(e)");
+        }
+        return ok;
+    });
+}
+
+void runBatchScoringTests(TestSuite& suite) {
+    // A -> C <- B, C -> D, all binary
+    auto network = []() {
+        BayesianNetwork net;
+        net.beginBatch();
+        for (std::string id : {"A", "B", "C", "D"}) {
+            net.addNode(id, id, {"T", "F"});
+        }
+        net.addEdge("A", "C");
+        net.addEdge("B", "C");
+        net.addEdge("C", "D");
+        net.commit();
+        ConditionalProbabilityTable a({2});
+        a.setProbability({}, 0, 0.3);
+        a.setProbability({}, 1, 0.7);
+        ConditionalProbabilityTable b({2});
+        b.setProbability({}, 0, 0.6);
+        b.setProbability({}, 1, 0.4);
+        ConditionalProbabilityTable c({2, 2, 2});
+        double p[4] = {0.95, 0.7, 0.4, 0.05};
+        for (size_t i = 0; i < 4; ++i) {
+            c.setProbability({i / 2, i % 2}, 0, p[i]);
+            c.setProbability({i / 2, i % 2}, 1, 1.0 - p[i]);
+        }
+        ConditionalProbabilityTable d({2, 2});
+        d.setProbability({0}, 0, 0.8);
+        d.setProbability({0}, 1, 0.2);
+        d.setProbability({1}, 0, 0.1);
+        d.setProbability({1}, 1, 0.9);
+        net.setCPT("A", a);
+        net.setCPT("B", b);
+        net.setCPT("C", c);
+        net.setCPT("D", d);
+        return net;
+    };
+    const char* states[3] = {"T", "F", "?"};
+    std::string cases = "D,A,Other\n";
+    std::vector<std::map<std::string, std::string>> evidence;
+    for (size_t i = 0; i < 23; ++i) {
+        const char* d = states[i % 3];
+        const char* a = states[(i / 3) % 3];
+        cases += std::string(d) + "," + a + ",x\n";
+        evidence.emplace_back();
+        if (i % 3 != 2) {
+            evidence.back()["D"] = d;
+        }
+        if ((i / 3) % 3 != 2) {
+            evidence.back()["A"] = a;
+        }
+    }
+    // Decode binary scores into case index -> probabilities
+    auto decode = [](const std::string& bytes, size_t& numColumns) {
+        std::map<uint64_t, std::vector<double>> rows;
+        uint32_t columns = 0;
+        std::memcpy(&columns, bytes.data() + 12, sizeof(columns));
+        numColumns = columns;
+        size_t offset = 16;
+        for (uint32_t c = 0; c < columns; ++c) {
+            uint32_t length = 0;
+            std::memcpy(&length, bytes.data() + offset, sizeof(length));
+            offset += sizeof(length) + length;
+        }
+        while (offset < bytes.size()) {
+            uint64_t caseId = 0;
+            std::memcpy(&caseId, bytes.data() + offset, sizeof(caseId));
+            std::vector<double> values(columns);
+            std::memcpy(values.data(), bytes.data() + offset + sizeof(caseId), columns * sizeof(double));
+            rows[caseId] = values;
+            offset += sizeof(caseId) + columns * sizeof(double);
+        }
+        return rows;
+    };
+
+    suite.runTest("Scores match computeMarginals case by case", [&]() {
+        BayesianNetwork net = network();
+        ScoringOptions options;
+        options.chunkRows = 4;
+        options.outputNodes = {"C", "B"};
+        options.format = ScoreFormat::Binary;
+        BatchScorer scorer(net.compile(), options);
+        std::istringstream input(cases);
+        std::ostringstream output;
+        ScoringResult result = scorer.run(input, output);
+        size_t numColumns = 0;
+        std::map<uint64_t, std::vector<double>> rows = decode(output.str(), numColumns);
+        bool ok = TestSuite::assertTrue(result.casesRead == 23 && result.casesScored == 23 && result.chunks == 6,
+                                        "Counts") &&
+                  TestSuite::assertTrue(numColumns == 4 && scorer.columns()[0] == "C=T" &&
+                                            scorer.columns()[3] == "B=F",
+                                        "Columns") &&
+                  TestSuite::assertTrue(rows.size() == 23, "One record per case");
+        for (size_t i = 0; ok && i < evidence.size(); ++i) {
+            Marginals marginals = net.computeMarginals(evidence[i]);
+            ok = TestSuite::assertEqual(rows[i][0], marginals.probability("C", "T"), 1e-15, "P(C = T)") &&
+                 TestSuite::assertEqual(rows[i][3], marginals.probability("B", "F"), 1e-15, "P(B = F)");
+        }
+        return ok;
+    });
+
+    suite.runTest("Worker processes and shards reproduce in-process scores", [&]() {
+        BayesianNetwork net = network();
+        std::string path = "/tmp/lbn_unit_scoring.lbn";
+        net.saveToFile(path, BayesianNetwork::FileFormat::Binary);
+        ScoringOptions options;
+        options.chunkRows = 3;
+        std::istringstream serialInput(cases);
+        std::ostringstream serialOutput;
+        BatchScorer(path, options).run(serialInput, serialOutput);
+
+        options.workers = 3;
+        std::istringstream parallelInput(cases);
+        std::ostringstream parallelOutput;
+        BatchScorer(path, options).run(parallelInput, parallelOutput);
+
+        // Two shards on two workers each: every case once, in case order
+        options.workers = 2;
+        options.shardCount = 2;
+        std::string merged;
+        std::vector<size_t> scored;
+        for (size_t shard = 0; shard < 2; ++shard) {
+            options.shardIndex = shard;
+            std::istringstream input(cases);
+            std::ostringstream output;
+            scored.push_back(BatchScorer(path, options).run(input, output).casesScored);
+            merged += output.str();
+        }
+        std::remove(path.c_str());
+        std::vector<std::string> serialLines;
+        std::istringstream serialStream(serialOutput.str());
+        for (std::string line; std::getline(serialStream, line);) {
+            serialLines.push_back(line);
+        }
+        std::vector<std::string> shardLines;
+        std::istringstream mergedStream(merged);
+        for (std::string line; std::getline(mergedStream, line);) {
+            if (line.compare(0, 5, "case,") != 0) {
+                shardLines.push_back(line);
+            }
+        }
+        std::sort(shardLines.begin(), shardLines.end(), [](const std::string& a, const std::string& b) {
+            return std::stoul(a) < std::stoul(b);
+        });
+        shardLines.insert(shardLines.begin(), serialLines[0]);
+        return TestSuite::assertTrue(parallelOutput.str() == serialOutput.str(), "Workers match in-process") &&
+               TestSuite::assertTrue(scored[0] == 12 && scored[1] == 11, "Cases split by index") &&
+               TestSuite::assertTrue(shardLines == serialLines, "Shards merge to the full output");
+    });
+
+    suite.runTest("Bad cases fail the run without hanging the workers", [&]() {
+        BayesianNetwork net = network();
+        ScoringOptions options;
+        options.workers = 2;
+        options.chunkRows = 2;
+        std::istringstream input(cases + "Maybe,T,x\n" + cases);
+        std::ostringstream output;
+        bool parseError = false;
+        try {
+            BatchScorer(net.compile(), options).run(input, output);
+        } catch (const ParseError& e) {
+            parseError = e.getLine() == 25;
+        }
+        bool badShard = false;
+        try {
+            options.shardIndex = 2;
+            options.shardCount = 2;
+            BatchScorer(net.compile(), options);
+        } catch (const std::runtime_error&) {
+            badShard = true;
+        }
+        return TestSuite::assertTrue(parseError, "Parse error reported with its line") &&
+               TestSuite::assertTrue(badShard, "Shard index checked");
+    });
 }
 
 int main() {
@@ -224,9 +2662,66 @@ int main() {
     std::cout << "\nCPT Tests:" << std::endl;
     runCPTTests(suite);
     
+    std::cout << "\nCPT Model Tests:" << std::endl;
+    runCPTModelTests(suite);
+    
+    std::cout << "\nFactor Tests:" << std::endl;
+    runFactorTests(suite);
+    
+    std::cout << "\nNumeric Policy Tests:" << std::endl;
+    runNumericPolicyTests(suite);
+    
+    std::cout << "\nMessage Store Tests:" << std::endl;
+    runMessageStoreTests(suite);
+    
+    std::cout << "\nSampling Tests:" << std::endl;
+    runSamplingTests(suite);
+    
+    std::cout << "\nElimination Order Tests:" << std::endl;
+    runEliminationOrderTests(suite);
+    
+    std::cout << "\nThread Pool Tests:" << std::endl;
+    runThreadPoolTests(suite);
+    
+    std::cout << "\nJunction Tree Tests:" << std::endl;
+    runJunctionTreeTests(suite);
+    
+    std::cout << "\nModel File Tests:" << std::endl;
+    runModelFileTests(suite);
+    
+    std::cout << "\nModel Text Tests:" << std::endl;
+    runModelTextTests(suite);
+    
     std::cout << "\nBayesianNetwork Tests:" << std::endl;
     runBayesianNetworkTests(suite);
     
+    std::cout << "\nResult Cache Tests:" << std::endl;
+    runResultCacheTests(suite);
+    
+    std::cout << "\nParameter Learning Tests:" << std::endl;
+    runParameterLearningTests(suite);
+    
+    std::cout << "\nInstrumentation Tests:" << std::endl;
+    runInstrumentationTests(suite);
+    
+    std::cout << "\nInference Workspace Tests:" << std::endl;
+    runInferenceWorkspaceTests(suite);
+    
+    std::cout << "\nModel Snapshot Tests:" << std::endl;
+    runModelSnapshotTests(suite);
+    
+    std::cout << "\nSmall Kernel Tests:" << std::endl;
+    runSmallKernelTests(suite);
+    
+    std::cout << "\nAsync Query Tests:" << std::endl;
+    runAsyncQueryTests(suite);
+    
+    std::cout << "\nRelevance Tests:" << std::endl;
+    runRelevanceTests(suite);
+    
+    std::cout << "\nBatch Scoring Tests:" << std::endl;
+    runBatchScoringTests(suite);
+    
     suite.printSummary();
     
     return suite.allPassed() ? 0 : 1;
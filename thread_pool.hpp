@@ -0,0 +1,268 @@
+/*
+ * thread_pool.hpp - Work-stealing thread pool for parallel inference
+ * Copyright (C) 2025, Shyamal Chandra
+ *
+ * This file implements a fixed-size thread pool in which every worker owns
+ * a task deque: a worker pops its own newest task first and steals the
+ * oldest task of another worker when it runs dry. Threads waiting on a
+ * parallelFor help execute queued tasks, so nested parallel loops cannot
+ * deadlock the pool.
+ */
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+// Profiling recorder handed to the tasks of a profiled query
+#include "instrumentation.hpp"
+// Vector container
+#include <vector>
+// Double-ended task queues
+#include <deque>
+// Worker threads
+#include <thread>
+// Queue locks
+#include <mutex>
+// Idle worker wake-up
+#include <condition_variable>
+// Lock-free counters and flags
+#include <atomic>
+// Type-erased tasks
+#include <functional>
+// Task results
+#include <future>
+// Unique ownership of worker queues
+#include <memory>
+// Exception propagation
+#include <exception>
+// Algorithm utilities
+#include <algorithm>
+
+/**
+ * ThreadPool runs tasks on a fixed set of workers with work stealing.
+ * Submitting from inside a worker pushes onto that worker's own deque, so
+ * recursively spawned work stays local until another worker steals it.
+ */
+class ThreadPool {
+private:
+    /**
+     * Structure holding one worker's task deque
+     */
+    struct WorkQueue {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+    };
+
+    // One deque per worker
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    // Worker threads
+    std::vector<std::thread> workers;
+    // Set when the pool shuts down
+    std::atomic<bool> stopping{false};
+    // Tasks queued but not yet started
+    std::atomic<size_t> queued{0};
+    // Round-robin target for submissions from outside the pool
+    std::atomic<size_t> nextQueue{0};
+    // Idle workers sleep here
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    // Pool and worker index of the calling thread (set by worker threads)
+    inline static thread_local const ThreadPool* owner = nullptr;
+    inline static thread_local size_t ownerIndex = 0;
+
+    /**
+     * Index of the calling worker in this pool, or -1 for outside threads
+     */
+    int currentWorker() const {
+        return (owner == this) ? static_cast<int>(ownerIndex) : -1;
+    }
+
+    /**
+     * Push a task onto a worker's deque and wake an idle worker
+     */
+    void enqueue(std::function<void()> task) {
+#if LBN_INSTRUMENTATION
+        task = [task = std::move(task), recorder = instrumentation::currentRecorder()]() {
+            instrumentation::RecorderScope scope(recorder);
+            task();
+        };
+#endif
+        int self = currentWorker();
+        size_t target = (self != -1) ? static_cast<size_t>(self)
+                                     : nextQueue.fetch_add(1) % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->mutex);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+        queued.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    /**
+     * Run one queued task: own newest first, otherwise steal the oldest
+     * @param self Worker index to start from (any index for outside threads)
+     * @return True if a task was run
+     */
+    bool runOne(size_t self) {
+        std::function<void()> task;
+        {
+            WorkQueue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+            }
+        }
+        for (size_t k = 1; !task && k < queues.size(); ++k) {
+            WorkQueue& victim = *queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+            }
+        }
+        if (!task) {
+            return false;
+        }
+        queued.fetch_sub(1);
+        task();
+        return true;
+    }
+
+    /**
+     * Worker main loop
+     */
+    void workerLoop(size_t self) {
+        owner = this;
+        ownerIndex = self;
+        while (true) {
+            if (runOne(self)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]() { return stopping.load() || queued.load() > 0; });
+            if (stopping.load() && queued.load() == 0) {
+                return;
+            }
+        }
+    }
+
+public:
+    /**
+     * Constructor with number of worker threads
+     * @param numThreads Worker count (0 uses std::thread::hardware_concurrency)
+     */
+    explicit ThreadPool(size_t numThreads = 0) {
+        if (numThreads == 0) {
+            numThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < numThreads; ++i) {
+            queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+        }
+        for (size_t i = 0; i < numThreads; ++i) {
+            workers.emplace_back(&ThreadPool::workerLoop, this, i);
+        }
+    }
+
+    /**
+     * Destructor: finishes queued tasks, then joins the workers
+     */
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping.store(true);
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Get number of worker threads
+     * @return Worker count
+     */
+    size_t size() const {
+        return workers.size();
+    }
+
+    /**
+     * Submit a task
+     * @param task Callable taking no arguments
+     * @return Future holding the task's result or exception
+     */
+    template <typename Task>
+    auto submit(Task task) -> std::future<decltype(task())> {
+        using Result = decltype(task());
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+        std::future<Result> result = packaged->get_future();
+        enqueue([packaged]() { (*packaged)(); });
+        return result;
+    }
+
+    /**
+     * Run body(i) for every i in [begin, end), split into chunks of grain
+     * The calling thread executes queued tasks while it waits. The first
+     * exception thrown by any iteration is rethrown here after all chunks
+     * have finished.
+     * @param begin First index
+     * @param end One past the last index
+     * @param body Function called once per index
+     * @param grain Indices per task
+     */
+    void parallelFor(size_t begin, size_t end,
+                     const std::function<void(size_t)>& body,
+                     size_t grain = 1) {
+        if (begin >= end) {
+            return;
+        }
+        grain = std::max<size_t>(1, grain);
+        size_t numChunks = (end - begin + grain - 1) / grain;
+        if (numChunks == 1 || workers.size() <= 1) {
+            for (size_t i = begin; i < end; ++i) {
+                body(i);
+            }
+            return;
+        }
+
+        std::atomic<size_t> remaining{numChunks};
+        std::exception_ptr failure;
+        std::mutex failureMutex;
+        for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+            size_t first = begin + chunk * grain;
+            size_t last = std::min(end, first + grain);
+            enqueue([&, first, last]() {
+                try {
+                    for (size_t i = first; i < last; ++i) {
+                        body(i);
+                    }
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(failureMutex);
+                    if (!failure) {
+                        failure = std::current_exception();
+                    }
+                }
+                remaining.fetch_sub(1);
+            });
+        }
+
+        // Help until every chunk has run
+        int self = currentWorker();
+        size_t start = (self != -1) ? static_cast<size_t>(self) : 0;
+        while (remaining.load() > 0) {
+            if (!runOne(start)) {
+                std::this_thread::yield();
+            }
+        }
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+};
+
+#endif // THREAD_POOL_HPP